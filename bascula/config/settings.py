@@ -40,6 +40,7 @@ class ScaleSettings:
     serial_timeout_s: float = 0.05
     poll_interval_s: float = 0.02
     min_publish_delta_g: float = 0.1
+    flow_credits: int = 16
 
     def __post_init__(self) -> None:
         try:
@@ -91,6 +92,10 @@ class ScaleSettings:
             self.min_publish_delta_g = value if value > 0 else 0.1
         except Exception:
             self.min_publish_delta_g = 0.1
+        try:
+            self.flow_credits = min(64, max(0, int(self.flow_credits)))
+        except Exception:
+            self.flow_credits = 16
 
     @property
     def calibration_factor(self) -> float:
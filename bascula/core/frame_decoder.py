@@ -0,0 +1,394 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""Streaming decoder for the scale firmware's serial output.
+
+Raw bytes go in, in chunks of any size (lines may be split across reads or
+glued together by a lost end of line); decoded :class:`Frame` tuples come
+out. The work is done by the C library built from
+``firmware-esp32/host/bascula_frames.cpp`` through its C ABI. Field tags,
+probe keys and protocol prefixes come from ``firmware-esp32/src/frame_schema.h``
+inside the library, so nothing here mirrors the protocol.
+
+The installers and ``scripts/ota.sh`` build the library
+(``make -C firmware-esp32/host libbascula_frames.so``). It is looked up in
+``$BASCULA_FRAMES_LIB``, then next to its sources in this repository and
+finally on the system library path. Without it :class:`FrameDecoder`
+raises :class:`FrameDecoderUnavailable`: there is no slower fallback.
+
+This module has no dependency on the rest of the package so that
+``python_backend`` can load it by path.
+
+Benchmark against the regex parsing it replaces::
+
+    python -m bascula.core.frame_decoder --bench [--lines N]
+
+Probe lines (``PROBE:<mask>`` on the firmware) from a raw capture as CSV,
+one row per frame with the weight it follows, ready for plotting::
+
+    python -m bascula.core.frame_decoder --probes capture.bin > probes.csv
+"""
+from __future__ import annotations
+
+import ctypes
+import ctypes.util
+import os
+import struct
+from pathlib import Path
+from typing import Dict, List, NamedTuple, Optional, Tuple
+
+ABI = 1
+LINE_MAX = 160
+TEXT_MAX = 96
+PROBES = 7
+
+OPT_BULK = 0x1
+
+KIND_WEIGHT = 1
+KIND_ACK = 2
+KIND_ERR = 3
+KIND_EVENT = 4
+KIND_INFO = 5
+KIND_TEXT = 6
+KIND_BULK = 7
+KIND_PROBE = 8
+
+FLAG_STABLE = 0x01
+FLAG_OVERLOAD = 0x02
+FLAG_PEAK = 0x04
+FLAG_CHB = 0x08
+FLAG_TRUNCATED = 0x10
+FLAG_RES = 0x20
+
+STATS_FIELDS = ("bytes", "lines", "weights", "bad", "overflow", "binary", "bulk_frames", "bulk_bad")
+
+BUILD_HINT = "make -C firmware-esp32/host libbascula_frames.so"
+
+
+class FrameDecoderUnavailable(RuntimeError):
+    """``libbascula_frames.so`` is missing or does not match this module."""
+
+
+class Frame(NamedTuple):
+    kind: int
+    flags: int = 0
+    text: str = ""
+    grams: float = 0.0
+    peak: Optional[float] = None
+    minimum: Optional[float] = None
+    chb: Optional[int] = None
+    bulk_type: str = ""
+    bulk_seq: int = 0
+    row: Tuple[int, ...] = ()
+    probe_mask: int = 0
+    probe: Tuple[float, ...] = ()
+    resolution: Optional[float] = None
+
+    @property
+    def taps(self) -> Dict[str, float]:
+        """Probe values present in a ``KIND_PROBE`` frame, by key."""
+        return {k: self.probe[i] for i, k in enumerate(probe_keys()) if self.probe_mask >> i & 1}
+
+    @property
+    def stable(self) -> bool:
+        return bool(self.flags & FLAG_STABLE)
+
+    @property
+    def overload(self) -> bool:
+        return bool(self.flags & FLAG_OVERLOAD)
+
+
+# bascula_frame: size, kind, flags, text_len, grams, peak, minimum, chb,
+# bulk_type, bulk_cols, bulk_seq, row[5], text[96], probe_mask (+3 bytes of
+# padding), probe[7], resolution.
+_FRAME = struct.Struct("=IBBHdddiBBH5i96sB3x7dd")
+_STATS = struct.Struct("=I4x8Q")
+_BATCH = 256
+
+
+def _load_library() -> Tuple[Optional[ctypes.CDLL], str]:
+    env = os.getenv("BASCULA_FRAMES_LIB")
+    candidates = []
+    if env:
+        candidates.append(env)
+    candidates.append(
+        str(Path(__file__).resolve().parents[2] / "firmware-esp32" / "host" / "libbascula_frames.so")
+    )
+    found = ctypes.util.find_library("bascula_frames")
+    if found:
+        candidates.append(found)
+    reason = "libbascula_frames.so not found"
+    for path in candidates:
+        if not path or ("/" in path and not os.path.exists(path)):
+            continue
+        try:
+            lib = ctypes.CDLL(path)
+            lib.bascula_frames_abi.restype = ctypes.c_uint32
+            if lib.bascula_frames_abi() != ABI:
+                reason = f"{path}: ABI {lib.bascula_frames_abi()}, expected {ABI}"
+                continue
+            lib.bascula_frames_new.restype = ctypes.c_void_p
+            lib.bascula_frames_new.argtypes = [ctypes.c_uint32]
+            lib.bascula_frames_free.argtypes = [ctypes.c_void_p]
+            lib.bascula_frames_reset.argtypes = [ctypes.c_void_p]
+            lib.bascula_frames_feed.restype = ctypes.c_size_t
+            lib.bascula_frames_feed.argtypes = [
+                ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t,
+                ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t),
+            ]
+            lib.bascula_frames_get_stats.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+            lib.bascula_frames_probe_keys.restype = ctypes.c_char_p
+        except (OSError, AttributeError) as exc:
+            reason = f"{path}: {exc}"
+            continue
+        # Every frame carries sizeof(bascula_frame) of the library; refuse a
+        # library built with a different layout (stale build).
+        probe = ctypes.create_string_buffer(_FRAME.size)
+        scratch = lib.bascula_frames_new(0)
+        lib.bascula_frames_feed(scratch, b"ACK:T\n", 6, probe, 1, None)
+        lib.bascula_frames_free(scratch)
+        size = struct.unpack_from("=I", probe.raw)[0]
+        if size != _FRAME.size:
+            reason = f"{path}: bascula_frame is {size} bytes, expected {_FRAME.size}"
+            continue
+        return lib, ""
+    return None, reason
+
+
+_LIB: Optional[ctypes.CDLL] = None
+_LIB_ERROR = ""
+_LIB_LOADED = False
+
+
+def native_library() -> Optional[ctypes.CDLL]:
+    global _LIB, _LIB_ERROR, _LIB_LOADED
+    if not _LIB_LOADED:
+        _LIB, _LIB_ERROR = _load_library()
+        _LIB_LOADED = True
+    return _LIB
+
+
+def _require_library() -> ctypes.CDLL:
+    lib = native_library()
+    if lib is None:
+        raise FrameDecoderUnavailable(f"{_LIB_ERROR}; build it with: {BUILD_HINT}")
+    return lib
+
+
+def probe_keys() -> str:
+    """PRB: keys in bit order, from ProbeFrame in frame_schema.h."""
+    return _require_library().bascula_frames_probe_keys().decode("ascii")
+
+
+# Same layout skipping the BULK and PROBE members: most frames only need
+# these, and every unpacked member is a Python object to build.
+_FRAME_TEXT = struct.Struct("=4xBBHdddi24x96s60xd")
+assert _FRAME_TEXT.size == _FRAME.size
+
+_new_frame = tuple.__new__
+
+
+def _unpack(raw: memoryview) -> List[Frame]:
+    frames = []
+    offset = 0
+    for kind, flags, text_len, grams, peak, minimum, chb, text, res in _FRAME_TEXT.iter_unpack(raw):
+        text = text[:text_len].decode("ascii", "replace")
+        if kind == KIND_WEIGHT:
+            frames.append(_new_frame(Frame, (
+                kind, flags, text, grams,
+                peak if flags & FLAG_PEAK else None,
+                minimum if flags & FLAG_PEAK else None,
+                chb if flags & FLAG_CHB else None,
+                "", 0, (), 0, (),
+                res if flags & FLAG_RES else None,
+            )))
+        elif kind == KIND_BULK or kind == KIND_PROBE:
+            (_, _, _, _, _, _, _, _, bulk_type, cols, seq,
+             r0, r1, r2, r3, r4, _, mask, *probe) = _FRAME.unpack_from(raw, offset)
+            if kind == KIND_BULK:
+                frames.append(_new_frame(Frame, (kind, flags, "", 0.0, None, None, None, chr(bulk_type), seq,
+                                                 (r0, r1, r2, r3, r4)[:cols], 0, (), None)))
+            else:
+                frames.append(_new_frame(Frame, (kind, flags, text, 0.0, None, None, None, "", 0, (),
+                                                 mask, tuple(probe[:PROBES]), None)))
+        else:
+            frames.append(_new_frame(Frame, (kind, flags, text, 0.0, None, None, None, "", 0, (), 0, (), None)))
+        offset += _FRAME.size
+    return frames
+
+
+class FrameDecoder:
+    """Feed raw serial bytes, get decoded frames.
+
+    ``bulk=True`` also decodes the binary dump frames (``LOG:DUMPB``) into
+    one ``KIND_BULK`` frame per row; otherwise those lines are dropped.
+    Raises :class:`FrameDecoderUnavailable` when the library is not built.
+    """
+
+    def __init__(self, bulk: bool = False) -> None:
+        self._handle = None
+        lib = _require_library()
+        self._lib = lib
+        self._handle = lib.bascula_frames_new(OPT_BULK if bulk else 0)
+        if not self._handle:
+            raise MemoryError("bascula_frames_new")
+        self._out = ctypes.create_string_buffer(_FRAME.size * _BATCH)
+        self._view = memoryview(self._out).cast("B")
+        self._used = ctypes.c_size_t(0)
+
+    def __del__(self) -> None:
+        handle = getattr(self, "_handle", None)
+        if handle:
+            self._lib.bascula_frames_free(handle)
+            self._handle = None
+
+    @property
+    def stats(self) -> dict:
+        buf = ctypes.create_string_buffer(_STATS.size)
+        self._lib.bascula_frames_get_stats(self._handle, buf)
+        return dict(zip(STATS_FIELDS, _STATS.unpack(buf.raw)[1:]))
+
+    def feed(self, data: bytes) -> List[Frame]:
+        if not data:
+            return []
+        data = bytes(data)
+        frames: List[Frame] = []
+        lib, handle, out, used = self._lib, self._handle, self._out, self._used
+        while True:
+            k = lib.bascula_frames_feed(handle, data, len(data), out, _BATCH, ctypes.byref(used))
+            if k:
+                frames.extend(_unpack(self._view[: k * _FRAME.size]))
+            data = data[used.value:]
+            if k < _BATCH and not data:
+                return frames
+
+    def reset(self) -> None:
+        self._lib.bascula_frames_reset(self._handle)
+
+
+# ---------------------------------------------------------------------------
+
+
+def _bench_stream(lines: int) -> bytes:
+    import random
+
+    rng = random.Random(1)
+    out = []
+    g = 0.0
+    for i in range(lines):
+        r = rng.randrange(100)
+        if r < 90:
+            g += rng.randrange(-1000, 1001) / 100.0
+            stable = int(rng.randrange(3) != 0)
+            if r < 70:
+                out.append(f"G:{g:.2f},S:{stable}\r\n")
+            elif r < 80:
+                out.append(f"G:{g:.2f},S:{stable},PK:{g + 3:.2f},PM:{g - 1.5:.2f}\r\n")
+            else:
+                out.append(f"G:{g:.2f},S:{stable},B:{rng.randrange(-100000, 100000)}\r\n")
+        elif r < 94:
+            out.append("ACK:FILT:5,200,0.50,300\r\n")
+        elif r < 96:
+            out.append("ERR:UNKNOWN_CMD\r\n")
+        elif r < 98:
+            out.append(f"EVT:OVERLOAD,R:8300000,G:{g:.1f},N:3,MS:{i * 20}\r\n")
+        else:
+            out.append("RATE:SPS:80.10,P:12484,D:2,N:2,A:0.500,HZ:40.0,M:1\r\n")
+    return "".join(out).encode("ascii")
+
+
+def _bench(lines: int, chunk: int, repeat: int) -> None:
+    import re
+    import time
+
+    data = _bench_stream(lines)
+    pieces = [data[i:i + chunk] for i in range(0, len(data), chunk)]
+
+    # What python_backend/serial_scale.py used to do with every chunk.
+    split_crlf = re.compile(r"[\r\n]+")
+    split_g = re.compile(r"(?=G:)")
+    parse = re.compile(r"\s*G:\s*([+-]?\d+(?:\.\d+)?)\s*,\s*S:\s*([01])\s*(?:,[^\r\n]*)?$", re.ASCII)
+
+    def regex() -> int:
+        buf = b""
+        found = 0
+        for piece in pieces:
+            buf += piece
+            parts = split_crlf.split(buf.decode("ascii", errors="ignore"))
+            buf = parts[-1].encode("ascii", errors="ignore")
+            for raw in parts[:-1]:
+                for sub in split_g.split(raw.strip()):
+                    m = parse.match(sub.strip())
+                    if m:
+                        float(m.group(1))
+                        found += 1
+        return found
+
+    def decoder() -> int:
+        dec = FrameDecoder()
+        found = 0
+        for piece in pieces:
+            for frame in dec.feed(piece):
+                if frame.kind == KIND_WEIGHT:
+                    found += 1
+        return found
+
+    print(f"{lines} lines, {len(data) / lines:.1f} B/line, {chunk} B reads, {repeat} runs")
+    print(f"{'parser':<8} {'median':>10} {'min':>10} {'max':>10} {'weights':>9}  (lines/s)")
+    for name, fn in (("regex", regex), ("native", decoder)):
+        rates = []
+        for _ in range(repeat):
+            t0 = time.perf_counter()
+            found = fn()
+            rates.append(lines / (time.perf_counter() - t0))
+        rates.sort()
+        print(f"{name:<8} {rates[len(rates) // 2]:10.3g} {rates[0]:10.3g} {rates[-1]:10.3g} {found:9d}")
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    import argparse
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bench", action="store_true")
+    parser.add_argument("--lines", type=int, default=100000)
+    parser.add_argument("--chunk", type=int, default=128)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--probes", action="store_true", help="print the PRB: lines of the capture as CSV")
+    parser.add_argument("capture", nargs="?", help="decode a raw capture file and print the frames")
+    args = parser.parse_args(argv)
+    if args.bench:
+        _bench(max(1, args.lines), max(1, args.chunk), max(1, args.repeat))
+        return 0
+    if not args.capture:
+        parser.print_usage()
+        return 2
+    dec = FrameDecoder(bulk=not args.probes)
+    if args.probes:
+        print("n,G,S," + ",".join(probe_keys()))
+    rows = 0
+    last: Optional[Frame] = None
+    with open(args.capture, "rb") as fh:
+        while True:
+            data = fh.read(4096)
+            if not data:
+                break
+            for frame in dec.feed(data):
+                if not args.probes:
+                    print(frame)
+                elif frame.kind == KIND_WEIGHT:
+                    last = frame
+                elif frame.kind == KIND_PROBE:
+                    # No G: right before it (capture started mid-line): no weight
+                    cells = [str(rows), "" if last is None else repr(last.grams),
+                             "" if last is None else str(int(last.stable))]
+                    cells += [repr(frame.probe[i]) if frame.probe_mask >> i & 1 else ""
+                              for i in range(PROBES)]
+                    print(",".join(cells))
+                    rows += 1
+                    last = None
+    if not args.probes:
+        print(dec.stats)
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
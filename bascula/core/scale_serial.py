@@ -27,6 +27,8 @@ try:
 except ImportError:  # pragma: no cover - depends on optional dependency
     yaml = None  # type: ignore[assignment]
 
+from .frame_decoder import KIND_TEXT, KIND_WEIGHT, Frame, FrameDecoder
+
 LOGGER = logging.getLogger("bascula.scale")
 
 DEFAULT_PORT_CANDIDATES = [
@@ -36,8 +38,13 @@ DEFAULT_PORT_CANDIDATES = [
 ]
 DEFAULT_BAUD_CANDIDATES = [115200, 57600, 38400, 19200, 9600, 4800]
 
+# Only for lines the frame decoder does not recognise (third-party scales).
 _WEIGHT_RE = re.compile(r"([-+]?\d+(?:\.\d+)?)(?:\s*(mg|g|kg|lb|oz))?", re.IGNORECASE)
 
+# Shared by parse_weight_line() calls, created on first use.
+_LINE_DECODER: Optional[FrameDecoder] = None
+_LINE_DECODER_LOCK = threading.Lock()
+
 
 class SerialScale:
     """Serial scale reader running in a background thread."""
@@ -90,6 +97,7 @@ class SerialScale:
         self._stop_event = threading.Event()
         self._thread: Optional[threading.Thread] = None
         self._serial: Optional[serial.Serial] = None
+        self._decoder: Optional[FrameDecoder] = None
         self._lock = threading.Lock()
 
         self._last_gross: float = 0.0
@@ -128,6 +136,9 @@ class SerialScale:
             return
         self._stop_event.clear()
         try:
+            # Created here, not in the reader thread: a missing native library
+            # (FrameDecoderUnavailable) must reach the caller or the simulation.
+            self._decoder = FrameDecoder()
             self._serial = self._open_serial()
             self._simulate = False
         except Exception as exc:
@@ -217,24 +228,18 @@ class SerialScale:
             self._run_serial()
 
     def _run_serial(self) -> None:
-        buffer = ""
+        decoder = self._decoder
         ser = self._serial
-        if not ser:
+        if not ser or decoder is None:
             return
+        decoder.reset()
         while not self._stop_event.is_set():
             try:
                 chunk = ser.read_until(b"\n")
                 if not chunk:
                     continue
-                try:
-                    text = chunk.decode("utf-8", errors="ignore")
-                except Exception:
-                    text = repr(chunk)
-                buffer += text
-                lines = re.split(r"[\r\n]+", buffer)
-                buffer = lines.pop() if lines else ""
-                for line in lines:
-                    self._handle_line(line)
+                for frame in decoder.feed(chunk):
+                    self._handle_frame(frame)
             except SerialException as exc:  # pragma: no cover - depends on hardware
                 self._logger.error("Serial error: %s", exc)
                 if self._simulate_if_unavailable:
@@ -293,11 +298,18 @@ class SerialScale:
             self._handle_measurement(gross, stable_hint)
             time.sleep(0.1)
 
+    def _handle_frame(self, frame: Frame) -> None:
+        if frame.kind == KIND_WEIGHT:
+            self._handle_measurement(frame.grams, frame.stable, raw_line=frame.text)
+        elif frame.kind == KIND_TEXT and not frame.text.startswith("G:"):
+            # A malformed firmware frame is dropped, not scanned for numbers.
+            self._handle_line(frame.text)
+
     def _handle_line(self, line: str) -> None:
         line = line.strip()
         if not line:
             return
-        grams, stable = parse_weight_line(line)
+        grams, stable = _parse_foreign_line(line)
         if grams is None:
             return
         self._handle_measurement(grams, stable, raw_line=line)
@@ -387,9 +399,32 @@ def _parse_int(value: Optional[object]) -> Optional[int]:
 
 
 def parse_weight_line(text: str) -> Tuple[Optional[float], Optional[bool]]:
-    """Parse a line of text and return (grams, stable_hint)."""
-    if not text:
+    """Parse a line of text and return (grams, stable_hint).
+
+    Firmware lines go through the frame decoder: weights come back with the
+    firmware's S: flag and control/event lines, which carry numbers but are
+    not weights, give ``(None, None)``.
+    """
+    if not text or not text.strip():
         return None, None
+    grams: Optional[float] = None
+    stable: Optional[bool] = None
+    with _LINE_DECODER_LOCK:
+        global _LINE_DECODER
+        if _LINE_DECODER is None:
+            _LINE_DECODER = FrameDecoder()
+        else:
+            _LINE_DECODER.reset()
+        frames = _LINE_DECODER.feed(text.encode("utf-8", errors="ignore") + b"\n")
+    for frame in frames:
+        if frame.kind == KIND_WEIGHT:
+            grams, stable = frame.grams, frame.stable
+        elif frame.kind == KIND_TEXT and not frame.text.startswith("G:"):
+            grams, stable = _parse_foreign_line(frame.text)
+    return grams, stable
+
+
+def _parse_foreign_line(text: str) -> Tuple[Optional[float], Optional[bool]]:
     raw = text.strip()
     if not raw:
         return None, None
@@ -34,11 +34,25 @@ class PhotoManager:
         self.cfg = config or PhotoConfig.load()
         for d in (BASE, STAGING, META): d.mkdir(parents=True, exist_ok=True)
         self.picam2 = None
+        self.scale = None
     def attach_camera(self, picam2): self.picam2 = picam2; self.log.info("PhotoManager: cámara adjuntada.")
+    # Báscula (ScaleService) para adjuntar a cada foto la instantánea SNAP:<id>
+    # de la conversión siguiente a la petición, no el último peso leído.
+    def attach_scale(self, scale): self.scale = scale; self.log.info("PhotoManager: báscula adjuntada.")
+    def _request_weight(self):
+        try: return self.scale.request_snapshot() if self.scale is not None else None
+        except Exception: return None
+    def _collect_weight(self, snap_id):
+        if snap_id is None: return None
+        try: return self.scale.wait_snapshot(snap_id, timeout=0.25)
+        except Exception: return None
     def capture(self, label="manual"):
         ts = time.strftime("%Y%m%d-%H%M%S", time.localtime()); ms = int((time.time()%1)*1000)
         name = f"{self.cfg.prefix}-{ts}-{ms:03d}-{''.join(c if c.isalnum() else '-' for c in label).strip('-') or 'x'}.jpg"
         p = STAGING / name
+        # Se pide justo antes de la exposición y se recoge después: la
+        # captura no espera a la báscula
+        snap_id = self._request_weight()
         try:
             self.picam2.capture_file(str(p), format="jpeg", quality=self.cfg.jpeg_quality)
         except Exception:
@@ -49,7 +63,10 @@ class PhotoManager:
             if img.mode not in ("RGB", "L"):
                 img = img.convert("RGB")
             img.save(p, "JPEG", quality=self.cfg.jpeg_quality, optimize=True)
-        (META / (p.stem + ".json")).write_text(json.dumps({"label":label,"ts":time.time()}))
+        meta = {"label":label,"ts":time.time()}
+        weight = self._collect_weight(snap_id)
+        if weight is not None: meta["weight"] = weight
+        (META / (p.stem + ".json")).write_text(json.dumps(meta))
         self._enforce_limits()
         return p
     def mark_used(self, path:Path):
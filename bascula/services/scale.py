@@ -10,9 +10,10 @@ import threading
 import time
 from collections import deque
 from pathlib import Path
-from typing import Callable, Deque, List, Optional
+from typing import Callable, Deque, Dict, List, Optional, Tuple
 
 from ..config.settings import ScaleSettings
+from ..core.frame_decoder import KIND_EVENT, KIND_WEIGHT, FrameDecoder
 
 try:  # pragma: no cover - optional dependency
     import serial  # type: ignore
@@ -35,6 +36,73 @@ PUBLISH_WATCHDOG_INTERVAL = 0.5
 DEFAULT_SERIAL_PORTS = ("/dev/serial0", "/dev/ttyAMA0", "/dev/ttyS0")
 DEFAULT_SERIAL_GLOBS = ("/dev/ttyUSB*", "/dev/ttyACM*")
 DEFAULT_SERIAL_BAUDS = (115200, 57600, 38400, 19200, 9600, 4800)
+MAX_PENDING_EVENTS = 64
+# Control de flujo por créditos (FC:<n>, firmware-esp32/src/flow_credit.h):
+# tope del firmware y renovación mínima aunque no lleguen tramas, para que
+# una concesión perdida no deje la báscula muda.
+FLOW_CREDIT_MAX = 64
+FLOW_REGRANT_S = 1.0
+FLOW_FRESH_READS = 3
+# Respuestas SNAP:<id> sin recoger que se guardan (las más viejas se tiran).
+MAX_PENDING_SNAPSHOTS = 8
+# Tara del firmware (kCommands en firmware-esp32/src/frame_schema.h).
+TARE_COMMAND = "T"
+_PROFILE_NAME_RE = re.compile(r"[A-Za-z0-9_-]{1,15}")
+
+
+def parse_event_line(line: str) -> Optional[dict]:
+    """Parse a firmware event line ``EVT:<KIND>,K:V,...`` into a dict.
+
+    Numeric values are converted to ``float``; the kind is stored under
+    ``"kind"``. Returns ``None`` when the line is not an event.
+    """
+    text = (line or "").strip()
+    if not text.startswith("EVT:"):
+        return None
+    parts = text[4:].split(",")
+    kind = parts[0].strip()
+    if not kind:
+        return None
+    event: dict = {"kind": kind}
+    for part in parts[1:]:
+        key, sep, value = part.partition(":")
+        if not sep:
+            continue
+        key = key.strip()
+        value = value.strip()
+        try:
+            event[key] = float(value)
+        except ValueError:
+            event[key] = value
+    return event
+
+
+def parse_snapshot_line(line: str) -> Optional[dict]:
+    """Parse ``SNAP:<id>,G:<g>,R:<raw>,S:<0|1>,T:<us>,L:<us>[,OL:1]``.
+
+    Returns ``None`` when the line is not a complete snapshot reply.
+    """
+    text = (line or "").strip()
+    if not text.startswith("SNAP:"):
+        return None
+    snap_id, _, rest = text[5:].partition(",")
+    fields = {}
+    for part in rest.split(","):
+        key, sep, value = part.partition(":")
+        if sep:
+            fields[key.strip()] = value.strip()
+    try:
+        return {
+            "id": snap_id,
+            "grams": float(fields["G"]),
+            "raw": int(fields["R"]),
+            "stable": fields["S"] == "1",
+            "t_us": int(fields["T"]),
+            "latency_us": int(fields["L"]),
+            "overload": fields.get("OL") == "1",
+        }
+    except (KeyError, ValueError):
+        return None
 
 
 def _normalize_serial_port(port: str) -> str:
@@ -84,10 +152,13 @@ class SerialScaleBackend(BaseScaleBackend):
         baud: int,
         *,
         timeout: float = 0.5,
+        flow_credits: int = 0,
         logger: Optional[logging.Logger] = None,
     ) -> None:
         if serial is None:
             raise BackendUnavailable("pyserial not available")
+        # Sin libbascula_frames.so no hay lectura: el error sube tal cual
+        self._decoder = FrameDecoder()
         resolved = self._resolve_port(port)
         if not Path(resolved).exists():
             raise BackendUnavailable(f"device {resolved} not found")
@@ -102,13 +173,29 @@ class SerialScaleBackend(BaseScaleBackend):
         self._logger = logger or LOGGER
         self._port = resolved
         self._baudrate = int(baud)
-        self._pattern = re.compile(r"G\s*:\s*([+-]?\d+(?:\.\d+)?)\s*,\s*S\s*:\s*(\d+)")
         self._last_valid_ts = time.monotonic()
         self._last_no_data_log = 0.0
         self._signal_state = False
         self._last_signal_log = 0.0
         self.signal_hint: Optional[bool] = None
+        # Resolución efectiva (g) de la última trama con REFINE:ON.
+        self.resolution_hint: Optional[float] = None
         self._timeout = float(timeout)
+        self._events: Deque[dict] = deque(maxlen=MAX_PENDING_EVENTS)
+        # Ventana de créditos: 0 deja el envío libre (firmware antiguo).
+        self._flow_credits = max(0, min(int(flow_credits or 0), FLOW_CREDIT_MAX))
+        self._flow_frames = 0
+        self._flow_grant_ts = 0.0
+        self._last_command = ""
+        self._snap_seq = 0
+        self._snap_sent: Dict[str, float] = {}
+        self._snaps: Dict[str, dict] = {}
+        self._snap_cond = threading.Condition()
+        # Con créditos lo pendiente cabe en una ventana: se lee entero para
+        # reconocer el parón en una sola llamada.
+        self._drain_limit = max(10, self._flow_credits + 2)
+        if self._flow_credits:
+            self._grant_credits(time.monotonic())
 
     @staticmethod
     def _resolve_port(port: str) -> str:
@@ -143,7 +230,7 @@ class SerialScaleBackend(BaseScaleBackend):
 
         try:
             drain_attempts = 0
-            while getattr(self._serial, "in_waiting", 0) > 0 and drain_attempts < 10:
+            while getattr(self._serial, "in_waiting", 0) > 0 and drain_attempts < self._drain_limit:
                 extra = self._serial.readline()
                 if not extra:
                     break
@@ -155,26 +242,11 @@ class SerialScaleBackend(BaseScaleBackend):
             self._logger.debug("Serial read error: %s", exc)
             return None
 
-        latest: Optional[float] = None
-        for payload in lines:
-            line = payload.decode(errors="ignore").strip()
-            if not line:
-                continue
-            match = self._pattern.search(line)
-            if not match:
-                self._handle_no_data(line)
-                continue
-            grams_text, signal_text = match.groups()
-            try:
-                grams = float(grams_text)
-            except ValueError:
-                self._handle_no_data(line)
-                continue
-            try:
-                self.signal_hint = bool(int(signal_text))
-            except ValueError:
-                self.signal_hint = None
-            latest = grams
+        latest, frames = self._parse_lines(lines)
+        if self._flow_credits:
+            fresh = self._update_flow(frames)
+            if fresh is not None:
+                latest = fresh
 
         if latest is not None:
             self._mark_signal_restored()
@@ -183,6 +255,76 @@ class SerialScaleBackend(BaseScaleBackend):
         self._handle_no_data()
         return None
 
+    def _parse_lines(self, lines: List[bytes]) -> Tuple[Optional[float], int]:
+        """Return the latest weight in ``lines`` and how many weight frames came."""
+        latest: Optional[float] = None
+        frames = 0
+        # El decodificador separa tramas pegadas y descarta las binarias
+        for frame in self._decoder.feed(b"".join(lines)):
+            if frame.kind == KIND_WEIGHT:
+                self.signal_hint = frame.stable
+                self.resolution_hint = frame.resolution
+                latest = frame.grams
+                frames += 1
+                continue
+            line = frame.text
+            if frame.kind == KIND_EVENT:
+                event = parse_event_line(line)
+                if event is not None:
+                    self._events.append(event)
+                continue
+            if line.startswith("SNAP:"):
+                self._store_snapshot(line)
+                continue
+            if line == "ERR:UNKNOWN_CMD" and self._last_command.startswith("FC:"):
+                # Firmware sin control de flujo: envía libre, no se insiste
+                self._logger.info("Serial sin control de flujo por créditos (%s)", self._port)
+                self._flow_credits = 0
+                continue
+            self._handle_no_data(line)
+        return latest, frames
+
+    def _grant_credits(self, now: float) -> None:
+        self._send_command(f"FC:{self._flow_credits}")
+        self._flow_frames = 0
+        self._flow_grant_ts = now
+
+    def _update_flow(self, frames: int) -> Optional[float]:
+        """Renew the credit window; return the fresh weight after a stall.
+
+        Se renueva a mitad de ventana, así que en marcha normal el firmware
+        nunca se queda sin créditos. Si se gastó la ventana entera, el lector
+        estuvo parado: lo leído es de antes del parón y la trama actual es la
+        que el firmware retiene y emite en cuanto llega la concesión.
+        """
+        self._flow_frames += frames
+        now = time.monotonic()
+        stalled = self._flow_frames >= self._flow_credits
+        if not (
+            stalled
+            or 2 * self._flow_frames >= self._flow_credits
+            or now - self._flow_grant_ts >= FLOW_REGRANT_S
+        ):
+            return None
+        self._grant_credits(now)
+        if not stalled:
+            return None
+        for _ in range(FLOW_FRESH_READS):
+            try:
+                payload = self._serial.readline()
+            except SerialException as exc:  # pragma: no cover - hardware dependent
+                raise BackendUnavailable(str(exc)) from exc
+            except Exception as exc:
+                self._logger.debug("Serial read error: %s", exc)
+                return None
+            if not payload:
+                return None
+            fresh, count = self._parse_lines([payload])
+            if count:
+                self._flow_frames += count
+                return fresh
+        return None
+
     def _mark_signal_restored(self) -> None:
         now = time.monotonic()
         self._last_valid_ts = now
@@ -207,7 +349,58 @@ class SerialScaleBackend(BaseScaleBackend):
                 self._logger.debug("serial sin datos válidos (%s)", self._port)
             self._last_no_data_log = now
 
+    def request_snapshot(self) -> str:
+        """Ask the firmware for the next conversion (``SNAP:<id>``); return the id."""
+        with self._snap_cond:
+            self._snap_seq = (self._snap_seq + 1) % 0x1000000
+            snap_id = f"{self._snap_seq:x}"
+            self._snap_sent[snap_id] = time.monotonic()
+            while len(self._snap_sent) > MAX_PENDING_SNAPSHOTS:
+                self._snap_sent.pop(next(iter(self._snap_sent)))
+        self._send_command(f"SNAP:{snap_id}")
+        return snap_id
+
+    def wait_snapshot(self, snap_id: str, timeout: float = 0.25) -> Optional[dict]:
+        """Wait for the reply to ``request_snapshot``; ``None`` on timeout.
+
+        The reply is collected by the reader thread (``read``); ``rtt_s`` is
+        the time from sending the request until the reply was read.
+        """
+        deadline = time.monotonic() + max(0.0, timeout)
+        with self._snap_cond:
+            while snap_id not in self._snaps:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    self._snap_sent.pop(snap_id, None)
+                    return None
+                self._snap_cond.wait(remaining)
+            self._snap_sent.pop(snap_id, None)
+            return self._snaps.pop(snap_id)
+
+    def _store_snapshot(self, line: str) -> None:
+        snap = parse_snapshot_line(line)
+        if snap is None:
+            self._handle_no_data(line)
+            return
+        with self._snap_cond:
+            sent = self._snap_sent.get(snap["id"])
+            snap["rtt_s"] = time.monotonic() - sent if sent is not None else None
+            self._snaps[snap["id"]] = snap
+            while len(self._snaps) > MAX_PENDING_SNAPSHOTS:
+                self._snaps.pop(next(iter(self._snaps)))
+            self._snap_cond.notify_all()
+
+    def drain_events(self) -> List[dict]:
+        """Return and clear firmware events received since the last call."""
+        events = list(self._events)
+        self._events.clear()
+        return events
+
+    def send_command(self, command: str) -> None:
+        self._send_command(command)
+
     def _send_command(self, command: str) -> None:
+        self._last_command = command
         try:
             payload = f"{command}\n".encode()
             self._serial.write(payload)
@@ -215,10 +408,11 @@ class SerialScaleBackend(BaseScaleBackend):
             self._logger.debug("Serial command %s failed: %s", command, exc)
 
     def tare(self) -> None:
-        self._send_command("TARE")
+        self._send_command(TARE_COMMAND)
 
     def zero(self) -> None:
-        self._send_command("ZERO")
+        # El firmware no tiene un cero aparte de la tara
+        self._send_command(TARE_COMMAND)
 
 
 class HX711GpioBackend(BaseScaleBackend):
@@ -361,6 +555,7 @@ class ScaleService:
         self._stop_event = threading.Event()
         self._thread: Optional[threading.Thread] = None
         self._callbacks: List[Callable[..., None]] = []
+        self._event_callbacks: List[Callable[[dict], None]] = []
 
         self._calibration_factor = max(1e-6, float(self._settings.calib_factor))
         self._offset = 0.0
@@ -376,6 +571,7 @@ class ScaleService:
         self._none_heartbeat_interval = 0.5
         self._last_none_heartbeat = 0.0
         self._serial_timeout = max(0.0, float(getattr(self._settings, "serial_timeout_s", 0.5)))
+        self._flow_credits = int(getattr(self._settings, "flow_credits", 0) or 0)
         poll_interval = float(getattr(self._settings, "poll_interval_s", DEFAULT_POLL_INTERVAL))
         self._poll_interval = max(0.001, poll_interval)
         min_delta_setting = float(getattr(self._settings, "min_publish_delta_g", 0.1))
@@ -428,6 +624,7 @@ class ScaleService:
                         port,
                         baud,
                         timeout=self._serial_timeout,
+                        flow_credits=self._flow_credits,
                         logger=self.logger,
                     )
                 except BackendUnavailable as exc:
@@ -534,6 +731,8 @@ class ScaleService:
             except Exception as exc:
                 self.logger.debug("Backend %s read error: %s", self._backend.name, exc, exc_info=True)
 
+            self._dispatch_backend_events()
+
             if sample is not None:
                 self._set_signal_available(True)
                 self._process_sample(float(sample))
@@ -640,6 +839,26 @@ class ScaleService:
             except Exception:  # pragma: no cover - protect callbacks
                 self.logger.exception("Scale subscriber failed")
 
+    def _dispatch_backend_events(self) -> None:
+        drain = getattr(self._backend, "drain_events", None)
+        if drain is None:
+            return
+        events = drain()
+        if not events:
+            return
+        for event in events:
+            if event.get("kind") == "OVERLOAD":
+                self.logger.warning(
+                    "Scale overload: %.1f g (total eventos: %s)",
+                    float(event.get("G", 0.0) or 0.0),
+                    event.get("N", "?"),
+                )
+            for callback in list(self._event_callbacks):
+                try:
+                    callback(event)
+                except Exception:  # pragma: no cover - protect callbacks
+                    self.logger.exception("Scale event subscriber failed")
+
     # ------------------------------------------------------------------
     def subscribe(self, callback: Callable[..., None]) -> None:
         if not callable(callback):
@@ -654,6 +873,118 @@ class ScaleService:
         except ValueError:
             pass
 
+    def subscribe_events(self, callback: Callable[[dict], None]) -> None:
+        """Register a callback for firmware events (``EVT:ADD``, ``EVT:REM``...)."""
+        if callable(callback):
+            self._event_callbacks.append(callback)
+
+    def unsubscribe_events(self, callback: Callable[[dict], None]) -> None:
+        try:
+            self._event_callbacks.remove(callback)
+        except ValueError:
+            pass
+
+    def send_command(self, command: str) -> bool:
+        """Send a raw command to the backend firmware if it supports it."""
+        sender = getattr(self._backend, "send_command", None)
+        if sender is None:
+            return False
+        try:
+            sender(command)
+        except Exception:
+            self.logger.debug("Scale command %s failed", command, exc_info=True)
+            return False
+        return True
+
+    def request_snapshot(self) -> Optional[str]:
+        """Ask the firmware for a weight snapshot of its next conversion.
+
+        Returns the request id for :meth:`wait_snapshot`, or ``None`` when
+        the backend has no firmware behind it. Requesting right before the
+        camera exposure and collecting afterwards keeps the weight aligned
+        with the picture without blocking the capture.
+        """
+        request = getattr(self._backend, "request_snapshot", None)
+        if request is None:
+            return None
+        try:
+            return request()
+        except Exception:
+            self.logger.debug("Scale snapshot request failed", exc_info=True)
+            return None
+
+    def wait_snapshot(self, snap_id: Optional[str], timeout: float = 0.25) -> Optional[dict]:
+        """Return the snapshot for ``snap_id`` with ``grams`` in UI units.
+
+        ``firmware_g`` keeps the firmware value; ``grams`` applies the same
+        offset and factor as the published weight. ``t_us`` is the
+        conversion timestamp and ``latency_us`` the firmware-side delay
+        from request to conversion (at most one conversion period).
+        """
+        wait = getattr(self._backend, "wait_snapshot", None)
+        if snap_id is None or wait is None:
+            return None
+        snap = wait(snap_id, timeout)
+        if snap is None:
+            return None
+        with self._lock:
+            grams = (snap["grams"] - self._offset) / self._effective_factor()
+        snap["firmware_g"] = snap["grams"]
+        snap["grams"] = max(0.0, min(MAX_WEIGHT_G, grams))
+        return snap
+
+    def snapshot(self, timeout: float = 0.25) -> Optional[dict]:
+        """``request_snapshot`` + ``wait_snapshot``."""
+        return self.wait_snapshot(self.request_snapshot(), timeout)
+
+    def enable_segmentation(self, enabled: bool = True) -> bool:
+        """Ask the firmware to emit per-ingredient ``EVT:ADD``/``EVT:REM`` events."""
+        return self.send_command("SEG:ON" if enabled else "SEG:OFF")
+
+    def set_check_window(self, min_g: float, max_g: float) -> bool:
+        """Enable firmware checkweigher events (``EVT:CHECK``) for [min_g, max_g]."""
+        low, high = sorted((float(min_g), float(max_g)))
+        return self.send_command(f"CHECK:{low:.2f},{high:.2f}")
+
+    def clear_check_window(self) -> bool:
+        return self.send_command("CHECK:OFF")
+
+    def set_display_division(
+        self,
+        division_g: float,
+        *,
+        hysteresis_g: Optional[float] = None,
+        report_on_change: bool = True,
+    ) -> bool:
+        """Quantize firmware frames to ``division_g`` (0.1/0.5/1/2 g, 0 disables).
+
+        With ``report_on_change`` the firmware only sends a frame when the
+        displayed value, the stable flag or the overload flag changes (plus a
+        short heartbeat), so jitter never reaches the UART.
+        """
+        command = f"DIV:{float(division_g):g}"
+        if hysteresis_g is not None:
+            command += f",{float(hysteresis_g):g}"
+        if not self.send_command(command):
+            return False
+        return self.send_command("ROC:ON" if report_on_change else "ROC:OFF")
+
+    def select_profile(self, name: str) -> bool:
+        """Switch the firmware to the named calibration profile (``PROFILE:<name>``).
+
+        Each platform keeps its own zero, span, filter and thresholds in the
+        firmware, so no re-calibration is needed after a swap. The local
+        smoothing window is cleared because the firmware re-seeds its filter.
+        """
+        if not _PROFILE_NAME_RE.fullmatch(name) or name in ("LIST", "GET", "NEW", "DEL"):
+            raise ValueError(f"invalid profile name: {name!r}")
+        if not self.send_command(f"PROFILE:{name}"):
+            return False
+        with self._lock:
+            self._window.clear()
+            self._skip_duplicate_sample = True
+        return True
+
     # ------------------------------------------------------------------
     def tare(self) -> None:
         with self._lock:
@@ -757,6 +1088,7 @@ class ScaleService:
 HX711Service = ScaleService
 
 __all__ = [
+    "parse_event_line",
     "ScaleService",
     "HX711Service",
     "SerialScaleBackend",
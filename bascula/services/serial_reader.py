@@ -17,6 +17,9 @@ try:
 except Exception:
     serial = None
 
+from ..core.frame_decoder import KIND_TEXT, KIND_WEIGHT, FrameDecoder
+
+# Solo para líneas que no son del protocolo del firmware (otras básculas).
 _NUMBER_RE = re.compile(r"(-?\d+(?:\.\d+)?)")
 
 
@@ -26,6 +29,7 @@ class SerialReader:
         self.baud = baud
         self.stale_ms = stale_ms
         self._ser = None
+        self._decoder: Optional[FrameDecoder] = None
         self._thread: Optional[threading.Thread] = None
         self._stop = threading.Event()
         self._lock = threading.Lock()
@@ -35,6 +39,10 @@ class SerialReader:
     def start(self) -> None:
         if self._thread and self._thread.is_alive():
             return
+        # Aquí y no en el hilo: sin la librería nativa (FrameDecoderUnavailable)
+        # el error llega a quien arranca el lector en vez de matar el hilo.
+        if self._decoder is None:
+            self._decoder = FrameDecoder()
         self._stop.clear()
         self._thread = threading.Thread(target=self._run, name="SerialReader", daemon=True)
         self._thread.start()
@@ -57,20 +65,24 @@ class SerialReader:
 
     def _run(self):
         backoff = 0.2
+        decoder = self._decoder
         while not self._stop.is_set():
             try:
                 if self._ser is None or not self._ser.is_open:
                     self._open()
+                    decoder.reset()
                 line = self._ser.readline()
                 if not line:
                     continue
-                try:
-                    text = line.decode("utf-8", errors="ignore")
-                except Exception:
-                    text = str(line)
-                m = _NUMBER_RE.search(text)
-                if m:
-                    val = float(m.group(1))
+                val = None
+                for frame in decoder.feed(line):
+                    if frame.kind == KIND_WEIGHT:
+                        val = frame.grams
+                    elif frame.kind == KIND_TEXT and not frame.text.startswith("G:"):
+                        m = _NUMBER_RE.search(frame.text)
+                        if m:
+                            val = float(m.group(1))
+                if val is not None:
                     with self._lock:
                         self._last_value = val
                         self._last_ts = time.time()
@@ -0,0 +1,503 @@
+// firmware-esp32/host/bascula_frames.cpp
+//
+// Implementación de bascula_frames.h. Sin memoria dinámica tras
+// bascula_frames_new() ni dependencia del locale (los números se convierten
+// a mano: en una interfaz con setlocale(LC_ALL, "") en español, strtod
+// esperaría coma decimal). Los campos de G: y PRB: y los prefijos de las
+// respuestas salen del esquema del firmware (frame_schema.h).
+
+#include "bascula_frames.h"
+
+#include <string.h>
+
+#include <new>
+#include <utility>
+
+#include "bulk_codec.h"
+#include "frame_schema.h"
+
+#define BASCULA_FRAMES_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace {
+
+using bascula::BulkFrameParser;
+using bascula::FieldType;
+using bascula::FrameField;
+using bascula::ProbeFrame;
+using bascula::WeightFrame;
+
+static_assert(BASCULA_FRAMES_PROBES == ProbeFrame::count, "una sonda por campo de ProbeFrame");
+static_assert(bascula::FRAME_LINE_MAX == BASCULA_FRAMES_LINE_MAX, "mismo límite de línea");
+
+// Campos de la trama G: que llegan a bascula_frame (el resto se valida y se
+// descarta). La separación de tramas pegadas busca "G:".
+constexpr size_t kG  = WeightFrame::at("G");
+constexpr size_t kS  = WeightFrame::at("S");
+constexpr size_t kPK = WeightFrame::at("PK");
+constexpr size_t kPM = WeightFrame::at("PM");
+constexpr size_t kB  = WeightFrame::at("B");
+constexpr size_t kRES = WeightFrame::at("RES");
+constexpr size_t kOL = WeightFrame::at("OL");
+static_assert(kG == 0 && kS < WeightFrame::count && kPK < WeightFrame::count &&
+                  kPM < WeightFrame::count && kB < WeightFrame::count &&
+                  kRES < WeightFrame::count && kOL < WeightFrame::count,
+              "campos de bascula_frame ausentes de WeightFrame");
+
+constexpr size_t requiredCount() {
+  size_t n = 0;
+  while (n < WeightFrame::count && WeightFrame::fields[n].required) ++n;
+  return n;
+}
+constexpr size_t kRequired = requiredCount();
+
+// Prefijos de las líneas de protocolo que no son ACK/ERR/EVT: respuestas de
+// kCommands sin repetir y líneas espontáneas.
+struct InfoPrefixes {
+  const char* at[bascula::kCommandCount + 1];
+  size_t      n;
+};
+
+constexpr InfoPrefixes makeInfoPrefixes() {
+  InfoPrefixes out{};
+  for (const char* u : bascula::kUnsolicited) out.at[out.n++] = u;
+  for (const bascula::FrameCommand& c : bascula::kCommands) {
+    bool seen = c.reply == nullptr;
+    for (size_t i = 0; i < out.n && !seen; ++i) seen = bascula::schemaStrEq(out.at[i], c.reply);
+    if (!seen) out.at[out.n++] = c.reply;
+  }
+  return out;
+}
+
+static_assert(sizeof(bascula::kUnsolicited) / sizeof(bascula::kUnsolicited[0]) == 1,
+              "InfoPrefixes reserva sitio para una línea espontánea");
+constexpr InfoPrefixes kInfoPrefixes = makeInfoPrefixes();
+
+// Claves de ProbeFrame en orden de bit, para bascula_frames_probe_keys() (de
+// una letra: lo comprueba probe.h).
+struct ProbeKeys {
+  char at[ProbeFrame::count + 1];
+};
+
+constexpr ProbeKeys makeProbeKeys() {
+  ProbeKeys out{};
+  for (size_t i = 0; i < ProbeFrame::count; ++i) out.at[i] = ProbeFrame::fields[i].tag[0];
+  return out;
+}
+constexpr ProbeKeys kProbeKeys = makeProbeKeys();
+
+const double kPow10[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8, 1e9,
+                         1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+void skipSpaces(const char*& p, const char* end) {
+  while (p < end && isSpace(*p)) ++p;
+}
+
+bool startsWithNoCase(const char* p, const char* end, const char* prefix) {
+  for (; *prefix; ++prefix, ++p) {
+    if (p >= end) return false;
+    char c = *p;
+    if (c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+    if (c != *prefix) return false;
+  }
+  return true;
+}
+
+// [+-]?\d+(\.\d+)? -> double exacto (mantisa entera / potencia de 10, igual
+// que float() de Python hasta 18 cifras).
+bool parseNumber(const char*& p, const char* end, double& out) {
+  const char* q = p;
+  bool neg = false;
+  if (q < end && (*q == '+' || *q == '-')) neg = *q++ == '-';
+  uint64_t m = 0;
+  int digits = 0, frac = 0;
+  while (q < end && isDigit(*q)) {
+    m = m * 10 + (uint64_t)(*q++ - '0');
+    digits++;
+  }
+  if (digits == 0) return false;
+  if (q < end && *q == '.') {
+    ++q;
+    while (q < end && isDigit(*q)) {
+      m = m * 10 + (uint64_t)(*q++ - '0');
+      digits++;
+      frac++;
+    }
+    if (frac == 0) return false;
+  }
+  if (digits > 18) return false;
+  double v = (double)m / kPow10[frac];
+  out = neg ? -v : v;
+  p = q;
+  return true;
+}
+
+bool parseInt(const char*& p, const char* end, int32_t& out) {
+  const char* q = p;
+  bool neg = false;
+  if (q < end && (*q == '+' || *q == '-')) neg = *q++ == '-';
+  int64_t v = 0;
+  int digits = 0;
+  while (q < end && isDigit(*q) && digits < 11) {
+    v = v * 10 + (*q++ - '0');
+    digits++;
+  }
+  if (digits == 0 || (q < end && isDigit(*q))) return false;
+  v = neg ? -v : v;
+  if (v < INT32_MIN || v > INT32_MAX) return false;
+  out = (int32_t)v;
+  p = q;
+  return true;
+}
+
+// Valor de un campo según su tipo en el esquema.
+bool parseField(const FrameField& fd, const char*& p, const char* end, double& out) {
+  switch (fd.type) {
+    case FieldType::FLOAT:
+      return parseNumber(p, end, out);
+    case FieldType::INT: {
+      int32_t v;
+      if (!parseInt(p, end, v)) return false;
+      out = v;
+      return true;
+    }
+    case FieldType::BOOL:
+      if (p >= end || (*p != '0' && *p != '1')) return false;
+      out = *p++ == '1' ? 1.0 : 0.0;
+      return true;
+    case FieldType::FLAG:
+      if (p >= end || *p != '1') return false;
+      ++p;
+      out = 1.0;
+      return true;
+  }
+  return false;
+}
+
+// Índice del campo con esa clave a partir de `from`, o count.
+template <class Frame>
+size_t fieldByKey(const char* key, size_t klen, size_t from) {
+  for (size_t i = from; i < Frame::count; ++i) {
+    const char* t = Frame::fields[i].tag;
+    if (strncmp(t, key, klen) == 0 && t[klen] == '\0') return i;
+  }
+  return Frame::count;
+}
+
+// Campo obligatorio I de WeightFrame: clave y tipo constantes, sin tabla.
+template <size_t I>
+bool parseRequired(const char*& p, const char* end, double* v) {
+  constexpr FrameField fd = WeightFrame::fields[I];
+  constexpr size_t tlen = bascula::schemaStrLen(fd.tag);
+  skipSpaces(p, end);
+  if (I > 0) {
+    if (p >= end || *p++ != ',') return false;
+    skipSpaces(p, end);
+  }
+  if ((size_t)(end - p) <= tlen || memcmp(p, fd.tag, tlen) != 0 || p[tlen] != ':') return false;
+  p += tlen + 1;
+  skipSpaces(p, end);
+  return parseField(fd, p, end, v[I]);
+}
+
+template <size_t... I>
+bool parseRequiredAll(const char*& p, const char* end, double* v, std::index_sequence<I...>) {
+  return (parseRequired<I>(p, end, v) && ...);
+}
+
+// \s*G:\s*<num>\s*,\s*S:\s*[01]\s*(,<campo>)*$ con los obligatorios de
+// WeightFrame en orden; los opcionales se reconocen por clave y tipo, y un
+// campo desconocido o con valor malo se ignora (el firmware añade campos).
+bool parseWeight(const char* p, const char* end, bascula_frame& f) {
+  double v[WeightFrame::count];
+  if (!parseRequiredAll(p, end, v, std::make_index_sequence<kRequired>{})) return false;
+  uint32_t present = (1u << kRequired) - 1;
+  skipSpaces(p, end);
+  while (p < end) {
+    if (*p++ != ',') return false;
+    const char* key = p;
+    while (p < end && *p != ':' && *p != ',') ++p;
+    if (p >= end || *p != ':') continue;  // campo sin valor: se ignora
+    const size_t k = fieldByKey<WeightFrame>(key, (size_t)(p - key), kRequired);
+    ++p;
+    const char* val = p;
+    while (p < end && *p != ',') ++p;
+    double d;
+    if (k < WeightFrame::count && parseField(WeightFrame::fields[k], val, p, d) && val == p) {
+      v[k] = d;
+      present |= 1u << k;
+    }
+  }
+  f.grams = v[kG];
+  if (v[kS] != 0.0) f.flags |= BASCULA_FRAME_STABLE;
+  if (present & ((1u << kPK) | (1u << kPM))) {
+    if (present & (1u << kPK)) f.peak = v[kPK];
+    if (present & (1u << kPM)) f.minimum = v[kPM];
+    f.flags |= BASCULA_FRAME_PEAK;
+  }
+  if (present & (1u << kB)) {
+    f.chb = (int32_t)v[kB];
+    f.flags |= BASCULA_FRAME_CHB;
+  }
+  if (present & (1u << kRES)) {
+    f.resolution = v[kRES];
+    f.flags |= BASCULA_FRAME_RES;
+  }
+  if (present & (1u << kOL)) f.flags |= BASCULA_FRAME_OVERLOAD;
+  return true;
+}
+
+// PRB:<clave>:<num>(,<clave>:<num>)* ; claves de ProbeFrame. Un campo que no
+// se entiende se salta sin invalidar el resto: la línea siempre es PROBE.
+void parseProbe(const char* p, const char* end, bascula_frame& f) {
+  p += bascula::schemaStrLen(ProbeFrame::prefix);
+  while (p < end) {
+    const char* key = p;
+    while (p < end && *p != ',') ++p;
+    const char* fend = p;
+    if (p < end) ++p;
+    const char* colon = (const char*)memchr(key, ':', (size_t)(fend - key));
+    if (!colon) continue;
+    const size_t i = fieldByKey<ProbeFrame>(key, (size_t)(colon - key), 0);
+    const char* val = colon + 1;
+    double d;
+    if (i == ProbeFrame::count || !parseNumber(val, fend, d) || val != fend) continue;
+    f.probe[i] = d;
+    f.probe_mask |= (uint8_t)(1u << i);
+  }
+}
+
+}  // namespace
+
+struct bascula_frames {
+  explicit bascula_frames(uint32_t options) : bulk((options & BASCULA_FRAMES_BULK) != 0) {
+    reset();
+  }
+
+  void reset() {
+    len = 0;
+    overflowing = false;
+    binLine = false;
+    segPos = segEnd = 0;
+    pendN = pendPos = 0;
+    parser = BulkFrameParser();
+  }
+
+  // Siguiente segmento de la línea lista: una trama G: o la línea entera.
+  void nextSegment(bascula_frame& f) {
+    const char* base = line;
+    size_t start = segPos;
+    size_t stop = segEnd;
+    // Dos tramas pegadas: "G:...,S:1G:...". Una G: precedida de ',' es un
+    // campo (p. ej. G: de EVT:OVERLOAD), no una trama nueva.
+    // Ruido pegado delante de una trama ("xxG:...") sale aparte como TEXT.
+    const char* s = base + start;
+    while (s < base + stop && isSpace(*s)) ++s;
+    const bool weightLine = (base + stop - s) >= 2 && s[0] == 'G' && s[1] == ':';
+    if (weightLine || !protocolLine(s, base + stop)) {
+      for (size_t i = (size_t)(s - base) + (weightLine ? 2 : 1); i + 1 < stop; ++i) {
+        if (base[i] == 'G' && base[i + 1] == ':' && base[i - 1] != ',') {
+          stop = i;
+          break;
+        }
+      }
+    }
+    segPos = stop;
+
+    memset(&f, 0, sizeof(f));
+    f.size = sizeof(bascula_frame);
+    const char* p = base + start;
+    const char* end = base + stop;
+    // Sin espacios ni fin de línea a los lados (como strip() en Python)
+    while (p < end && isSpace(*p)) ++p;
+    while (end > p && isSpace(end[-1])) --end;
+    size_t n = (size_t)(end - p);
+    if (n >= BASCULA_FRAMES_TEXT_MAX) {
+      n = BASCULA_FRAMES_TEXT_MAX - 1;
+      f.flags |= BASCULA_FRAME_TRUNCATED;
+    }
+    memcpy(f.text, p, n);
+    f.text[n] = '\0';
+    f.text_len = (uint16_t)n;
+
+    if (weightLine) {
+      if (parseWeight(p, end, f)) {
+        f.kind = BASCULA_FRAME_WEIGHT;
+        stats.weights++;
+        return;
+      }
+      f.flags &= BASCULA_FRAME_TRUNCATED;
+      f.grams = f.peak = f.minimum = 0.0;
+      f.chb = 0;
+      f.kind = BASCULA_FRAME_TEXT;
+      stats.bad++;
+      return;
+    }
+    f.kind = classify(p, end);
+    if (f.kind == BASCULA_FRAME_PROBE) parseProbe(p, end, f);
+  }
+
+  static uint8_t classify(const char* p, const char* end) {
+    if (startsWithNoCase(p, end, "ACK:")) return BASCULA_FRAME_ACK;
+    if (startsWithNoCase(p, end, "ERR:")) return BASCULA_FRAME_ERR;
+    if (startsWithNoCase(p, end, "EVT:")) return BASCULA_FRAME_EVENT;
+    if (startsWithNoCase(p, end, ProbeFrame::prefix)) return BASCULA_FRAME_PROBE;
+    for (size_t i = 0; i < kInfoPrefixes.n; ++i) {
+      if (startsWithNoCase(p, end, kInfoPrefixes.at[i])) return BASCULA_FRAME_INFO;
+    }
+    return BASCULA_FRAME_TEXT;
+  }
+
+  static bool protocolLine(const char* p, const char* end) {
+    return classify(p, end) != BASCULA_FRAME_TEXT;
+  }
+
+  bool segmentPending() {
+    // Salta segmentos vacíos (solo espacios)
+    while (segPos < segEnd) {
+      size_t i = segPos;
+      while (i < segEnd && isSpace(line[i])) ++i;
+      if (i < segEnd) return true;
+      segPos = segEnd;
+    }
+    return false;
+  }
+
+  void endLine() {
+    if (overflowing) {
+      overflowing = false;
+      len = 0;
+      return;
+    }
+    if (len > 0) {
+      stats.lines++;
+      segPos = 0;
+      segEnd = len;
+    }
+    len = 0;
+  }
+
+  void bulkFrame() {
+    stats.bulk_frames++;
+    pendN = pendPos = 0;
+    pendType = parser.type();
+    pendSeq = parser.seq();
+    const size_t cols = bascula::bulkCols(pendType);
+    bool ok = bascula::bulkDecodeRows(parser, [&](const int32_t* row) {
+      if (pendN < kMaxRows) {
+        memcpy(pend[pendN], row, cols * sizeof(int32_t));
+        pendN++;
+      }
+    });
+    if (!ok) {
+      pendN = 0;
+      stats.bulk_frames--;
+      stats.bulk_bad++;
+    }
+  }
+
+  void byte(uint8_t b) {
+    stats.bytes++;
+    const bool eol = b == '\n' || b == '\r';
+    if (b == bascula::BULK_SYNC && !binLine) {
+      binLine = true;
+      stats.binary++;
+      len = 0;  // lo que precede en la misma línea es ruido
+      overflowing = false;
+    }
+    if (binLine) {
+      if (bulk) {
+        BulkFrameParser::Result r = parser.feed(b);
+        if (r == BulkFrameParser::FRAME) bulkFrame();
+        else if (r == BulkFrameParser::BAD) stats.bulk_bad++;
+      }
+      if (eol) binLine = false;
+      return;
+    }
+    if (eol) {
+      endLine();
+      return;
+    }
+    if (overflowing) return;
+    if (len >= sizeof(line)) {
+      overflowing = true;
+      stats.overflow++;
+      return;
+    }
+    line[len++] = (char)b;
+  }
+
+  size_t feed(const uint8_t* data, size_t n, bascula_frame* out, size_t max, size_t* used) {
+    size_t k = 0, i = 0;
+    for (;;) {
+      while (k < max && pendPos < pendN) {
+        bascula_frame& f = out[k++];
+        memset(&f, 0, sizeof(f));
+        f.size = sizeof(bascula_frame);
+        f.kind = BASCULA_FRAME_BULK;
+        f.bulk_type = pendType;
+        f.bulk_cols = (uint8_t)bascula::bulkCols(pendType);
+        f.bulk_seq = pendSeq;
+        memcpy(f.row, pend[pendPos], f.bulk_cols * sizeof(int32_t));
+        pendPos++;
+      }
+      while (k < max && segmentPending()) nextSegment(out[k++]);
+      if (k >= max || i >= n) break;
+      byte(data[i++]);
+    }
+    if (used) *used = i;
+    return k;
+  }
+
+  static const size_t kMaxRows = bascula::BULK_PAYLOAD_MAX / bascula::BULK_TRACE_COLS;
+
+  bool                 bulk;
+  char                 line[BASCULA_FRAMES_LINE_MAX];
+  size_t               len;
+  bool                 overflowing;
+  bool                 binLine;
+  size_t               segPos;   // segmentos de la línea completa aún sin entregar
+  size_t               segEnd;
+  BulkFrameParser      parser;
+  int32_t              pend[kMaxRows][bascula::BULK_LOG_COLS];
+  size_t               pendN;
+  size_t               pendPos;
+  uint8_t              pendType;
+  uint16_t             pendSeq;
+  bascula_frames_stats stats = bascula_frames_stats();
+};
+
+BASCULA_FRAMES_EXPORT uint32_t bascula_frames_abi(void) { return BASCULA_FRAMES_ABI; }
+
+BASCULA_FRAMES_EXPORT const char* bascula_frames_probe_keys(void) {
+  return kProbeKeys.at;
+}
+
+BASCULA_FRAMES_EXPORT bascula_frames* bascula_frames_new(uint32_t options) {
+  return new (std::nothrow) bascula_frames(options);
+}
+
+BASCULA_FRAMES_EXPORT void bascula_frames_free(bascula_frames* d) { delete d; }
+
+BASCULA_FRAMES_EXPORT void bascula_frames_reset(bascula_frames* d) {
+  if (d) d->reset();
+}
+
+BASCULA_FRAMES_EXPORT size_t bascula_frames_feed(bascula_frames* d, const uint8_t* data,
+                                                 size_t len, bascula_frame* out,
+                                                 size_t max_out, size_t* consumed) {
+  if (!d || (!data && len > 0) || (!out && max_out > 0)) {
+    if (consumed) *consumed = 0;
+    return 0;
+  }
+  return d->feed(data, len, out, max_out, consumed);
+}
+
+BASCULA_FRAMES_EXPORT void bascula_frames_get_stats(const bascula_frames* d,
+                                                    bascula_frames_stats* out) {
+  if (!d || !out) return;
+  *out = d->stats;
+  out->size = sizeof(bascula_frames_stats);
+}
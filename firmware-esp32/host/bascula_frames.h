@@ -0,0 +1,116 @@
+/* firmware-esp32/host/bascula_frames.h
+ *
+ * Decodificador en flujo de la salida serie del firmware, con ABI C estable
+ * para usarlo desde Python (ctypes, bascula/core/frame_decoder.py) u otros
+ * lenguajes. Se le dan los bytes tal como llegan (trozos de cualquier
+ * tamaño, líneas partidas o pegadas) y devuelve estructuras ya decodificadas:
+ * peso y estabilidad de las tramas G:, ACK:, ERR:, eventos EVT:, las sondas
+ * PRB: (probe.h), el resto de líneas del protocolo y, si se activa, las
+ * filas de las tramas binarias de volcado (bulk_codec.h).
+ *
+ * Resincronización:
+ * - Una línea de más de BASCULA_FRAMES_LINE_MAX bytes se descarta hasta el
+ *   siguiente fin de línea (cuenta en `overflow`).
+ * - Dos tramas G: pegadas por un fin de línea perdido se separan.
+ * - Una trama G: mal formada sale como TEXT y cuenta en `bad`.
+ * - Una línea con 0xA5 es una trama binaria: sin BASCULA_FRAMES_BULK se
+ *   descarta entera; con él se valida (CRC) y sus filas salen como BULK.
+ *
+ * Estabilidad de la ABI: solo se añaden campos al final de las estructuras y
+ * valores nuevos a los enumerados; `size` lleva sizeof() de la versión con la
+ * que se compiló la biblioteca para que el llamador lo compruebe.
+ */
+
+#ifndef BASCULA_FRAMES_H
+#define BASCULA_FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BASCULA_FRAMES_ABI      1
+#define BASCULA_FRAMES_LINE_MAX 160 /* bytes por línea de texto */
+#define BASCULA_FRAMES_TEXT_MAX 96  /* bytes de texto copiados por trama */
+#define BASCULA_FRAMES_PROBES   7   /* sondas de PRB:, en orden de bit (RVMNIDT) */
+
+/* Opciones de bascula_frames_new() */
+#define BASCULA_FRAMES_BULK 0x1u /* decodificar tramas binarias de volcado */
+
+enum bascula_frame_kind {
+  BASCULA_FRAME_WEIGHT = 1, /* G:<g>,S:<0|1>[,PK:<g>,PM:<g>][,B:<crudo>][,RES:<g>][,OL:1] */
+  BASCULA_FRAME_ACK    = 2, /* ACK:... */
+  BASCULA_FRAME_ERR    = 3, /* ERR:... */
+  BASCULA_FRAME_EVENT  = 4, /* EVT:<tipo>,... */
+  BASCULA_FRAME_INFO   = 5, /* otra línea del protocolo (HELLO, RATE:, LOG:, ...) */
+  BASCULA_FRAME_TEXT   = 6, /* línea que no es del protocolo */
+  BASCULA_FRAME_BULK   = 7, /* una fila de una trama binaria */
+  BASCULA_FRAME_PROBE  = 8  /* PRB:R:<crudo>,V:,M:,N:,I:,D:,T: (PROBE:<máscara>) */
+};
+
+/* bascula_frame.flags */
+#define BASCULA_FRAME_STABLE    0x01u
+#define BASCULA_FRAME_OVERLOAD  0x02u /* campo OL:1 */
+#define BASCULA_FRAME_PEAK      0x04u /* campos PK/PM presentes */
+#define BASCULA_FRAME_CHB       0x08u /* campo B presente */
+#define BASCULA_FRAME_TRUNCATED 0x10u /* text recortado a TEXT_MAX - 1 */
+#define BASCULA_FRAME_RES       0x20u /* campo RES presente */
+
+typedef struct bascula_frame {
+  uint32_t size;      /* sizeof(bascula_frame) de la biblioteca */
+  uint8_t  kind;      /* bascula_frame_kind */
+  uint8_t  flags;
+  uint16_t text_len;
+  double   grams;     /* WEIGHT */
+  double   peak;      /* WEIGHT con PEAK */
+  double   minimum;   /* WEIGHT con PEAK */
+  int32_t  chb;       /* WEIGHT con CHB: crudo del canal B */
+  uint8_t  bulk_type; /* BULK: 'L' registro, 'T' traza */
+  uint8_t  bulk_cols;
+  uint16_t bulk_seq;  /* BULK: secuencia de la trama */
+  int32_t  row[5];    /* BULK: columnas de la fila */
+  char     text[BASCULA_FRAMES_TEXT_MAX]; /* línea sin fin de línea, terminada en 0 */
+  uint8_t  probe_mask; /* PROBE: bit i -> probe[i] presente */
+  double   probe[BASCULA_FRAMES_PROBES]; /* PROBE: valores (0 si falta el campo) */
+  double   resolution; /* WEIGHT con RES: resolución efectiva en g (REFINE:ON) */
+} bascula_frame;
+
+typedef struct bascula_frames_stats {
+  uint32_t size;
+  uint64_t bytes;
+  uint64_t lines;       /* líneas de texto completas */
+  uint64_t weights;
+  uint64_t bad;         /* tramas G: mal formadas */
+  uint64_t overflow;    /* líneas descartadas por largas */
+  uint64_t binary;      /* líneas binarias (decodificadas o descartadas) */
+  uint64_t bulk_frames; /* tramas binarias válidas */
+  uint64_t bulk_bad;    /* tramas binarias con CRC o formato erróneo */
+} bascula_frames_stats;
+
+typedef struct bascula_frames bascula_frames;
+
+uint32_t        bascula_frames_abi(void);
+bascula_frames* bascula_frames_new(uint32_t options);
+void            bascula_frames_free(bascula_frames* d);
+void            bascula_frames_reset(bascula_frames* d);
+
+/* Consume bytes de data y escribe hasta max_out tramas en out. Devuelve las
+ * tramas escritas; *consumed (si no es NULL) recibe los bytes consumidos,
+ * que pueden ser menos que len si out se llenó: volver a llamar con el resto
+ * (o con len = 0 para vaciar filas binarias pendientes). */
+size_t bascula_frames_feed(bascula_frames* d, const uint8_t* data, size_t len,
+                           bascula_frame* out, size_t max_out, size_t* consumed);
+
+void bascula_frames_get_stats(const bascula_frames* d, bascula_frames_stats* out);
+
+/* Claves de las sondas de PRB: en orden de bit ("RVMNIDT"), sacadas de
+ * ProbeFrame (frame_schema.h). Cadena estática. */
+const char* bascula_frames_probe_keys(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASCULA_FRAMES_H */
@@ -0,0 +1,846 @@
+// firmware-esp32/host/filter_sweep.cpp
+//
+// Barrido de los parámetros del filtro (mediana, τ del IIR, umbral y tiempo
+// de estabilidad) sobre trazas grabadas, con el núcleo del firmware
+// (pipeline.h, filterParamsFor de rate.h). Sustituye al bucle de Python.
+//
+//   filter_sweep --cal <g/cuenta> [rejilla] [--threads N] [--all todo.csv]
+//                traza.txt|directorio ...
+//   filter_sweep --selftest                   núcleo idéntico a Pipeline,
+//                                             paralelo == serie, frente
+//   filter_sweep --bench [--threads N]        configuraciones·muestras/s
+//
+// Rejilla: --med a:b:paso, --tau a:b:paso (ms), --th a:b:paso (g),
+// --sms a:b:paso (ms); el filtro de fábrica (375, 112, 1.0, 700) se añade
+// siempre para tener la referencia. Verdad: --tol <g> (0.5) y
+// --min-step <g> (5).
+//
+// Una traza es texto con una fila TR:<µs>,<crudo> por conversión (lo que
+// saca bulk_decode de un volcado BULK_TRACE); las demás líneas se ignoran.
+// Se diezma como acq (decimationFor a LOOP_HZ) y la verdad sale de la traza
+// entera, sin causalidad: mesetas de al menos PLATEAU_MIN_MS donde la media
+// de QUIET_HALF_MS a cada lado no cambia, y escalones entre mesetas.
+//
+// Para cada configuración:
+// - asentamiento: del inicio de cada escalón al primer S:1 dentro de la
+//   tolerancia del nivel nuevo (si no llega antes del final de la meseta,
+//   cuenta hasta ahí y suma un "sin asentar");
+// - ruido: RMS de la salida frente al nivel en la segunda mitad de cada
+//   meseta;
+// - estabilidad falsa: ms con S:1 fuera de la tolerancia, por escalón.
+// La salida es el frente de Pareto de las tres, en CSV.
+//
+// Cálculo: las configuraciones con la misma mediana comparten la ventana,
+// que se calcula una vez por muestra; IIR y estabilidad van en carriles
+// (estructura de arrays, sin saltos) que el compilador vectoriza. Cada
+// tarea es (traza, mediana, bloque de carriles) y las reparte un pool con
+// robo de trabajo. Los acumuladores son enteros: el resultado no depende
+// del número de hilos ni del orden.
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pipeline.h"
+#include "rate.h"
+
+using namespace bascula;
+
+namespace {
+
+// Mismos valores que main.cpp.
+const uint32_t     LOOP_HZ = 50;
+const FilterTiming FIRMWARE_TIMING{375, 112, 1.0f, 700};
+
+const size_t   LANE_BLOCK     = 256;   // carriles por tarea
+const size_t   NOISE_FLUSH    = 1024;  // muestras por suma parcial en float
+const uint32_t QUIET_HALF_MS  = 250;
+const uint32_t PLATEAU_MIN_MS = 1000;
+const double   NOISE_UNIT     = 1e-9;  // g² por unidad del acumulador
+
+enum : uint8_t { F_ONSET = 1, F_DEADLINE = 2, F_NOISE = 4 };
+
+struct Trace {
+  std::string           name;
+  std::vector<long>     raw;     // muestras del pipeline (ya diezmadas)
+  std::vector<uint32_t> tMs;
+  std::vector<int32_t>  dtMs;    // hasta la muestra siguiente
+  std::vector<float>    target;  // nivel de la meseta actual o siguiente; NaN sin verdad
+  std::vector<uint8_t>  flags;
+  float                 stepMs = 0.0f;
+  float                 cal = 1.0f;
+  int32_t               tare = 0;
+  size_t                steps = 0;
+  size_t                noiseN = 0;
+};
+
+struct Axis {
+  std::vector<float> v;
+};
+
+struct Grid {
+  Axis  med, tau, th, sms;
+  float tol = 0.5f;  // tolerancia de la verdad (g)
+  size_t lanes() const { return tau.v.size() * th.v.size() * sms.v.size(); }
+  size_t size() const { return med.v.size() * lanes(); }
+  FilterTiming timing(size_t cfg) const {
+    const size_t nl = lanes(), c = cfg % sms.v.size(), b = (cfg / sms.v.size()) % th.v.size();
+    const size_t a = (cfg % nl) / (sms.v.size() * th.v.size()), m = cfg / nl;
+    return FilterTiming{(uint32_t)med.v[m], (uint32_t)tau.v[a], th.v[b], (uint32_t)sms.v[c]};
+  }
+  size_t index(const FilterTiming& t) const {
+    auto at = [](const Axis& x, float v) {
+      return (size_t)(std::find(x.v.begin(), x.v.end(), v) - x.v.begin());
+    };
+    return ((at(med, (float)t.medianMs) * tau.v.size() + at(tau, (float)t.iirTauMs)) *
+                th.v.size() + at(th, t.stableDeltaG)) * sms.v.size() +
+           at(sms, (float)t.stableMs);
+  }
+};
+
+// Sumas por configuración.
+struct Totals {
+  std::vector<int64_t> settleMs, unsettled, falseMs, noise;
+  void resize(size_t n) {
+    settleMs.assign(n, 0);
+    unsettled.assign(n, 0);
+    falseMs.assign(n, 0);
+    noise.assign(n, 0);
+  }
+  void add(const Totals& o) {
+    for (size_t i = 0; i < settleMs.size(); ++i) {
+      settleMs[i] += o.settleMs[i];
+      unsettled[i] += o.unsettled[i];
+      falseMs[i] += o.falseMs[i];
+      noise[i] += o.noise[i];
+    }
+  }
+  bool operator==(const Totals& o) const {
+    return settleMs == o.settleMs && unsettled == o.unsettled && falseMs == o.falseMs &&
+           noise == o.noise;
+  }
+};
+
+struct Score {
+  size_t cfg;
+  double settleMs, noiseG, falseMs;
+  long   unsettled;
+};
+
+// ---------- TRAZAS ----------
+
+// Verdad de la traza: mesetas, escalones, zonas de ruido.
+void segment(Trace& t, float tolG, float minStepG) {
+  const size_t n = t.raw.size();
+  std::vector<double> g(n), pre(n + 1, 0.0);
+  for (size_t k = 0; k < n; ++k) {
+    g[k] = (double)(t.raw[k] - t.tare) * t.cal;
+    pre[k + 1] = pre[k] + g[k];
+  }
+  // Ruido por muestra a partir de las diferencias (MAD, robusto a escalones)
+  std::vector<double> d;
+  for (size_t k = 1; k < n; ++k) d.push_back(fabs(g[k] - g[k - 1]));
+  double sigma = 0.0;
+  if (!d.empty()) {
+    std::nth_element(d.begin(), d.begin() + d.size() / 2, d.end());
+    sigma = d[d.size() / 2] / 0.6745 / sqrt(2.0);
+  }
+  const size_t h = std::max<size_t>(2, (size_t)lroundf((float)QUIET_HALF_MS / t.stepMs));
+  const double band = std::max((double)tolG * 0.5, 5.0 * sigma * sqrt(2.0 / (double)h));
+  std::vector<uint8_t> quiet(n, 0);
+  for (size_t k = h; k + h < n; ++k) {
+    const double before = (pre[k] - pre[k - h]) / (double)h;
+    const double after = (pre[k + h] - pre[k]) / (double)h;
+    quiet[k] = fabs(after - before) <= band;
+  }
+  struct Plateau {
+    size_t a, b;  // [a, b)
+    double level;
+  };
+  std::vector<Plateau> pl;
+  const size_t minLen = (size_t)((float)PLATEAU_MIN_MS / t.stepMs);
+  for (size_t k = 0; k < n;) {
+    if (!quiet[k]) {
+      ++k;
+      continue;
+    }
+    size_t e = k;
+    while (e < n && quiet[e]) ++e;
+    if (e - k >= minLen) pl.push_back(Plateau{k, e, (pre[e] - pre[k]) / (double)(e - k)});
+    k = e;
+  }
+  t.target.assign(n, NAN);
+  t.flags.assign(n, 0);
+  t.steps = 0;
+  t.noiseN = 0;
+  for (size_t i = 0; i < pl.size(); ++i) {
+    const Plateau& p = pl[i];
+    const size_t from = i == 0 ? p.a : pl[i - 1].b;
+    for (size_t k = from; k < p.b; ++k) t.target[k] = (float)p.level;
+    for (size_t k = p.a + (p.b - p.a) / 2; k < p.b; ++k) {
+      t.flags[k] |= F_NOISE;
+      t.noiseN++;
+    }
+    if (i == 0 || fabs(p.level - pl[i - 1].level) < minStepG) continue;
+    // Inicio: primer crudo que sale claramente del nivel anterior
+    const double prev = pl[i - 1].level, jump = std::max(minStepG * 0.5, 6.0 * sigma);
+    size_t on = pl[i - 1].b > h ? pl[i - 1].b - h : 0;
+    while (on < p.a && fabs(g[on] - prev) <= jump) ++on;
+    // Hasta el inicio, la verdad sigue siendo el nivel anterior
+    for (size_t k = pl[i - 1].b; k < on; ++k) t.target[k] = (float)prev;
+    t.flags[on] |= F_ONSET;
+    t.flags[p.b - 1] |= F_DEADLINE;
+    t.steps++;
+  }
+}
+
+// Filas (µs, crudo) -> muestras del pipeline como en acq, más la verdad.
+bool prepare(Trace& t, const std::vector<uint32_t>& us, const std::vector<long>& raw,
+             float cal, float tolG, float minStepG) {
+  if (us.size() < 16) return false;
+  std::vector<uint32_t> dt;
+  for (size_t i = 1; i < us.size(); ++i) dt.push_back(us[i] - us[i - 1]);
+  std::nth_element(dt.begin(), dt.begin() + dt.size() / 2, dt.end());
+  const uint32_t periodUs = dt[dt.size() / 2];
+  const uint8_t decim = decimationFor(periodUs, 1000000u / LOOP_HZ);
+  t.stepMs = (float)decim * (float)periodUs / 1000.0f;
+  t.cal = cal;
+  t.raw.clear();
+  t.tMs.clear();
+  for (size_t i = decim - 1; i < us.size(); i += decim) {
+    t.raw.push_back(raw[i]);
+    t.tMs.push_back(us[i] / 1000u);
+  }
+  const size_t n = t.raw.size();
+  t.dtMs.assign(n, (int32_t)lroundf(t.stepMs));
+  for (size_t k = 0; k + 1 < n; ++k) t.dtMs[k] = (int32_t)(t.tMs[k + 1] - t.tMs[k]);
+  t.tare = (int32_t)t.raw[0];
+  segment(t, tolG, minStepG);
+  return n >= 16;
+}
+
+bool loadTrace(const std::string& path, float cal, float tolG, float minStepG, Trace& t) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (!f) return false;
+  std::vector<uint32_t> us;
+  std::vector<long> raw;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long u;
+    long r;
+    if (sscanf(line, "TR:%lu,%ld", &u, &r) == 2) {
+      us.push_back((uint32_t)u);
+      raw.push_back(r);
+    }
+  }
+  fclose(f);
+  t.name = path;
+  return prepare(t, us, raw, cal, tolG, minStepG);
+}
+
+// ---------- NÚCLEO EN CARRILES ----------
+
+// Carriles [l0, l1) de la mediana m sobre una traza. Replica Pipeline::push
+// carril a carril; g0/s0 (si no son nulos) reciben la salida del carril l0.
+void runBlock(const Trace& tr, const Grid& grid, size_t m, size_t l0, size_t l1, Totals& out,
+              std::vector<float>* g0 = nullptr, std::vector<uint8_t>* s0 = nullptr) {
+  const size_t nl = l1 - l0, nTh = grid.th.v.size(), nSms = grid.sms.v.size();
+  float alpha[LANE_BLOCK], th[LANE_BLOCK], iir[LANE_BLOCK], last[LANE_BLOCK], nsq[LANE_BLOCK];
+  uint32_t sms[LANE_BLOCK], ref[LANE_BLOCK], pendT[LANE_BLOCK];
+  int32_t st[LANE_BLOCK], pend[LANE_BLOCK], settle[LANE_BLOCK], uns[LANE_BLOCK], fls[LANE_BLOCK];
+  double nsqD[LANE_BLOCK];
+  const FilterTiming base{(uint32_t)grid.med.v[m], 0, 1.0f, 100};
+  const FilterParams mp = filterParamsFor(base, tr.stepMs);
+  for (size_t j = 0; j < nl; ++j) {
+    const size_t l = l0 + j;
+    FilterTiming ft = base;
+    ft.iirTauMs = (uint32_t)grid.tau.v[l / (nTh * nSms)];
+    alpha[j] = filterParamsFor(ft, tr.stepMs).iirAlpha;
+    th[j] = grid.th.v[(l / nSms) % nTh];
+    sms[j] = (uint32_t)grid.sms.v[l % nSms];
+    iir[j] = last[j] = nsq[j] = 0.0f;
+    ref[j] = pendT[j] = 0;
+    st[j] = pend[j] = settle[j] = uns[j] = fls[j] = 0;
+    nsqD[j] = 0.0;
+  }
+  MedianRing rb;
+  rb.setWindow(mp.medianWindow);
+  const float cal = tr.cal, tol = grid.tol;
+  const size_t n = tr.raw.size();
+  for (size_t k = 0; k < n; ++k) {
+    const long raw = tr.raw[k];
+    const uint32_t t = tr.tMs[k];
+    const uint8_t fl = tr.flags[k];
+    rb.add(raw);
+    // Misma aritmética que Pipeline::rawToGrams
+    const bool filtered = rb.size() >= 3;
+    const float x = (float)((filtered ? rb.median() : raw) - tr.tare) * cal;
+    if (!filtered) {
+      for (size_t j = 0; j < nl; ++j) iir[j] = x;
+    } else if (k == 2) {
+      for (size_t j = 0; j < nl; ++j) iir[j] = x;  // siembra
+    } else {
+      for (size_t j = 0; j < nl; ++j) iir[j] = (1.0f - alpha[j]) * iir[j] + alpha[j] * x;
+    }
+    if (fl & F_ONSET) {
+      for (size_t j = 0; j < nl; ++j) {
+        uns[j] += pend[j];  // el anterior no llegó a asentar (no debería pasar)
+        pend[j] = 1;
+        pendT[j] = t;
+      }
+    }
+    const float tgt = tr.target[k];
+    const int32_t known = tgt == tgt;
+    const int32_t dt = tr.dtMs[k];
+    // Fuera de la zona de ruido el peso es 0 y el nivel, 0 (no NaN)
+    const float w = (fl & F_NOISE) ? 1.0f : 0.0f, level = (fl & F_NOISE) ? tgt : 0.0f;
+    for (size_t j = 0; j < nl; ++j) {
+      const float g = iir[j];
+      const int32_t in = fabsf(g - last[j]) <= th[j];
+      const int32_t ok = (uint32_t)(t - ref[j]) >= sms[j];
+      st[j] = in & (st[j] | ok);
+      ref[j] = in ? ref[j] : t;
+      last[j] = g;
+      const float e = g - tgt;
+      const int32_t good = fabsf(e) <= tol;
+      fls[j] += (st[j] & known & (1 - good)) * dt;
+      const int32_t hit = pend[j] & st[j] & good;
+      settle[j] += hit * (int32_t)(t - pendT[j]);
+      pend[j] &= 1 - hit;
+      nsq[j] += w * ((g - level) * (g - level));
+    }
+    if (fl & F_DEADLINE) {
+      for (size_t j = 0; j < nl; ++j) {
+        uns[j] += pend[j];
+        settle[j] += pend[j] * (int32_t)(t - pendT[j]);
+        pend[j] = 0;
+      }
+    }
+    if ((k + 1) % NOISE_FLUSH == 0 || k + 1 == n) {
+      for (size_t j = 0; j < nl; ++j) {
+        nsqD[j] += nsq[j];
+        nsq[j] = 0.0f;
+      }
+    }
+    if (g0) g0->push_back(iir[0]);
+    if (s0) s0->push_back((uint8_t)st[0]);
+  }
+  const size_t cfg0 = m * grid.lanes() + l0;
+  for (size_t j = 0; j < nl; ++j) {
+    out.settleMs[cfg0 + j] += settle[j];
+    out.unsettled[cfg0 + j] += uns[j];
+    out.falseMs[cfg0 + j] += fls[j];
+    out.noise[cfg0 + j] += llround(nsqD[j] / NOISE_UNIT);
+  }
+}
+
+// ---------- POOL CON ROBO DE TRABAJO ----------
+
+struct Task {
+  size_t trace, med, l0, l1;
+};
+
+// Una cola por hilo: el dueño saca por detrás y los demás roban por delante.
+// Las tareas no crean tareas, así que un hilo termina cuando no queda nada
+// en ninguna cola.
+class StealPool {
+public:
+  explicit StealPool(size_t threads) : queues_(threads ? threads : 1), steals_(0) {}
+
+  void run(const std::vector<Task>& tasks, std::function<void(size_t, const Task&)> fn) {
+    for (size_t i = 0; i < tasks.size(); ++i) queues_[i % queues_.size()].q.push_back(tasks[i]);
+    std::vector<std::thread> th;
+    for (size_t w = 1; w < queues_.size(); ++w) th.emplace_back([this, w, &fn] { work(w, fn); });
+    work(0, fn);
+    for (std::thread& x : th) x.join();
+  }
+
+  size_t steals() const { return steals_.load(); }
+
+private:
+  struct Queue {
+    std::mutex        mu;
+    std::deque<Task>  q;
+  };
+
+  bool take(size_t w, Task& t) {
+    {
+      Queue& own = queues_[w];
+      std::lock_guard<std::mutex> lk(own.mu);
+      if (!own.q.empty()) {
+        t = own.q.back();
+        own.q.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      Queue& v = queues_[(w + i) % queues_.size()];
+      std::lock_guard<std::mutex> lk(v.mu);
+      if (!v.q.empty()) {
+        t = v.q.front();
+        v.q.pop_front();
+        steals_++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(size_t w, std::function<void(size_t, const Task&)>& fn) {
+    Task t;
+    while (take(w, t)) fn(w, t);
+  }
+
+  std::vector<Queue>  queues_;
+  std::atomic<size_t> steals_;
+};
+
+// Toda la rejilla sobre todas las trazas.
+Totals sweep(const std::vector<Trace>& traces, const Grid& grid, size_t threads,
+             size_t* steals = nullptr) {
+  std::vector<Task> tasks;
+  for (size_t i = 0; i < traces.size(); ++i) {
+    for (size_t m = 0; m < grid.med.v.size(); ++m) {
+      for (size_t l = 0; l < grid.lanes(); l += LANE_BLOCK) {
+        tasks.push_back(Task{i, m, l, std::min(l + LANE_BLOCK, grid.lanes())});
+      }
+    }
+  }
+  StealPool pool(threads);
+  std::vector<Totals> part(threads ? threads : 1);
+  for (Totals& p : part) p.resize(grid.size());
+  pool.run(tasks, [&](size_t w, const Task& t) {
+    runBlock(traces[t.trace], grid, t.med, t.l0, t.l1, part[w]);
+  });
+  for (size_t w = 1; w < part.size(); ++w) part[0].add(part[w]);
+  if (steals) *steals = pool.steals();
+  return part[0];
+}
+
+// ---------- FRENTE DE PARETO ----------
+
+std::vector<Score> scores(const Totals& tot, const std::vector<Trace>& traces) {
+  size_t steps = 0, noiseN = 0;
+  for (const Trace& t : traces) {
+    steps += t.steps;
+    noiseN += t.noiseN;
+  }
+  std::vector<Score> s(tot.settleMs.size());
+  for (size_t i = 0; i < s.size(); ++i) {
+    s[i].cfg = i;
+    s[i].settleMs = steps ? (double)tot.settleMs[i] / (double)steps : 0.0;
+    s[i].falseMs = steps ? (double)tot.falseMs[i] / (double)steps : 0.0;
+    s[i].noiseG = noiseN ? sqrt((double)tot.noise[i] * NOISE_UNIT / (double)noiseN) : 0.0;
+    s[i].unsettled = (long)tot.unsettled[i];
+  }
+  return s;
+}
+
+bool dominates(const Score& a, const Score& b) {
+  return a.settleMs <= b.settleMs && a.noiseG <= b.noiseG && a.falseMs <= b.falseMs &&
+         (a.settleMs < b.settleMs || a.noiseG < b.noiseG || a.falseMs < b.falseMs);
+}
+
+// Ordenadas por asentamiento, ninguna domina a otra.
+std::vector<Score> paretoFront(std::vector<Score> s) {
+  std::sort(s.begin(), s.end(), [](const Score& a, const Score& b) {
+    if (a.settleMs != b.settleMs) return a.settleMs < b.settleMs;
+    if (a.noiseG != b.noiseG) return a.noiseG < b.noiseG;
+    return a.falseMs < b.falseMs;
+  });
+  std::vector<Score> front;
+  for (const Score& c : s) {
+    bool dom = false;
+    for (const Score& f : front) {
+      if (dominates(f, c) ||
+          (f.settleMs == c.settleMs && f.noiseG == c.noiseG && f.falseMs == c.falseMs)) {
+        dom = true;
+        break;
+      }
+    }
+    if (!dom) front.push_back(c);
+  }
+  return front;
+}
+
+void printScores(FILE* f, const Grid& grid, const std::vector<Score>& s) {
+  fprintf(f, "med_ms,tau_ms,th_g,stable_ms,settle_ms,noise_g,false_ms,unsettled,cmd\n");
+  for (const Score& x : s) {
+    const FilterTiming t = grid.timing(x.cfg);
+    fprintf(f, "%lu,%lu,%.2f,%lu,%.1f,%.4f,%.1f,%ld,FILT:%lu,%lu,%.2f,%lu\n",
+            (unsigned long)t.medianMs, (unsigned long)t.iirTauMs, (double)t.stableDeltaG,
+            (unsigned long)t.stableMs, x.settleMs, x.noiseG, x.falseMs, x.unsettled,
+            (unsigned long)t.medianMs, (unsigned long)t.iirTauMs, (double)t.stableDeltaG,
+            (unsigned long)t.stableMs);
+  }
+}
+
+// ---------- REJILLA ----------
+
+bool parseAxis(const char* s, Axis& a) {
+  float lo, hi, step;
+  if (sscanf(s, "%f:%f:%f", &lo, &hi, &step) != 3 || step <= 0.0f || hi < lo) return false;
+  a.v.clear();
+  for (int i = 0;; ++i) {
+    const float v = roundf((lo + (float)i * step) * 100.0f) / 100.0f;
+    if (v > hi + step * 1e-3f) break;
+    a.v.push_back(v);
+  }
+  return !a.v.empty();
+}
+
+void addValue(Axis& a, float v) {
+  if (std::find(a.v.begin(), a.v.end(), v) == a.v.end()) a.v.push_back(v);
+  std::sort(a.v.begin(), a.v.end());
+}
+
+Grid defaultGrid() {
+  Grid g;
+  parseAxis("60:600:60", g.med);
+  parseAxis("0:400:25", g.tau);
+  parseAxis("0.1:1.5:0.1", g.th);
+  parseAxis("100:1500:100", g.sms);
+  return g;
+}
+
+void addFirmware(Grid& g) {
+  addValue(g.med, (float)FIRMWARE_TIMING.medianMs);
+  addValue(g.tau, (float)FIRMWARE_TIMING.iirTauMs);
+  addValue(g.th, FIRMWARE_TIMING.stableDeltaG);
+  addValue(g.sms, (float)FIRMWARE_TIMING.stableMs);
+}
+
+// ---------- TRAZAS SINTÉTICAS ----------
+
+// Cocina simulada: cargas que se colocan con rebote amortiguado, ruido
+// gaussiano del HX711 y deriva lenta, a 80 SPS.
+Trace synthTrace(uint32_t seed, double seconds, float cal, float tolG, float minStepG) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0.0, 60.0);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  std::vector<uint32_t> us;
+  std::vector<long> raw;
+  double level = 0.0, from = 0.0, tStep = -10.0, nextStep = 3.0 + 4.0 * u(rng);
+  double ringHz = 5.0 + 5.0 * u(rng), ringG = 2.0, tauS = 0.05;
+  const uint32_t t0 = 1000000u + seed * 7919u;
+  for (double t = 0.0; t < seconds; t += 0.0125) {
+    if (t >= nextStep) {
+      from = level;
+      level = u(rng) < 0.3 ? 0.0 : 20.0 + 980.0 * u(rng);
+      tStep = t;
+      nextStep = t + 3.0 + 5.0 * u(rng);
+      ringHz = 4.0 + 8.0 * u(rng);
+      ringG = 0.5 + 0.02 * fabs(level - from);
+      tauS = 0.03 + 0.1 * u(rng);
+    }
+    const double s = t - tStep;
+    double g = level + (from - level) * exp(-s / tauS) +
+               ringG * exp(-s / 0.2) * sin(2.0 * M_PI * ringHz * s);
+    g += 0.02 * sin(t / 40.0);
+    us.push_back(t0 + (uint32_t)llround(t * 1e6) + (uint32_t)(u(rng) * 40.0));
+    raw.push_back(84210 + lround(g / cal + noise(rng)));
+  }
+  Trace tr;
+  tr.name = "sintética " + std::to_string(seed);
+  prepare(tr, us, raw, cal, tolG, minStepG);
+  return tr;
+}
+
+// ---------- PRUEBAS ----------
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "selftest: falla %s (línea %d)\n", #cond, __LINE__); \
+      return 1;                                                       \
+    }                                                                 \
+  } while (0)
+
+// Métricas de una configuración con Pipeline, sin carriles.
+void referenceScore(const Trace& tr, const FilterTiming& ft, float tol, int64_t& settle,
+                    int64_t& uns, int64_t& fls, double& noise, std::vector<float>& g,
+                    std::vector<uint8_t>& s) {
+  Pipeline p(filterParamsFor(ft, tr.stepMs));
+  p.setCalibration(tr.cal, tr.tare);
+  settle = uns = fls = 0;
+  noise = 0.0;
+  bool pend = false;
+  uint32_t pendT = 0;
+  for (size_t k = 0; k < tr.raw.size(); ++k) {
+    const PipelineOut& o = p.push(tr.raw[k], tr.tMs[k]);
+    g.push_back(o.grams);
+    s.push_back(o.stable);
+    if (tr.flags[k] & F_ONSET) {
+      uns += pend;
+      pend = true;
+      pendT = tr.tMs[k];
+    }
+    const float tgt = tr.target[k];
+    const bool good = fabsf(o.grams - tgt) <= tol;
+    if (o.stable && tgt == tgt && !good) fls += tr.dtMs[k];
+    if (tr.flags[k] & F_NOISE) noise += (double)(o.grams - tgt) * (o.grams - tgt);
+    if (pend && o.stable && good) {
+      settle += (int32_t)(tr.tMs[k] - pendT);
+      pend = false;
+    }
+    if ((tr.flags[k] & F_DEADLINE) && pend) {
+      uns++;
+      settle += (int32_t)(tr.tMs[k] - pendT);
+      pend = false;
+    }
+  }
+}
+
+int selftest() {
+  const float cal = 1.0f / 420.0f;
+  std::vector<Trace> traces;
+  for (uint32_t i = 0; i < 6; ++i) traces.push_back(synthTrace(i + 1, 40.0, cal, 0.5f, 5.0f));
+  for (const Trace& t : traces) CHECK(t.steps >= 3 && t.noiseN > 100 && t.stepMs == 25.0f);
+
+  // Carriles == Pipeline, muestra a muestra y en las métricas
+  Grid grid = defaultGrid();
+  addFirmware(grid);
+  grid.tol = 0.5f;
+  std::mt19937 rng(9);
+  for (int r = 0; r < 40; ++r) {
+    const size_t cfg = r == 0 ? grid.index(FIRMWARE_TIMING) : rng() % grid.size();
+    const Trace& tr = traces[r % traces.size()];
+    const size_t m = cfg / grid.lanes(), l = cfg % grid.lanes();
+    Totals one;
+    one.resize(grid.size());
+    std::vector<float> g;
+    std::vector<uint8_t> s;
+    runBlock(tr, grid, m, l, std::min(l + 7, grid.lanes()), one, &g, &s);
+    std::vector<float> rg;
+    std::vector<uint8_t> rs;
+    int64_t settle, uns, fls;
+    double noise;
+    referenceScore(tr, grid.timing(cfg), grid.tol, settle, uns, fls, noise, rg, rs);
+    CHECK(g == rg && s == rs);
+    CHECK(one.settleMs[cfg] == settle && one.unsettled[cfg] == uns && one.falseMs[cfg] == fls);
+    CHECK(fabs((double)one.noise[cfg] * NOISE_UNIT - noise) <= 1e-4 * noise + 1e-6);
+  }
+
+  // Paralelo == serie, con el robo de trabajo en marcha
+  Grid small;
+  parseAxis("100:500:100", small.med);
+  parseAxis("0:300:50", small.tau);
+  parseAxis("0.2:1.2:0.2", small.th);
+  parseAxis("200:1000:200", small.sms);
+  addFirmware(small);
+  small.tol = 0.5f;
+  size_t steals = 0;
+  const Totals serial = sweep(traces, small, 1);
+  const Totals par = sweep(traces, small, 4, &steals);
+  CHECK(serial == par);
+
+  // Frente: nadie lo domina y todo lo demás está dominado
+  const std::vector<Score> all = scores(serial, traces);
+  const std::vector<Score> front = paretoFront(all);
+  CHECK(!front.empty() && front.size() < all.size());
+  for (const Score& f : front) {
+    for (const Score& a : all) CHECK(!dominates(a, f));
+  }
+  std::vector<uint8_t> inFront(all.size(), 0);
+  for (const Score& f : front) inFront[f.cfg] = 1;
+  for (const Score& a : all) {
+    if (inFront[a.cfg]) continue;
+    bool covered = false;
+    for (const Score& f : front) {
+      covered = covered || dominates(f, a) ||
+                (f.settleMs == a.settleMs && f.noiseG == a.noiseG && f.falseMs == a.falseMs);
+    }
+    CHECK(covered);
+  }
+  const Score& fw = all[small.index(FIRMWARE_TIMING)];
+  printf("rejilla %zu configuraciones, frente %zu; fábrica: %.0f ms, %.4f g, %.0f ms falsos "
+         "(robos %zu)\n", all.size(), front.size(), fw.settleMs, fw.noiseG, fw.falseMs, steals);
+  printf("selftest OK\n");
+  return 0;
+}
+
+int bench(size_t threads) {
+  const float cal = 1.0f / 420.0f;
+  std::vector<Trace> traces;
+  for (uint32_t i = 0; i < 16; ++i) traces.push_back(synthTrace(100 + i, 60.0, cal, 0.5f, 5.0f));
+  size_t samples = 0;
+  for (const Trace& t : traces) samples += t.raw.size();
+  Grid grid = defaultGrid();
+  addFirmware(grid);
+  grid.tol = 0.5f;
+  printf("%zu trazas, %zu muestras del pipeline, %zu configuraciones\n", traces.size(), samples,
+         grid.size());
+
+  // Referencia: un Pipeline y sus métricas por configuración (muestra de 200)
+  auto t0 = std::chrono::steady_clock::now();
+  std::mt19937 rng(5);
+  size_t refSamples = 0;
+  for (int r = 0; r < 200; ++r) {
+    const Trace& tr = traces[r % traces.size()];
+    int64_t settle, uns, fls;
+    double noise;
+    std::vector<float> g;
+    std::vector<uint8_t> s;
+    referenceScore(tr, grid.timing(rng() % grid.size()), grid.tol, settle, uns, fls, noise, g, s);
+    refSamples += g.size();
+  }
+  const double refSecs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  const double refRate = (double)refSamples / refSecs;
+  printf("Pipeline por configuración   %12.3g conf·muestra/s\n", refRate);
+
+  size_t list[2] = {1, threads};
+  for (size_t i = 0; i < (threads > 1 ? 2u : 1u); ++i) {
+    t0 = std::chrono::steady_clock::now();
+    const Totals tot = sweep(traces, grid, list[i]);
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    const double rate = (double)grid.size() * (double)samples / secs;
+    printf("carriles, %2zu hilo(s)          %12.3g conf·muestra/s  (%.2f s, x%.0f)\n", list[i],
+           rate, secs, rate / refRate);
+    if (i == 0) {
+      const std::vector<Score> front = paretoFront(scores(tot, traces));
+      printf("frente de Pareto: %zu de %zu configuraciones\n", front.size(), grid.size());
+    }
+  }
+  return 0;
+}
+
+void usage() {
+  fprintf(stderr,
+          "uso: filter_sweep --cal <g/cuenta> [--med a:b:paso] [--tau a:b:paso] [--th a:b:paso]\n"
+          "                  [--sms a:b:paso] [--tol g] [--min-step g] [--threads N]\n"
+          "                  [--all todo.csv] traza.txt|directorio ...\n"
+          "     filter_sweep --selftest\n"
+          "     filter_sweep --bench [--threads N]\n");
+}
+
+// Ficheros de un directorio (sin recursión) o el propio fichero.
+void collect(const std::string& path, std::vector<std::string>& out) {
+  struct stat sb;
+  if (stat(path.c_str(), &sb) != 0) return;
+  if (!S_ISDIR(sb.st_mode)) {
+    out.push_back(path);
+    return;
+  }
+  DIR* d = opendir(path.c_str());
+  if (!d) return;
+  std::vector<std::string> names;
+  while (dirent* e = readdir(d)) {
+    if (e->d_name[0] != '.') names.push_back(path + "/" + e->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  out.insert(out.end(), names.begin(), names.end());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Grid grid = defaultGrid();
+  float cal = 0.0f, tolG = 0.5f, minStepG = 5.0f;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  const char* allPath = nullptr;
+  bool doBench = false, doSelftest = false;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    auto val = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    bool ok = true;
+    if (a == "--selftest") doSelftest = true;
+    else if (a == "--bench") doBench = true;
+    else if (a == "--cal") cal = strtof(val(), nullptr);
+    else if (a == "--tol") tolG = strtof(val(), nullptr);
+    else if (a == "--min-step") minStepG = strtof(val(), nullptr);
+    else if (a == "--threads") threads = strtoul(val(), nullptr, 10);
+    else if (a == "--all") allPath = val();
+    else if (a == "--med") ok = parseAxis(val(), grid.med);
+    else if (a == "--tau") ok = parseAxis(val(), grid.tau);
+    else if (a == "--th") ok = parseAxis(val(), grid.th);
+    else if (a == "--sms") ok = parseAxis(val(), grid.sms);
+    else if (a[0] != '-') collect(a, paths);
+    else ok = false;
+    if (!ok) {
+      usage();
+      return 2;
+    }
+  }
+  if (threads == 0) threads = 1;
+  if (doSelftest) return selftest();
+  if (doBench) return bench(threads);
+  if (paths.empty() || !(cal != 0.0f) || !(tolG > 0.0f)) {
+    usage();
+    return 2;
+  }
+  addFirmware(grid);
+  grid.tol = tolG;
+  for (float th : grid.th.v) {
+    if (!(th >= 0.05f && th <= 50.0f)) {
+      fprintf(stderr, "filter_sweep: umbral %.2f g fuera de FILT: (0.05-50)\n", (double)th);
+      return 2;
+    }
+  }
+
+  std::vector<Trace> traces;
+  size_t samples = 0, steps = 0;
+  for (const std::string& p : paths) {
+    Trace t;
+    if (!loadTrace(p, cal, tolG, minStepG, t)) {
+      fprintf(stderr, "filter_sweep: %s: sin filas TR: suficientes, se ignora\n", p.c_str());
+      continue;
+    }
+    samples += t.raw.size();
+    steps += t.steps;
+    traces.push_back(std::move(t));
+  }
+  if (traces.empty() || steps == 0) {
+    fprintf(stderr, "filter_sweep: no hay escalones de %.1f g o más en las trazas\n",
+            (double)minStepG);
+    return 1;
+  }
+  const auto t0 = std::chrono::steady_clock::now();
+  size_t steals = 0;
+  const Totals tot = sweep(traces, grid, threads, &steals);
+  const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  const std::vector<Score> all = scores(tot, traces);
+  const std::vector<Score> front = paretoFront(all);
+  fprintf(stderr,
+          "%zu trazas, %zu muestras, %zu escalones; %zu configuraciones en %.2f s con %zu "
+          "hilo(s) (%.3g conf·muestra/s, %zu robos)\n",
+          traces.size(), samples, steps, grid.size(), secs, threads,
+          (double)grid.size() * (double)samples / secs, steals);
+  const Score& fw = all[grid.index(FIRMWARE_TIMING)];
+  fprintf(stderr, "fábrica FILT:375,112,1.00,700: %.0f ms, %.4f g, %.0f ms falsos, %ld sin asentar\n",
+          fw.settleMs, fw.noiseG, fw.falseMs, fw.unsettled);
+  printScores(stdout, grid, front);
+  if (allPath) {
+    FILE* f = fopen(allPath, "w");
+    if (!f) {
+      fprintf(stderr, "filter_sweep: no se puede escribir %s\n", allPath);
+      return 1;
+    }
+    printScores(f, grid, all);
+    fclose(f);
+  }
+  return 0;
+}
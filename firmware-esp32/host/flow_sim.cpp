@@ -0,0 +1,430 @@
+// firmware-esp32/host/flow_sim.cpp
+//
+// Simulación del enlace báscula -> Pi para medir el retraso de lo que ve la
+// interfaz con y sin control de flujo por créditos (flow_credit.h).
+//
+//   flow_sim [--stall 2000] [--every 5000] [--window 16] [--poll 20]
+//            [--kbuf 4096] [--seconds 60]     tabla con FC apagado y encendido
+//   flow_sim --selftest                       cotas del retraso (make check)
+//
+// Modelo, en pasos de 250 µs:
+// - firmware: HX711 a 80 SPS y trama cada 2 conversiones (40 Hz), con el
+//   CreditGate real; los comandos se atienden en cada conversión como en la
+//   tarea acq. El peso de cada trama es su instante de generación en ms, así
+//   que la edad de lo que lee el host sale directamente.
+// - UART a 115200 baudios (11,52 B/ms) en los dos sentidos y buffer de
+//   lectura del tty en la Pi (n_tty: 4096 B; lo que no cabe se pierde).
+// - host: SerialScaleBackend.read() de bascula/services/scale.py (readline
+//   con espera, vaciado de lo pendiente y la misma política de renovación)
+//   cada poll_interval_s, con parones periódicos (captura de cámara,
+//   llamadas a la IA) en los que no lee.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "flow_credit.h"
+
+using namespace bascula;
+
+namespace {
+
+const uint32_t TICK_US   = 250;
+const uint32_t CONV_US   = 12500;  // 80 SPS
+const int      DECIM     = 2;      // trama a 40 Hz (LOOP_HZ 50)
+const double   UART_BPUS = 115200.0 / 10.0 / 1e6;
+const uint32_t TIMEOUT_US = 50000;  // serial_timeout_s
+const int      FRESH_READS = 3;     // FLOW_FRESH_READS
+const uint32_t REGRANT_US = 1000000;  // FLOW_REGRANT_S
+
+struct SimOpts {
+  bool     fc = true;
+  uint16_t window = 16;
+  uint32_t pollMs = 20;
+  uint32_t stallMs = 2000;
+  uint32_t everyMs = 5000;
+  size_t   kbuf = 4096;
+  uint32_t seconds = 60;
+};
+
+struct SimResult {
+  size_t   reads = 0;        // pesos entregados a la interfaz
+  double   meanAgeMs = 0.0;  // fuera de los parones
+  double   maxAgeMs = 0.0;
+  double   firstMaxMs = 0.0;  // primera lectura tras cada parón
+  double   firstMeanMs = 0.0;
+  double   recoverMaxMs = 0.0;  // desde el fin del parón hasta edad < 100 ms
+  size_t   stalls = 0;
+  size_t   lostBytes = 0;    // desbordamiento del tty
+  uint32_t skipped = 0;      // tramas sustituidas en el firmware
+  size_t   grants = 0;
+};
+
+// Cola de bytes con transmisión a velocidad de UART.
+struct Wire {
+  std::deque<char> q;
+  double           credit = 0.0;
+};
+
+class Sim {
+public:
+  explicit Sim(const SimOpts& o) : o_(o) {}
+
+  SimResult run() {
+    const uint64_t endUs = (uint64_t)o_.seconds * 1000000u;
+    if (o_.fc) grant(0);
+    for (uint64_t t = 0; t < endUs; t += TICK_US) {
+      firmware(t);
+      uart(t);
+      host(t);
+    }
+    r_.skipped = gate_.skipped();
+    if (r_.reads > firstCount_) r_.meanAgeMs = ageSum_ / (double)(r_.reads - firstCount_);
+    if (firstCount_) r_.firstMeanMs = firstSum_ / (double)firstCount_;
+    return r_;
+  }
+
+private:
+  enum Phase { IDLE, FIRST, DRAIN, FRESH };
+
+  // ---- firmware ----
+  void firmware(uint64_t t) {
+    if (t < nextConvUs_) return;
+    nextConvUs_ += CONV_US;
+    const uint32_t nowMs = (uint32_t)(t / 1000u);
+    while (!cmds_.empty() && cmds_.front().first <= t) {
+      const std::string& c = cmds_.front().second;
+      gate_.grant((uint16_t)atoi(c.c_str() + 3), nowMs);
+      if (const char* held = gate_.takeHeld()) send(held);
+      cmds_.pop_front();
+    }
+    gate_.expired(nowMs);
+    if (++decim_ < DECIM) return;
+    decim_ = 0;
+    char out[32];
+    snprintf(out, sizeof(out), "G:%.2f,S:1", t / 1000.0);
+    if (gate_.offer(out)) send(out);
+  }
+
+  void send(const char* line) {
+    tx_.q.insert(tx_.q.end(), line, line + strlen(line));
+    tx_.q.push_back('\r');
+    tx_.q.push_back('\n');
+  }
+
+  // ---- UART y tty de la Pi ----
+  void uart(uint64_t) {
+    tx_.credit += UART_BPUS * TICK_US;
+    while (tx_.credit >= 1.0 && !tx_.q.empty()) {
+      if (kbuf_.size() < o_.kbuf) {
+        kbuf_.push_back(tx_.q.front());
+      } else {
+        r_.lostBytes++;
+      }
+      tx_.q.pop_front();
+      tx_.credit -= 1.0;
+    }
+    if (tx_.q.empty()) tx_.credit = std::min(tx_.credit, 1.0);
+  }
+
+  // readline(): una línea completa del tty, si la hay.
+  bool readline(std::string& line) {
+    auto nl = std::find(kbuf_.begin(), kbuf_.end(), '\n');
+    if (nl == kbuf_.end()) return false;
+    line.assign(kbuf_.begin(), nl);
+    kbuf_.erase(kbuf_.begin(), nl + 1);
+    return true;
+  }
+
+  // El comando llega tras su tiempo en la línea y medio ms del driver.
+  void grant(uint64_t t) {
+    char c[16];
+    int n = snprintf(c, sizeof(c), "FC:%u", (unsigned)o_.window);
+    cmds_.push_back({t + 500u + (uint64_t)((n + 1) / UART_BPUS), std::string(c)});
+    flowFrames_ = 0;
+    grantUs_ = t;
+    r_.grants++;
+  }
+
+  // ---- host ----
+  bool busy(uint64_t t, uint64_t& endUs) const {
+    const uint64_t every = (uint64_t)o_.everyMs * 1000u;
+    const uint64_t stall = (uint64_t)o_.stallMs * 1000u;
+    if (!stall || !every) return false;
+    const uint64_t start = (t / every) * every + every / 2;
+    if (t >= start && t < start + stall) {
+      endUs = start + stall;
+      return true;
+    }
+    return false;
+  }
+
+  void host(uint64_t t) {
+    std::string line;
+    switch (phase_) {
+      case IDLE: {
+        if (t < nextPollUs_) return;
+        uint64_t endUs;
+        if (busy(t, endUs)) {
+          nextPollUs_ = endUs;
+          if (!inStall_) r_.stalls++;
+          inStall_ = true;
+          stallEndUs_ = endUs;
+          return;
+        }
+        lines_.clear();
+        phase_ = FIRST;
+        deadlineUs_ = t + TIMEOUT_US;
+      }
+      // fallthrough
+      case FIRST:
+        if (readline(line)) {
+          lines_.push_back(line);
+          phase_ = DRAIN;
+          drained_ = 0;
+        } else if (t >= deadlineUs_) {
+          finish(t, -1.0);
+        }
+        return;
+      case DRAIN: {
+        const int limit = std::max(10, o_.fc ? o_.window + 2 : 0);
+        while (!kbuf_.empty() && drained_ < limit && readline(line)) {
+          lines_.push_back(line);
+          drained_++;
+        }
+        // Con bytes pendientes sin fin de línea, readline espera a que llegue
+        if (!kbuf_.empty() && drained_ < limit &&
+            std::find(kbuf_.begin(), kbuf_.end(), '\n') == kbuf_.end()) {
+          return;
+        }
+        process(t);
+        return;
+      }
+      case FRESH:
+        if (readline(line)) {
+          double g = weight(line);
+          if (g >= 0.0) {
+            flowFrames_++;
+            finish(t, g);
+          } else if (++freshTries_ >= FRESH_READS) {
+            finish(t, staleLatest_);
+          }
+        } else if (t >= deadlineUs_) {
+          finish(t, staleLatest_);
+        }
+        return;
+    }
+  }
+
+  static double weight(const std::string& line) {
+    double g;
+    int s;
+    return sscanf(line.c_str(), "G:%lf,S:%d", &g, &s) == 2 ? g : -1.0;
+  }
+
+  // Igual que SerialScaleBackend.read() + _update_flow().
+  void process(uint64_t t) {
+    double latest = -1.0;
+    int frames = 0;
+    for (const std::string& l : lines_) {
+      double g = weight(l);
+      if (g >= 0.0) {
+        latest = g;
+        frames++;
+      }
+    }
+    if (!o_.fc) {
+      finish(t, latest);
+      return;
+    }
+    flowFrames_ += frames;
+    const bool stalled = flowFrames_ >= o_.window;
+    if (!(stalled || 2 * flowFrames_ >= o_.window || t - grantUs_ >= REGRANT_US)) {
+      finish(t, latest);
+      return;
+    }
+    grant(t);
+    if (!stalled) {
+      finish(t, latest);
+      return;
+    }
+    staleLatest_ = latest;
+    freshTries_ = 0;
+    deadlineUs_ = t + TIMEOUT_US;
+    phase_ = FRESH;
+  }
+
+  void finish(uint64_t t, double grams) {
+    phase_ = IDLE;
+    nextPollUs_ = t + (uint64_t)o_.pollMs * 1000u;
+    if (grams < 0.0) return;
+    const double age = t / 1000.0 - grams;
+    r_.reads++;
+    r_.maxAgeMs = std::max(r_.maxAgeMs, age);
+    if (inStall_) {
+      inStall_ = false;
+      recovering_ = true;
+      firstCount_++;
+      firstSum_ += age;
+      r_.firstMaxMs = std::max(r_.firstMaxMs, age);
+    } else {
+      ageSum_ += age;
+    }
+    if (recovering_ && age < 100.0) {
+      recovering_ = false;
+      r_.recoverMaxMs = std::max(r_.recoverMaxMs, (t - stallEndUs_) / 1000.0);
+    }
+  }
+
+  SimOpts    o_;
+  SimResult  r_;
+  CreditGate gate_;
+  uint64_t   nextConvUs_ = 0;
+  int        decim_ = 0;
+  std::deque<std::pair<uint64_t, std::string>> cmds_;
+  Wire       tx_;
+  std::deque<char> kbuf_;
+  Phase      phase_ = IDLE;
+  uint64_t   nextPollUs_ = 0;
+  uint64_t   deadlineUs_ = 0;
+  std::vector<std::string> lines_;
+  int        drained_ = 0;
+  int        flowFrames_ = 0;
+  uint64_t   grantUs_ = 0;
+  double     staleLatest_ = -1.0;
+  int        freshTries_ = 0;
+  bool       inStall_ = false;
+  bool       recovering_ = false;
+  uint64_t   stallEndUs_ = 0;
+  size_t     firstCount_ = 0;
+  double     firstSum_ = 0.0;
+  double     ageSum_ = 0.0;
+};
+
+void printRow(const char* name, const SimResult& r) {
+  printf("%-8s %7.1f %9.0f %9.0f %9.0f %10.0f %8zu %6u %7zu\n", name, r.meanAgeMs,
+         r.firstMeanMs, r.firstMaxMs, r.maxAgeMs, r.recoverMaxMs, r.lostBytes,
+         (unsigned)r.skipped, r.grants);
+}
+
+int report(SimOpts o) {
+  printf("parón de %u ms cada %u ms, lectura cada %u ms, tty %zu B, ventana %u, %u s\n",
+         (unsigned)o.stallMs, (unsigned)o.everyMs, (unsigned)o.pollMs, o.kbuf,
+         (unsigned)o.window, (unsigned)o.seconds);
+  printf("%-8s %7s %9s %9s %9s %10s %8s %6s %7s\n", "FC", "edad_ms", "1ª_media",
+         "1ª_máx", "máx_ms", "recup_ms", "perdidos", "SK", "FC:<n>");
+  o.fc = false;
+  printRow("apagado", Sim(o).run());
+  o.fc = true;
+  printRow("créditos", Sim(o).run());
+  return 0;
+}
+
+#define CHECK(c)                                                              \
+  do {                                                                        \
+    if (!(c)) {                                                               \
+      fprintf(stderr, "selftest: falla %s (línea %d)\n", #c, __LINE__);      \
+      return 1;                                                               \
+    }                                                                         \
+  } while (0)
+
+int selftest() {
+  {
+    // Lector al día: sin parones no se retiene nada y la edad no cambia
+    SimOpts o;
+    o.stallMs = 0;
+    o.seconds = 20;
+    o.fc = false;
+    SimResult off = Sim(o).run();
+    o.fc = true;
+    SimResult on = Sim(o).run();
+    CHECK(off.reads > 400 && on.reads > 400);
+    CHECK(on.skipped == 0 && on.lostBytes == 0);
+    CHECK(on.maxAgeMs < 60.0 && fabs(on.meanAgeMs - off.meanAgeMs) < 5.0);
+  }
+  {
+    // Parón de 2 s: sin créditos se muestran pesos viejos; con créditos lo
+    // primero que llega es actual
+    SimOpts o;
+    o.fc = false;
+    SimResult off = Sim(o).run();
+    o.fc = true;
+    SimResult on = Sim(o).run();
+    CHECK(off.stalls >= 10 && on.stalls == off.stalls);
+    CHECK(off.firstMaxMs > 1500.0 && off.recoverMaxMs > 100.0);
+    CHECK(on.firstMaxMs < 60.0 && on.recoverMaxMs < 60.0);
+    CHECK(on.skipped > 0 && on.lostBytes == 0);
+    printf("parón de 2 s: primera lectura con %.0f ms de retraso sin créditos, "
+           "%.0f ms con créditos\n", off.firstMaxMs, on.firstMaxMs);
+  }
+  {
+    // Parón más largo que lo que cabe en el tty: sin créditos se pierden
+    // bytes (tramas rotas); con créditos no
+    SimOpts o;
+    o.stallMs = 8000;
+    o.everyMs = 20000;
+    o.fc = false;
+    SimResult off = Sim(o).run();
+    o.fc = true;
+    SimResult on = Sim(o).run();
+    CHECK(off.lostBytes > 0 && on.lostBytes == 0);
+    CHECK(on.firstMaxMs < 60.0);
+  }
+  {
+    // Parón más largo que la concesión: el firmware vuelve al envío libre y
+    // el host se recupera igual que sin créditos, y vuelve a conceder
+    SimOpts o;
+    o.stallMs = 35000;
+    o.everyMs = 60000;
+    o.seconds = 70;
+    o.fc = true;
+    SimResult on = Sim(o).run();
+    CHECK(on.stalls == 1 && on.recoverMaxMs > 0.0 && on.recoverMaxMs < 5000.0);
+  }
+  printf("selftest OK\n");
+  return 0;
+}
+
+void usage() {
+  fprintf(stderr,
+          "uso: flow_sim [--stall ms] [--every ms] [--window n] [--poll ms]\n"
+          "              [--kbuf bytes] [--seconds s]\n"
+          "     flow_sim --selftest\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  SimOpts o;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    auto val = [&]() -> unsigned long {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return strtoul(argv[++i], nullptr, 10);
+    };
+    if (a == "--selftest") return selftest();
+    else if (a == "--stall") o.stallMs = (uint32_t)val();
+    else if (a == "--every") o.everyMs = (uint32_t)val();
+    else if (a == "--window") o.window = (uint16_t)std::min(val(), (unsigned long)FC_CREDIT_MAX);
+    else if (a == "--poll") o.pollMs = (uint32_t)val();
+    else if (a == "--kbuf") o.kbuf = (size_t)val();
+    else if (a == "--seconds") o.seconds = (uint32_t)val();
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (o.window == 0 || o.pollMs == 0 || o.seconds == 0) {
+    usage();
+    return 2;
+  }
+  return report(o);
+}
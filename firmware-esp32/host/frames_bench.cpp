@@ -0,0 +1,365 @@
+// firmware-esp32/host/frames_bench.cpp
+//
+// Pruebas y banco de bascula_frames (el decodificador en flujo con ABI C).
+//
+//   frames_bench --selftest                 trozos, resincronización y binario
+//   frames_bench --bench [--lines N]        líneas/s con un flujo sintético
+//   frames_bench captura.bin [--chunk B]    líneas/s y recuento sobre una captura
+//
+// Una captura es lo que sale del puerto tal cual, p. ej.
+//   stty -F /dev/serial0 115200 raw && timeout 60 cat /dev/serial0 > captura.bin
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bascula_frames.h"
+#include "bulk_codec.h"
+
+using namespace bascula;
+
+namespace {
+
+typedef std::vector<bascula_frame> Frames;
+
+// Decodifica data en trozos de `chunk` bytes con como mucho `maxOut` tramas
+// por llamada (si out se llena, se vuelve a llamar con el resto).
+Frames decode(bascula_frames* d, const std::vector<uint8_t>& data, size_t chunk,
+              size_t maxOut) {
+  Frames all;
+  std::vector<bascula_frame> out(maxOut);
+  for (size_t at = 0; at < data.size();) {
+    const size_t n = std::min(chunk, data.size() - at);
+    size_t used = 0;
+    const size_t k = bascula_frames_feed(d, data.data() + at, n, out.data(), maxOut, &used);
+    all.insert(all.end(), out.begin(), out.begin() + k);
+    at += used;
+  }
+  // Filas binarias que no cupieron en la última llamada
+  size_t k;
+  while ((k = bascula_frames_feed(d, nullptr, 0, out.data(), maxOut, nullptr)) > 0) {
+    all.insert(all.end(), out.begin(), out.begin() + k);
+  }
+  return all;
+}
+
+Frames decodeNew(const std::vector<uint8_t>& data, uint32_t options, size_t chunk,
+                 size_t maxOut, bascula_frames_stats* st = nullptr) {
+  bascula_frames* d = bascula_frames_new(options);
+  Frames f = decode(d, data, chunk, maxOut);
+  if (st) bascula_frames_get_stats(d, st);
+  bascula_frames_free(d);
+  return f;
+}
+
+bool sameFrames(const Frames& a, const Frames& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (memcmp(&a[i], &b[i], sizeof(bascula_frame)) != 0) return false;
+  }
+  return true;
+}
+
+void append(std::vector<uint8_t>& v, const char* s) { v.insert(v.end(), s, s + strlen(s)); }
+
+// Una trama de traza con `rows` filas (µs, crudo).
+std::vector<uint8_t> traceFrame(uint16_t seq, size_t rows, std::vector<int32_t>& raws) {
+  DeltaFrameWriter<BULK_TRACE_COLS> w;
+  w.begin(BULK_TRACE, seq);
+  for (size_t i = 0; i < rows; ++i) {
+    const int32_t r = 84210 + (int32_t)(i * 37 % 211) - 100;
+    const int32_t row[BULK_TRACE_COLS] = {(int32_t)(12500 * i), r};
+    if (!w.put(row)) break;
+    raws.push_back(r);
+  }
+  std::vector<uint8_t> out(BULK_WIRE_MAX);
+  out.resize(w.finish(out.data()));
+  return out;
+}
+
+// Flujo típico: tramas a 50 Hz con los campos opcionales, respuestas y
+// eventos de vez en cuando.
+std::vector<uint8_t> makeStream(size_t lines, uint32_t seed, size_t* weights) {
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> s;
+  char buf[128];
+  double g = 0.0;
+  size_t w = 0;
+  for (size_t i = 0; i < lines; ++i) {
+    const unsigned r = rng() % 100;
+    if (r < 90) {
+      g += ((int)(rng() % 2001) - 1000) / 100.0;
+      const int stable = (rng() % 3) != 0;
+      if (r < 70) snprintf(buf, sizeof(buf), "G:%.2f,S:%d\r\n", g, stable);
+      else if (r < 80) snprintf(buf, sizeof(buf), "G:%.2f,S:%d,PK:%.2f,PM:%.2f\r\n", g, stable, g + 3.0, g - 1.5);
+      else snprintf(buf, sizeof(buf), "G:%.2f,S:%d,B:%d\r\n", g, stable, (int)(rng() % 200000) - 100000);
+      w++;
+    } else if (r < 94) {
+      snprintf(buf, sizeof(buf), "ACK:FILT:%u,%u,%.2f,%u\r\n", 5u, 200u, 0.50, 300u);
+    } else if (r < 96) {
+      snprintf(buf, sizeof(buf), "ERR:UNKNOWN_CMD\r\n");
+    } else if (r < 98) {
+      snprintf(buf, sizeof(buf), "EVT:OVERLOAD,R:%d,G:%.1f,N:%u,MS:%u\r\n", 8300000, g, 3u, (unsigned)i * 20);
+    } else {
+      snprintf(buf, sizeof(buf), "RATE:SPS:%.2f,P:%u,D:%u,N:%u,A:%.3f,HZ:%.1f,M:%d\r\n", 80.1, 12484u, 2u, 2u, 0.5, 40.0, 1);
+    }
+    append(s, buf);
+  }
+  if (weights) *weights = w;
+  return s;
+}
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "selftest: falla %s (línea %d)\n", #cond, __LINE__); \
+      return 1;                                                       \
+    }                                                                 \
+  } while (0)
+
+int selftest() {
+  CHECK(bascula_frames_abi() == BASCULA_FRAMES_ABI);
+  static_assert(sizeof(bascula_frame) == 224, "la ABI fija el tamaño de bascula_frame");
+  CHECK(strcmp(bascula_frames_probe_keys(), "RVMNIDT") == 0);
+
+  // Campos de la trama de peso y tipos de línea
+  {
+    std::vector<uint8_t> s;
+    append(s, "G:12.50,S:1\r\n");
+    append(s, "G: -0.25 , S:0,PK:300.00,PM:-2.10,B:-123456,OL:1,XX:9\n");
+    append(s, "ACK:T\r\n");
+    append(s, "err:unknown_cmd\r\n");
+    append(s, "EVT:CHECK,C:ok,S:1,G:500.00,MS:1234\r\n");  // G: como campo: una línea
+    append(s, "HELLO:ESP32-HX711,ST:OK,SPS:80.0,NOISE:1.2\r\n");
+    append(s, "hola\r\n\r\n   \r\n");
+    append(s, "G:250.004,S:1,RES:0.0048\r\nG:1.00,S:0,RES:x\r\nREFINE:ON\r\n");
+    Frames f = decodeNew(s, 0, s.size(), 64);
+    CHECK(f.size() == 10);
+    CHECK(f[0].kind == BASCULA_FRAME_WEIGHT && f[0].grams == 12.5 &&
+          f[0].flags == BASCULA_FRAME_STABLE && strcmp(f[0].text, "G:12.50,S:1") == 0);
+    CHECK(f[1].kind == BASCULA_FRAME_WEIGHT && f[1].grams == -0.25 && f[1].peak == 300.0 &&
+          f[1].minimum == -2.1 && f[1].chb == -123456 &&
+          f[1].flags == (BASCULA_FRAME_OVERLOAD | BASCULA_FRAME_PEAK | BASCULA_FRAME_CHB));
+    CHECK(f[2].kind == BASCULA_FRAME_ACK && strcmp(f[2].text, "ACK:T") == 0);
+    CHECK(f[3].kind == BASCULA_FRAME_ERR);
+    CHECK(f[4].kind == BASCULA_FRAME_EVENT);
+    CHECK(f[5].kind == BASCULA_FRAME_INFO);
+    CHECK(f[6].kind == BASCULA_FRAME_TEXT && strcmp(f[6].text, "hola") == 0);
+    CHECK(f[7].kind == BASCULA_FRAME_WEIGHT && f[7].grams == 250.004 &&
+          f[7].resolution == 0.0048 &&
+          f[7].flags == (BASCULA_FRAME_STABLE | BASCULA_FRAME_RES));
+    CHECK(f[8].kind == BASCULA_FRAME_WEIGHT && f[8].flags == 0 && f[8].resolution == 0.0);
+    CHECK(f[9].kind == BASCULA_FRAME_INFO);
+  }
+
+  // Sondas: campos en cualquier orden, los desconocidos o mal formados se saltan
+  {
+    std::vector<uint8_t> s;
+    append(s, "G:1.00,S:1\r\nPRB:R:8400123,N:-45,I:-0.1071,T:350\r\n");
+    append(s, "PRB:D:0.0042,XX:1,V:abc,M:8400100\r\nPRB:\r\n");
+    Frames f = decodeNew(s, 0, s.size(), 64);
+    CHECK(f.size() == 4 && f[0].kind == BASCULA_FRAME_WEIGHT);
+    CHECK(f[1].kind == BASCULA_FRAME_PROBE && f[1].probe_mask == 0x59 &&
+          f[1].probe[0] == 8400123.0 && f[1].probe[3] == -45.0 && f[1].probe[4] == -0.1071 &&
+          f[1].probe[6] == 350.0 && f[1].probe[1] == 0.0);
+    CHECK(f[2].kind == BASCULA_FRAME_PROBE && f[2].probe_mask == 0x24 &&
+          f[2].probe[5] == 0.0042 && f[2].probe[2] == 8400100.0);
+    CHECK(f[3].kind == BASCULA_FRAME_PROBE && f[3].probe_mask == 0);
+  }
+
+  // Resincronización: tramas pegadas, ruido delante, línea larga, mal formada
+  {
+    std::vector<uint8_t> s;
+    append(s, "G:1.00,S:1G:2.00,S:0\r\n");
+    append(s, "\x01xxG:3.00,S:1\r\n");
+    s.insert(s.end(), 400, 'x');
+    append(s, "\r\nG:4.00,S:1\r\n");
+    append(s, "G:abc,S:1\r\nG:5.00\r\nG:6.00,S:2\r\n");
+    bascula_frames_stats st;
+    Frames f = decodeNew(s, 0, s.size(), 64, &st);
+    CHECK(f.size() == 8);
+    CHECK(f[0].grams == 1.0 && f[1].grams == 2.0 && f[1].kind == BASCULA_FRAME_WEIGHT);
+    CHECK(f[2].kind == BASCULA_FRAME_TEXT && f[3].grams == 3.0);
+    CHECK(f[4].kind == BASCULA_FRAME_WEIGHT && f[4].grams == 4.0);
+    CHECK(f[5].kind == BASCULA_FRAME_TEXT && f[6].kind == BASCULA_FRAME_TEXT &&
+          f[7].kind == BASCULA_FRAME_TEXT);
+    CHECK(st.weights == 4 && st.bad == 3 && st.overflow == 1);
+  }
+
+  // Binario: sin la opción se salta la línea; con ella salen las filas
+  {
+    std::vector<int32_t> raws;
+    std::vector<uint8_t> s;
+    append(s, "G:7.00,S:1\r\n");
+    std::vector<uint8_t> a = traceFrame(3, 200, raws);
+    s.insert(s.end(), a.begin(), a.end());
+    append(s, "LOG:END,N:1,NEXT:2\r\n");
+    std::vector<uint8_t> bad = traceFrame(4, 10, raws);
+    bad[bad.size() / 2] = bad[bad.size() / 2] == 'Z' ? 'Y' : 'Z';
+    s.insert(s.end(), bad.begin(), bad.end());
+    append(s, "G:8.00,S:1\r\n");
+    raws.resize(raws.size() - 10);
+
+    bascula_frames_stats st;
+    Frames off = decodeNew(s, 0, s.size(), 64, &st);
+    CHECK(off.size() == 3 && st.binary == 2 && off[1].kind == BASCULA_FRAME_INFO);
+    Frames on = decodeNew(s, BASCULA_FRAMES_BULK, s.size(), 256, &st);
+    CHECK(on.size() == 3 + raws.size());
+    CHECK(st.bulk_frames == 1 && st.bulk_bad == 1);
+    for (size_t i = 0; i < raws.size(); ++i) {
+      const bascula_frame& r = on[1 + i];
+      CHECK(r.kind == BASCULA_FRAME_BULK && r.bulk_type == BULK_TRACE && r.bulk_seq == 3 &&
+            r.bulk_cols == 2 && r.row[0] == (int32_t)(12500 * i) && r.row[1] == raws[i]);
+    }
+    CHECK(on.back().grams == 8.0);
+    // Salida de una en una (las filas quedan pendientes entre llamadas)
+    CHECK(sameFrames(on, decodeNew(s, BASCULA_FRAMES_BULK, s.size(), 1)));
+  }
+
+  // El resultado no depende de cómo lleguen los bytes
+  {
+    std::vector<int32_t> raws;
+    std::vector<uint8_t> s = makeStream(3000, 5, nullptr);
+    std::vector<uint8_t> b = traceFrame(9, 100, raws);
+    s.insert(s.begin() + 5000, b.begin(), b.end());  // a mitad de una línea: ruido
+    append(s, "G:9.99,S:1");                          // sin fin de línea: no sale
+    for (uint32_t opt : {0u, (uint32_t)BASCULA_FRAMES_BULK}) {
+      Frames whole = decodeNew(s, opt, s.size(), 4096);
+      CHECK(!whole.empty() && whole.back().grams != 9.99);
+      CHECK(sameFrames(whole, decodeNew(s, opt, 1, 4096)));
+      CHECK(sameFrames(whole, decodeNew(s, opt, 7, 3)));
+      CHECK(sameFrames(whole, decodeNew(s, opt, 4096, 1)));
+      std::mt19937 rng(opt + 11);
+      bascula_frames* d = bascula_frames_new(opt);
+      Frames rnd;
+      std::vector<bascula_frame> out(8);
+      for (size_t at = 0; at < s.size();) {
+        size_t used = 0;
+        const size_t n = std::min<size_t>(1 + rng() % 300, s.size() - at);
+        const size_t k = bascula_frames_feed(d, s.data() + at, n, out.data(), 1 + rng() % 8, &used);
+        rnd.insert(rnd.end(), out.begin(), out.begin() + k);
+        at += used;
+      }
+      size_t k;
+      while ((k = bascula_frames_feed(d, nullptr, 0, out.data(), 8, nullptr)) > 0) {
+        rnd.insert(rnd.end(), out.begin(), out.begin() + k);
+      }
+      bascula_frames_free(d);
+      CHECK(sameFrames(whole, rnd));
+    }
+  }
+  printf("selftest OK\n");
+  return 0;
+}
+
+// Líneas/s decodificando `s` en trozos de `chunk` bytes (repetido ~0,3 s).
+double linesPerSec(const std::vector<uint8_t>& s, size_t chunk, uint64_t* lines) {
+  std::vector<bascula_frame> out(256);
+  bascula_frames* d = bascula_frames_new(BASCULA_FRAMES_BULK);
+  uint64_t frames = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  double secs = 0.0;
+  do {
+    for (size_t at = 0; at < s.size();) {
+      size_t used = 0;
+      frames += bascula_frames_feed(d, s.data() + at, std::min(chunk, s.size() - at), out.data(),
+                                    out.size(), &used);
+      at += used;
+    }
+    secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  } while (secs < 0.3);
+  bascula_frames_stats st;
+  bascula_frames_get_stats(d, &st);
+  bascula_frames_free(d);
+  if (lines) *lines = st.lines;
+  (void)frames;
+  return st.lines / secs;
+}
+
+int bench(size_t lines) {
+  size_t weights = 0;
+  std::vector<uint8_t> s = makeStream(lines, 1, &weights);
+  printf("%zu líneas (%zu tramas G:), %.1f B/línea\n", lines, weights,
+         (double)s.size() / (double)lines);
+  printf("%-10s %14s %12s\n", "trozo B", "líneas/s", "MB/s");
+  for (size_t chunk : {(size_t)16, (size_t)64, (size_t)4096}) {
+    const double lps = linesPerSec(s, chunk, nullptr);
+    printf("%-10zu %14.3g %12.1f\n", chunk, lps, lps * s.size() / lines / 1e6);
+  }
+  printf("(el enlace a 115200 baudios da ~%.0f líneas/s de este tamaño)\n",
+         11520.0 / ((double)s.size() / (double)lines));
+  return 0;
+}
+
+int capture(const char* path, size_t chunk) {
+  FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "frames_bench: no se puede leer %s\n", path);
+    return 2;
+  }
+  std::vector<uint8_t> s;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) s.insert(s.end(), buf, buf + n);
+  if (f != stdin) fclose(f);
+
+  bascula_frames_stats st;
+  Frames fr = decodeNew(s, BASCULA_FRAMES_BULK, chunk, 256, &st);
+  size_t kinds[16] = {0};
+  for (const bascula_frame& x : fr) kinds[x.kind & 15]++;
+  printf("%zu bytes, %llu líneas: G %zu, PRB %zu, ACK %zu, ERR %zu, EVT %zu, otras %zu, "
+         "texto %zu, filas binarias %zu\n",
+         s.size(), (unsigned long long)st.lines, kinds[BASCULA_FRAME_WEIGHT],
+         kinds[BASCULA_FRAME_PROBE], kinds[BASCULA_FRAME_ACK], kinds[BASCULA_FRAME_ERR],
+         kinds[BASCULA_FRAME_EVENT], kinds[BASCULA_FRAME_INFO], kinds[BASCULA_FRAME_TEXT],
+         kinds[BASCULA_FRAME_BULK]);
+  printf("mal formadas %llu, largas %llu, binarias %llu (%llu válidas, %llu dañadas)\n",
+         (unsigned long long)st.bad, (unsigned long long)st.overflow,
+         (unsigned long long)st.binary, (unsigned long long)st.bulk_frames,
+         (unsigned long long)st.bulk_bad);
+  if (st.lines > 0) printf("%.3g líneas/s en trozos de %zu B\n", linesPerSec(s, chunk, nullptr), chunk);
+  return 0;
+}
+
+void usage() {
+  fprintf(stderr,
+          "uso: frames_bench --selftest\n"
+          "     frames_bench --bench [--lines N]\n"
+          "     frames_bench <captura.bin | -> [--chunk B]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  size_t lines = 200000, chunk = 4096;
+  bool doBench = false, doSelftest = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    auto val = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    if (a == "--selftest") doSelftest = true;
+    else if (a == "--bench") doBench = true;
+    else if (a == "--lines") lines = strtoul(val(), nullptr, 10);
+    else if (a == "--chunk") chunk = strtoul(val(), nullptr, 10);
+    else if ((a == "-" || a[0] != '-') && !path) path = argv[i];
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (doSelftest) return selftest();
+  if (doBench) return bench(lines ? lines : 1);
+  if (path && chunk > 0) return capture(path, chunk);
+  usage();
+  return 2;
+}
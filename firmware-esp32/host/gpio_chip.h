@@ -0,0 +1,133 @@
+// firmware-esp32/host/gpio_chip.h
+//
+// Líneas DOUT/SCK del HX711 sobre el dispositivo de caracteres GPIO de Linux
+// (/dev/gpiochipN, uAPI v2), para leer la celda directamente desde la Pi sin
+// ESP32. Una sola petición de líneas: SCK como salida (arranca a 0) y DOUT
+// como entrada con flanco de bajada, de modo que la espera de DRDY duerme en
+// poll() en lugar de sondear.
+//
+// Misma interfaz que MockGpioChip (mock_gpio.h) para que Hx711Bus
+// (hx711_bus.h) se pruebe sin hardware: sck(), dout(), waitDoutLow(),
+// nowNs().
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+
+namespace bascula {
+namespace host {
+
+class GpioChip {
+public:
+  GpioChip() : fd_(-1) {}
+  ~GpioChip() { close(); }
+  GpioChip(const GpioChip&) = delete;
+  GpioChip& operator=(const GpioChip&) = delete;
+
+  // dout y sck son offsets de línea en el chip (en la Pi, números BCM).
+  bool open(const char* path, unsigned dout, unsigned sck, const char* consumer) {
+    close();
+    int chip = ::open(path, O_RDWR | O_CLOEXEC);
+    if (chip < 0) {
+      error_ = std::string(path) + ": " + strerror(errno);
+      return false;
+    }
+    gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[kSck] = sck;
+    req.offsets[kDout] = dout;
+    req.num_lines = 2;
+    strncpy(req.consumer, consumer, sizeof(req.consumer) - 1);
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    req.config.num_attrs = 2;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+    req.config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    req.config.attrs[0].mask = 1u << kSck;
+    req.config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[1].attr.values = 0;
+    req.config.attrs[1].mask = 1u << kSck;
+    int rc = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+    int err = errno;
+    ::close(chip);
+    if (rc < 0) {
+      error_ = std::string("GPIO_V2_GET_LINE: ") + strerror(err);
+      return false;
+    }
+    fd_ = req.fd;
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+    return true;
+  }
+
+  void close() {
+    if (fd_ < 0) return;
+    sck(false);  // SCK en alto > 60 µs apaga el HX711
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  bool               ok() const { return fd_ >= 0; }
+  const std::string& error() const { return error_; }
+
+  void sck(bool high) {
+    gpio_v2_line_values v;
+    v.bits = high ? 1u << kSck : 0;
+    v.mask = 1u << kSck;
+    ioctl(fd_, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+  }
+
+  bool dout() {
+    gpio_v2_line_values v;
+    v.bits = 0;
+    v.mask = 1u << kDout;
+    if (ioctl(fd_, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0) return true;
+    return (v.bits >> kDout) & 1u;
+  }
+
+  // Espera a que DOUT baje (conversión lista) como mucho timeoutUs. Los
+  // flancos acumulados durante la lectura anterior se descartan: lo que
+  // cuenta es el nivel.
+  bool waitDoutLow(uint32_t timeoutUs) {
+    const uint64_t deadline = nowNs() + (uint64_t)timeoutUs * 1000u;
+    for (;;) {
+      drainEvents();
+      if (!dout()) return true;
+      uint64_t now = nowNs();
+      if (now >= deadline) return false;
+      pollfd pf{fd_, POLLIN, 0};
+      int ms = (int)((deadline - now + 999999u) / 1000000u);
+      if (poll(&pf, 1, ms) < 0 && errno != EINTR) return false;
+    }
+  }
+
+  uint64_t nowNs() const {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+  }
+
+private:
+  static const unsigned kSck = 0;   // índice de la línea en la petición
+  static const unsigned kDout = 1;
+
+  void drainEvents() {
+    gpio_v2_line_event ev[8];
+    while (::read(fd_, ev, sizeof(ev)) > 0) {
+    }
+  }
+
+  int         fd_;
+  std::string error_;
+};
+
+}  // namespace host
+}  // namespace bascula
@@ -0,0 +1,67 @@
+// firmware-esp32/host/hx711_bus.h
+//
+// Lectura bit a bit del HX711 desde la Pi (sin ESP32), genérica sobre el
+// chip GPIO: GpioChip (gpio_chip.h) en la placa, MockGpioChip (mock_gpio.h)
+// en las pruebas.
+//
+// El HX711 se apaga si SCK pasa más de 60 µs en alto, y entonces la palabra
+// que se estaba leyendo sale corrupta sin ninguna señal de error. En Linux
+// una interrupción o un cambio de contexto en mitad de un pulso puede pasar
+// de ese límite aunque el hilo sea de tiempo real, así que cada pulso se
+// cronometra (cota superior: desde antes de subir hasta después de bajar) y
+// una lectura con algún pulso largo se descarta en lugar de entregarse.
+
+#pragma once
+
+#include <cstdint>
+
+namespace bascula {
+namespace host {
+
+static const uint32_t HX711_SCK_HIGH_MAX_NS = 50000;  // datasheet: 50 µs
+
+enum Hx711Result : uint8_t {
+  HX711_OK = 0,
+  HX711_TIMEOUT,  // DOUT no bajó a tiempo
+  HX711_TIMING,   // algún pulso de SCK demasiado largo: lectura descartada
+};
+
+template <class Chip>
+class Hx711Bus {
+public:
+  explicit Hx711Bus(Chip& chip) : chip_(chip), pulses_(25), worstHighNs_(0) {}
+
+  // 128 (canal A), 64 (canal A) o 32 (canal B): pulsos extra tras los 24
+  // bits, que fijan la ganancia de la siguiente conversión.
+  void setGain(int gain) { pulses_ = gain == 64 ? 27 : gain == 32 ? 26 : 25; }
+
+  Hx711Result read(long& raw, uint32_t timeoutUs) {
+    if (!chip_.waitDoutLow(timeoutUs)) return HX711_TIMEOUT;
+    uint32_t v = 0;
+    uint64_t worst = 0;
+    for (uint8_t i = 0; i < pulses_; ++i) {
+      const uint64_t t0 = chip_.nowNs();
+      chip_.sck(true);
+      const bool bit = i < 24 && chip_.dout();
+      chip_.sck(false);
+      const uint64_t dt = chip_.nowNs() - t0;
+      if (dt > worst) worst = dt;
+      if (i < 24) v = (v << 1) | (bit ? 1u : 0u);
+    }
+    worstHighNs_ = worst;
+    if (worst > HX711_SCK_HIGH_MAX_NS) return HX711_TIMING;
+    raw = (long)(int32_t)(v << 8) >> 8;  // 24 bits con signo
+    return HX711_OK;
+  }
+
+  // Pulso más largo de la última lectura (cota superior, ns).
+  uint64_t worstHighNs() const { return worstHighNs_; }
+
+private:
+  Chip&    chip_;
+  uint8_t  pulses_;
+  uint64_t worstHighNs_;
+};
+
+}  // namespace host
+}  // namespace bascula
@@ -0,0 +1,1288 @@
+// firmware-esp32/host/hx711_gpio.cpp
+//
+// Adquisición del HX711 directamente en la Pi (montajes sin ESP32), con el
+// mismo pipeline que el firmware (mediana -> IIR -> estabilidad, tasa medida
+// y sobrecarga: pipeline.h, rate.h, overload.h) en un hilo de tiempo real
+// sobre el dispositivo de caracteres GPIO. Las tramas salen con el formato
+// del firmware (G:<g>,S:<0|1>[,OL:1], frame_schema.h) por un pty o un socket TCP local, así
+// que el resto de la pila las lee como si hubiera un ESP32 en Serial1.
+//
+//   hx711_gpio [--chip /dev/gpiochip0] [--dout 5] [--sck 6]
+//              [--pty /run/bascula/scale | --tcp 5711]
+//              [--state /var/lib/bascula/hx711.state] [--prio 50] [--cpu 3]
+//   hx711_gpio --mock [--mock-grams G] ...    HX711 simulado a 80 SPS
+//   hx711_gpio --selftest                     lectura, tiempos y pipeline
+//
+// Comandos (mismas respuestas que el firmware): "T" / "TARE", "C:<g>",
+// "CAP:<g>[,<ovl_g>]" | "CAP:GET", "OVL:CLR", "FILT:<med_ms>,<tau_ms>,<umbral_g>,
+// <estable_ms>" | "FILT:GET", "FC:<n>|OFF|GET" (créditos, flow_credit.h),
+// "SNAP:<id>" (instantánea, snapshot.h; L: cuenta desde que acq toma el
+// comando), "REFINE:ON|OFF|GET" (refinado con la carga quieta, refine.h;
+// añade ,RES:<g> a la trama), "AUTOTUNE[:<ruido_g>[,<tol_g>]]|ABORT" (ajuste
+// del filtro, autotune.h), "PROBE:<máscara>|OFF|GET" (línea PRB: tras cada
+// trama, probe.h) y "RATE" (con TF: lecturas descartadas por tiempos, TO: esperas
+// de DRDY agotadas y HI: pulso de SCK más largo en µs).
+//
+// Hilos:
+// - acq (SCHED_FIFO, memoria bloqueada): lee cada conversión, ejecuta los
+//   comandos entre muestras y escribe las tramas sin bloquear (si el lector
+//   no da abasto se descartan líneas enteras y se cuentan).
+// - principal: atiende el pty/socket, encola los comandos y guarda el
+//   estado (tara, calibración, filtro) cuando cambia. acq solo usa try_lock
+//   con él: nunca espera a un hilo de menor prioridad.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "autotune.h"
+#include "flow_credit.h"
+#include "frame_schema.h"
+#include "gpio_chip.h"
+#include "hx711_bus.h"
+#include "mock_gpio.h"
+#include "overload.h"
+#include "pipeline.h"
+#include "probe.h"
+#include "profile.h"  // filterTimingValid, filterTimingParse
+#include "rate.h"
+#include "refine.h"
+#include "snapshot.h"
+
+using namespace bascula;
+using namespace bascula::host;
+
+namespace {
+
+// Mismos valores por defecto que main.cpp.
+const uint32_t MEDIAN_MS         = 375;
+const uint32_t IIR_TAU_MS        = 112;
+const float    STABLE_DELTA_G    = 1.0f;
+const uint32_t STABLE_MS         = 700;
+const uint16_t LOOP_HZ           = 50;
+const uint32_t NOMINAL_PERIOD_US = 100000;  // 10 SPS hasta medir
+const float    RATE_RETUNE_FRAC  = 0.15f;
+const uint32_t ADC_TIMEOUT_MS    = 500;
+const int      CAL_SAMPLES       = 20;
+const float    DEFAULT_CAPACITY_G = 5000.0f;
+const float    DEFAULT_OVERLOAD_G = 6000.0f;
+const size_t   CMD_MAX_LEN       = 80;
+
+// Lo que sobrevive a un reinicio del demonio.
+struct EngineState {
+  float        calFactor = 1.0f;
+  int32_t      tareOffset = 0;
+  FilterTiming timing{MEDIAN_MS, IIR_TAU_MS, STABLE_DELTA_G, STABLE_MS};
+  float        capacityG = DEFAULT_CAPACITY_G;
+  float        overloadG = DEFAULT_OVERLOAD_G;
+  int32_t      zeroOffset = OVERLOAD_NO_ZERO;  // cero de calibración (plato vacío)
+};
+
+bool loadState(const char* path, EngineState& s) {
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+  EngineState t = s;
+  unsigned long med, tau, sms;
+  long tare, zero;
+  int n = fscanf(f, "cal=%f tare=%ld med=%lu tau=%lu th=%f sms=%lu cap=%f ovl=%f zero=%ld",
+                 &t.calFactor, &tare, &med, &tau, &t.timing.stableDeltaG, &sms,
+                 &t.capacityG, &t.overloadG, &zero);
+  fclose(f);
+  t.tareOffset = (int32_t)tare;
+  t.zeroOffset = (int32_t)zero;
+  t.timing.medianMs = (uint32_t)med;
+  t.timing.iirTauMs = (uint32_t)tau;
+  t.timing.stableMs = (uint32_t)sms;
+  if (n != 9 || !std::isfinite(t.calFactor) || t.calFactor == 0.0f ||
+      !filterTimingValid(t.timing)) {
+    return false;
+  }
+  s = t;
+  return true;
+}
+
+// Escritura atómica (rename) para no dejar un estado a medias.
+bool saveState(const char* path, const EngineState& s) {
+  std::string tmp = std::string(path) + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "w");
+  if (!f) return false;
+  fprintf(f, "cal=%.9g tare=%ld med=%lu tau=%lu th=%.3f sms=%lu cap=%.1f ovl=%.1f zero=%ld\n",
+          (double)s.calFactor, (long)s.tareOffset, (unsigned long)s.timing.medianMs,
+          (unsigned long)s.timing.iirTauMs, (double)s.timing.stableDeltaG,
+          (unsigned long)s.timing.stableMs, (double)s.capacityG, (double)s.overloadG,
+          (long)s.zeroOffset);
+  bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp.c_str(), path) == 0;
+}
+
+// ---------- MOTOR: el lazo de acq de main.cpp sin ESP32 ----------
+
+template <class Chip>
+class Engine {
+public:
+  typedef std::function<void(const char*)> Emit;
+
+  Engine(Chip& chip, const EngineState& s, Emit emit)
+      : chip_(chip), bus_(chip), emit_(emit), s_(s),
+        pipeline_(filterParamsFor(s.timing, NOMINAL_PERIOD_US / 1000.0f)),
+        periodUs_(NOMINAL_PERIOD_US), decim_(1), decimCount_(0), nSnap_(0), refineOn_(false),
+        probe_(0), lastValid_(0), dirty_(false),
+        timeouts_(0), timingFaults_(0), invalid_(0), worstHighNs_(0) {
+    applyCalibration();
+    guard_.configure(s_.capacityG, s_.overloadG);
+    applyTiming(NOMINAL_PERIOD_US);
+  }
+
+  // Una conversión: leer, validar, filtrar y emitir la trama si toca.
+  void step() {
+    long raw;
+    if (!readRaw(raw)) return;
+    const uint64_t nowNs = chip_.nowNs();
+    const uint32_t nowMs = (uint32_t)(nowNs / 1000000u);
+    const uint32_t convUs = (uint32_t)(nowNs / 1000u);
+    if (rate_.push((uint32_t)(nowNs / 1000u)) &&
+        fabsf((float)rate_.periodUs() - (float)periodUs_) >
+            RATE_RETUNE_FRAC * (float)periodUs_) {
+      applyTiming(rate_.periodUs());
+    }
+    if (guard_.push(raw)) {
+      emitf("EVT:OVERLOAD,R:%ld,G:%.1f,N:%lu,MS:%lu", raw,
+            (double)pipeline_.rawToGrams(raw), (unsigned long)guard_.count(),
+            (unsigned long)nowMs);
+    }
+    if (!rawValid(raw)) {
+      invalid_++;
+    } else {
+      lastValid_ = raw;
+      if (refineOn_) {
+        const float cal = fabsf(pipeline_.calFactor());
+        refine_.push(raw, cal > 0.0f ? pipeline_.params().stableDeltaG / cal : 0.0f);
+      }
+    }
+    if (fc_.expired(nowMs)) reportFlow();
+    if (tuner_.state() == FilterTuner::RUN) tuneEvent(tuner_.work());
+
+    // Una instantánea pendiente adelanta el paso del filtro a esta conversión
+    if (nSnap_ > 0) decimCount_ = decim_ - 1;
+    if (++decimCount_ < decim_) return;
+    decimCount_ = 0;
+    const PipelineOut& o = pipeline_.push(raw, nowMs);
+    const bool overloaded = guard_.flagged();
+    if (refineOn_) refine_.setStable(o.stable && !overloaded);
+    if (tuner_.capturing()) tuneEvent(tuner_.push(raw, nowMs));
+    for (size_t i = 0; i < nSnap_; ++i) {
+      char snap[96];
+      snapFormat(snap, sizeof(snap), snaps_[i], o.grams, raw, o.stable, overloaded, convUs);
+      emit_(snap);
+    }
+    nSnap_ = 0;
+    const bool refined = refineOn_ && refine_.refining();
+    const float res = refineOn_ ? refine_.resolution(pipeline_.calFactor(),
+                                                     pipeline_.params().iirAlpha)
+                                : 0.0f;
+    const float g = refined ? refine_.grams(pipeline_.calFactor(), pipeline_.tareOffset())
+                            : o.grams;
+    FrameRecord<WeightFrame> rec;
+    rec.fine = refined && res < 0.005f;
+    rec.set<WeightFrame::at("G")>(g);
+    rec.set<WeightFrame::at("S")>((o.stable && !overloaded) ? 1 : 0);
+    if (res > 0.0f) rec.set<WeightFrame::at("RES")>(res);
+    if (overloaded) rec.set<WeightFrame::at("OL")>(1);
+    char out[128];
+    char prb[FC_TRAILER_MAX];
+    static_assert(frameMaxLen<WeightFrame>() < sizeof(out) && frameMaxLen<ProbeFrame>() < sizeof(prb),
+                  "la trama no cabe en out");
+    frameEncode(out, sizeof(out), rec);
+    if (probe_) {
+      probeFormat(prb, sizeof(prb), probe_,
+                  ProbeValues{raw, lastValid_, o.median, o.median - (long)pipeline_.tareOffset(),
+                              o.grams, o.delta, o.stableForMs});
+    }
+    if (!fc_.offer(out, probe_ ? prb : nullptr)) return;
+    emit_(out);
+    if (probe_) emit_(prb);
+  }
+
+  void command(const char* line) {
+    if (line[0] == '\0') return;
+
+    if (strcmp(line, "T") == 0 || strcmp(line, "t") == 0 || strcmp(line, "TARE") == 0) {
+      long r;
+      if (!readRaw(r)) {
+        emit_("ERR:ADC:timeout");
+        return;
+      }
+      s_.tareOffset = (int32_t)r;
+      applyCalibration();
+      dirty_ = true;
+      emit_("ACK:T");
+      return;
+    }
+
+    if (strncmp(line, "C:", 2) == 0 || strncmp(line, "c:", 2) == 0) {
+      float ref = strtof(line + 2, nullptr);
+      if (ref <= 0.0f) {
+        emit_("ERR:CAL:weight");
+        return;
+      }
+      long acc = 0;
+      for (int i = 0; i < CAL_SAMPLES; ++i) {
+        long r;
+        if (!readRaw(r)) {
+          emit_("ERR:ADC:timeout");
+          return;
+        }
+        acc += r;
+      }
+      long net = acc / CAL_SAMPLES - s_.tareOffset;
+      if (net == 0) {
+        emit_("ERR:CAL:zero");
+        return;
+      }
+      s_.calFactor = ref / (float)net;
+      s_.zeroOffset = s_.tareOffset;  // la pesa va sobre el plato vacío tarado
+      applyCalibration();
+      guard_.rearm();
+      dirty_ = true;
+      emitf("ACK:C:%.8f", (double)s_.calFactor);
+      return;
+    }
+
+    if (strcmp(line, "CAP:GET") == 0) {
+      emitf("CAP:%.1f,OVL:%.1f,N:%lu,L:%d,ARM:%d", (double)guard_.capacityG(),
+            (double)guard_.overloadG(), (unsigned long)guard_.count(),
+            guard_.latched() ? 1 : 0, guard_.armed() ? 1 : 0);
+      return;
+    }
+
+    if (strncmp(line, "CAP:", 4) == 0) {
+      float cap, ovl;
+      const CapParse pr = capacityParse(line + 4, cap, ovl);
+      if (pr != CAP_OK) {
+        emit_(pr == CAP_VALUE ? "ERR:CAP:value" : "ERR:CAP:overload");
+        return;
+      }
+      s_.capacityG = cap;
+      s_.overloadG = ovl;
+      guard_.configure(cap, ovl);
+      dirty_ = true;
+      emitf("ACK:CAP:%.1f,%.1f", (double)cap, (double)ovl);
+      return;
+    }
+
+    if (strcmp(line, "OVL:CLR") == 0) {
+      emit_(guard_.clearLatch() ? "ACK:OVL:CLR" : "ERR:OVL:loaded");
+      return;
+    }
+
+    if (strcmp(line, "FILT:GET") == 0) {
+      emitf("FILT:MED:%lu,TAU:%lu,TH:%.2f,SMS:%lu", (unsigned long)s_.timing.medianMs,
+            (unsigned long)s_.timing.iirTauMs, (double)s_.timing.stableDeltaG,
+            (unsigned long)s_.timing.stableMs);
+      return;
+    }
+
+    if (strncmp(line, "FILT:", 5) == 0) {
+      FilterTiming t;
+      const FilterParse pr = filterTimingParse(line + 5, t);
+      if (pr != FILT_OK) {
+        emit_(pr == FILT_FORMAT ? "ERR:FILT:format" : "ERR:FILT:value");
+        return;
+      }
+      s_.timing = t;
+      applyTiming(periodUs_);
+      pipeline_.setStableDelta(t.stableDeltaG);
+      dirty_ = true;
+      emitf("ACK:FILT:%lu,%lu,%.2f,%lu", (unsigned long)t.medianMs,
+            (unsigned long)t.iirTauMs, (double)t.stableDeltaG, (unsigned long)t.stableMs);
+      return;
+    }
+
+    if (strcmp(line, "RATE") == 0) {
+      const FilterParams& p = pipeline_.params();
+      emitf("RATE:SPS:%.2f,P:%lu,D:%u,N:%u,A:%.3f,HZ:%.1f,M:%d,TF:%lu,TO:%lu,HI:%lu",
+            (double)rate_.sps(), (unsigned long)periodUs_, (unsigned)decim_,
+            (unsigned)p.medianWindow, (double)p.iirAlpha,
+            1.0e6 / ((double)decim_ * (double)periodUs_), rate_.valid() ? 1 : 0,
+            (unsigned long)timingFaults_, (unsigned long)timeouts_,
+            (unsigned long)(worstHighNs_ / 1000u));
+      return;
+    }
+
+    if (strncmp(line, "SNAP:", 5) == 0) {
+      SnapRequest r;
+      if (!snapParse(line, (uint32_t)(chip_.nowNs() / 1000u), r)) {
+        emit_("ERR:SNAP:id");
+      } else if (nSnap_ >= SNAP_QUEUE_DEPTH) {
+        emit_("ERR:SNAP:busy");
+      } else {
+        snaps_[nSnap_++] = r;
+      }
+      return;
+    }
+
+    if (strcmp(line, "AUTOTUNE:ABORT") == 0) {
+      tuner_.abort();
+      emit_("ACK:AUTOTUNE:ABORT");
+      return;
+    }
+
+    if (strcmp(line, "AUTOTUNE") == 0 || strncmp(line, "AUTOTUNE:", 9) == 0) {
+      float noiseG = 0.0f, tolG = TUNE_TOL_G;
+      if (line[8] == ':') {
+        int n = sscanf(line + 9, "%f,%f", &noiseG, &tolG);
+        if (n < 1 || !(noiseG > 0.0f && noiseG <= 50.0f) || !(tolG > 0.0f && tolG <= 50.0f)) {
+          emit_("ERR:AUTOTUNE:value");
+          return;
+        }
+      }
+      if (tuner_.state() != FilterTuner::OFF) {
+        emit_("ERR:AUTOTUNE:busy");
+        return;
+      }
+      tuner_.start(s_.timing, noiseG, tolG, (float)decim_ * (float)periodUs_ / 1000.0f,
+                   pipeline_.calFactor(), pipeline_.tareOffset(),
+                   (uint32_t)(chip_.nowNs() / 1000000u));
+      emit_("ACK:AUTOTUNE:IDLE");
+      return;
+    }
+
+    if (strcmp(line, "REFINE:GET") == 0) {
+      emitf("REFINE:%d,N:%lu,RES:%.4f,SD:%.1f", refineOn_ ? 1 : 0,
+            (unsigned long)refine_.count(),
+            (double)refine_.resolution(pipeline_.calFactor(), pipeline_.params().iirAlpha),
+            (double)refine_.sigmaCounts());
+      return;
+    }
+
+    if (strcmp(line, "REFINE:ON") == 0 || strcmp(line, "REFINE:OFF") == 0) {
+      refineOn_ = (line[8] == 'N');
+      refine_.reset();
+      emit_(refineOn_ ? "ACK:REFINE:ON" : "ACK:REFINE:OFF");
+      return;
+    }
+
+    if (strcmp(line, "PROBE:GET") == 0) {
+      emitf("PROBE:0x%02X", (unsigned)probe_);
+      return;
+    }
+
+    if (strncmp(line, "PROBE:", 6) == 0) {
+      uint8_t mask;
+      if (!probeParseMask(line + 6, mask)) {
+        emit_("ERR:PROBE:value");
+        return;
+      }
+      probe_ = mask;
+      emitf("ACK:PROBE:0x%02X", (unsigned)mask);
+      return;
+    }
+
+    if (strncmp(line, "FC:", 3) == 0) {
+      if (strcmp(line + 3, "GET") == 0) {
+        reportFlow();
+      } else if (strcmp(line + 3, "OFF") == 0) {
+        fc_.disable();
+        emit_("ACK:FC:OFF");
+      } else {
+        char* end = nullptr;
+        unsigned long n = strtoul(line + 3, &end, 10);
+        if (end == line + 3 || *end != '\0') {
+          emit_("ERR:FC:value");
+          return;
+        }
+        fc_.grant((uint16_t)(n > FC_CREDIT_MAX ? FC_CREDIT_MAX : n),
+                  (uint32_t)(chip_.nowNs() / 1000000u));
+        const char* heldProbe = nullptr;
+        if (const char* held = fc_.takeHeld(&heldProbe)) {
+          emit_(held);
+          if (heldProbe) emit_(heldProbe);
+        }
+      }
+      return;
+    }
+
+    emit_("ERR:UNKNOWN_CMD");
+  }
+
+  // true una vez por cada cambio de tara, calibración, capacidad o filtro.
+  bool takeDirty() {
+    bool d = dirty_;
+    dirty_ = false;
+    return d;
+  }
+
+  const EngineState& state() const { return s_; }
+  uint32_t           timeouts() const { return timeouts_; }
+  uint32_t           timingFaults() const { return timingFaults_; }
+  uint32_t           periodUs() const { return periodUs_; }
+  const Pipeline&    pipeline() const { return pipeline_; }
+
+private:
+  // Reintenta las lecturas descartadas por tiempos: la siguiente conversión
+  // llega en un periodo. Solo la espera de DRDY agotada es un fallo.
+  bool readRaw(long& raw) {
+    for (int tries = 0; tries < 4; ++tries) {
+      Hx711Result r = bus_.read(raw, ADC_TIMEOUT_MS * 1000u);
+      if (bus_.worstHighNs() > worstHighNs_) worstHighNs_ = bus_.worstHighNs();
+      if (r == HX711_OK) return true;
+      if (r == HX711_TIMEOUT) {
+        timeouts_++;
+        return false;
+      }
+      timingFaults_++;
+    }
+    return false;
+  }
+
+  void applyCalibration() {
+    pipeline_.setCalibration(s_.calFactor, s_.tareOffset);
+    guard_.setCalibration(s_.calFactor, s_.zeroOffset);
+  }
+
+  void applyTiming(uint32_t periodUs) {
+    periodUs_ = periodUs;
+    decim_ = decimationFor(periodUs, 1000000u / LOOP_HZ);
+    FilterParams p = filterParamsFor(s_.timing, (float)decim_ * (float)periodUs / 1000.0f);
+    p.stableDeltaG = pipeline_.params().stableDeltaG;
+    pipeline_.retime(p);
+  }
+
+  void tuneEvent(FilterTuner::Event e) {
+    switch (e) {
+      case FilterTuner::LOAD:
+        emitf("AUTOTUNE:LOAD,SD:%.1f", (double)tuner_.idleSigma());
+        break;
+      case FilterTuner::ANALYZE:
+        emitf("AUTOTUNE:RUN,STEP:%.1f", (double)tuner_.stepGrams());
+        break;
+      case FilterTuner::DONE: {
+        const TuneResult& r = tuner_.result();
+        s_.timing = r.timing;
+        applyTiming(periodUs_);
+        pipeline_.setStableDelta(r.timing.stableDeltaG);
+        dirty_ = true;
+        emitf("AUTOTUNE:MED:%lu,TAU:%lu,TH:%.2f,SMS:%lu,SETTLE:%lu,WAS:%ld,NOISE:%.3f,OK:%u/%u",
+              (unsigned long)r.timing.medianMs, (unsigned long)r.timing.iirTauMs,
+              (double)r.timing.stableDeltaG, (unsigned long)r.timing.stableMs,
+              (unsigned long)r.settleMs, (long)r.wasMs, (double)r.noiseG,
+              (unsigned)r.feasible, (unsigned)r.total);
+        break;
+      }
+      case FilterTuner::TIMEOUT:   emit_("ERR:AUTOTUNE:timeout"); break;
+      case FilterTuner::NOSTEP:    emit_("ERR:AUTOTUNE:nostep"); break;
+      case FilterTuner::UNSETTLED: emit_("ERR:AUTOTUNE:unsettled"); break;
+      case FilterTuner::NOFIT:     emit_("ERR:AUTOTUNE:nofit"); break;
+      default: break;
+    }
+  }
+
+  void reportFlow() {
+    emitf("FC:%s,CR:%u,SK:%lu", fc_.enabled() ? "ON" : "OFF",
+          (unsigned)fc_.credits(), (unsigned long)fc_.skipped());
+  }
+
+  void emitf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[160];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    emit_(buf);
+  }
+
+  Chip&          chip_;
+  Hx711Bus<Chip> bus_;
+  Emit           emit_;
+  EngineState    s_;
+  Pipeline       pipeline_;
+  RateEstimator  rate_;
+  OverloadGuard  guard_;
+  CreditGate     fc_;
+  uint32_t       periodUs_;
+  uint8_t        decim_;
+  uint8_t        decimCount_;
+  SnapRequest    snaps_[SNAP_QUEUE_DEPTH];
+  size_t         nSnap_;
+  StableRefiner  refine_;
+  FilterTuner    tuner_;
+  bool           refineOn_;
+  uint8_t        probe_;      // máscara de sondas PRB:
+  long           lastValid_;  // sonda V
+  bool           dirty_;
+  uint32_t       timeouts_;
+  uint32_t       timingFaults_;
+  uint32_t       invalid_;
+  uint64_t       worstHighNs_;
+};
+
+// ---------- SALIDA: pty o socket TCP local ----------
+
+std::atomic<bool> g_stop(false);
+
+void onSignal(int) { g_stop = true; }
+
+class Port {
+public:
+  Port() : listen_(-1), fd_(-1), slave_(-1), drops_(0) {}
+
+  // pty en modo crudo; `link` apunta al esclavo (lo que abre la pila).
+  bool openPty(const char* link) {
+    int m = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m < 0 || grantpt(m) != 0 || unlockpt(m) != 0) return false;
+    const char* name = ptsname(m);
+    if (!name) return false;
+    // El esclavo se mantiene abierto: sin lector, el maestro no da EIO y las
+    // tramas que no caben se descartan como en la UART.
+    slave_ = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slave_ < 0) return false;
+    termios tio;
+    tcgetattr(slave_, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave_, TCSANOW, &tio);
+    if (link) {
+      unlink(link);
+      if (symlink(name, link) != 0) {
+        fprintf(stderr, "hx711_gpio: no se puede crear %s: %s\n", link, strerror(errno));
+        return false;
+      }
+    }
+    fprintf(stderr, "hx711_gpio: tramas en %s%s%s\n", name, link ? " -> " : "",
+            link ? link : "");
+    fd_ = m;
+    return true;
+  }
+
+  // Un cliente a la vez en 127.0.0.1 (pyserial: socket://localhost:<puerto>).
+  bool listenTcp(int port) {
+    listen_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_ < 0) return false;
+    int one = 1;
+    setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_port = htons((uint16_t)port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_, (sockaddr*)&a, sizeof(a)) != 0 || listen(listen_, 1) != 0) {
+      return false;
+    }
+    fprintf(stderr, "hx711_gpio: tramas en tcp 127.0.0.1:%d\n", port);
+    return true;
+  }
+
+  // Hilo acq: línea entera o nada, sin esperar nunca.
+  void writeLine(const char* s) {
+    std::unique_lock<std::mutex> lk(mu_, std::try_to_lock);
+    if (!lk.owns_lock() || fd_ < 0) {
+      drops_++;
+      return;
+    }
+    char buf[192];
+    int n = snprintf(buf, sizeof(buf), "%s\r\n", s);
+    if (n <= 0 || (size_t)n >= sizeof(buf)) return;
+    ssize_t w = listen_ >= 0 ? send(fd_, buf, (size_t)n, MSG_NOSIGNAL | MSG_DONTWAIT)
+                             : write(fd_, buf, (size_t)n);
+    if (w != n) drops_++;  // una línea partida se corta en el lector
+  }
+
+  // Hilo principal: espera comandos (o clientes) hasta timeoutMs y entrega
+  // cada línea completa a fn.
+  template <class Fn>
+  void poll(int timeoutMs, Fn fn) {
+    pollfd pf[2];
+    int n = 0;
+    int fd;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      fd = fd_;
+    }
+    if (fd >= 0) pf[n++] = pollfd{fd, POLLIN, 0};
+    if (listen_ >= 0) pf[n++] = pollfd{listen_, POLLIN, 0};
+    if (::poll(pf, (nfds_t)n, timeoutMs) <= 0) return;
+    for (int i = 0; i < n; ++i) {
+      if (!pf[i].revents) continue;
+      if (pf[i].fd == listen_) {
+        int c = accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (c >= 0) swapFd(c);
+        continue;
+      }
+      char tmp[256];
+      ssize_t r = read(pf[i].fd, tmp, sizeof(tmp));
+      if (r == 0 && listen_ >= 0) {
+        swapFd(-1);  // el cliente se fue
+        continue;
+      }
+      for (ssize_t k = 0; k < r; ++k) {
+        char ch = tmp[k];
+        if (ch == '\r' || ch == '\n') {
+          if (!line_.empty()) fn(line_.c_str());
+          line_.clear();
+        } else if (line_.size() < CMD_MAX_LEN) {
+          line_.push_back(ch);
+        }
+      }
+    }
+  }
+
+  unsigned long drops() const { return drops_; }
+
+private:
+  void swapFd(int c) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (fd_ >= 0) close(fd_);
+    fd_ = c;
+    line_.clear();
+  }
+
+  int                        listen_;
+  int                        fd_;
+  int                        slave_;
+  std::mutex                 mu_;
+  std::string                line_;
+  std::atomic<unsigned long> drops_;
+};
+
+// Comandos pendientes y estado a guardar, entre el hilo principal y acq.
+struct Mailbox {
+  std::mutex              mu;
+  std::deque<std::string> cmds;
+  bool                    saveDue = false;
+  EngineState             toSave;
+};
+
+void makeRealtime(std::thread& t, int prio, int cpu) {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    fprintf(stderr, "hx711_gpio: aviso: mlockall: %s\n", strerror(errno));
+  }
+  sched_param sp;
+  sp.sched_priority = prio;
+  int rc = pthread_setschedparam(t.native_handle(), SCHED_FIFO, &sp);
+  if (rc != 0) {
+    fprintf(stderr, "hx711_gpio: aviso: SCHED_FIFO %d: %s (sin tiempo real)\n", prio,
+            strerror(rc));
+  }
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    rc = pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+    if (rc != 0) fprintf(stderr, "hx711_gpio: aviso: CPU %d: %s\n", cpu, strerror(rc));
+  }
+}
+
+struct Options {
+  const char* chip = "/dev/gpiochip0";
+  unsigned    dout = 5;   // mismos pines por defecto que bascula/config/settings.py
+  unsigned    sck = 6;
+  const char* pty = nullptr;
+  int         tcp = 0;
+  const char* state = nullptr;
+  int         prio = 50;
+  int         cpu = -1;
+  bool        mock = false;
+  float       mockGrams = 0.0f;
+};
+
+template <class Chip>
+int runDaemon(Chip& chip, const Options& opt, EngineState st) {
+  if (opt.state && !loadState(opt.state, st)) {
+    fprintf(stderr, "hx711_gpio: sin estado válido en %s, valores por defecto\n", opt.state);
+  }
+  Port port;
+  bool ok = opt.tcp > 0 ? port.listenTcp(opt.tcp) : port.openPty(opt.pty);
+  if (!ok) {
+    fprintf(stderr, "hx711_gpio: no se puede abrir la salida: %s\n", strerror(errno));
+    return 2;
+  }
+  Mailbox box;
+  Engine<Chip> engine(chip, st, [&](const char* l) { port.writeLine(l); });
+
+  std::thread acq([&]() {
+    std::string cmd;
+    bool saveDue = false;
+    while (!g_stop) {
+      // Comandos entre muestras, como la tarea acq del firmware
+      for (;;) {
+        std::unique_lock<std::mutex> lk(box.mu, std::try_to_lock);
+        if (!lk.owns_lock()) break;
+        if (saveDue) {
+          box.toSave = engine.state();
+          box.saveDue = true;
+          saveDue = false;
+        }
+        if (box.cmds.empty()) break;
+        cmd.swap(box.cmds.front());
+        box.cmds.pop_front();
+        lk.unlock();
+        engine.command(cmd.c_str());
+        saveDue = saveDue || engine.takeDirty();
+      }
+      engine.step();
+    }
+  });
+  makeRealtime(acq, opt.prio, opt.cpu);
+
+  while (!g_stop) {
+    port.poll(200, [&](const char* line) {
+      std::lock_guard<std::mutex> lk(box.mu);
+      if (box.cmds.size() < 8) box.cmds.push_back(line);
+      else port.writeLine("ERR:BUSY");
+    });
+    EngineState save;
+    bool due = false;
+    {
+      std::lock_guard<std::mutex> lk(box.mu);
+      if (box.saveDue) {
+        save = box.toSave;
+        box.saveDue = false;
+        due = true;
+      }
+    }
+    if (due && opt.state && !saveState(opt.state, save)) {
+      fprintf(stderr, "hx711_gpio: no se puede guardar %s: %s\n", opt.state, strerror(errno));
+    }
+  }
+  acq.join();
+  fprintf(stderr, "hx711_gpio: fin (%lu líneas descartadas, %lu lecturas descartadas, "
+                  "%lu esperas agotadas)\n",
+          port.drops(), (unsigned long)engine.timingFaults(),
+          (unsigned long)engine.timeouts());
+  return 0;
+}
+
+// ---------- PRUEBAS CON EL gpiochip SIMULADO ----------
+
+#define CHECK(c)                                                              \
+  do {                                                                        \
+    if (!(c)) {                                                               \
+      fprintf(stderr, "selftest: falla %s (línea %d)\n", #c, __LINE__);      \
+      return 1;                                                               \
+    }                                                                         \
+  } while (0)
+
+// Celda simulada: cero en ZERO_COUNTS, CAL_TRUE gramos por cuenta y ruido
+// gaussiano de NOISE_COUNTS.
+const long  ZERO_COUNTS  = 84210;
+const float CAL_TRUE     = 1.0f / 420.0f;
+const float NOISE_COUNTS = 60.0f;
+
+MockGpioChip::Signal cellSignal(std::function<float(uint64_t)> grams, uint32_t seed) {
+  auto rng = std::make_shared<std::mt19937>(seed);
+  return [=](uint64_t t) {
+    std::normal_distribution<float> noise(0.0f, NOISE_COUNTS);
+    return ZERO_COUNTS + lroundf(grams(t) / CAL_TRUE + noise(*rng));
+  };
+}
+
+int selftest() {
+  {
+    // Bus limpio: cada palabra leída es la que sacó el HX711
+    MockHx711Opts o;
+    MockGpioChip chip(o, cellSignal([](uint64_t) { return 123.0f; }, 1));
+    Hx711Bus<MockGpioChip> bus(chip);
+    for (int i = 0; i < 500; ++i) {
+      long raw = 0;
+      size_t before = chip.delivered().size();
+      CHECK(bus.read(raw, 500000) == HX711_OK);
+      CHECK(chip.delivered().size() == before + 1 && raw == chip.delivered().back());
+    }
+    // Negativos y extremos de 24 bits
+    for (long v : {-1L, -8388608L, 8388607L, 0L}) {
+      MockGpioChip c2(o, [v](uint64_t) { return v; });
+      Hx711Bus<MockGpioChip> b2(c2);
+      long raw = 0;
+      CHECK(b2.read(raw, 500000) == HX711_OK && raw == v);
+    }
+  }
+  {
+    // Con expulsiones del hilo: las lecturas con pulsos largos se descartan
+    // y ninguna palabra corrupta llega como buena
+    MockHx711Opts o;
+    o.preemptProb = 0.001;
+    o.preemptUs = 120;
+    o.seed = 7;
+    MockGpioChip chip(o, cellSignal([](uint64_t) { return 250.0f; }, 2));
+    Hx711Bus<MockGpioChip> bus(chip);
+    size_t good = 0, timing = 0;
+    for (int i = 0; i < 3000; ++i) {
+      long raw = 0;
+      size_t before = chip.delivered().size();
+      Hx711Result r = bus.read(raw, 500000);
+      CHECK(r != HX711_TIMEOUT);
+      if (r == HX711_OK) {
+        CHECK(chip.delivered().size() == before + 1 && raw == chip.delivered().back());
+        good++;
+      } else {
+        timing++;
+      }
+    }
+    CHECK(timing > 0 && chip.powerDowns() > 0 && good > 2500);
+    printf("bus: %zu buenas, %zu descartadas por tiempos, %u apagados del HX711\n", good,
+           timing, chip.powerDowns());
+  }
+  {
+    // DOUT muerto: espera acotada, sin trama
+    MockHx711Opts o;
+    o.deadDout = true;
+    MockGpioChip chip(o, cellSignal([](uint64_t) { return 0.0f; }, 3));
+    std::vector<std::string> lines;
+    EngineState st;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    e.step();
+    CHECK(lines.empty() && e.timeouts() == 1);
+    CHECK(chip.nowNs() >= ADC_TIMEOUT_MS * 1000000ull);
+    e.command("T");
+    CHECK(lines.size() == 1 && lines[0] == "ERR:ADC:timeout");
+  }
+  {
+    // Pipeline completo: tara y calibración por comandos, escalón de 500 g a
+    // los 6 s, con expulsiones ocasionales
+    const uint64_t STEP_NS = 6000000000ull;
+    bool loaded = false;
+    MockHx711Opts o;
+    o.preemptProb = 0.001;
+    o.seed = 11;
+    MockGpioChip chip(o, cellSignal(
+        [&](uint64_t t) { return loaded || t >= STEP_NS ? 500.0f : 0.0f; }, 4));
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = 1.0f / 400.0f;  // de una placa parecida, sin tara
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    while (chip.nowNs() < 2000000000ull) e.step();
+    e.command("T");
+    CHECK(lines.back() == "ACK:T");
+    CHECK(e.takeDirty());
+    CHECK(std::abs(e.state().tareOffset - ZERO_COUNTS) < 4 * NOISE_COUNTS);
+    // Calibrar con la pesa patrón ya asentada
+    loaded = true;
+    while (chip.nowNs() < 2500000000ull) e.step();
+    e.command("C:500");
+    loaded = false;
+    CHECK(lines.back().compare(0, 6, "ACK:C:") == 0);
+    CHECK(fabsf(e.state().calFactor / CAL_TRUE - 1.0f) < 0.01f);
+    CHECK(e.periodUs() > 12000 && e.periodUs() < 13000);
+
+    while (chip.nowNs() < 5000000000ull) e.step();
+    lines.clear();
+    double settleMs = -1.0;
+    bool sawUnstable = false;
+    float g = 0.0f;
+    int s = 0;
+    while (chip.nowNs() < STEP_NS + 3000000000ull) {
+      size_t before = lines.size();
+      e.step();
+      if (lines.size() == before) continue;
+      CHECK(sscanf(lines.back().c_str(), "G:%f,S:%d", &g, &s) == 2);
+      if (chip.nowNs() < STEP_NS) {
+        CHECK(fabsf(g) < 1.0f);
+      } else if (!s) {
+        sawUnstable = true;
+      } else if (settleMs < 0.0 && fabsf(g - 500.0f) < 1.0f) {
+        settleMs = (chip.nowNs() - STEP_NS) / 1e6;
+      }
+    }
+    CHECK(sawUnstable && settleMs > 0.0 && settleMs < 2000.0);
+    CHECK(s == 1 && fabsf(g - 500.0f) < 0.5f);
+    printf("pipeline: escalón de 500 g estable en %.0f ms (%u lecturas descartadas)\n",
+           settleMs, e.timingFaults());
+
+    lines.clear();
+    e.command("FILT:GET");
+    e.command("FILT:0,0,0,0");
+    e.command("CAP:nan");
+    e.command("CAP:400,450zz");
+    e.command("CAP:400");
+    do e.step(); while (lines.back()[0] != 'G');
+    e.command("OVL:CLR");
+    e.command("ZERO");
+    CHECK(lines.size() >= 8);
+    CHECK(lines[0] == "FILT:MED:375,TAU:112,TH:1.00,SMS:700");
+    CHECK(lines[1] == "ERR:FILT:value");
+    CHECK(lines[2] == "ERR:CAP:value" && lines[3] == "ERR:CAP:overload");
+    CHECK(lines[4] == "ACK:CAP:400.0,480.0");
+    CHECK(lines[5].compare(0, 13, "EVT:OVERLOAD,") == 0);
+    CHECK(lines[6].find(",OL:1") != std::string::npos);
+    CHECK(lines[7] == "ERR:OVL:loaded" && lines.back() == "ERR:UNKNOWN_CMD");
+  }
+  {
+    // Sin calibrar (estado por defecto, pendiente 1): el offset del HX711 no
+    // engancha la sobrecarga al arrancar
+    MockGpioChip chip(MockHx711Opts(), cellSignal([](uint64_t) { return 0.0f; }, 8));
+    std::vector<std::string> lines;
+    EngineState st;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    for (int i = 0; i < 100; ++i) e.step();
+    e.command("CAP:GET");
+    CHECK(lines.size() > 10 && lines.back() == "CAP:5000.0,OVL:6000.0,N:0,L:0,ARM:0");
+    for (const std::string& l : lines) CHECK(l.find("OL:1") == std::string::npos && l[0] != 'E');
+  }
+  {
+    // Recipiente de 300 g tarado: los umbrales siguen midiéndose sobre la
+    // carga de la celda (CAP:400 salta a 400 g brutos, 100 g netos)
+    float gross = 300.0f;
+    MockGpioChip chip(MockHx711Opts(), cellSignal([&](uint64_t) { return gross; }, 7));
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = ZERO_COUNTS;
+    st.capacityG = 400.0f;
+    st.overloadG = 480.0f;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    for (int i = 0; i < 100; ++i) e.step();
+    e.command("T");
+    CHECK(lines.back() == "ACK:T" && e.state().zeroOffset == ZERO_COUNTS);
+    auto run = [&](float g) {
+      gross = g;
+      lines.clear();
+      for (int i = 0; i < 100; ++i) e.step();
+    };
+    auto has = [&](const char* s) {
+      return std::any_of(lines.begin(), lines.end(), [&](const std::string& l) {
+        return l.find(s) != std::string::npos;
+      });
+    };
+    run(380.0f);
+    CHECK(!has(",OL:1") && !has("EVT:OVERLOAD"));
+    run(430.0f);
+    CHECK(has(",OL:1") && !has("EVT:OVERLOAD"));
+    run(520.0f);
+    CHECK(has("EVT:OVERLOAD"));
+  }
+  {
+    // Créditos: sin concesión solo queda la última trama, que sale al conceder
+    MockGpioChip chip(MockHx711Opts(), cellSignal(
+        [](uint64_t t) { return (float)(t / 10000000ull); }, 5));  // 100 g/s
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = ZERO_COUNTS;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    e.command("FC:2");
+    for (int i = 0; i < 200; ++i) e.step();
+    CHECK(lines.size() == 2);
+    float before = 0.0f, held = 0.0f;
+    int s;
+    CHECK(sscanf(lines[1].c_str(), "G:%f,S:%d", &before, &s) == 2);
+    e.command("FC:GET");
+    CHECK(lines.back().compare(0, 11, "FC:ON,CR:0,") == 0);
+    const float nowG = (float)(chip.nowNs() / 10000000ull);
+    e.command("FC:8");
+    CHECK(sscanf(lines.back().c_str(), "G:%f,S:%d", &held, &s) == 2);
+    CHECK(held > before + 100.0f && fabsf(held - nowG) < 50.0f);  // solo el retardo del filtro
+    e.command("FC:x");
+    CHECK(lines.back() == "ERR:FC:value");
+    e.command("FC:OFF");
+    size_t n = lines.size();
+    for (int i = 0; i < 40; ++i) e.step();
+    CHECK(lines[n - 1] == "ACK:FC:OFF" && lines.size() >= n + 15);
+  }
+  {
+    // Instantánea: la siguiente conversión, con el peso del escalón ya
+    // filtrado, y como mucho un periodo de conversión después
+    MockGpioChip chip(MockHx711Opts(), cellSignal([](uint64_t) { return 250.0f; }, 6));
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = ZERO_COUNTS;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    while (chip.nowNs() < 3000000000ull) e.step();
+    unsigned long worstL = 0;
+    for (int k = 0; k < 50; ++k) {
+      for (int i = 0; i < k % 3; ++i) e.step();  // peticiones en cualquier fase
+      lines.clear();
+      e.command(k == 0 ? "SNAP:a1" : "SNAP:x");
+      e.command("SNAP:b-2");
+      CHECK(lines.empty());
+      const uint64_t before = chip.nowNs();
+      e.step();
+      CHECK(lines.size() >= 2);
+      char id[16];
+      float g;
+      long raw;
+      int s;
+      unsigned long t, l;
+      CHECK(sscanf(lines[0].c_str(), "SNAP:%15[^,],G:%f,R:%ld,S:%d,T:%lu,L:%lu", id, &g,
+                   &raw, &s, &t, &l) == 6);
+      CHECK(strcmp(id, k == 0 ? "a1" : "x") == 0 && lines[1].compare(0, 10, "SNAP:b-2,G") == 0);
+      CHECK(fabsf(g - 250.0f) < 1.0f && s == 1 && std::abs(raw - ZERO_COUNTS - 105000) < 400);
+      CHECK(t == (unsigned long)(chip.nowNs() / 1000u) && t >= before / 1000u);
+      CHECK(l <= e.periodUs() + 500u);
+      worstL = std::max(worstL, l);
+    }
+    e.command("SNAP:");
+    e.command("SNAP:demasiado-largo1");
+    for (int i = 0; i < 5; ++i) e.command("SNAP:q");
+    CHECK(lines[lines.size() - 3] == "ERR:SNAP:id" && lines[lines.size() - 2] == "ERR:SNAP:id" &&
+          lines.back() == "ERR:SNAP:busy");
+    printf("instantánea: latencia máxima %lu µs (periodo %u µs)\n", worstL,
+           (unsigned)e.periodUs());
+  }
+  {
+    // Refinado: con la carga quieta la resolución baja con 1/sqrt(n) y el
+    // valor se acerca al real; un escalón vacía la ventana en esa conversión
+    MockGpioChip chip(MockHx711Opts(), cellSignal(
+        [](uint64_t t) { return t < 12000000000ull ? 250.0f : 400.0f; }, 7));
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = ZERO_COUNTS;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    e.command("REFINE:ON");
+    CHECK(lines.back() == "ACK:REFINE:ON");
+    float g = 0.0f, res1 = 0.0f, resEnd = 0.0f;
+    int s = 0;
+    uint64_t stableNs = 0;
+    while (chip.nowNs() < 11950000000ull) {
+      e.step();
+      if (sscanf(lines.back().c_str(), "G:%f,S:%d", &g, &s) != 2 || s != 1) continue;
+      if (stableNs == 0) stableNs = chip.nowNs();
+      const char* r = strstr(lines.back().c_str(), ",RES:");
+      if (chip.nowNs() < stableNs + 200000000ull) continue;  // primera ventana
+      CHECK(r != nullptr);
+      if (res1 == 0.0f && chip.nowNs() >= stableNs + 1000000000ull) res1 = strtof(r + 5, nullptr);
+      resEnd = strtof(r + 5, nullptr);
+    }
+    const float iirRes = NOISE_COUNTS * CAL_TRUE *
+                         sqrtf(e.pipeline().params().iirAlpha / (2.0f - e.pipeline().params().iirAlpha));
+    CHECK(stableNs > 0 && res1 > 0.0f && res1 < iirRes && resEnd < res1 / 2.5f);
+    CHECK(fabsf(g - 250.0f) < 5.0f * resEnd + 0.001f);
+    CHECK(lines.back().compare(0, 2, "G:") == 0 && strchr(lines.back().c_str(), '.')[4] == ',');
+    while (chip.nowNs() < 12000000000ull) e.step();
+    e.step();
+    CHECK(strchr(lines.back().c_str(), '.')[3] == ',');  // ya sin la media refinada
+    e.command("REFINE:GET");
+    CHECK(lines.back().compare(0, 13, "REFINE:1,N:0,") == 0 ||
+          lines.back().compare(0, 13, "REFINE:1,N:1,") == 0);
+    while (chip.nowNs() < 15000000000ull) e.step();
+    CHECK(sscanf(lines.back().c_str(), "G:%f,S:%d", &g, &s) == 2 && s == 1 &&
+          fabsf(g - 400.0f) < 0.05f);
+    e.command("REFINE:OFF");
+    e.step();
+    CHECK(lines.back().find(",RES:") == std::string::npos);
+    printf("refinado: RES %.4f g tras 1 s, %.4f g tras %.1f s (IIR %.4f g)\n", (double)res1,
+           (double)resEnd, (double)(11950000000ull - stableNs) / 1e9, (double)iirRes);
+  }
+  {
+    // Sondas: la línea PRB: sale detrás de su trama con los campos pedidos
+    // y en orden de bit; la mediana neta cuadra con el peso filtrado
+    MockGpioChip chip(MockHx711Opts(), cellSignal([](uint64_t) { return 120.0f; }, 11));
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = ZERO_COUNTS;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    e.command("PROBE:x");
+    CHECK(lines.back() == "ERR:PROBE:value");
+    e.command("PROBE:0x80");
+    CHECK(lines.back() == "ERR:PROBE:value");
+    e.command("PROBE:RNIT");
+    CHECK(lines.back() == "ACK:PROBE:0x59");
+    while (chip.nowNs() < 3000000000ull) e.step();
+    const size_t n = lines.size();
+    CHECK(n >= 4 && lines[n - 2].compare(0, 2, "G:") == 0);
+    long r = 0, net = 0;
+    float iir = 0.0f, g = 0.0f;
+    unsigned long t = 0;
+    int s = 0;
+    CHECK(sscanf(lines[n - 1].c_str(), "PRB:R:%ld,N:%ld,I:%f,T:%lu", &r, &net, &iir, &t) == 4);
+    CHECK(sscanf(lines[n - 2].c_str(), "G:%f,S:%d", &g, &s) == 2 && s == 1);
+    CHECK(fabsf(iir - g) < 0.006f && fabsf((float)net * CAL_TRUE - 120.0f) < 1.0f && t > 0);
+    CHECK(labs(r - (ZERO_COUNTS + (long)(120.0f / CAL_TRUE))) < 20 * NOISE_COUNTS);
+    e.command("PROBE:127");
+    for (int i = 0; i < 8 && lines.back().compare(0, 4, "PRB:") != 0; ++i) e.step();
+    CHECK(lines.back().compare(0, 6, "PRB:R:") == 0 &&
+          lines.back().find(",V:") != std::string::npos &&
+          lines.back().find(",D:") != std::string::npos);
+    // Sin créditos la PRB: se retiene con su trama y sale detrás de ella
+    // con la siguiente concesión
+    e.command("FC:0");
+    const size_t held = lines.size();
+    for (int i = 0; i < 16; ++i) e.step();
+    CHECK(lines.size() == held);
+    e.command("FC:4");
+    CHECK(lines.size() == held + 2 && lines[held].compare(0, 2, "G:") == 0 &&
+          lines[held + 1].compare(0, 6, "PRB:R:") == 0);
+    e.command("FC:OFF");
+    e.command("PROBE:OFF");
+    CHECK(lines.back() == "ACK:PROBE:0x00");
+    for (int i = 0; i < 8; ++i) e.step();
+    CHECK(lines.back().compare(0, 2, "G:") == 0);
+    e.command("PROBE:GET");
+    CHECK(lines.back() == "PROBE:0x00");
+  }
+  {
+    // Ajuste automático: vacío, escalón con rebote mecánico y elección del
+    // filtro; el asentamiento esperado se comprueba con otro escalón real
+    auto load = [](double t) {  // s desde la colocación
+      if (t < 0.0) return 0.0;
+      return 300.0 * (1.0 - exp(-t / 0.06)) + 6.0 * exp(-t / 0.15) * sin(2.0 * M_PI * 7.0 * t);
+    };
+    MockGpioChip chip(MockHx711Opts(), cellSignal([&](uint64_t ns) {
+      const double t = (double)ns / 1e9;
+      return (float)(t < 14.0 ? load(t - 5.0) : load(t - 24.0));
+    }, 8));
+    std::vector<std::string> lines;
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = ZERO_COUNTS;
+    Engine<MockGpioChip> e(chip, st, [&](const char* l) { lines.push_back(l); });
+    while (chip.nowNs() < 2000000000ull) e.step();
+    e.command("AUTOTUNE:x");
+    CHECK(lines.back() == "ERR:AUTOTUNE:value");
+    e.command("AUTOTUNE");
+    CHECK(lines.back() == "ACK:AUTOTUNE:IDLE");
+    e.command("AUTOTUNE");
+    CHECK(lines.back() == "ERR:AUTOTUNE:busy");
+    std::vector<std::string> tune;
+    while (chip.nowNs() < 14000000000ull) {
+      lines.clear();
+      e.step();
+      for (const std::string& l : lines) {
+        if (l.compare(0, 9, "AUTOTUNE:") == 0 || l.compare(0, 13, "ERR:AUTOTUNE:") == 0) {
+          tune.push_back(l);
+        }
+      }
+    }
+    CHECK(tune.size() == 3 && tune[0].compare(0, 14, "AUTOTUNE:LOAD,") == 0 &&
+          tune[1].compare(0, 13, "AUTOTUNE:RUN,") == 0);
+    unsigned long med = 0, tau = 0, sms = 0, settle = 0;
+    long was = 0;
+    float th = 0.0f, noise = 0.0f;
+    unsigned ok = 0, total = 0;
+    CHECK(sscanf(tune[2].c_str(), "AUTOTUNE:MED:%lu,TAU:%lu,TH:%f,SMS:%lu,SETTLE:%lu,WAS:%ld,"
+                 "NOISE:%f,OK:%u/%u", &med, &tau, &th, &sms, &settle, &was, &noise, &ok,
+                 &total) == 9);
+    CHECK(ok > 0 && total == TUNE_N_MED * TUNE_N_TAU * TUNE_N_TH * TUNE_N_SMS);
+    CHECK(settle > 0 && (was < 0 || settle < (unsigned long)was));
+    CHECK(e.takeDirty() && e.state().timing.medianMs == med && e.state().timing.stableMs == sms);
+    // Segundo escalón con el filtro nuevo: primer S:1 a menos de 0,5 g
+    uint64_t settledNs = 0;
+    while (chip.nowNs() < 27000000000ull) {
+      lines.clear();
+      e.step();
+      float g;
+      int s;
+      if (settledNs == 0 && chip.nowNs() > 24000000000ull && !lines.empty() &&
+          sscanf(lines.back().c_str(), "G:%f,S:%d", &g, &s) == 2 && s == 1 &&
+          fabsf(g - 300.0f) <= TUNE_TOL_G) {
+        settledNs = chip.nowNs() - 24000000000ull;
+      }
+    }
+    const long measured = (long)(settledNs / 1000000u);
+    CHECK(settledNs > 0 && labs(measured - (long)settle) <= 150);
+    // Sin escalón: a los TUNE_WAIT_MS se rinde
+    e.command("AUTOTUNE:0.05,0.3");
+    lines.clear();
+    while (chip.nowNs() < 62000000000ull) e.step();
+    CHECK(std::find(lines.begin(), lines.end(), "ERR:AUTOTUNE:timeout") != lines.end());
+    printf("autotune: MED:%lu,TAU:%lu,TH:%.2f,SMS:%lu, asienta en %lu ms (antes %ld ms, "
+           "medido %ld ms), ruido %.3f g, %u/%u válidas\n", med, tau, (double)th, sms, settle,
+           was, measured, (double)noise, ok, total);
+  }
+  {
+    // Estado persistente
+    EngineState a, b;
+    a.calFactor = 0.00238f;
+    a.tareOffset = -12345;
+    a.zeroOffset = -23456;
+    a.timing.stableMs = 900;
+    char path[] = "/tmp/hx711_gpio_stXXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    CHECK(saveState(path, a) && loadState(path, b));
+    CHECK(b.tareOffset == -12345 && b.zeroOffset == -23456 &&
+          fabsf(b.calFactor - 0.00238f) < 1e-9f && b.timing.stableMs == 900);
+    unlink(path);
+  }
+  printf("selftest OK\n");
+  return 0;
+}
+
+void usage() {
+  fprintf(stderr,
+          "uso: hx711_gpio [--chip /dev/gpiochip0] [--dout 5] [--sck 6]\n"
+          "                [--pty <enlace> | --tcp <puerto>] [--state <fichero>]\n"
+          "                [--prio 50] [--cpu N] [--mock [--mock-grams G]]\n"
+          "     hx711_gpio --selftest\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    auto val = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    if (a == "--selftest") return selftest();
+    else if (a == "--chip") opt.chip = val();
+    else if (a == "--dout") opt.dout = (unsigned)atoi(val());
+    else if (a == "--sck") opt.sck = (unsigned)atoi(val());
+    else if (a == "--pty") opt.pty = val();
+    else if (a == "--tcp") opt.tcp = atoi(val());
+    else if (a == "--state") opt.state = val();
+    else if (a == "--prio") opt.prio = atoi(val());
+    else if (a == "--cpu") opt.cpu = atoi(val());
+    else if (a == "--mock") opt.mock = true;
+    else if (a == "--mock-grams") opt.mockGrams = (float)atof(val());
+    else {
+      usage();
+      return 2;
+    }
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSignal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  if (opt.mock) {
+    MockHx711Opts o;
+    o.virtualTime = false;
+    const float grams = opt.mockGrams;
+    MockGpioChip chip(o, cellSignal([grams](uint64_t) { return grams; }, 1));
+    // Sin --state, ya calibrado contra la celda simulada
+    EngineState st;
+    st.calFactor = CAL_TRUE;
+    st.tareOffset = st.zeroOffset = (int32_t)ZERO_COUNTS;
+    return runDaemon(chip, opt, st);
+  }
+  GpioChip chip;
+  if (!chip.open(opt.chip, opt.dout, opt.sck, "bascula-hx711")) {
+    fprintf(stderr, "hx711_gpio: %s\n", chip.error().c_str());
+    return 2;
+  }
+  return runDaemon(chip, opt, EngineState());
+}
@@ -0,0 +1,167 @@
+// firmware-esp32/host/mock_gpio.h
+//
+// gpiochip simulado con un HX711 conectado, con la misma interfaz que
+// GpioChip (gpio_chip.h), para probar la lectura y el pipeline sin placa.
+//
+// Modelo del HX711:
+// - Convierte continuamente cada periodUs; la palabra lista se sobrescribe
+//   con la siguiente si nadie la lee. DOUT baja cuando hay palabra lista.
+// - Cada flanco de subida de SCK saca el siguiente bit (MSB primero); el 25.º
+//   devuelve DOUT a alto y los pulsos 26 y 27 eligen la ganancia.
+// - SCK en alto más de 60 µs apaga el chip: DOUT queda en alto y, al bajar
+//   SCK, vuelve a arrancar y tarda settleUs en dar la primera conversión.
+//
+// Con `virtualTime` (pruebas) el reloj avanza opNs por cada acceso a una
+// línea y, con probabilidad preemptProb, un acceso tarda además preemptUs
+// (el hilo perdió la CPU): así se reproducen de forma determinista los
+// pulsos largos que dan lecturas corruptas. Sin él (--mock del demonio) el
+// reloj es el real y las conversiones llegan a su ritmo.
+
+#pragma once
+
+#include <time.h>
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace bascula {
+namespace host {
+
+struct MockHx711Opts {
+  uint32_t periodUs    = 12500;  // 80 SPS
+  uint32_t settleUs    = 50000;  // tras apagarse por SCK alto
+  bool     virtualTime = true;
+  uint32_t opNs        = 1500;   // coste de un ioctl de línea
+  double   preemptProb = 0.0;
+  uint32_t preemptUs   = 200;
+  bool     deadDout    = false;  // DOUT siempre en alto (sensor desconectado)
+  uint32_t seed        = 1;
+};
+
+class MockGpioChip {
+public:
+  // Cuentas crudas que convierte el HX711 en el instante t (ns).
+  typedef std::function<long(uint64_t tNs)> Signal;
+
+  MockGpioChip(const MockHx711Opts& o, Signal sig)
+      : o_(o), sig_(sig), rng_(o.seed), t_(0), t0_(monoNs()),
+        nextReadyNs_((uint64_t)o.periodUs * 1000u), word_(0), bit_(0),
+        ready_(false), sck_(false), down_(false), highSinceNs_(0),
+        powerDowns_(0) {}
+
+  void sck(bool high) {
+    access();
+    if (high == sck_) return;
+    sck_ = high;
+    if (high) {
+      highSinceNs_ = nowNs();
+      if (down_) return;
+      if (ready_ && bit_ == 0) bit_ = 1;           // primer bit
+      else if (bit_ >= 1 && bit_ < 27) bit_++;
+      if (bit_ == 25) {
+        ready_ = false;
+        delivered_.push_back(signExtend(word_));
+      }
+      return;
+    }
+    if (nowNs() - highSinceNs_ > 60000u) {
+      // Se apagó con SCK en alto; al bajar arranca de nuevo
+      powerDowns_++;
+      down_ = false;
+      ready_ = false;
+      bit_ = 0;
+      nextReadyNs_ = nowNs() + (uint64_t)o_.settleUs * 1000u;
+    }
+  }
+
+  bool dout() {
+    access();
+    update();
+    if (o_.deadDout || poweredDown()) return true;
+    if (bit_ >= 1 && bit_ <= 24) return (word_ >> (24 - bit_)) & 1u;
+    return !ready_;
+  }
+
+  bool waitDoutLow(uint32_t timeoutUs) {
+    update();
+    if (!o_.deadDout && ready_ && bit_ == 0) return true;
+    const uint64_t deadline = nowNs() + (uint64_t)timeoutUs * 1000u;
+    const uint64_t at = o_.deadDout ? deadline + 1 : nextReadyNs_;
+    sleepUntil(at < deadline ? at : deadline);
+    update();
+    return !o_.deadDout && ready_ && bit_ == 0;
+  }
+
+  uint64_t nowNs() const { return o_.virtualTime ? t_ : monoNs() - t0_; }
+
+  // Palabras que el HX711 llegó a sacar completas (24 bits), en orden.
+  const std::vector<long>& delivered() const { return delivered_; }
+  uint32_t                 powerDowns() const { return powerDowns_; }
+
+private:
+  static uint64_t monoNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+  }
+
+  static long signExtend(uint32_t w) { return (long)(int32_t)(w << 8) >> 8; }
+
+  void access() {
+    if (!o_.virtualTime) return;
+    t_ += o_.opNs;
+    if (o_.preemptProb > 0.0 &&
+        std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < o_.preemptProb) {
+      t_ += (uint64_t)o_.preemptUs * 1000u;
+    }
+  }
+
+  bool poweredDown() {
+    if (sck_ && nowNs() - highSinceNs_ > 60000u) down_ = true;
+    return down_;
+  }
+
+  // Conversiones terminadas hasta ahora. Durante una lectura la palabra no
+  // cambia (la conversión en curso se pierde).
+  void update() {
+    const uint64_t now = nowNs();
+    while (now >= nextReadyNs_) {
+      if (bit_ == 0 || bit_ >= 25) {
+        word_ = (uint32_t)sig_(nextReadyNs_) & 0xFFFFFFu;
+        ready_ = true;
+        bit_ = 0;
+      }
+      nextReadyNs_ += (uint64_t)o_.periodUs * 1000u;
+    }
+  }
+
+  void sleepUntil(uint64_t tNs) {
+    if (o_.virtualTime) {
+      if (tNs > t_) t_ = tNs;
+      return;
+    }
+    uint64_t abs = t0_ + tNs;
+    timespec ts{(time_t)(abs / 1000000000u), (long)(abs % 1000000000u)};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+  }
+
+  MockHx711Opts     o_;
+  Signal            sig_;
+  std::mt19937      rng_;
+  uint64_t          t_;
+  uint64_t          t0_;
+  uint64_t          nextReadyNs_;
+  uint32_t          word_;
+  uint8_t           bit_;   // 0 = sin lectura en curso; 1-24 bits; 25-27 ganancia
+  bool              ready_;
+  bool              sck_;
+  bool              down_;
+  uint64_t          highSinceNs_;
+  uint32_t          powerDowns_;
+  std::vector<long> delivered_;
+};
+
+}  // namespace host
+}  // namespace bascula
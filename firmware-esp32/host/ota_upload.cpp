@@ -0,0 +1,522 @@
+// firmware-esp32/host/ota_upload.cpp
+//
+// Cargador OTA por la UART de la báscula (Serial1), o contra un enlace
+// simulado que ejecuta el mismo analizador y receptor del firmware
+// (ota_stream.h) sobre una flash en RAM.
+//
+//   ota_upload --port /dev/serial0 [--baud 115200] firmware.bin
+//   ota_upload --sim [--loss P] [--corrupt P] [--cut N] [--seed S] firmware.bin
+//   ota_upload --sim --synthetic <bytes> ...
+//
+// Protocolo (ver README, sección "Actualización OTA por UART"):
+//   -> OTA:BEGIN:<bytes>,<crc32 hex>,<chunk>
+//   <- OTA:READY:<siguiente>,W:<ventana>,C:<chunk>,N:<chunks>
+//   -> tramas binarias (go-back-N, hasta W sin confirmar)
+//   <- OTA:ACK:<siguiente> | OTA:NAK:<siguiente>
+//   -> OTA:END
+//   <- OTA:OK:<bytes> | ERR:OTA:<motivo>
+//
+// Si el enlace se corta (o el ESP32 se reinicia) se repite OTA:BEGIN con la
+// misma imagen y el receptor continúa desde su último progreso guardado.
+// Sale con 0 solo si la báscula responde OTA:OK.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ota_stream.h"
+#include "serial_link.h"
+
+using namespace bascula;
+using bascula::host::Link;
+using bascula::host::SerialLink;
+
+namespace {
+
+// Flash en RAM con la interfaz de EspPartitionFlash.
+struct RamFlash {
+  std::vector<uint8_t> mem;
+  explicit RamFlash(size_t n) : mem(n, 0xFF) {}
+  size_t size() const { return mem.size(); }
+  bool read(uint32_t off, void* dst, size_t n) {
+    if (off + n > mem.size()) return false;
+    memcpy(dst, &mem[off], n);
+    return true;
+  }
+  bool write(uint32_t off, const void* src, size_t n) {
+    if (off + n > mem.size()) return false;
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < n; ++i) mem[off + i] &= s[i];  // NOR: solo 1 -> 0
+    return true;
+  }
+  bool erase(uint32_t off) {
+    if (off % OTA_SECTOR_BYTES != 0 || off + OTA_SECTOR_BYTES > mem.size()) return false;
+    memset(&mem[off], 0xFF, OTA_SECTOR_BYTES);
+    return true;
+  }
+};
+
+// Báscula simulada con reloj virtual: tiempo de línea a `baud`, coste de
+// borrado/escritura de flash, ventana de OTA_WINDOW slots como en main.cpp,
+// tramas G: a 5 Hz mezcladas con las respuestas, pérdidas y corrupción de
+// tramas, y cortes (reinicio del ESP32: solo sobrevive el progreso en "NVS").
+class SimLink : public Link {
+public:
+  struct Opts {
+    int      baud = 115200;
+    double   loss = 0.0;
+    double   corrupt = 0.0;
+    int      cutEvery = 0;  // reiniciar el ESP32 cada N tramas recibidas (0 = nunca)
+    uint32_t seed = 1;
+  };
+
+  explicit SimLink(const Opts& o)
+      : o_(o), flash_(0x1E0000), rx_(flash_), rng_(o.seed), now_(0), hostTxFree_(0),
+        devBusy_(0), nextG_(0), active_(false), framesIn_(0), haveSaved_(false) {}
+
+  void write(const uint8_t* p, size_t n) override {
+    // Los bytes de un write() salen seguidos; la llegada del último marca el
+    // momento en que la trama queda completa en el ESP32.
+    double start = hostTxFree_ > now_ ? hostTxFree_ : now_;
+    hostTxFree_ = start + wire(n);
+    std::vector<uint8_t> bytes(p, p + n);
+    bool isFrame = n > 0 && p[0] == OTA_SYNC0;
+    if (isFrame) {
+      std::uniform_real_distribution<double> u(0.0, 1.0);
+      if (u(rng_) < o_.loss) return;
+      if (u(rng_) < o_.corrupt) {
+        std::uniform_int_distribution<size_t> at(2, n - 1);
+        bytes[at(rng_)] ^= 0x10;
+      }
+    }
+    deviceRx(bytes, hostTxFree_);
+  }
+
+  bool readLine(std::string& out, int timeoutMs) override {
+    double deadline = now_ + timeoutMs / 1000.0;
+    double tResp = resp_.empty() ? 1e300 : resp_.front().t;
+    if (active_ && nextG_ < tResp && nextG_ <= deadline) {
+      now_ = nextG_ > now_ ? nextG_ : now_;
+      nextG_ += 0.200;
+      out = "G:1234.50,S:1";
+      return true;
+    }
+    if (tResp <= deadline) {
+      now_ = tResp > now_ ? tResp : now_;
+      out = resp_.front().line;
+      resp_.pop_front();
+      return true;
+    }
+    now_ = deadline;
+    return false;
+  }
+
+  double elapsed() const override { return now_; }
+
+  // Imagen escrita (para comprobar en las pruebas).
+  const RamFlash& flash() const { return flash_; }
+  int reboots() const { return reboots_; }
+
+private:
+  struct Resp {
+    double      t;
+    std::string line;
+  };
+
+  double wire(size_t n) const { return n * 10.0 / o_.baud; }
+
+  void reply(double t, const std::string& line) {
+    double at = t + wire(line.size() + 2);
+    if (!resp_.empty() && resp_.back().t > at) at = resp_.back().t;
+    resp_.push_back(Resp{at, line});
+  }
+
+  void reboot(double t) {
+    // Todo lo que no está en flash/NVS se pierde, incluidas las respuestas
+    // en vuelo y las tramas pendientes.
+    reboots_++;
+    resp_.clear();
+    inFlight_.clear();
+    parser_.reset();
+    rx_.abort();
+    active_ = false;
+    line_.clear();
+    bootUntil_ = t + 0.3;
+    devBusy_ = bootUntil_;
+  }
+
+  void deviceRx(const std::vector<uint8_t>& bytes, double t) {
+    if (t < bootUntil_) return;  // arrancando: se pierde
+    for (uint8_t b : bytes) {
+      if (parser_.active() || (active_ && b == OTA_SYNC0)) {
+        if (!parser_.active()) line_.clear();
+        OtaFrameParser::Result r = parser_.feed(b);
+        if (r == OtaFrameParser::FRAME) onFrame(t);
+        else if (r == OtaFrameParser::BAD && rx_.status() == OtaReceiver<RamFlash>::RECEIVING) {
+          process(t, 0.0001, [this]() { return "OTA:NAK:" + std::to_string(rx_.next()); });
+        }
+        continue;
+      }
+      if (b == '\n' || b == '\r') {
+        if (!line_.empty()) onLine(line_, t);
+        line_.clear();
+      } else {
+        line_.push_back((char)b);
+      }
+    }
+  }
+
+  template <class F>
+  void process(double arrival, double cost, F fn) {
+    double start = devBusy_ > arrival ? devBusy_ : arrival;
+    devBusy_ = start + cost;
+    reply(devBusy_, fn());
+  }
+
+  void onFrame(double t) {
+    // Slots ocupados = tramas que aún no ha procesado la tarea ota.
+    while (!inFlight_.empty() && inFlight_.front() <= t) inFlight_.pop_front();
+    if (inFlight_.size() >= OTA_WINDOW) return;  // sin slot: se pierde
+
+    if (o_.cutEvery > 0 && ++framesIn_ % (uint32_t)o_.cutEvery == 0) {
+      reboot(t);
+      return;
+    }
+    OtaFrame f;
+    otaFrameView(parser_.bytes(), f);
+    uint32_t off = (uint32_t)f.seq * rx_.resume().chunk;
+    double cost = 0.002 + (off % OTA_SECTOR_BYTES == 0 ? 0.045 : 0.0);  // borrado 4 KiB
+    OtaReceiver<RamFlash>::Verdict v = rx_.accept(f);
+    if (rx_.takePersistDue()) {
+      saved_ = rx_.resume();
+      haveSaved_ = true;
+      cost += 0.010;
+    }
+    process(t, cost, [this, v]() {
+      if (v == OtaReceiver<RamFlash>::FAIL) return std::string("ERR:OTA:flash");
+      return std::string(v == OtaReceiver<RamFlash>::ACK ? "OTA:ACK:" : "OTA:NAK:") +
+             std::to_string(rx_.next());
+    });
+    inFlight_.push_back(devBusy_);
+  }
+
+  void onLine(const std::string& l, double t) {
+    if (l.compare(0, 10, "OTA:BEGIN:") == 0) {
+      unsigned long size = 0, chunk = 0;
+      unsigned long crc = 0;
+      if (sscanf(l.c_str() + 10, "%lu,%lx,%lu", &size, &crc, &chunk) != 3) {
+        process(t, 0.0001, []() { return std::string("ERR:OTA:format"); });
+        return;
+      }
+      int e = rx_.begin((uint32_t)size, (uint32_t)crc, (uint16_t)chunk,
+                        haveSaved_ ? &saved_ : nullptr);
+      if (e != OtaReceiver<RamFlash>::OK) {
+        active_ = false;
+        process(t, 0.0001, [e]() {
+          return std::string(e == OtaReceiver<RamFlash>::E_CHUNK ? "ERR:OTA:chunk"
+                                                                 : "ERR:OTA:size");
+        });
+        return;
+      }
+      saved_ = rx_.resume();
+      haveSaved_ = true;
+      active_ = true;
+      if (nextG_ < t) nextG_ = t;
+      process(t, 0.005, [this, chunk]() {
+        return "OTA:READY:" + std::to_string(rx_.next()) + ",W:" +
+               std::to_string(OTA_WINDOW) + ",C:" + std::to_string(chunk) + ",N:" +
+               std::to_string(rx_.chunks());
+      });
+    } else if (l == "OTA:END") {
+      if (rx_.status() != OtaReceiver<RamFlash>::COMPLETE) {
+        process(t, 0.0001, [this]() {
+          return "ERR:OTA:incomplete,NEXT:" + std::to_string(rx_.next());
+        });
+        return;
+      }
+      active_ = false;
+      bool ok = rx_.verify();
+      haveSaved_ = false;
+      double cost = rx_.bytes() / 20e6;  // lectura de flash a ~20 MB/s
+      if (!ok) rx_.abort();
+      process(t, cost, [this, ok]() {
+        return ok ? "OTA:OK:" + std::to_string(rx_.bytes()) : std::string("ERR:OTA:crc");
+      });
+    } else if (l == "OTA:ABORT") {
+      active_ = false;
+      rx_.abort();
+      haveSaved_ = false;
+      process(t, 0.0001, []() { return std::string("ACK:OTA:ABORT"); });
+    }
+  }
+
+  Opts                       o_;
+  RamFlash                   flash_;
+  OtaReceiver<RamFlash>      rx_;
+  OtaFrameParser             parser_;
+  std::mt19937               rng_;
+  double                     now_;
+  double                     hostTxFree_;
+  double                     devBusy_;
+  double                     nextG_;
+  bool                       active_;
+  std::string                line_;
+  std::deque<Resp>           resp_;
+  std::deque<double>         inFlight_;
+  uint32_t                   framesIn_;
+  OtaResume                  saved_;
+  bool                       haveSaved_;
+  int                        reboots_ = 0;
+  double                     bootUntil_ = 0;
+};
+
+// ---------- cargador ----------
+
+struct Stats {
+  size_t frames = 0;
+  size_t wireBytes = 0;
+  size_t retransmits = 0;
+  size_t sessions = 0;
+};
+
+// Espera una línea OTA:/ERR:OTA: (las tramas G: siguen llegando durante la
+// OTA y se ignoran) hasta `secs` segundos. false si vence el plazo.
+bool waitOtaLine(Link& link, std::string& l, double secs) {
+  const double until = link.elapsed() + secs;
+  for (;;) {
+    double left = until - link.elapsed();
+    if (left <= 0 || !link.readLine(l, (int)(left * 1000) + 1)) return false;
+    if (l.compare(0, 4, "OTA:") == 0 || l.compare(0, 8, "ERR:OTA:") == 0) return true;
+  }
+}
+
+bool parseNum(const std::string& l, const char* prefix, unsigned long& v) {
+  size_t n = strlen(prefix);
+  if (l.compare(0, n, prefix) != 0) return false;
+  v = strtoul(l.c_str() + n, nullptr, 10);
+  return true;
+}
+
+// Abre (o reabre) la sesión. Devuelve el siguiente chunk o -1.
+long beginSession(Link& link, size_t size, uint32_t crc, unsigned chunk, unsigned& window,
+                  Stats& st) {
+  char cmd[64];
+  snprintf(cmd, sizeof(cmd), "OTA:BEGIN:%zu,%08x,%u", size, crc, chunk);
+  for (int attempt = 0; attempt < 5; ++attempt) {
+    link.writeLine(cmd);
+    std::string l;
+    while (waitOtaLine(link, l, 1.5)) {
+      unsigned long next;
+      if (parseNum(l, "OTA:READY:", next)) {
+        size_t w = l.find(",W:");
+        window = w != std::string::npos ? (unsigned)strtoul(l.c_str() + w + 3, nullptr, 10) : 1;
+        if (window == 0 || window > OTA_WINDOW) window = OTA_WINDOW;
+        st.sessions++;
+        return (long)next;
+      }
+      if (l.compare(0, 8, "ERR:OTA:") == 0) {
+        fprintf(stderr, "ota_upload: %s\n", l.c_str());
+        return -1;
+      }
+    }
+  }
+  fprintf(stderr, "ota_upload: sin respuesta a OTA:BEGIN\n");
+  return -1;
+}
+
+int upload(Link& link, const std::vector<uint8_t>& img, unsigned chunk, bool compress,
+           bool badCrc, Stats& st) {
+  const uint32_t crc = crc32(img.data(), img.size()) ^ (badCrc ? 1u : 0u);
+  const size_t chunks = (img.size() + chunk - 1) / chunk;
+
+  // Las tramas se preparan una vez: los reenvíos cuestan solo la línea.
+  std::vector<std::vector<uint8_t>> frames(chunks);
+  size_t compressed = 0;
+  for (size_t i = 0; i < chunks; ++i) {
+    size_t off = i * chunk;
+    size_t n = img.size() - off < chunk ? img.size() - off : chunk;
+    uint8_t buf[OTA_FRAME_MAX];
+    size_t len = otaEncodeFrame((uint16_t)i, &img[off], n, compress, buf);
+    frames[i].assign(buf, buf + len);
+    compressed += len;
+  }
+  printf("imagen: %zu bytes, %zu chunks de %u, %zu bytes en tramas (%.1f%%)\n", img.size(),
+         chunks, chunk, compressed, 100.0 * compressed / img.size());
+
+  unsigned window = 1;
+  long r = beginSession(link, img.size(), crc, chunk, window, st);
+  if (r < 0) return 1;
+  size_t base = (size_t)r, nextSend = base;
+  long rewoundAt = -1;  // un NAK repetido por las tramas en vuelo no rebobina otra vez
+  int timeouts = 0;
+  while (base < chunks) {
+    while (nextSend < chunks && nextSend < base + window) {
+      link.write(frames[nextSend].data(), frames[nextSend].size());
+      st.frames++;
+      st.wireBytes += frames[nextSend].size();
+      nextSend++;
+    }
+    std::string l;
+    if (!waitOtaLine(link, l, 1.0)) {
+      // Sin noticias: se reenvía la ventana; tras varios plazos, se reabre
+      // la sesión (reinicio del ESP32 o cable desconectado).
+      st.retransmits += nextSend - base;
+      nextSend = base;
+      rewoundAt = -1;
+      if (++timeouts >= 3) {
+        link.reconnect();
+        r = beginSession(link, img.size(), crc, chunk, window, st);
+        if (r < 0) return 1;
+        base = nextSend = (size_t)r;
+        timeouts = 0;
+      }
+      continue;
+    }
+    unsigned long n;
+    if (parseNum(l, "OTA:ACK:", n)) {
+      timeouts = 0;
+      if (n > base) {
+        base = n;
+        rewoundAt = -1;
+        if (nextSend < base) nextSend = base;
+      }
+    } else if (parseNum(l, "OTA:NAK:", n)) {
+      timeouts = 0;
+      if (n >= base && (long)n != rewoundAt) {
+        st.retransmits += nextSend > n ? nextSend - n : 0;
+        base = n;
+        nextSend = n;
+        rewoundAt = (long)n;
+      }
+    } else if (l.compare(0, 8, "ERR:OTA:") == 0) {
+      fprintf(stderr, "ota_upload: %s\n", l.c_str());
+      return 1;
+    }
+  }
+
+  link.writeLine("OTA:END");
+  std::string l;
+  while (waitOtaLine(link, l, 5.0)) {
+    if (l.compare(0, 7, "OTA:OK:") == 0) return 0;
+    if (l.compare(0, 8, "ERR:OTA:") == 0) {
+      fprintf(stderr, "ota_upload: %s\n", l.c_str());
+      return 1;
+    }
+  }
+  fprintf(stderr, "ota_upload: sin respuesta a OTA:END\n");
+  return 1;
+}
+
+// Imagen de prueba con la mezcla típica de un binario: zonas repetitivas
+// (tablas, relleno) y zonas de alta entropía.
+std::vector<uint8_t> syntheticImage(size_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> img(n);
+  size_t i = 0;
+  while (i < n) {
+    size_t run = 64 + rng() % 960;
+    bool noisy = rng() % 3 == 0;
+    uint8_t pat[16];
+    for (auto& b : pat) b = (uint8_t)rng();
+    for (size_t k = 0; k < run && i < n; ++k, ++i) {
+      img[i] = noisy ? (uint8_t)rng() : (uint8_t)(pat[k % 16] + (k / 256));
+    }
+  }
+  return img;
+}
+
+void usage() {
+  fprintf(stderr,
+          "uso: ota_upload (--port <tty> [--baud B] | --sim [--loss P] [--corrupt P]\n"
+          "                 [--cut N] [--seed S]) [--chunk C] [--raw] [--bad-crc]\n"
+          "                 (<imagen.bin> | --synthetic <bytes>)\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* port = nullptr;
+  const char* path = nullptr;
+  bool sim = false, compress = true, badCrc = false;
+  size_t synthetic = 0;
+  unsigned chunk = OTA_CHUNK_MAX;
+  SimLink::Opts so;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    auto val = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    if (a == "--port") port = val();
+    else if (a == "--baud") so.baud = atoi(val());
+    else if (a == "--sim") sim = true;
+    else if (a == "--loss") so.loss = atof(val());
+    else if (a == "--corrupt") so.corrupt = atof(val());
+    else if (a == "--cut") so.cutEvery = atoi(val());
+    else if (a == "--seed") so.seed = (uint32_t)strtoul(val(), nullptr, 10);
+    else if (a == "--chunk") chunk = (unsigned)atoi(val());
+    else if (a == "--raw") compress = false;
+    else if (a == "--bad-crc") badCrc = true;
+    else if (a == "--synthetic") synthetic = strtoul(val(), nullptr, 10);
+    else if (a[0] != '-' && !path) path = argv[i];
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if ((!sim && !port) || (!path && synthetic == 0)) {
+    usage();
+    return 2;
+  }
+
+  std::vector<uint8_t> img;
+  if (path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+      fprintf(stderr, "ota_upload: no se puede leer %s\n", path);
+      return 2;
+    }
+    img.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  } else {
+    img = syntheticImage(synthetic, so.seed);
+  }
+  if (img.empty()) {
+    fprintf(stderr, "ota_upload: imagen vacía\n");
+    return 2;
+  }
+
+  Stats st;
+  int rc;
+  double secs;
+  if (sim) {
+    SimLink link(so);
+    rc = upload(link, img, chunk, compress, badCrc, st);
+    secs = link.elapsed();
+    if (rc == 0 && memcmp(link.flash().mem.data(), img.data(), img.size()) != 0) {
+      fprintf(stderr, "ota_upload: la imagen simulada no coincide\n");
+      rc = 1;
+    }
+    printf("sim: %d reinicios del ESP32\n", link.reboots());
+  } else {
+    SerialLink link(port, so.baud);
+    if (!link.ok()) {
+      fprintf(stderr, "ota_upload: no se puede abrir %s\n", port);
+      return 2;
+    }
+    rc = upload(link, img, chunk, compress, badCrc, st);
+    secs = link.elapsed();
+  }
+  printf("%s: %.2f s, %.1f KiB/s de imagen, %zu tramas, %zu reenvíos, %zu sesiones, "
+         "%zu bytes en línea\n",
+         rc == 0 ? "OK" : "FALLO", secs, secs > 0 ? img.size() / 1024.0 / secs : 0.0,
+         st.frames, st.retransmits, st.sessions, st.wireBytes);
+  return rc;
+}
@@ -0,0 +1,108 @@
+// firmware-esp32/host/serial_link.h
+//
+// Enlace por líneas con la báscula para las herramientas del host: interfaz
+// común (para poder sustituirla por un enlace simulado) y la implementación
+// sobre un tty real (termios, 8N1 en crudo). Las líneas se entregan tal cual,
+// sin el fin de línea: las tramas binarias de bulk_codec.h también son
+// "líneas" y llegan completas.
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace bascula {
+namespace host {
+
+class Link {
+public:
+  virtual ~Link() {}
+  virtual void write(const uint8_t* p, size_t n) = 0;
+  // Siguiente línea recibida (sin fin de línea) o false si vence el plazo.
+  virtual bool readLine(std::string& out, int timeoutMs) = 0;
+  // Tiempo transcurrido en segundos (real o simulado).
+  virtual double elapsed() const = 0;
+  // Tras muchos plazos vencidos seguidos: reabrir la sesión.
+  virtual void reconnect() {}
+
+  void writeLine(const std::string& s) {
+    std::string l = s + "\n";
+    write(reinterpret_cast<const uint8_t*>(l.data()), l.size());
+  }
+};
+
+class SerialLink : public Link {
+public:
+  SerialLink(const char* path, int baud) : fd_(-1), t0_(std::chrono::steady_clock::now()) {
+    fd_ = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0) return;
+    termios tio;
+    tcgetattr(fd_, &tio);
+    cfmakeraw(&tio);
+    speed_t sp = baud == 921600 ? B921600 : baud == 460800 ? B460800
+               : baud == 230400 ? B230400 : B115200;
+    cfsetispeed(&tio, sp);
+    cfsetospeed(&tio, sp);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd_, TCSANOW, &tio);
+    tcflush(fd_, TCIOFLUSH);
+  }
+  ~SerialLink() override {
+    if (fd_ >= 0) ::close(fd_);
+  }
+  bool ok() const { return fd_ >= 0; }
+
+  void write(const uint8_t* p, size_t n) override {
+    while (n > 0) {
+      ssize_t w = ::write(fd_, p, n);
+      if (w < 0) {
+        if (errno != EAGAIN) return;
+        pollfd pf{fd_, POLLOUT, 0};
+        poll(&pf, 1, 100);
+        continue;
+      }
+      p += w;
+      n -= (size_t)w;
+    }
+  }
+
+  bool readLine(std::string& out, int timeoutMs) override {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (;;) {
+      size_t nl = buf_.find('\n');
+      if (nl != std::string::npos) {
+        out = buf_.substr(0, nl);
+        buf_.erase(0, nl + 1);
+        if (!out.empty() && out.back() == '\r') out.pop_back();
+        return true;
+      }
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now()).count();
+      if (left <= 0) return false;
+      pollfd pf{fd_, POLLIN, 0};
+      if (poll(&pf, 1, (int)left) <= 0) continue;
+      char tmp[256];
+      ssize_t r = ::read(fd_, tmp, sizeof(tmp));
+      if (r > 0) buf_.append(tmp, (size_t)r);
+    }
+  }
+
+  double elapsed() const override {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0_).count();
+  }
+
+private:
+  int         fd_;
+  std::string buf_;
+  std::chrono::steady_clock::time_point t0_;
+};
+
+}  // namespace host
+}  // namespace bascula
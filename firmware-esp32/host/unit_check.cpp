@@ -0,0 +1,565 @@
+// firmware-esp32/host/unit_check.cpp
+//
+// Pruebas de las cabeceras portables de ../src que no tienen herramienta
+// propia en el host. Cada bloque ejercita una clase con entradas sintéticas,
+// sin Arduino, sin hilos y sin reloj real.
+//
+//   unit_check --selftest        todas las pruebas (make check)
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "channel_mux.h"
+#include "checkweigher.h"
+#include "event_log.h"
+#include "overload.h"
+#include "peak_hold.h"
+#include "profile.h"
+#include "quantizer.h"
+#include "segmenter.h"
+#include "selftest.h"
+#include "spectrum.h"
+#include "warm_state.h"
+
+using namespace bascula;
+
+namespace {
+
+#define CHECK(c)                                                              \
+  do {                                                                        \
+    if (!(c)) {                                                               \
+      fprintf(stderr, "selftest: falla %s (línea %d)\n", #c, __LINE__);      \
+      return 1;                                                               \
+    }                                                                         \
+  } while (0)
+
+const int32_t ZERO  = 84000;         // crudo con el plato vacío
+const float   CAL   = 1.0f / 400.0f; // g por cuenta
+
+long rawFor(float grams) { return ZERO + lroundf(grams / CAL); }
+
+// Flash en RAM con la interfaz de EspPartitionFlash; `tornAt` corta la
+// siguiente escritura tras ese número de bytes (corte de alimentación).
+struct RamFlash {
+  std::vector<uint8_t> mem;
+  size_t tornAt = 0;
+  explicit RamFlash(size_t n) : mem(n, 0xFF) {}
+  size_t size() const { return mem.size(); }
+  bool read(uint32_t off, void* dst, size_t n) {
+    if (off + n > mem.size()) return false;
+    memcpy(dst, &mem[off], n);
+    return true;
+  }
+  bool write(uint32_t off, const void* src, size_t n) {
+    if (off + n > mem.size()) return false;
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+    if (tornAt != 0) {
+      n = tornAt;
+      tornAt = 0;
+    }
+    for (size_t i = 0; i < n; ++i) mem[off + i] &= s[i];  // NOR: solo 1 -> 0
+    return true;
+  }
+  bool erase(uint32_t off) {
+    if (off % LOG_SECTOR_BYTES != 0 || off + LOG_SECTOR_BYTES > mem.size()) return false;
+    memset(&mem[off], 0xFF, LOG_SECTOR_BYTES);
+    return true;
+  }
+};
+
+// Todo el registro desde `since`, en lotes de 100 como el volcado LOG:.
+std::vector<LogRecord> logDump(RingLog<RamFlash>& log, uint32_t since) {
+  std::vector<LogRecord> all;
+  LogRecord batch[100];
+  LogCursor cur = log.begin();
+  size_t n;
+  while ((n = log.read(since, cur, batch, 100)) > 0) all.insert(all.end(), batch, batch + n);
+  return all;
+}
+
+bool logContiguous(const std::vector<LogRecord>& v, uint32_t first, uint32_t last) {
+  if (v.size() != last - first + 1) return false;
+  for (size_t i = 0; i < v.size(); ++i) {
+    if (v[i].seq != first + i || v[i].value != (int32_t)v[i].seq) return false;
+  }
+  return true;
+}
+
+int eventLogTests() {
+  {
+    RamFlash small(LOG_SECTOR_BYTES);
+    RingLog<RamFlash> log(small);
+    CHECK(!log.mount() && !log.append(LOG_TARE, 0, 0));  // un sector no basta
+  }
+  RamFlash flash(3 * LOG_SECTOR_BYTES);
+  flash.mem[5] = 0x00;  // basura de fábrica en el sector 0
+  {
+    RingLog<RamFlash> log(flash);
+    CHECK(log.mount() && log.nextSeq() == 1 && flash.mem[5] == 0xFF);
+    log.beginBoot();
+    CHECK(log.boot() == 0 && log.capacity() == 2 * LOG_PER_SECTOR);
+    for (uint32_t i = 1; i <= 10; ++i) CHECK(log.append(LOG_TARE, (int32_t)i, i * 10));
+    std::vector<LogRecord> v = logDump(log, 0);
+    CHECK(logContiguous(v, 1, 10) && v[9].kind == LOG_TARE && v[9].ms == 100);
+    // Vuelta completa y media: se borra el sector más antiguo y se sigue
+    for (uint32_t i = 11; i <= 818; ++i) CHECK(log.append(LOG_CAP, (int32_t)i, i));
+    v = logDump(log, 0);
+    CHECK(logContiguous(v, 257, 818));
+    CHECK(logContiguous(logDump(log, 800), 800, 818));
+    CHECK(logContiguous(logDump(log, 300), 300, 818));
+    CHECK(logDump(log, 819).empty());
+  }
+  {
+    // Reinicio: la cabeza y la secuencia se recuperan de la flash
+    RingLog<RamFlash> log(flash);
+    CHECK(log.mount() && log.nextSeq() == 819 && log.boot() == 0);
+    log.beginBoot();
+    CHECK(log.boot() == 1 && log.append(LOG_BOOT, 819, 0));
+    // Corte a mitad de registro: queda un hueco ni válido ni en blanco
+    flash.tornAt = 7;
+    CHECK(log.append(LOG_TARE, 820, 0));
+  }
+  {
+    RingLog<RamFlash> log(flash);
+    CHECK(log.mount() && log.nextSeq() == 820);
+    log.beginBoot();
+    CHECK(log.boot() == 2 && log.append(LOG_BOOT, 820, 0));
+    std::vector<LogRecord> v = logDump(log, 818);
+    CHECK(v.size() == 3 && v[0].seq == 818 && v[1].boot == 1 && v[2].seq == 820);
+    CHECK(v[2].boot == 2 && v[2].kind == LOG_BOOT);
+  }
+  CHECK(strcmp(logKindName(LOG_OVL_CLR), "OVL_CLR") == 0 && strcmp(logKindName(0), "?") == 0);
+  return 0;
+}
+
+int overloadTests() {
+  {
+    // Umbrales en gramos sobre el cero de calibración, enganche y borrado
+    OverloadGuard g;
+    g.configure(2000.0f, 2400.0f);
+    g.setCalibration(CAL, ZERO);
+    CHECK(!g.push(rawFor(1990.0f)) && g.level() == OverloadGuard::NORMAL);
+    CHECK(!g.push(rawFor(2010.0f)) && g.level() == OverloadGuard::OVER_CAPACITY);
+    CHECK(!g.latched() && g.clearLatch());
+    CHECK(g.push(rawFor(2410.0f)) && g.latched() && g.count() == 1);
+    CHECK(!g.push(rawFor(2500.0f)) && g.count() == 1);  // ya enganchado
+    CHECK(!g.clearLatch());                              // con la carga encima
+    CHECK(!g.push(rawFor(0.0f)) && g.flagged() && g.clearLatch() && !g.flagged());
+    // Recalibrar la pendiente recalcula las cuentas de los umbrales: las
+    // mismas cuentas son ahora 3980 g
+    g.setCalibration(CAL * 2.0f, ZERO);
+    CHECK(g.push(rawFor(1990.0f)) && g.count() == 2);
+  }
+  {
+    // Unidad nueva con el perfil por defecto: sin cero de calibración la
+    // protección no actúa ni con el offset típico del HX711 ni saturado
+    const CalProfile p = profileUncalibrated(FilterTiming{375, 112, 1.0f, 700}, 5000.0f, 6000.0f);
+    OverloadGuard g;
+    g.configure(p.capacityG, p.overloadG);
+    g.setCalibration(p.calFactor, p.zeroOffset);
+    CHECK(!g.armed());
+    CHECK(!g.push(ZERO) && !g.push(HX711_RAW_MAX) && !g.flagged() && g.count() == 0);
+    // C: fija cero y pendiente: ahora sí protege
+    g.setCalibration(CAL, ZERO);
+    g.rearm();
+    CHECK(g.armed() && !g.push(rawFor(100.0f)) && !g.flagged());
+    CHECK(g.push(rawFor(6100.0f)) && g.count() == 1);
+  }
+  {
+    // Enganche con una calibración mala (pendiente 10 veces mayor): C: lo
+    // suelta y la carga real, 300 g, ya no lo provoca
+    OverloadGuard g;
+    g.configure(2000.0f, 2400.0f);
+    g.setCalibration(CAL * 10.0f, ZERO);
+    CHECK(g.push(rawFor(300.0f)) && g.latched());
+    g.setCalibration(CAL, ZERO);
+    g.rearm();
+    CHECK(!g.latched() && !g.push(rawFor(300.0f)) && !g.flagged() && g.count() == 1);
+  }
+  {
+    // Argumento de CAP:
+    float cap = -1.0f, ovl = -1.0f;
+    CHECK(capacityParse("400", cap, ovl) == CAP_OK && cap == 400.0f && fabsf(ovl - 480.0f) < 0.01f);
+    CHECK(capacityParse("400,450", cap, ovl) == CAP_OK && ovl == 450.0f);
+    CHECK(capacityParse("0", cap, ovl) == CAP_OK && cap == 0.0f);  // CAP:0 apaga
+    const char* const value[] = {"", "x", "100abc", "-1", "nan", "inf", "100;150", "100 "};
+    for (const char* bad : value) CHECK(capacityParse(bad, cap, ovl) == CAP_VALUE);
+    const char* const over[] = {"100,150xyz", "100,", "100,50", "100,nan", "100,inf", "100,150,1"};
+    for (const char* bad : over) CHECK(capacityParse(bad, cap, ovl) == CAP_OVERLOAD);
+    CHECK(cap == 0.0f && ovl == 0.0f);  // sin tocar si falla
+  }
+  {
+    // Pendiente negativa (celda montada al revés) y saturación
+    OverloadGuard g;
+    g.configure(2000.0f, 2400.0f);
+    g.setCalibration(-CAL, ZERO);
+    CHECK(!g.push(ZERO - lroundf(1990.0f / CAL)) && g.level() == OverloadGuard::NORMAL);
+    CHECK(g.push(HX711_RAW_MIN) && g.level() == OverloadGuard::OVERLOAD);
+  }
+  {
+    // Capacidad 0: protección apagada
+    OverloadGuard g;
+    g.configure(0.0f, 0.0f);
+    g.setCalibration(CAL, ZERO);
+    CHECK(!g.push(HX711_RAW_MAX) && !g.flagged());
+  }
+  return 0;
+}
+
+int profileTests() {
+  // Argumento de FILT:
+  FilterTiming t{0, 0, 0.0f, 0};
+  CHECK(filterTimingParse("375,112,1.00,700", t) == FILT_OK);
+  CHECK(t.medianMs == 375 && t.iirTauMs == 112 && t.stableDeltaG == 1.0f && t.stableMs == 700);
+  const char* const format[] = {"375,112,1.00", "375,112,1.00,700x", "375,112,1.00,700,1",
+                                "375,112,1.00,700 ", "-1,112,1.00,700", "375,+112,1.00,700",
+                                "375,112,1.00, 700", "375,112,1.00,-4294966596", ""};
+  for (const char* bad : format) CHECK(filterTimingParse(bad, t) == FILT_FORMAT);
+  const char* const value[] = {"3001,112,1.00,700", "375,5001,1.00,700", "375,112,0.01,700",
+                               "375,112,-1,700", "375,112,nan,700", "375,112,1.00,99",
+                               "4294967671,112,1.00,700", "375,112,1.00,18446744073709551615"};
+  for (const char* bad : value) CHECK(filterTimingParse(bad, t) == FILT_VALUE);
+  CHECK(t.medianMs == 375 && t.stableMs == 700);  // sin tocar si falla
+  return 0;
+}
+
+int quantizerTests() {
+  DisplayQuantizer q;
+  CHECK(!q.active() && q.push(12.345f) == 12.345f);  // div = 0: sin tocar
+  q.configure(1.0f, 0.9f);
+  CHECK(q.hysteresis() == 0.45f);  // acotada a 0,45 div
+  q.configure(-1.0f, 0.1f);
+  CHECK(!q.active() && q.hysteresis() == 0.0f);
+  // Con ROC la trama sale cuando cambia el valor mostrado: se cuentan los
+  // cambios con ruido de ±0,3 g justo en el límite 100,5 g
+  auto changes = [&](float hyst) {
+    q.configure(1.0f, hyst);
+    int n = 0;
+    float last = q.push(100.5f);
+    for (int i = 0; i < 400; ++i) {
+      float shown = q.push(100.5f + 0.3f * sinf((float)i * 0.7f));
+      n += shown != last ? 1 : 0;
+      last = shown;
+    }
+    return n;
+  };
+  CHECK(changes(0.0f) > 50);  // sin histéresis el último dígito parpadea
+  CHECK(changes(0.4f) == 0);
+  // Con histéresis: 100 se mantiene hasta alejarse 0,5 + 0,4 g, y entonces
+  // salta a la división más cercana
+  q.configure(1.0f, 0.4f);
+  CHECK(q.push(100.2f) == 100.0f);
+  CHECK(q.push(100.85f) == 100.0f && q.push(99.15f) == 100.0f);
+  CHECK(q.push(100.95f) == 101.0f);
+  CHECK(q.push(103.4f) == 103.0f);  // salto grande: directo, sin pasos
+  // reset() (tara) fija la siguiente muestra sin histéresis
+  q.reset();
+  CHECK(q.push(0.3f) == 0.0f && !std::signbit(q.push(-0.3f)));
+  // División de 0,5 g
+  q.configure(0.5f, 0.1f);
+  CHECK(q.push(250.3f) == 250.5f && q.push(250.2f) == 250.5f && q.push(250.1f) == 250.0f);
+  return 0;
+}
+
+int segmenterTests() {
+  const SegParams p{5.0f, 1.0f, 300};
+  Segmenter seg(p);
+  SegEvent ev{};
+  uint32_t t = 0;
+  int events = 0;
+  // Avanza hasta `ms` a 20 ms por muestra con el peso de `grams`
+  auto feed = [&](uint32_t ms, float (*grams)(uint32_t)) {
+    for (; t < ms; t += 20) events += seg.push(grams(t), t, ev) ? 1 : 0;
+  };
+  feed(1000, [](uint32_t) { return 0.0f; });
+  CHECK(events == 0 && !seg.moving() && seg.baseline() == 0.0f);
+  // Subida de 100 g en 200 ms: en movimiento hasta 300 ms quieto
+  feed(1200, [](uint32_t ms) { return (float)(ms - 1000) * 0.5f; });
+  CHECK(seg.moving() && events == 0);
+  feed(1480, [](uint32_t) { return 100.0f; });
+  CHECK(seg.moving() && events == 0);
+  feed(1600, [](uint32_t) { return 100.0f; });
+  CHECK(events == 1 && !seg.moving());
+  CHECK(ev.kind == SegEvent::ADD && fabsf(ev.delta - 100.0f) < 1e-3f && ev.total == 100.0f);
+  CHECK(ev.startMs == 1020 && ev.endMs == 1500);
+  // Dos adiciones seguidas con 320 ms de pausa: dos pasos, no uno
+  feed(1700, [](uint32_t) { return 130.0f; });
+  feed(2040, [](uint32_t) { return 130.0f; });
+  feed(2100, [](uint32_t) { return 160.0f; });
+  feed(2500, [](uint32_t) { return 160.0f; });
+  CHECK(events == 3 && ev.kind == SegEvent::ADD && fabsf(ev.delta - 30.0f) < 1e-3f);
+  // Deriva por debajo de minStepG: sin evento, pero la base la absorbe
+  feed(2900, [](uint32_t) { return 163.0f; });
+  CHECK(events == 3 && seg.baseline() == 163.0f);
+  // Ruido dentro de la banda: ni movimiento ni evento
+  feed(3500, [](uint32_t ms) { return 163.0f + ((ms / 20) % 2 ? 0.5f : -0.5f); });
+  CHECK(events == 3 && !seg.moving());
+  // Retirada
+  feed(3900, [](uint32_t) { return 40.0f; });
+  CHECK(events == 4 && ev.kind == SegEvent::REMOVE && ev.delta < -120.0f && ev.total == 40.0f);
+  // Tras reset la primera muestra fija la base sin evento
+  seg.reset(0.0f);
+  CHECK(!seg.push(500.0f, t, ev) && seg.baseline() == 500.0f);
+  return 0;
+}
+
+// Secuencia de conversiones leídas: mayúscula válida, minúscula descartada.
+std::string muxRun(ChannelMux& mux, int n) {
+  std::string out;
+  for (int i = 0; i < n; ++i) {
+    ChannelMux::Sample s = mux.commit(mux.planNext());
+    const char c = s.chan == ChannelMux::A ? 'A' : 'B';
+    out += s.valid ? c : (char)(c - 'A' + 'a');
+  }
+  return out;
+}
+
+int channelMuxTests() {
+  ChannelMux mux;
+  CHECK(muxRun(mux, 8) == "AAAAAAAA" && mux.onA());  // every = 0: solo A
+  // Cada 3 A válidas: la 3ª programa B, la primera B se descarta, la B
+  // asentada programa A y esa primera A también se descarta
+  mux.setEvery(3);
+  CHECK(muxRun(mux, 12) == "AAAbBaAAAbBa");
+  // Entre lecturas: onA() solo con A asentado
+  CHECK(muxRun(mux, 3) == "AAA" && !mux.onA());
+  CHECK(muxRun(mux, 1) == "b" && !mux.onA());
+  CHECK(muxRun(mux, 2) == "Ba" && mux.onA());
+  // hold() no interrumpe una visita empezada, pero no inicia otra
+  CHECK(muxRun(mux, 3) == "AAA");
+  mux.setHold(true);
+  CHECK(muxRun(mux, 3) == "bBa");
+  CHECK(muxRun(mux, 8) == "AAAAAAAA");
+  // Al soltar, la cuenta ya superada dispara la visita en la siguiente
+  mux.setHold(false);
+  CHECK(muxRun(mux, 4) == "AbBa");
+  // every = 1: una A válida por visita
+  mux.setEvery(1);
+  CHECK(muxRun(mux, 8) == "AbBaAbBa");
+  mux.setEvery(0);
+  CHECK(muxRun(mux, 4) == "AAAA");
+  return 0;
+}
+
+int checkweigherTests() {
+  CheckWeigher cw(2.0f);
+  CHECK(!cw.push(150.0f, true));  // sin configurar no informa
+  cw.configure(100.0f, 120.0f);
+  // La primera muestra siempre informa
+  CHECK(cw.push(50.0f, false) && cw.zone() == CheckWeigher::UNDER);
+  CHECK(!cw.push(60.0f, false));
+  // Entrar exige superar min + histéresis
+  CHECK(!cw.push(101.0f, false) && cw.zone() == CheckWeigher::UNDER);
+  CHECK(cw.push(102.5f, false) && cw.zone() == CheckWeigher::IN);
+  // Cambiar solo la estabilidad también informa
+  CHECK(cw.push(110.0f, true) && cw.stable());
+  CHECK(!cw.push(110.2f, true));
+  // En el borde no parpadea: salir exige bajar de min - histéresis
+  CHECK(!cw.push(99.0f, true) && cw.zone() == CheckWeigher::IN);
+  CHECK(!cw.push(100.5f, true));
+  CHECK(cw.push(97.5f, true) && cw.zone() == CheckWeigher::UNDER);
+  // Por encima: OVER, y de vuelta a IN con max - histéresis
+  CHECK(cw.push(125.0f, true) && cw.zone() == CheckWeigher::OVER);
+  CHECK(!cw.push(119.0f, true) && cw.zone() == CheckWeigher::OVER);
+  CHECK(cw.push(117.5f, true) && cw.zone() == CheckWeigher::IN);
+  // De UNDER a OVER de un salto
+  CHECK(cw.push(50.0f, true) && cw.push(300.0f, true) && cw.zone() == CheckWeigher::OVER);
+  // Reconfigurar vuelve a informar la primera muestra, clasificada sin histéresis
+  cw.configure(290.0f, 310.0f);
+  CHECK(cw.push(300.0f, true) && cw.zone() == CheckWeigher::IN);
+  CHECK(strcmp(CheckWeigher::zoneName(cw.zone()), "IN") == 0);
+  cw.disable();
+  CHECK(!cw.active() && !cw.push(0.0f, false));
+  return 0;
+}
+
+int peakHoldTests() {
+  PeakHold ph;
+  ph.reset(1000);
+  CHECK(ph.count() == 0 && ph.resetMs() == 1000);
+  // La primera muestra fija pico y mínimo aunque sea negativa
+  ph.push(-500, 1010);
+  CHECK(ph.maxRaw() == -500 && ph.minRaw() == -500 && ph.maxMs() == 1010);
+  // Un golpe de una sola conversión (12,5 ms a 80 SPS) queda retenido
+  long raw = -500;
+  uint32_t t = 1010;
+  for (int i = 0; i < 200; ++i) {
+    t += 12;
+    raw = i == 50 ? 250000 : (i == 120 ? -90000 : 40000 + (i % 3));
+    ph.push(raw, t);
+  }
+  CHECK(ph.count() == 201);
+  CHECK(ph.maxRaw() == 250000 && ph.maxMs() == 1010 + 51 * 12);
+  CHECK(ph.minRaw() == -90000 && ph.minMs() == 1010 + 121 * 12);
+  // Un empate no mueve el instante del pico
+  ph.push(250000, t + 12);
+  CHECK(ph.maxMs() == 1010 + 51 * 12);
+  ph.reset(t);
+  ph.push(raw, t + 12);
+  CHECK(ph.maxRaw() == raw && ph.minRaw() == raw && ph.count() == 1 && ph.resetMs() == t);
+  // Solo los códigos de saturación son inválidos
+  CHECK(!rawValid(HX711_RAW_MAX) && !rawValid(HX711_RAW_MIN));
+  CHECK(rawValid(HX711_RAW_MAX - 1) && rawValid(HX711_RAW_MIN + 1) && rawValid(0));
+  return 0;
+}
+
+int spectrumTests() {
+  static SpectrumAnalyzer<256> sa;  // 3 KB: estático, como `vib` en main.cpp
+  SpectrumReport r;
+  CHECK(!sa.push(1.0f, 0));  // sin start() no recoge
+  // 2 g a 8,1 Hz y 0,5 g a 20,2 Hz sobre 500 g, una conversión cada 12 ms
+  // (83,3 Hz); las frecuencias caen en bins exactos (k = 25 y 62)
+  const float kPi = 3.14159265358979f;
+  sa.start();
+  bool done = false;
+  for (int i = 0; i < 256; ++i) {
+    const float x = 500.0f + 2.0f * sinf(2.0f * kPi * 25.0f * (float)i / 256.0f) +
+                    0.5f * sinf(2.0f * kPi * 62.0f * (float)i / 256.0f);
+    CHECK(!done);
+    done = sa.push(x, 1000u + 12u * (uint32_t)i);
+  }
+  CHECK(done && !sa.active() && !sa.push(0.0f, 5000));
+  sa.analyze(r);
+  const float bin = r.fsHz / 256.0f;
+  CHECK(r.n == 256 && fabsf(r.fsHz - 83.333f) < 0.01f);
+  CHECK(fabsf(r.rmsG - sqrtf(2.0f + 0.125f)) < 0.01f);
+  CHECK(fabsf(r.peaks[0].hz - 25.0f * bin) < 1e-3f && fabsf(r.peaks[0].ampG - 2.0f) < 0.02f);
+  CHECK(fabsf(r.peaks[1].hz - 62.0f * bin) < 1e-3f && fabsf(r.peaks[1].ampG - 0.5f) < 0.02f);
+  CHECK(r.peaks[2].ampG < 0.01f);
+  // Cada tono en su banda; la media no entra en ninguna
+  CHECK(r.bandRmsG[0] < 0.01f && r.bandRmsG[1] < 0.01f);
+  CHECK(fabsf(r.bandRmsG[2] - sqrtf(2.0f)) < 0.02f);
+  CHECK(fabsf(r.bandRmsG[3] - sqrtf(0.125f)) < 0.02f);
+  // Ventana cancelada a medias: se vuelve a empezar de cero
+  sa.start();
+  for (int i = 0; i < 100; ++i) sa.push(0.0f, (uint32_t)i);
+  sa.cancel();
+  CHECK(!sa.active() && !sa.push(0.0f, 200));
+  sa.start();
+  CHECK(sa.count() == 0);
+  return 0;
+}
+
+int warmStateTests() {
+  const int64_t MAX_AGE_US = 30 * 1000000LL;
+  WarmState w;
+  memset(&w, 0, sizeof(w));
+  CHECK(!warmStateValid(w, 0, MAX_AGE_US));  // RTC a ceros tras un corte
+  w.savedUs = 5000000;
+  w.calFactor = CAL;
+  w.tareOffset = ZERO;
+  w.medianRaw = ZERO + 40000;
+  w.iir = 100.0f;
+  w.stableG = 100.0f;
+  w.stable = 1;
+  w.periodUs = 12500;
+  warmStateSeal(w);
+  CHECK(w.magic == WARM_MAGIC && warmStateValid(w, 6000000, MAX_AGE_US));
+  // Cualquier byte alterado antes del CRC (incluido el relleno) lo invalida
+  for (size_t i = 0; i < offsetof(WarmState, crc); ++i) {
+    WarmState bad = w;
+    reinterpret_cast<uint8_t*>(&bad)[i] ^= 0x10;
+    CHECK(!warmStateValid(bad, 6000000, MAX_AGE_US));
+  }
+  WarmState bad = w;
+  bad.crc ^= 1u;
+  CHECK(!warmStateValid(bad, 6000000, MAX_AGE_US));
+  // Volver a sellar tras modificar lo acepta de nuevo
+  bad.iir = 101.0f;
+  warmStateSeal(bad);
+  CHECK(warmStateValid(bad, 6000000, MAX_AGE_US));
+  // Edad: en el límite vale; más antiguo o con el reloj hacia atrás, no
+  CHECK(warmStateValid(w, 5000000 + MAX_AGE_US, MAX_AGE_US));
+  CHECK(!warmStateValid(w, 5000001 + MAX_AGE_US, MAX_AGE_US));
+  CHECK(!warmStateValid(w, 4999999, MAX_AGE_US));
+  return 0;
+}
+
+int selfTestTests() {
+  const size_t N = SELFTEST_MAX_SAMPLES;
+  long raw[N];
+  uint32_t tUs[N];
+  SelfTestResult r;
+  uint32_t lcg = 12345;
+  auto capture = [&](long base, long spread, uint32_t periodUs) {
+    for (size_t i = 0; i < N; ++i) {
+      lcg = lcg * 1664525u + 1013904223u;
+      raw[i] = base + (spread ? (long)(lcg >> 8) % (2 * spread + 1) - spread : 0);
+      tUs[i] = 1000 + (uint32_t)i * periodUs;
+    }
+  };
+  auto code = [&](size_t n, bool toggled, float noiseMax) {
+    selfTestAnalyze(raw, tUs, n, toggled, noiseMax, r);
+    return r.code;
+  };
+  // Captura sana: 80 SPS, ruido uniforme de ±100 cuentas
+  capture(ZERO, 100, 12500);
+  CHECK(code(N, true, 500.0f) == SelfTestResult::OK);
+  CHECK(fabsf(r.sps - 80.0f) < 0.01f && r.n == N && labs(r.mean - ZERO) < 100);
+  CHECK(r.noise > 30.0f && r.noise < 100.0f);
+  CHECK(code(N, true, 10.0f) == SelfTestResult::NOISY);
+  // 10 SPS también es una tasa válida; 40 SPS no
+  capture(ZERO, 100, 100000);
+  CHECK(code(N, true, 500.0f) == SelfTestResult::OK && fabsf(r.sps - 10.0f) < 0.01f);
+  capture(ZERO, 100, 25000);
+  CHECK(code(N, true, 500.0f) == SelfTestResult::RATE);
+  CHECK(code(0, false, 500.0f) == SelfTestResult::NO_DRDY);
+  capture(0, 0, 12500);
+  CHECK(code(N, false, 500.0f) == SelfTestResult::STUCK_LOW);
+  CHECK(code(N, true, 500.0f) == SelfTestResult::FLAT);  // ceros, pero DRDY se mueve
+  capture(-1, 0, 12500);  // 0xFFFFFF con signo
+  CHECK(code(N, true, 500.0f) == SelfTestResult::STUCK_HIGH);
+  capture(ZERO, 100, 12500);
+  raw[7] = HX711_RAW_MAX;
+  CHECK(code(N, true, 500.0f) == SelfTestResult::SATURATED);
+  capture(ZERO, 0, 12500);
+  CHECK(code(N, true, 500.0f) == SelfTestResult::FLAT);
+  // Bit 2 pegado a 0 con ruido de sobra
+  capture(ZERO, 100, 12500);
+  for (size_t i = 0; i < N; ++i) raw[i] &= ~4L;
+  CHECK(code(N, true, 500.0f) == SelfTestResult::STUCK_BITS && r.stuckMask == 0x4u);
+  // Con poco ruido un bit bajo quieto no es sospechoso
+  capture(ZERO, 8, 12500);
+  for (size_t i = 0; i < N; ++i) raw[i] &= ~4L;
+  CHECK(code(N, true, 500.0f) == SelfTestResult::OK);
+  CHECK(strcmp(selfTestName(SelfTestResult::STUCK_BITS), "STUCK_BITS") == 0);
+  return 0;
+}
+
+int selftest() {
+  if (channelMuxTests() != 0) return 1;
+  printf("channel_mux OK\n");
+  if (checkweigherTests() != 0) return 1;
+  printf("checkweigher OK\n");
+  if (eventLogTests() != 0) return 1;
+  printf("event_log OK\n");
+  if (overloadTests() != 0) return 1;
+  printf("overload OK\n");
+  if (peakHoldTests() != 0) return 1;
+  printf("peak_hold OK\n");
+  if (profileTests() != 0) return 1;
+  printf("profile OK\n");
+  if (quantizerTests() != 0) return 1;
+  printf("quantizer OK\n");
+  if (segmenterTests() != 0) return 1;
+  printf("segmenter OK\n");
+  if (selfTestTests() != 0) return 1;
+  printf("selftest.h OK\n");
+  if (spectrumTests() != 0) return 1;
+  printf("spectrum OK\n");
+  if (warmStateTests() != 0) return 1;
+  printf("warm_state OK\n");
+  printf("selftest OK\n");
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "--selftest") == 0) return selftest();
+  fprintf(stderr, "uso: unit_check --selftest\n");
+  return 2;
+}
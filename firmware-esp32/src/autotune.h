@@ -0,0 +1,283 @@
+// firmware-esp32/src/autotune.h
+//
+// Ajuste automático del filtro ("AUTOTUNE") para el ruido de cada celda.
+// Todas las unidades salían con la misma mediana e IIR aunque el ruido
+// cambia mucho de una instalación a otra. El procedimiento:
+//
+//   1. Vacío: TUNE_IDLE_MS de crudos con la plataforma quieta (ruido).
+//   2. Espera a que se coloque una carga (hasta TUNE_WAIT_MS); el primer
+//      crudo que se aleja del vacío marca el inicio del escalón.
+//   3. Escalón: se graba hasta llenar el buffer (TUNE_MAX_SAMPLES pasos del
+//      pipeline); el último segundo da el valor final de referencia.
+//   4. Se reproduce la grabación con cada par (mediana, τ) de la rejilla
+//      por un Pipeline real; para cada par se evalúan a la vez todos los
+//      (umbral, tiempo de estabilidad) con la misma regla que
+//      Pipeline::push. Un par por llamada a work(), para no parar acq.
+//
+// Se elige el menor tiempo de asentamiento (del inicio del escalón a S:1
+// dentro de la tolerancia) entre las combinaciones cuyo ruido de salida en
+// vacío no pasa del límite y que nunca declaran S:1 fuera de la tolerancia
+// ni lo pierden una vez asentadas (el S:1 anterior al escalón, que dura lo
+// que tarda en notarse, no cuenta). Sin límite explícito, el límite es el
+// ruido del filtro actual: nunca se vuelve más ruidoso.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipeline.h"
+#include "rate.h"
+
+namespace bascula {
+
+static const size_t   TUNE_MAX_SAMPLES = 320;    // 6,4 s a 50 Hz
+static const uint32_t TUNE_IDLE_MS     = 2000;
+static const uint32_t TUNE_WAIT_MS     = 30000;  // para colocar la carga
+static const uint32_t TUNE_FINAL_MS    = 1000;   // cola que da el valor final
+static const float    TUNE_ONSET_SIGMA = 10.0f;  // inicio del escalón
+static const float    TUNE_STEP_SIGMA  = 20.0f;  // escalón mínimo útil
+static const float    TUNE_TOL_G       = 0.5f;   // tolerancia por defecto
+
+// Rejilla. Umbrales y tiempos respetan filterTimingValid().
+static const uint32_t TUNE_MED_MS[] = {60, 150, 250, 375, 600};
+static const uint32_t TUNE_TAU_MS[] = {0, 40, 80, 112, 160, 240, 360};
+static const float    TUNE_TH_G[]   = {0.1f, 0.2f, 0.3f, 0.5f, 0.75f, 1.0f, 1.5f};
+static const uint32_t TUNE_SMS[]    = {150, 250, 400, 700, 1000};
+
+static const size_t TUNE_N_MED = sizeof(TUNE_MED_MS) / sizeof(TUNE_MED_MS[0]);
+static const size_t TUNE_N_TAU = sizeof(TUNE_TAU_MS) / sizeof(TUNE_TAU_MS[0]);
+static const size_t TUNE_N_TH  = sizeof(TUNE_TH_G) / sizeof(TUNE_TH_G[0]);
+static const size_t TUNE_N_SMS = sizeof(TUNE_SMS) / sizeof(TUNE_SMS[0]);
+
+struct TuneResult {
+  FilterTiming timing;     // elegido
+  uint32_t     settleMs;   // asentamiento esperado con él
+  float        noiseG;     // ruido de salida en vacío (desv. típica)
+  float        noiseMaxG;  // límite aplicado
+  int32_t      wasMs;      // asentamiento del filtro anterior (-1: no asienta bien)
+  uint16_t     feasible;   // combinaciones que cumplen
+  uint16_t     total;      // combinaciones evaluadas
+};
+
+class FilterTuner {
+public:
+  enum State { OFF, IDLE, WAIT, POST, RUN };
+  enum Event { NONE, LOAD, ANALYZE, DONE, TIMEOUT, NOSTEP, UNSETTLED, NOFIT };
+
+  FilterTuner() : state_(OFF) {}
+
+  // noiseMaxG <= 0: el ruido del filtro actual. stepMs: periodo con que se
+  // alimenta el pipeline (diezmado incluido).
+  void start(const FilterTiming& current, float noiseMaxG, float tolG, float stepMs,
+             float calFactor, int32_t tareOffset, uint32_t nowMs) {
+    current_ = current;
+    noiseMaxG_ = noiseMaxG;
+    tolG_ = tolG > 0.0f ? tolG : TUNE_TOL_G;
+    stepMs_ = stepMs > 0.0f ? stepMs : 1.0f;
+    cal_ = calFactor;
+    tare_ = tareOffset;
+    n_ = 0;
+    startMs_ = nowMs;
+    state_ = IDLE;
+  }
+
+  void abort() { state_ = OFF; }
+
+  State state() const { return state_; }
+  bool  capturing() const { return state_ == IDLE || state_ == WAIT || state_ == POST; }
+  float idleSigma() const { return idleSd_; }
+  float stepGrams() const { return (finalMean_ - idleMean_) * cal_; }
+  const TuneResult& result() const { return res_; }
+
+  // Crudo de cada paso del pipeline mientras captura.
+  Event push(long raw, uint32_t nowMs) {
+    switch (state_) {
+      case IDLE:
+        buf_[n_++] = (int32_t)raw;
+        if ((float)n_ * stepMs_ < (float)TUNE_IDLE_MS) return NONE;
+        idleN_ = n_;
+        stats(0, idleN_, idleMean_, idleSd_);
+        startMs_ = nowMs;
+        state_ = WAIT;
+        return LOAD;
+      case WAIT: {
+        const float onset = fmaxf(TUNE_ONSET_SIGMA * idleSd_, 16.0f);
+        if (fabsf((float)raw - idleMean_) <= onset) {
+          if (nowMs - startMs_ < TUNE_WAIT_MS) return NONE;
+          state_ = OFF;
+          return TIMEOUT;
+        }
+        buf_[n_++] = (int32_t)raw;
+        state_ = POST;
+        return NONE;
+      }
+      case POST: {
+        buf_[n_++] = (int32_t)raw;
+        if (n_ < TUNE_MAX_SAMPLES) return NONE;
+        size_t tail = (size_t)((float)TUNE_FINAL_MS / stepMs_);
+        if (tail < 2) tail = 2;
+        float sd;
+        stats(n_ - tail, n_, finalMean_, sd);
+        if (fabsf(finalMean_ - idleMean_) < TUNE_STEP_SIGMA * fmaxf(idleSd_, 1.0f)) {
+          state_ = OFF;
+          return NOSTEP;
+        }
+        if (sd > 3.0f * idleSd_ + 8.0f) {
+          state_ = OFF;
+          return UNSETTLED;
+        }
+        res_ = TuneResult();
+        res_.noiseMaxG = noiseMaxG_;
+        res_.wasMs = -1;
+        res_.settleMs = UINT32_MAX;
+        pair_ = 0;
+        state_ = RUN;
+        return ANALYZE;
+      }
+      default:
+        return NONE;
+    }
+  }
+
+  // Reproduce un par (mediana, τ). El par 0 es el filtro actual.
+  Event work() {
+    if (state_ != RUN) return NONE;
+    if (pair_ == 0) {
+      replay(current_.medianMs, current_.iirTauMs, &current_.stableDeltaG, 1,
+             &current_.stableMs, 1);
+      Track& t = track_[0];
+      if (!t.bad && t.settle != NO_SETTLE) res_.wasMs = (int32_t)toMs(t.settle - idleN_);
+      if (noiseMaxG_ <= 0.0f) res_.noiseMaxG = noiseG_;
+    } else {
+      const size_t i = pair_ - 1;
+      const uint32_t med = TUNE_MED_MS[i / TUNE_N_TAU];
+      const uint32_t tau = TUNE_TAU_MS[i % TUNE_N_TAU];
+      replay(med, tau, TUNE_TH_G, TUNE_N_TH, TUNE_SMS, TUNE_N_SMS);
+      res_.total = (uint16_t)(res_.total + TUNE_N_TH * TUNE_N_SMS);
+      if (noiseG_ <= res_.noiseMaxG) {
+        for (size_t a = 0; a < TUNE_N_TH; ++a) {
+          for (size_t b = 0; b < TUNE_N_SMS; ++b) {
+            const Track& t = track_[a * TUNE_N_SMS + b];
+            if (t.bad || t.settle == NO_SETTLE) continue;
+            res_.feasible++;
+            const uint32_t ms = toMs(t.settle - idleN_);
+            if (ms < res_.settleMs || (ms == res_.settleMs && noiseG_ < res_.noiseG)) {
+              res_.settleMs = ms;
+              res_.noiseG = noiseG_;
+              res_.timing = FilterTiming{med, tau, TUNE_TH_G[a], TUNE_SMS[b]};
+            }
+          }
+        }
+      }
+    }
+    if (++pair_ <= TUNE_N_MED * TUNE_N_TAU) return NONE;
+    state_ = OFF;
+    return res_.feasible > 0 ? DONE : NOFIT;
+  }
+
+private:
+  static const uint16_t NO_SETTLE = 0xFFFF;
+
+  struct Track {
+    uint16_t ref;     // inicio del tramo dentro del umbral (paso)
+    uint16_t settle;  // primer S:1 tras el escalón
+    bool     stable;
+    bool     moved;   // perdió S:1 tras el escalón
+    bool     bad;     // S:1 fuera de tolerancia o perdido tras asentar
+  };
+
+  uint32_t toMs(size_t steps) const { return (uint32_t)lroundf((float)steps * stepMs_); }
+
+  void stats(size_t from, size_t to, float& mean, float& sd) const {
+    int64_t sum = 0, sumSq = 0;
+    const int32_t base = buf_[from];
+    for (size_t i = from; i < to; ++i) {
+      const int64_t d = (int64_t)buf_[i] - base;
+      sum += d;
+      sumSq += d * d;
+    }
+    const double n = (double)(to - from);
+    const double m = (double)sum / n;
+    mean = (float)((double)base + m);
+    const double var = (double)sumSq / n - m * m;
+    sd = var > 0.0 ? (float)sqrt(var * n / (n > 1.0 ? n - 1.0 : 1.0)) : 0.0f;
+  }
+
+  // Grabación -> mediana + IIR de (med, τ); estabilidad de cada umbral x
+  // tiempo con la regla de Pipeline::push, en pasos de stepMs_.
+  void replay(uint32_t medMs, uint32_t tauMs, const float* th, size_t nTh,
+              const uint32_t* sms, size_t nSms) {
+    Pipeline p(filterParamsFor(FilterTiming{medMs, tauMs, 1.0f, 100}, stepMs_));
+    p.setCalibration(cal_, tare_);
+    for (size_t j = 0; j < nTh * nSms; ++j) track_[j] = Track{0, NO_SETTLE, false, false, false};
+    const float finalG = (finalMean_ - (float)tare_) * cal_;
+    float last = 0.0f;
+    double sum = 0.0, sumSq = 0.0;
+    size_t nNoise = 0;
+    for (size_t k = 0; k < n_; ++k) {
+      const float g = p.push(buf_[k], (uint32_t)k).grams;
+      const float delta = fabsf(g - last);
+      last = g;
+      if (k >= idleN_ / 2 && k < idleN_) {
+        sum += g;
+        sumSq += (double)g * g;
+        nNoise++;
+      }
+      const bool after = k >= idleN_;
+      const bool inTol = fabsf(g - finalG) <= tolG_;
+      for (size_t a = 0; a < nTh; ++a) {
+        for (size_t b = 0; b < nSms; ++b) {
+          Track& t = track_[a * nSms + b];
+          if (delta <= th[a]) {
+            if ((float)(k - t.ref) * stepMs_ >= (float)sms[b]) t.stable = true;
+          } else {
+            t.stable = false;
+            t.ref = (uint16_t)k;
+          }
+          if (!after || t.bad) continue;
+          if (!t.moved) {
+            // La mediana retiene el valor anterior media ventana: hasta que
+            // se pierde S:1 es el retardo del filtro, no un asentamiento
+            t.moved = !t.stable;
+          } else if (t.settle == NO_SETTLE) {
+            if (!t.stable) continue;
+            if (inTol) {
+              t.settle = (uint16_t)k;
+            } else {
+              t.bad = true;
+            }
+          } else if (!t.stable || !inTol) {
+            t.bad = true;
+          }
+        }
+      }
+    }
+    const double m = nNoise ? sum / (double)nNoise : 0.0;
+    const double var = nNoise > 1 ? (sumSq - (double)nNoise * m * m) / (double)(nNoise - 1) : 0.0;
+    noiseG_ = var > 0.0 ? (float)sqrt(var) : 0.0f;
+  }
+
+  State        state_;
+  FilterTiming current_;
+  float        noiseMaxG_;
+  float        tolG_;
+  float        stepMs_;
+  float        cal_;
+  int32_t      tare_;
+  uint32_t     startMs_;
+  int32_t      buf_[TUNE_MAX_SAMPLES];
+  size_t       n_;
+  size_t       idleN_;
+  float        idleMean_;
+  float        idleSd_;
+  float        finalMean_;
+  size_t       pair_;
+  float        noiseG_;
+  Track        track_[TUNE_N_TH * TUNE_N_SMS];
+  TuneResult   res_;
+};
+
+}  // namespace bascula
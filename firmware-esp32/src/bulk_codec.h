@@ -0,0 +1,248 @@
+// firmware-esp32/src/bulk_codec.h
+//
+// Codificación compacta para volcados masivos (registro de eventos, trazas
+// capturadas): a 115200 baudios el texto decimal cuesta ~50 bytes por
+// registro, cuando casi todo es redundante entre registros consecutivos.
+//
+// Cada registro es una fila de Cols enteros de 32 bits. Se envía la
+// diferencia con la fila anterior, columna a columna, en zigzag + varint
+// (LEB128): una secuencia que sube de 1 en 1 o un tiempo que avanza poco
+// ocupan un byte. La primera fila de cada trama va contra ceros, así que cada
+// trama se decodifica sola y una trama perdida no arrastra a las siguientes.
+//
+// Trama (campos little endian), delimitada como una línea:
+//
+//   A5 | tipo u8 | seq u16 | filas u16 | len u16 | datos[len] | crc32 u32 | \n
+//
+// Todo lo que va tras el A5 se escapa (0A, 0D, A5 y DB pasan a DB DC, DB DD,
+// DB DF y DB DE). Así cada trama es una sola "línea" que empieza por 0xA5, los
+// lectores de líneas la descartan de una pieza y el decodificador se
+// resincroniza en el siguiente 0xA5 o fin de línea. El CRC-32 cubre desde tipo
+// hasta el último byte de datos, sin escapar.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+
+namespace bascula {
+
+static const uint8_t BULK_SYNC        = 0xA5;
+static const uint8_t BULK_ESC         = 0xDB;
+static const size_t  BULK_HDR_BYTES   = 7;     // tipo, seq, filas, len
+static const size_t  BULK_PAYLOAD_MAX = 240;
+static const size_t  BULK_RAW_MAX     = BULK_HDR_BYTES + BULK_PAYLOAD_MAX + 4;
+static const size_t  BULK_WIRE_MAX    = 1 + 2 * BULK_RAW_MAX + 1;
+
+// Tipos de trama y número de columnas de cada uno.
+static const uint8_t BULK_LOG   = 'L';  // seq, arranque, ms, tipo, valor
+static const uint8_t BULK_TRACE = 'T';  // µs, crudo
+static const size_t  BULK_LOG_COLS   = 5;
+static const size_t  BULK_TRACE_COLS = 2;
+
+static_assert(BULK_TRACE_COLS <= BULK_LOG_COLS, "bulkDecodeRows usa la fila más ancha");
+
+static inline size_t bulkCols(uint8_t type) {
+  return type == BULK_LOG ? BULK_LOG_COLS : type == BULK_TRACE ? BULK_TRACE_COLS : 0;
+}
+
+static inline uint32_t zigzagEncode(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+static inline int32_t zigzagDecode(uint32_t u) {
+  return (int32_t)(u >> 1) ^ -(int32_t)(u & 1u);
+}
+
+// Escribe v en LEB128 (1-5 bytes). Devuelve los bytes escritos.
+static inline size_t varintPut(uint8_t* p, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+// Lee un varint de como mucho `avail` bytes. Devuelve los bytes usados o 0
+// si está truncado o es demasiado largo.
+static inline size_t varintGet(const uint8_t* p, size_t avail, uint32_t& v) {
+  v = 0;
+  for (size_t i = 0; i < avail && i < 5; ++i) {
+    v |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+    if ((p[i] & 0x80) == 0) return i + 1;
+  }
+  return 0;
+}
+
+// Acumula filas en una trama y la entrega ya escapada.
+template <size_t Cols>
+class DeltaFrameWriter {
+public:
+  DeltaFrameWriter() : type_(0), seq_(0) { reset(); }
+
+  void begin(uint8_t type, uint16_t seq) {
+    type_ = type;
+    seq_ = seq;
+    reset();
+  }
+
+  // false si la fila no cabe: cerrar con finish() y empezar otra trama.
+  bool put(const int32_t (&row)[Cols]) {
+    if (len_ + Cols * 5 > BULK_PAYLOAD_MAX) return false;
+    for (size_t c = 0; c < Cols; ++c) {
+      // Resta en módulo 2^32: vale también si la columna da la vuelta.
+      int32_t d = (int32_t)((uint32_t)row[c] - (uint32_t)prev_[c]);
+      len_ += varintPut(raw_ + BULK_HDR_BYTES + len_, zigzagEncode(d));
+      prev_[c] = row[c];
+    }
+    rows_++;
+    return true;
+  }
+
+  uint16_t rows() const { return rows_; }
+  bool     empty() const { return rows_ == 0; }
+
+  // Cierra la trama en out (>= BULK_WIRE_MAX bytes). Devuelve los bytes a
+  // enviar, incluido el fin de línea.
+  size_t finish(uint8_t* out) {
+    raw_[0] = type_;
+    raw_[1] = (uint8_t)seq_;
+    raw_[2] = (uint8_t)(seq_ >> 8);
+    raw_[3] = (uint8_t)rows_;
+    raw_[4] = (uint8_t)(rows_ >> 8);
+    raw_[5] = (uint8_t)len_;
+    raw_[6] = (uint8_t)(len_ >> 8);
+    size_t n = BULK_HDR_BYTES + len_;
+    uint32_t crc = crc32(raw_, n);
+    for (int i = 0; i < 4; ++i) raw_[n++] = (uint8_t)(crc >> (8 * i));
+    size_t o = 0;
+    out[o++] = BULK_SYNC;
+    for (size_t i = 0; i < n; ++i) {
+      uint8_t b = raw_[i];
+      if (b == '\n' || b == '\r' || b == BULK_SYNC || b == BULK_ESC) {
+        out[o++] = BULK_ESC;
+        out[o++] = b == '\n' ? 0xDC : b == '\r' ? 0xDD : b == BULK_ESC ? 0xDE : 0xDF;
+      } else {
+        out[o++] = b;
+      }
+    }
+    out[o++] = '\n';
+    return o;
+  }
+
+private:
+  void reset() {
+    len_ = 0;
+    rows_ = 0;
+    for (size_t c = 0; c < Cols; ++c) prev_[c] = 0;
+  }
+
+  uint8_t  type_;
+  uint16_t seq_;
+  uint16_t rows_;
+  size_t   len_;
+  int32_t  prev_[Cols];
+  uint8_t  raw_[BULK_RAW_MAX];
+};
+
+// Analizador byte a byte de tramas de volcado entre líneas de texto. Los
+// bytes que no pertenecen a una trama se ignoran (el llamador los trata como
+// texto si quiere).
+class BulkFrameParser {
+public:
+  enum Result : uint8_t { NONE = 0, FRAME, BAD };
+
+  BulkFrameParser() : active_(false), esc_(false), n_(0) {}
+
+  bool active() const { return active_; }
+
+  Result feed(uint8_t b) {
+    if (b == BULK_SYNC) {
+      // Un A5 nunca va dentro de una trama: empieza otra (la anterior, si
+      // estaba a medias, se pierde).
+      bool wasActive = active_ && n_ > 0;
+      start();
+      return wasActive ? BAD : NONE;
+    }
+    if (!active_) return NONE;
+    if (b == '\n' || b == '\r') {
+      active_ = false;
+      return check();
+    }
+    if (esc_) {
+      esc_ = false;
+      if (b < 0xDC || b > 0xDF) {
+        active_ = false;
+        return BAD;
+      }
+      static const uint8_t kUnesc[4] = {'\n', '\r', BULK_ESC, BULK_SYNC};
+      b = kUnesc[b - 0xDC];
+    } else if (b == BULK_ESC) {
+      esc_ = true;
+      return NONE;
+    }
+    if (n_ >= sizeof(raw_)) {
+      active_ = false;
+      return BAD;
+    }
+    raw_[n_++] = b;
+    return NONE;
+  }
+
+  uint8_t        type() const { return raw_[0]; }
+  uint16_t       seq() const { return (uint16_t)(raw_[1] | (raw_[2] << 8)); }
+  uint16_t       rows() const { return (uint16_t)(raw_[3] | (raw_[4] << 8)); }
+  const uint8_t* payload() const { return raw_ + BULK_HDR_BYTES; }
+  size_t         payloadLen() const { return (size_t)(raw_[5] | (raw_[6] << 8)); }
+
+private:
+  void start() {
+    active_ = true;
+    esc_ = false;
+    n_ = 0;
+  }
+
+  Result check() const {
+    if (n_ < BULK_HDR_BYTES + 4) return BAD;
+    size_t len = payloadLen();
+    if (BULK_HDR_BYTES + len + 4 != n_ || bulkCols(type()) == 0) return BAD;
+    size_t body = BULK_HDR_BYTES + len;
+    uint32_t crc = (uint32_t)raw_[body] | ((uint32_t)raw_[body + 1] << 8) |
+                   ((uint32_t)raw_[body + 2] << 16) | ((uint32_t)raw_[body + 3] << 24);
+    return crc == crc32(raw_, body) ? FRAME : BAD;
+  }
+
+  bool    active_;
+  bool    esc_;
+  size_t  n_;
+  uint8_t raw_[BULK_RAW_MAX];
+};
+
+// Decodifica las filas de una trama ya validada. fn(const int32_t* fila) se
+// llama una vez por fila. false si los datos no cuadran con las filas.
+template <class Fn>
+static inline bool bulkDecodeRows(const BulkFrameParser& f, Fn fn) {
+  const size_t cols = bulkCols(f.type());
+  int32_t row[BULK_LOG_COLS] = {0, 0, 0, 0, 0};
+  const uint8_t* p = f.payload();
+  size_t left = f.payloadLen();
+  for (uint16_t r = 0; r < f.rows(); ++r) {
+    for (size_t c = 0; c < cols; ++c) {
+      uint32_t u;
+      size_t used = varintGet(p, left, u);
+      if (used == 0) return false;
+      p += used;
+      left -= used;
+      row[c] = (int32_t)((uint32_t)row[c] + (uint32_t)zigzagDecode(u));
+    }
+    fn((const int32_t*)row);
+  }
+  return left == 0;
+}
+
+}  // namespace bascula
@@ -0,0 +1,73 @@
+// firmware-esp32/src/channel_mux.h
+//
+// Intercalado del canal B (ganancia 32) entre las conversiones del canal A
+// (ganancia 128). En el HX711 el número de pulsos de SCK de cada lectura
+// programa el canal de la conversión *siguiente*, y la primera conversión
+// tras un cambio de canal todavía no está asentada: se descarta.
+//
+// Una visita a B cuesta tres conversiones de A:
+//
+//   A A ... A(programa B) | B descartada | B válida(programa A) | A descartada | A ...
+//
+// Con every = N se hace una visita cada N conversiones válidas de A. Mientras
+// hold() está activo (autotest, captura de vibraciones) no se inicia ninguna
+// visita nueva; una ya empezada termina con normalidad.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace bascula {
+
+class ChannelMux {
+public:
+  enum Chan : uint8_t { A = 0, B };
+
+  struct Sample {
+    Chan chan;   // canal de la conversión leída
+    bool valid;  // false si es la primera tras un cambio de canal
+  };
+
+  ChannelMux() : every_(0), countA_(0), cur_(A), fresh_(false), hold_(false) {}
+
+  // every = 0 desactiva el canal B.
+  void setEvery(uint16_t every) {
+    every_ = every;
+    countA_ = 0;
+  }
+  uint16_t every() const { return every_; }
+  void setHold(bool h) { hold_ = h; }
+
+  // Antes de leer: canal que deben programar los pulsos de esta lectura.
+  Chan planNext() const {
+    if (cur_ == B) return fresh_ ? B : A;  // una B asentada y de vuelta
+    // La lectura que programa B es la every-ésima A válida de la vuelta
+    if (every_ != 0 && !hold_ && !fresh_ && countA_ + 1u >= every_) return B;
+    return A;
+  }
+
+  // Tras una lectura correcta con los pulsos de `next`: clasifica la
+  // conversión leída y avanza.
+  Sample commit(Chan next) {
+    Sample s{cur_, !fresh_};
+    if (cur_ == A && s.valid) {
+      countA_ = next == B ? 0 : (uint16_t)(countA_ + 1);
+    }
+    fresh_ = next != cur_;
+    cur_ = next;
+    return s;
+  }
+
+  // En A asentado: las lecturas directas (tara, calibración) son del canal A.
+  bool onA() const { return cur_ == A && !fresh_; }
+
+private:
+  uint16_t every_;
+  uint16_t countA_;
+  Chan     cur_;    // canal de la conversión que se leerá a continuación
+  bool     fresh_;  // esa conversión es la primera tras un cambio
+  bool     hold_;
+};
+
+}  // namespace bascula
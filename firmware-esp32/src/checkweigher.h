@@ -0,0 +1,88 @@
+// firmware-esp32/src/checkweigher.h
+//
+// Clasificación de control de porciones (checkweigher): cada muestra filtrada
+// se clasifica como UNDER / IN / OVER respecto a [min, max]. Para que el
+// borde no parpadee, salir de una zona exige superar el límite en la banda de
+// histéresis. Se informa un cambio cuando cambia la zona o el estado estable.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace bascula {
+
+class CheckWeigher {
+public:
+  enum Zone : uint8_t { UNDER = 0, IN, OVER };
+
+  explicit CheckWeigher(float hysteresisG) : hyst_(hysteresisG) { disable(); }
+
+  void configure(float minG, float maxG) {
+    min_ = minG;
+    max_ = maxG;
+    active_ = true;
+    primed_ = false;
+  }
+
+  void disable() {
+    active_ = false;
+    primed_ = false;
+    min_ = max_ = 0.0f;
+    zone_ = UNDER;
+    stable_ = false;
+  }
+
+  bool  active() const { return active_; }
+  float minG() const { return min_; }
+  float maxG() const { return max_; }
+  Zone  zone() const { return zone_; }
+  bool  stable() const { return stable_; }
+
+  static const char* zoneName(Zone z) {
+    return z == UNDER ? "UNDER" : (z == IN ? "IN" : "OVER");
+  }
+
+  // Devuelve true si cambia la zona o el estado estable respecto a la
+  // muestra anterior (la primera muestra tras configurar siempre reporta).
+  bool push(float grams, bool stable) {
+    if (!active_) return false;
+    Zone z = classify(grams);
+    bool changed = !primed_ || z != zone_ || stable != stable_;
+    zone_ = z;
+    stable_ = stable;
+    primed_ = true;
+    return changed;
+  }
+
+private:
+  Zone classify(float g) const {
+    if (!primed_) {
+      return g < min_ ? UNDER : (g > max_ ? OVER : IN);
+    }
+    // Histéresis: mantener la zona actual mientras no se cruce el límite
+    // con margen suficiente.
+    switch (zone_) {
+      case UNDER:
+        if (g >= min_ + hyst_) return g > max_ ? OVER : IN;
+        return UNDER;
+      case OVER:
+        if (g <= max_ - hyst_) return g < min_ ? UNDER : IN;
+        return OVER;
+      default:
+        if (g < min_ - hyst_) return UNDER;
+        if (g > max_ + hyst_) return OVER;
+        return IN;
+    }
+  }
+
+  float hyst_;
+  float min_;
+  float max_;
+  bool  active_;
+  bool  primed_;
+  Zone  zone_;
+  bool  stable_;
+};
+
+}  // namespace bascula
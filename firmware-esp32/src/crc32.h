@@ -0,0 +1,27 @@
+// firmware-esp32/src/crc32.h
+//
+// CRC-32 (IEEE 802.3, polinomio reflejado 0xEDB88320) sin tabla: unos pocos
+// bytes de código y sin RAM, suficiente para registros pequeños. Portable
+// (firmware y herramientas del host producen el mismo valor).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bascula {
+
+// Permite encadenar: crc32(b, nb, crc32(a, na)).
+static inline uint32_t crc32(const void* data, size_t len, uint32_t prev = 0) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint32_t crc = ~prev;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= p[i];
+    for (int b = 0; b < 8; ++b) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
+
+}  // namespace bascula
@@ -0,0 +1,244 @@
+// firmware-esp32/src/event_log.h
+//
+// Registro circular de eventos de operación en flash para diagnóstico en
+// campo ("la báscula saltó": ¿hubo tara, recalibración, sobrecarga, fallo
+// del ADC, reinicio o watchdog?).
+//
+// - Registros fijos de 16 bytes con número de secuencia monotónico entre
+//   arranques, número de arranque, ms desde el arranque y CRC-8.
+// - La partición se recorre por sectores de 4 KiB en rueda: al llenar uno se
+//   borra el siguiente (el más antiguo) y se sigue escribiendo. Cada sector se
+//   borra una vez por vuelta completa: desgaste uniforme sin tabla aparte.
+// - Montaje: el sector con la mayor secuencia en su primer registro es la
+//   cabeza; dentro de él, el primer hueco en blanco es la posición de
+//   escritura. Un registro a medio escribir (corte de alimentación) falla el
+//   CRC y se salta.
+//
+// El acceso a la flash se abstrae en el parámetro Flash (size/read/write/
+// erase) para poder probar la rueda en el host con un buffer en RAM; en el
+// ESP32 se usa EspPartitionFlash (partition_flash.h) sobre una partición de
+// datos propia.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bascula {
+
+enum LogKind : uint8_t {
+  LOG_BOOT = 1,      // arranque; valor = esp_reset_reason()
+  LOG_WDT,           // el arranque viene de un watchdog; valor = motivo
+  LOG_TARE,          // valor = offset de tara (cuentas)
+  LOG_CAL,           // valor = factor de calibración × 1e6
+  LOG_OVERLOAD,      // valor = crudo que enganchó
+  LOG_OVL_CLR,       // enganche borrado por el host
+  LOG_ADC_FAULT,     // sin DRDY; valor = total de esperas agotadas
+  LOG_SELFTEST,      // autotest distinto de OK; valor = código
+  LOG_CAP,           // capacidad cambiada; valor = gramos
+  LOG_DROPPED,       // registros perdidos por cola llena; valor = cuántos
+  LOG_OTA,           // imagen OTA activada (valor = bytes) o rechazada (< 0)
+  LOG_PROFILE,       // perfil de calibración activado; valor = slot
+  LOG_TRIG,          // captura con disparo congelada; valor = fuente (TrigSource)
+};
+
+static inline const char* logKindName(uint8_t k) {
+  switch (k) {
+    case LOG_BOOT:      return "BOOT";
+    case LOG_WDT:       return "WDT";
+    case LOG_TARE:      return "TARE";
+    case LOG_CAL:       return "CAL";
+    case LOG_OVERLOAD:  return "OVERLOAD";
+    case LOG_OVL_CLR:   return "OVL_CLR";
+    case LOG_ADC_FAULT: return "ADC_FAULT";
+    case LOG_SELFTEST:  return "SELFTEST";
+    case LOG_CAP:       return "CAP";
+    case LOG_DROPPED:   return "DROPPED";
+    case LOG_OTA:       return "OTA";
+    case LOG_PROFILE:   return "PROFILE";
+    case LOG_TRIG:      return "TRIG";
+    default:            return "?";
+  }
+}
+
+struct LogRecord {
+  uint32_t seq;    // 0xFFFFFFFF = hueco en blanco
+  uint32_t ms;     // ms desde el arranque
+  int32_t  value;
+  uint16_t boot;   // número de arranque
+  uint8_t  kind;
+  uint8_t  crc;    // CRC-8 de los 15 bytes anteriores
+};
+static_assert(sizeof(LogRecord) == 16, "LogRecord debe ocupar 16 bytes");
+
+static const size_t   LOG_SECTOR_BYTES = 4096;
+static const size_t   LOG_PER_SECTOR   = LOG_SECTOR_BYTES / sizeof(LogRecord);
+static const uint32_t LOG_BLANK        = 0xFFFFFFFFu;
+
+static inline uint8_t crc8(const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint8_t c = 0;
+  for (size_t i = 0; i < len; ++i) {
+    c ^= p[i];
+    for (int k = 0; k < 8; ++k) c = (c & 0x80) ? (uint8_t)((c << 1) ^ 0x07) : (uint8_t)(c << 1);
+  }
+  return c;
+}
+
+static inline bool logRecordValid(const LogRecord& r) {
+  return r.seq != LOG_BLANK && r.crc == crc8(&r, offsetof(LogRecord, crc));
+}
+
+static inline bool logRecordBlank(const LogRecord& r) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&r);
+  for (size_t i = 0; i < sizeof(r); ++i) {
+    if (p[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+// Posición de lectura para volcados por lotes.
+struct LogCursor {
+  uint16_t step;  // sectores recorridos desde el más antiguo
+  uint16_t slot;
+};
+
+template <class Flash>
+class RingLog {
+public:
+  explicit RingLog(Flash& f)
+      : f_(f), sectors_(0), head_(0), slot_(0), nextSeq_(1), boot_(0),
+        mounted_(false) {}
+
+  // Busca la cabeza y la posición de escritura. false si no hay partición.
+  bool mount() {
+    mounted_ = false;
+    sectors_ = (uint16_t)(f_.size() / LOG_SECTOR_BYTES);
+    if (sectors_ < 2) return false;
+
+    bool found = false;
+    uint32_t best = 0;
+    for (uint16_t s = 0; s < sectors_; ++s) {
+      LogRecord r;
+      if (!readSlot(s, 0, r)) return false;
+      if (logRecordValid(r) && (!found || r.seq > best)) {
+        best = r.seq;
+        head_ = s;
+        found = true;
+      }
+    }
+
+    if (!found) {
+      // Partición nueva (o ilegible): se empieza en el sector 0 limpio.
+      head_ = 0;
+      slot_ = 0;
+      nextSeq_ = 1;
+      boot_ = 0;
+      LogRecord r;
+      if (!readSlot(0, 0, r)) return false;
+      if (!logRecordBlank(r) && !f_.erase(0)) return false;
+      mounted_ = true;
+      return true;
+    }
+
+    slot_ = (uint16_t)LOG_PER_SECTOR;
+    for (uint16_t i = 0; i < LOG_PER_SECTOR; ++i) {
+      LogRecord r;
+      if (!readSlot(head_, i, r)) return false;
+      if (logRecordBlank(r)) {
+        slot_ = i;
+        break;
+      }
+      if (logRecordValid(r)) {
+        nextSeq_ = r.seq + 1;
+        boot_ = r.boot;
+      }
+    }
+    mounted_ = true;
+    return true;
+  }
+
+  // Llamar una vez por arranque, antes del primer append().
+  void beginBoot() {
+    if (mounted_ && nextSeq_ > 1) boot_++;
+  }
+
+  bool append(uint8_t kind, int32_t value, uint32_t ms) {
+    if (!mounted_) return false;
+    if (slot_ >= LOG_PER_SECTOR) {
+      head_ = (uint16_t)((head_ + 1) % sectors_);
+      if (!f_.erase((uint32_t)head_ * LOG_SECTOR_BYTES)) return false;
+      slot_ = 0;
+    }
+    LogRecord r;
+    r.seq = nextSeq_;
+    r.ms = ms;
+    r.value = value;
+    r.boot = boot_;
+    r.kind = kind;
+    r.crc = crc8(&r, offsetof(LogRecord, crc));
+    uint32_t off = (uint32_t)head_ * LOG_SECTOR_BYTES + (uint32_t)slot_ * sizeof(LogRecord);
+    slot_++;  // un fallo de escritura no reintenta sobre el mismo hueco
+    if (!f_.write(off, &r, sizeof(r))) return false;
+    nextSeq_++;
+    return true;
+  }
+
+  LogCursor begin() const { return LogCursor{0, 0}; }
+
+  // Lee hasta max registros válidos con seq >= since, del más antiguo al más
+  // reciente, a partir de cur (que avanza). Devuelve cuántos se copiaron;
+  // 0 = fin.
+  size_t read(uint32_t since, LogCursor& cur, LogRecord* out, size_t max) {
+    size_t n = 0;
+    if (!mounted_) return 0;
+    while (n < max && cur.step < sectors_) {
+      uint16_t s = (uint16_t)((head_ + 1 + cur.step) % sectors_);
+      if (cur.slot == 0 && cur.step + 1u < sectors_) {
+        // Si el sector siguiente ya empieza en o antes de `since`, todo este
+        // sector es anterior: se salta sin recorrerlo.
+        LogRecord nx;
+        if (readSlot((uint16_t)((s + 1) % sectors_), 0, nx) && logRecordValid(nx) &&
+            nx.seq <= since) {
+          cur.step++;
+          continue;
+        }
+      }
+      LogRecord r;
+      if (!readSlot(s, cur.slot, r)) return n;
+      bool blank = logRecordBlank(r);
+      if (++cur.slot >= LOG_PER_SECTOR || blank) {
+        cur.slot = 0;
+        cur.step++;
+      }
+      if (!blank && logRecordValid(r) && r.seq >= since) out[n++] = r;
+    }
+    return n;
+  }
+
+  bool     mounted() const { return mounted_; }
+  uint32_t nextSeq() const { return nextSeq_; }
+  uint16_t boot() const { return boot_; }
+  uint16_t sectors() const { return sectors_; }
+  size_t   capacity() const { return (size_t)(sectors_ > 0 ? sectors_ - 1 : 0) * LOG_PER_SECTOR; }
+
+private:
+  bool readSlot(uint16_t sector, uint16_t slot, LogRecord& r) {
+    uint32_t off = (uint32_t)sector * LOG_SECTOR_BYTES + (uint32_t)slot * sizeof(LogRecord);
+    return f_.read(off, &r, sizeof(r));
+  }
+
+  Flash&   f_;
+  uint16_t sectors_;
+  uint16_t head_;     // sector en escritura
+  uint16_t slot_;     // siguiente hueco dentro de head_
+  uint32_t nextSeq_;
+  uint16_t boot_;
+  bool     mounted_;
+};
+
+// Subtipo de la partición de datos del registro (ver partitions.csv).
+static const uint8_t LOG_PARTITION_SUBTYPE = 0x40;
+
+}  // namespace bascula
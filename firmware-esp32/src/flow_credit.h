@@ -0,0 +1,114 @@
+// firmware-esp32/src/flow_credit.h
+//
+// Control de flujo por créditos de las tramas G: hacia el host. Sin él, un
+// host ocupado (captura de cámara, llamadas a la IA) deja de leer y el
+// buffer de la UART del kernel se llena de tramas viejas: al volver, la
+// interfaz enseña pesos de hace segundos.
+//
+// Con "FC:<n>" el host fija cuántas tramas más acepta; cada trama emitida
+// gasta un crédito. Sin créditos no sale nada y solo se guarda la última
+// trama (la más reciente sustituye a la anterior). La siguiente concesión la
+// emite en el acto, así que lo primero que lee el host tras un parón es el
+// valor actual y no una cola de valores viejos. El host renueva la
+// concesión antes de agotarla (mitad de la ventana) y en marcha normal nunca
+// se llega a retener nada.
+//
+// Solo se regulan las tramas G:. Respuestas y eventos salen siempre: son
+// pocos y no se pueden perder. La línea PRB: de la misma muestra va pegada a
+// su trama: sale, se retiene y se sustituye con ella.
+//
+// Un host que no habla este protocolo (o que murió) no puede dejar la
+// báscula muda para siempre: sin ninguna concesión en FC_LEASE_MS se vuelve
+// al envío libre.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace bascula {
+
+static const uint16_t FC_CREDIT_MAX = 64;     // ~1,3 s de tramas a 50 Hz
+static const uint32_t FC_LEASE_MS   = 30000;  // sin concesiones: envío libre
+static const size_t   FC_FRAME_MAX  = 96;     // trama retenida (con campos extra)
+static const size_t   FC_TRAILER_MAX = 112;   // línea que la acompaña (PRB:)
+
+class CreditGate {
+public:
+  CreditGate() { disable(); }
+
+  bool     enabled() const { return on_; }
+  uint16_t credits() const { return credits_; }
+  bool     holding() const { return held_; }
+  // Tramas sustituidas por una más reciente mientras no había créditos.
+  uint32_t skipped() const { return skipped_; }
+
+  // "FC:<n>": fija los créditos (no los suma: una concesión perdida no
+  // desajusta la cuenta) y activa el control. n = 0 corta el envío ya.
+  void grant(uint16_t n, uint32_t nowMs) {
+    on_ = true;
+    credits_ = n > FC_CREDIT_MAX ? FC_CREDIT_MAX : n;
+    grantMs_ = nowMs;
+  }
+
+  void disable() {
+    on_ = false;
+    credits_ = 0;
+    held_ = false;
+    skipped_ = 0;
+    grantMs_ = 0;
+  }
+
+  // Trama lista, con la línea que la sigue o nullptr. true: salen ya.
+  // false: quedan retenidas juntas como las últimas.
+  bool offer(const char* line, const char* trailer = nullptr) {
+    if (!on_) return true;
+    if (credits_ > 0) {
+      credits_--;
+      held_ = false;  // la retenida es más vieja que esta
+      return true;
+    }
+    if (held_) skipped_++;
+    strncpy(heldLine_, line, FC_FRAME_MAX - 1);
+    heldLine_[FC_FRAME_MAX - 1] = '\0';
+    heldTrailer_[0] = '\0';
+    if (trailer) {
+      strncpy(heldTrailer_, trailer, FC_TRAILER_MAX - 1);
+      heldTrailer_[FC_TRAILER_MAX - 1] = '\0';
+    }
+    held_ = true;
+    return false;
+  }
+
+  // Tras grant(): la trama retenida, si la hay y hay crédito (una vez). En
+  // *trailer, la línea retenida con ella o nullptr.
+  const char* takeHeld(const char** trailer = nullptr) {
+    if (!held_ || credits_ == 0) return nullptr;
+    held_ = false;
+    credits_--;
+    if (trailer) *trailer = heldTrailer_[0] ? heldTrailer_ : nullptr;
+    return heldLine_;
+  }
+
+  // true (una vez) si el host dejó de conceder: vuelve el envío libre.
+  bool expired(uint32_t nowMs) {
+    if (!on_ || (nowMs - grantMs_) < FC_LEASE_MS) return false;
+    on_ = false;
+    credits_ = 0;
+    held_ = false;
+    return true;
+  }
+
+private:
+  bool     on_;
+  bool     held_;
+  uint16_t credits_;
+  uint32_t skipped_;
+  uint32_t grantMs_;
+  char     heldLine_[FC_FRAME_MAX];
+  char     heldTrailer_[FC_TRAILER_MAX];
+};
+
+}  // namespace bascula
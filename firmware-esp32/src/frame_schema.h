@@ -0,0 +1,317 @@
+// firmware-esp32/src/frame_schema.h
+//
+// Esquema único de las líneas de texto del protocolo: los campos de cada
+// trama (clave, tipo, escala y cifras) y los comandos con su respuesta. De
+// aquí salen el codificador del firmware (main.cpp, host/hx711_gpio.cpp) y
+// el decodificador del host (host/bascula_frames.cpp), que Python usa por
+// ctypes (bascula/core/frame_decoder.py) sin copiar nada de aquí.
+// tests/test_frame_schema.py comprueba que los comandos que envía el host
+// existen en kCommands.
+//
+// - Añadir un campo es una línea en la tabla de su trama. El codificador lo
+//   escribe en ese orden si está presente, y el tamaño máximo de la línea se
+//   vuelve a comprobar en compilación contra FRAME_LINE_MAX.
+// - Los formatos (",PK:%.2f", ...) se generan en compilación y cada campo se
+//   expande en línea. Queda el mismo snprintf por campo que se escribía a
+//   mano.
+// - Cada valor se recorta a sus cifras enteras, así que frameMaxLen() es una
+//   cota real: ninguna línea se corta a medias en el búfer del emisor.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <utility>
+
+namespace bascula {
+
+// Línea de texto más larga que acepta el decodificador del host, sin el fin
+// de línea (BASCULA_FRAMES_LINE_MAX).
+static const size_t FRAME_LINE_MAX = 160;
+
+enum class FieldType : uint8_t {
+  FLOAT,  // con `decimals` decimales
+  INT,
+  BOOL,   // 0 | 1
+  FLAG,   // solo aparece activo: <clave>:1
+};
+
+struct FrameField {
+  const char* tag;
+  FieldType   type;
+  uint8_t     decimals;  // escala: resolución 10^-decimals
+  uint8_t     fine;      // decimales con FrameRecord::fine
+  uint8_t     digits;    // cifras enteras; el valor se recorta a ±(10^digits - 1)
+  bool        required;  // sale siempre; los obligatorios van primero
+  const char* name;
+};
+
+struct FrameCommand {
+  const char* tag;    // comando, o su prefijo si termina en ':'
+  const char* args;   // sintaxis de lo que sigue a tag ("" si nada)
+  const char* reply;  // prefijo de la respuesta informativa (nullptr: ACK/ERR)
+  const char* name;
+};
+
+// ---------- TRAMAS ----------
+
+// G:<g>,S:<0|1>[,PK:<g>,PM:<g>][,B:<crudo>][,RES:<g>][,OL:1]
+struct WeightFrame {
+  static constexpr const char* prefix = "";
+  static constexpr FrameField fields[] = {
+      // clave  tipo            dec  fino cifras oblig. nombre
+      {"G",   FieldType::FLOAT, 2,   3,   7,     true,  "peso en g (3 decimales refinado)"},
+      {"S",   FieldType::BOOL,  0,   0,   1,     true,  "estable"},
+      {"PK",  FieldType::FLOAT, 2,   2,   7,     false, "pico en g (PEAK:ON)"},
+      {"PM",  FieldType::FLOAT, 2,   2,   7,     false, "mínimo en g (PEAK:ON)"},
+      {"B",   FieldType::INT,   0,   0,   8,     false, "crudo del canal B (CHB:<n>)"},
+      {"RES", FieldType::FLOAT, 4,   4,   3,     false, "resolución efectiva en g (REFINE:ON)"},
+      {"OL",  FieldType::FLAG,  0,   0,   1,     false, "sobrecarga"},
+  };
+  static constexpr size_t count = sizeof(fields) / sizeof(fields[0]);
+  static constexpr size_t at(const char* tag);
+};
+
+// PRB:R:<crudo>,V:,M:,N:,I:,D:,T: (PROBE:<máscara>; bit i = campo i)
+struct ProbeFrame {
+  static constexpr const char* prefix = "PRB:";
+  static constexpr FrameField fields[] = {
+      // clave  tipo            dec  fino cifras oblig. nombre
+      {"R",   FieldType::INT,   0,   0,   8,     false, "crudo que entró al filtro"},
+      {"V",   FieldType::INT,   0,   0,   8,     false, "último crudo validado"},
+      {"M",   FieldType::INT,   0,   0,   8,     false, "mediana en cuentas"},
+      {"N",   FieldType::INT,   0,   0,   9,     false, "mediana menos tara en cuentas"},
+      {"I",   FieldType::FLOAT, 4,   4,   7,     false, "salida del IIR en g"},
+      {"D",   FieldType::FLOAT, 4,   4,   7,     false, "delta de estabilidad en g"},
+      {"T",   FieldType::INT,   0,   0,   9,     false, "ms dentro del umbral"},
+  };
+  static constexpr size_t count = sizeof(fields) / sizeof(fields[0]);
+  static constexpr size_t at(const char* tag);
+};
+
+// ---------- COMANDOS ----------
+// Respuestas informativas (lo que no es ACK:/ERR:/EVT:): el decodificador
+// del host clasifica como INFO las que empiezan por algún `reply` de aquí o
+// por kUnsolicited.
+static constexpr FrameCommand kCommands[] = {
+    // comando     argumentos                                        respuesta
+    {"T",          "",                                               nullptr,      "tara"},
+    {"TARE",       "",                                               nullptr,      "tara (alias)"},
+    {"C:",         "<g>",                                            nullptr,      "calibrar con peso patrón"},
+    {"MEM",        "",                                               "MEM:",       "mapa de memoria"},
+    {"SEG:",       "ON|OFF",                                         nullptr,      "segmentación"},
+    {"CHECK:",     "<min>,<max>|OFF",                                nullptr,      "clasificación de porciones"},
+    {"PEAK:",      "RESET|GET|ON|OFF",                               "PEAK:",      "pico y mínimo"},
+    {"CAP:",       "<g>[,<ovl_g>]|GET",                              "CAP:",       "capacidad y sobrecarga"},
+    {"OVL:CLR",    "",                                               nullptr,      "borrar sobrecarga"},
+    {"VIB:",       "RUN|GET|ADAPT:ON|OFF",                           "VIB:",       "vibraciones"},
+    {"BOOT",       "",                                               "BOOT:",      "arranque"},
+    {"SELFTEST",   "[:RUN]",                                         "SELFTEST:",  "autotest del HX711"},
+    {"RATE",       "",                                               "RATE:",      "tasa medida"},
+    {"CHB:",       "<n>|GET",                                        "CHB:",       "canal B"},
+    {"DIV:",       "<d>[,<h>]|GET",                                  "DIV:",       "división de display"},
+    {"ROC:",       "ON|OFF",                                         nullptr,      "trama solo al cambiar"},
+    {"LOG:",       "DUMP[B][:<desde>]|INFO",                         "LOG:",       "registro en flash"},
+    {"OTA:",       "BEGIN:<bytes>,<crc32>,<chunk>|END|ABORT|STATUS", "OTA:",       "actualización"},
+    {"PROFILE:",   "<nombre>|LIST|GET|NEW:<nombre>|DEL:<nombre>",    "PROFILE:",   "perfiles"},
+    {"FILT:",      "<med_ms>,<tau_ms>,<umbral_g>,<estable_ms>|GET",  "FILT:",      "filtro"},
+    {"FC:",        "<n>|OFF|GET",                                    "FC:",        "créditos de tramas"},
+    {"SNAP:",      "<id>",                                           "SNAP:",      "instantánea"},
+    {"REFINE:",    "ON|OFF|GET",                                     "REFINE:",    "refinado"},
+    {"AUTOTUNE",   "[:<ruido_g>[,<tol_g>]]|:ABORT",                  "AUTOTUNE:",  "ajuste del filtro"},
+    {"TRIG",       "[:ARM[:<fuentes>[,<pre>,<post>]]|:OFF|:GET|:DUMP[:<desde>]]", "TRIG:", "captura con disparo"},
+    {"PROBE:",     "<máscara>|OFF|GET",                              "PROBE:",     "sondas del pipeline"},
+};
+static constexpr size_t kCommandCount = sizeof(kCommands) / sizeof(kCommands[0]);
+
+// Líneas informativas que salen sin comando
+static constexpr const char* kUnsolicited[] = {"HELLO"};
+
+// ---------- UTILIDADES EN COMPILACIÓN ----------
+
+constexpr size_t schemaStrLen(const char* s) {
+  size_t n = 0;
+  while (s[n] != '\0') ++n;
+  return n;
+}
+
+constexpr bool schemaStrEq(const char* a, const char* b) {
+  while (*a != '\0' && *a == *b) ++a, ++b;
+  return *a == *b;
+}
+
+template <class Frame>
+constexpr size_t frameFieldIndex(const char* tag) {
+  for (size_t i = 0; i < Frame::count; ++i) {
+    if (schemaStrEq(Frame::fields[i].tag, tag)) return i;
+  }
+  return Frame::count;
+}
+
+constexpr size_t WeightFrame::at(const char* tag) { return frameFieldIndex<WeightFrame>(tag); }
+constexpr size_t ProbeFrame::at(const char* tag) { return frameFieldIndex<ProbeFrame>(tag); }
+
+// Caracteres del campo como mucho, con la coma delante.
+constexpr size_t fieldMaxLen(const FrameField& f) {
+  const size_t dec = f.decimals > f.fine ? f.decimals : f.fine;
+  const size_t value = f.type == FieldType::FLOAT ? 1 + f.digits + 1 + dec
+                       : f.type == FieldType::INT ? 1 + f.digits
+                                                  : 1;
+  return 1 + schemaStrLen(f.tag) + 1 + value;
+}
+
+template <class Frame>
+constexpr size_t frameMaxLen() {
+  size_t n = schemaStrLen(Frame::prefix);
+  for (size_t i = 0; i < Frame::count; ++i) n += fieldMaxLen(Frame::fields[i]);
+  return n;
+}
+
+// Claves únicas y cortas, decimales de una cifra, enteros que caben en un
+// long de 32 bits, obligatorios delante y máscara de presencia de 32 bits.
+template <class Frame>
+constexpr bool frameValid() {
+  if (Frame::count == 0 || Frame::count > 32) return false;
+  bool optional = false;
+  for (size_t i = 0; i < Frame::count; ++i) {
+    const FrameField& f = Frame::fields[i];
+    const size_t len = schemaStrLen(f.tag);
+    if (len == 0 || len > 8 || f.decimals > 9 || f.fine > 9 || f.digits == 0 ||
+        f.digits > 10 || frameFieldIndex<Frame>(f.tag) != i) {
+      return false;
+    }
+    if (f.type != FieldType::FLOAT && (f.decimals != 0 || f.fine != 0)) return false;
+    if (f.type == FieldType::INT && f.digits > 9) return false;  // long de 32 bits
+    if (f.required && optional) return false;
+    optional = optional || !f.required;
+  }
+  return true;
+}
+
+constexpr size_t commandMaxLen() {
+  size_t n = 0;
+  for (size_t i = 0; i < kCommandCount; ++i) {
+    const size_t len = schemaStrLen(kCommands[i].tag);
+    if (len > n) n = len;
+  }
+  return n;
+}
+
+constexpr bool commandsValid() {
+  for (size_t i = 0; i < kCommandCount; ++i) {
+    if (schemaStrLen(kCommands[i].tag) == 0) return false;
+    for (size_t j = 0; j < i; ++j) {
+      if (schemaStrEq(kCommands[i].tag, kCommands[j].tag)) return false;
+    }
+  }
+  return true;
+}
+
+static_assert(frameValid<WeightFrame>(), "tabla de WeightFrame mal formada");
+static_assert(frameValid<ProbeFrame>(), "tabla de ProbeFrame mal formada");
+static_assert(frameMaxLen<WeightFrame>() <= FRAME_LINE_MAX, "la trama G: no cabe en una línea");
+static_assert(frameMaxLen<ProbeFrame>() <= FRAME_LINE_MAX, "la línea PRB: no cabe en una línea");
+static_assert(commandsValid(), "comandos repetidos o vacíos");
+
+// ---------- CODIFICADOR ----------
+
+// Valores de una línea. Los campos obligatorios se ponen siempre; el resto
+// sale solo si se ha llamado a set<>() con ellos.
+template <class Frame>
+struct FrameRecord {
+  double   value[Frame::count] = {};
+  uint32_t present = 0;
+  bool     fine = false;  // decimales `fine` en vez de `decimals`
+
+  template <size_t I>
+  void set(double v) {
+    static_assert(I < Frame::count, "campo fuera del esquema");
+    value[I] = v;
+    present |= 1u << I;
+  }
+};
+
+struct FieldFormat {
+  char text[16];
+};
+
+// ",<clave>:%.<d>f" | ",<clave>:%ld" | ",<clave>:%d"
+template <class Frame, size_t I, bool Fine>
+constexpr FieldFormat makeFieldFormat() {
+  FieldFormat out{};
+  const FrameField& f = Frame::fields[I];
+  size_t n = 0;
+  out.text[n++] = ',';
+  for (const char* t = f.tag; *t != '\0'; ++t) out.text[n++] = *t;
+  out.text[n++] = ':';
+  out.text[n++] = '%';
+  if (f.type == FieldType::FLOAT) {
+    out.text[n++] = '.';
+    out.text[n++] = (char)('0' + (Fine ? f.fine : f.decimals));
+    out.text[n++] = 'f';
+  } else if (f.type == FieldType::INT) {
+    out.text[n++] = 'l';
+    out.text[n++] = 'd';
+  } else {
+    out.text[n++] = 'd';
+  }
+  out.text[n] = '\0';
+  return out;
+}
+
+template <class Frame, size_t I, bool Fine>
+struct FieldFormatOf {
+  static constexpr FieldFormat value = makeFieldFormat<Frame, I, Fine>();
+};
+
+constexpr double schemaPow10(uint8_t d) {
+  double p = 1.0;
+  while (d-- > 0) p *= 10.0;
+  return p;
+}
+
+template <class Frame, size_t I>
+inline void encodeField(char* out, size_t size, size_t& n, const FrameRecord<Frame>& r) {
+  constexpr FrameField f = Frame::fields[I];
+  if (!f.required && !(r.present & (1u << I))) return;
+  const char* fmt = (f.fine != f.decimals && r.fine) ? FieldFormatOf<Frame, I, true>::value.text
+                                                     : FieldFormatOf<Frame, I, false>::value.text;
+  constexpr size_t prefixLen = schemaStrLen(Frame::prefix);
+  if (n == prefixLen) fmt++;  // primer campo: sin coma
+  char* p = out + (n < size ? n : size);
+  const size_t left = n < size ? size - n : 0;
+  constexpr double lim = schemaPow10(f.digits) - 1.0;
+  const double v = r.value[I] > lim ? lim : (r.value[I] < -lim ? -lim : r.value[I]);
+  int k;
+  if constexpr (f.type == FieldType::FLOAT) {
+    k = snprintf(p, left, fmt, v);
+  } else if constexpr (f.type == FieldType::INT) {
+    k = snprintf(p, left, fmt, (long)v);
+  } else if constexpr (f.type == FieldType::BOOL) {
+    k = snprintf(p, left, fmt, v != 0.0 ? 1 : 0);
+  } else {
+    k = snprintf(p, left, fmt, 1);
+  }
+  if (k > 0) n += (size_t)k;
+}
+
+template <class Frame, size_t... I>
+inline size_t encodeFrame(char* out, size_t size, const FrameRecord<Frame>& r,
+                          std::index_sequence<I...>) {
+  const int k = snprintf(out, size, "%s", Frame::prefix);
+  size_t n = k > 0 ? (size_t)k : 0;
+  (encodeField<Frame, I>(out, size, n, r), ...);
+  return n;
+}
+
+// Escribe la línea (sin fin de línea) y devuelve su longitud. Con size >=
+// frameMaxLen<Frame>() + 1 nunca se recorta.
+template <class Frame>
+inline size_t frameEncode(char* out, size_t size, const FrameRecord<Frame>& r) {
+  return encodeFrame(out, size, r, std::make_index_sequence<Frame::count>());
+}
+
+}  // namespace bascula
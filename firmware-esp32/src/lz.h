@@ -0,0 +1,115 @@
+// firmware-esp32/src/lz.h
+//
+// Compresor LZSS mínimo para bloques independientes (chunks de OTA). Sin
+// dependencias (zlib/miniz): el descompresor son unas decenas de líneas sin
+// estado entre bloques ni memoria de trabajo aparte de la salida, y el
+// compresor (solo lo usa el host) es una búsqueda voraz con cadenas hash.
+//
+// Formato: grupos de un byte de banderas + 8 elementos. Bit i (LSB primero)
+// a 1 = literal (1 byte); a 0 = coincidencia de 2 bytes:
+//   b0 = (dist - 1) & 0xFF
+//   b1 = ((dist - 1) >> 8) & 0x0F | (len - 3) << 4      dist 1..4096, len 3..18
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bascula {
+
+static const size_t LZ_WINDOW  = 4096;
+static const size_t LZ_MIN_LEN = 3;
+static const size_t LZ_MAX_LEN = 18;
+static const size_t LZ_BLOCK_MAX = 4096;  // bloque máximo del compresor
+
+// Devuelve los bytes descomprimidos o -1 si la entrada está corrupta o no
+// cabe en outCap.
+static inline int lzDecompress(const uint8_t* in, size_t inLen, uint8_t* out,
+                               size_t outCap) {
+  size_t ip = 0, op = 0;
+  while (ip < inLen) {
+    uint8_t flags = in[ip++];
+    for (int bit = 0; bit < 8 && ip < inLen; ++bit) {
+      if (flags & (1u << bit)) {
+        if (op >= outCap) return -1;
+        out[op++] = in[ip++];
+      } else {
+        if (ip + 2 > inLen) return -1;
+        size_t dist = ((size_t)in[ip] | ((size_t)(in[ip + 1] & 0x0F) << 8)) + 1;
+        size_t len = (size_t)(in[ip + 1] >> 4) + LZ_MIN_LEN;
+        ip += 2;
+        if (dist > op || op + len > outCap) return -1;
+        for (size_t k = 0; k < len; ++k, ++op) out[op] = out[op - dist];
+      }
+    }
+  }
+  return (int)op;
+}
+
+// Comprime n bytes (n <= LZ_BLOCK_MAX; usa ~16 KB de pila, pensado para el
+// host). Devuelve el tamaño comprimido o 0 si no cabe en outCap (el llamador
+// envía entonces el bloque sin comprimir).
+static inline size_t lzCompress(const uint8_t* in, size_t n, uint8_t* out,
+                                size_t outCap) {
+  static const size_t HASH_BITS = 12;
+  static const size_t NO_POS = 0xFFFF;
+  uint16_t head[1u << HASH_BITS];
+  uint16_t prev[LZ_BLOCK_MAX];
+  if (n > LZ_BLOCK_MAX) return 0;
+  for (size_t i = 0; i < (1u << HASH_BITS); ++i) head[i] = (uint16_t)NO_POS;
+
+  auto hash3 = [&](size_t i) -> size_t {
+    uint32_t v = (uint32_t)in[i] | ((uint32_t)in[i + 1] << 8) | ((uint32_t)in[i + 2] << 16);
+    return (size_t)((v * 2654435761u) >> (32 - HASH_BITS));
+  };
+  auto insert = [&](size_t i) {
+    if (i + LZ_MIN_LEN > n) return;
+    size_t h = hash3(i);
+    prev[i] = head[h];
+    head[h] = (uint16_t)i;
+  };
+
+  size_t ip = 0, op = 0;
+  while (ip < n) {
+    if (op >= outCap) return 0;
+    size_t flagPos = op++;
+    uint8_t flags = 0;
+    for (int bit = 0; bit < 8 && ip < n; ++bit) {
+      size_t bestLen = 0, bestDist = 0;
+      if (ip + LZ_MIN_LEN <= n) {
+        size_t cand = head[hash3(ip)];
+        for (int chain = 0; cand != NO_POS && chain < 32; ++chain) {
+          size_t dist = ip - cand;
+          if (dist > LZ_WINDOW) break;
+          size_t maxLen = n - ip < LZ_MAX_LEN ? n - ip : LZ_MAX_LEN;
+          size_t len = 0;
+          while (len < maxLen && in[cand + len] == in[ip + len]) ++len;
+          if (len > bestLen) {
+            bestLen = len;
+            bestDist = dist;
+            if (len == maxLen) break;
+          }
+          cand = prev[cand];
+        }
+      }
+      if (bestLen >= LZ_MIN_LEN) {
+        if (op + 2 > outCap) return 0;
+        size_t d = bestDist - 1;
+        out[op++] = (uint8_t)(d & 0xFF);
+        out[op++] = (uint8_t)(((d >> 8) & 0x0F) | ((bestLen - LZ_MIN_LEN) << 4));
+        for (size_t k = 0; k < bestLen; ++k) insert(ip + k);
+        ip += bestLen;
+      } else {
+        if (op >= outCap) return 0;
+        flags |= (uint8_t)(1u << bit);
+        insert(ip);
+        out[op++] = in[ip++];
+      }
+    }
+    out[flagPos] = flags;
+  }
+  return op;
+}
+
+}  // namespace bascula
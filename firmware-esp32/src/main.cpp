@@ -1,13 +1,82 @@
 // firmware-esp32/src/main.cpp
 //
 // ESP32 + HX711 -> UART (Serial1) @ 115200
-// Protocolo por línea: G:<gramos>,S:<0|1>
-// Comandos desde la Pi: "T" (Tara) y "C:<peso>" (Calibrar con peso patrón en gramos)
+// Protocolo por línea: G:<gramos>,S:<0|1> (campos y comandos: frame_schema.h)
+// Comandos desde la Pi: "T"/"TARE" (Tara), "C:<peso>" (Calibrar con peso patrón en g)
+//                       "MEM" (mapa de memoria estática), "SEG:ON|OFF" y
+//                       "CHECK:<min>,<max>" / "CHECK:OFF" y
+//                       "PEAK:RESET|GET|ON|OFF", "CAP:<g>[,<ovl_g>]",
+//                       "CAP:GET", "OVL:CLR", "VIB:RUN|GET|ADAPT:ON|OFF" y
+//                       "BOOT" (tiempos de arranque), "SELFTEST[:RUN]" y
+//                       "RATE" (tasa medida del HX711), "CHB:<n>|GET",
+//                       "DIV:<d>[,<h>]", "ROC:ON|OFF" y
+//                       "LOG:DUMP[B][:<desde>]" / "LOG:INFO" (registro en flash) y
+//                       "OTA:BEGIN|END|ABORT|STATUS" (actualización por Serial1) y
+//                       "PROFILE:<nombre>|LIST|GET|NEW:<n>|DEL:<n>", "FILT:..." y
+//                       "FC:<n>|OFF|GET" (control de flujo por créditos) y
+//                       "SNAP:<id>" (instantánea para la cámara) y
+//                       "REFINE:ON|OFF|GET" (refinado con la carga quieta) y
+//                       "AUTOTUNE[:<ruido_g>[,<tol_g>]]|ABORT" (ajuste del filtro) y
+//                       "TRIG", "TRIG:ARM[:<fuentes>[,<pre_ms>,<post_ms>]]|OFF|GET" y
+//                       "TRIG:DUMP[:<desde>]" (captura con disparo) y
+//                       "PROBE:<máscara>|OFF|GET" (sondas del pipeline)
+// Saludo tras el autotest: HELLO:ESP32-HX711,ST:<código>,SPS:<sps>,NOISE:<cuentas>
+// Trama extendida opcional (PEAK:ON): G:<g>,S:<0|1>,PK:<g>,PM:<g>
+// Canal B intercalado (CHB:<n>): ...,B:<crudo B>
+// Refinado (REFINE:ON): ...,RES:<g> (resolución efectiva del valor G)
+// Sondas (PROBE:<máscara>), tras cada G:: PRB:R:<crudo>,V:,M:,N:,I:,D:,T:
+// Sobre capacidad o sobrecarga enganchada: ...,S:0,OL:1
+// Evento de protección (siempre): EVT:OVERLOAD,R:<crudo>,G:<g>,N:<total>,MS:<ms>
+// Evento de arranque (una vez):    EVT:BOOT,W:<0|1>,V:<ms>,ST:<ms>,RST:<motivo>
+// Eventos opcionales: EVT:ADD|REM,D:<delta>,T:<total>,MS:<fin>,DUR:<ms>
+//                     EVT:CHECK,C:<UNDER|IN|OVER>,S:<0|1>,G:<gramos>,MS:<ms>
+// Captura congelada: EVT:TRIG,WHY:<MOT|OVL|ADC|CMD>,N:<muestras>,AT:<i>,MS:<ms>
 //
-// - Filtro: mediana (ventana N) + IIR (alpha)
+// - Filtro: mediana (ventana N) + IIR (alpha)  -> pipeline.h
+// - Tasa real del HX711 medida en continuo; ventanas y constantes de tiempo
+//   en ms convertidas a muestras -> rate.h
 // - Estabilidad: ventana temporal con umbral
-// - Persistencia: factor de calibración y tara en NVS (Preferences)
+// - Segmentación de ingredientes a ritmo de muestra -> segmenter.h
+// - Clasificación de porciones (checkweigher) por muestra -> checkweigher.h
+// - Pico / mínimo sobre crudos validados a la tasa completa -> peak_hold.h
+// - Capacidad / sobrecarga sobre cuentas crudas, antes del filtro -> overload.h
+// - Diagnóstico de vibraciones (FFT real, esp-dsp si existe) -> spectrum.h
+// - Arranque en caliente desde memoria RTC (CRC + marca de tiempo) -> warm_state.h
+// - División de display con histéresis -> quantizer.h; con ROC:ON la trama
+//   solo sale si cambia G, S u OL (y un latido cada ROC_HEARTBEAT_MS)
+// - Canal B (ganancia 32) intercalado a baja proporción -> channel_mux.h
+// - Autotest del HX711 en las primeras conversiones (DRDY, tasa, ruido,
+//   bits pegados, saturación) -> selftest.h
+// - Persistencia: perfiles de calibración con nombre en NVS (Preferences):
+//   cero, pendiente, filtro y umbrales por plataforma -> profile.h
+// - Registro circular de eventos en una partición de flash propia, escrito
+//   por una tarea de baja prioridad -> event_log.h; volcado en texto o en
+//   tramas binarias delta + varint -> bulk_codec.h
+// - Actualización OTA por Serial1: tramas binarias comprimidas con CRC,
+//   ventana con confirmaciones, reanudación y verificación antes de activar
+//   -> ota_stream.h
+// - Control de flujo por créditos de las tramas G: (FC:<n>); sin créditos
+//   solo se guarda la última y sale en cuanto el host concede -> flow_credit.h
+// - Refinado progresivo con S:1: media de ventana creciente de los crudos
+//   validados, vaciada al primer movimiento -> refine.h
+// - Ajuste automático del filtro: vacío + escalón grabados y reproducidos
+//   por una rejilla de mediana/IIR/estabilidad -> autotune.h
+// - Captura con disparo: anillo de crudos (PSRAM si hay) congelado con
+//   pre/post-disparo por movimiento, sobrecarga, ADC o TRIG -> trigger_capture.h
+// - Esquema único de campos de trama y comandos; el codificador de G: y PRB:
+//   y la comprobación de tamaño se generan en compilación -> frame_schema.h
+// - Sondas: valores intermedios del pipeline en una línea PRB: detrás de
+//   cada trama emitida, solo los de la máscara -> probe.h
 // - Protección: límite de longitud de comando y error si se excede
+// - Tareas FreeRTOS con asignación estática (rtos_static.h):
+//     acq  -> lectura HX711, comandos y filtro (único dueño del pipeline)
+//     rx   -> ensamblado de líneas de comando desde Serial1 (despierta con
+//             onReceive, sin sondeo)
+//     tx   -> vaciado del stream buffer de salida hacia Serial1
+//     log  -> escritura del registro en flash y volcados LOG:DUMP
+//     ota  -> descompresión y escritura de la imagen OTA en la partición inactiva
+//   Sin memoria dinámica en runtime; el mapa de memoria se comprueba en
+//   compilación contra BASCULA_RAM_BUDGET.
 //
 // Pines por defecto (ajustables):
 //   HX711_DOUT = GPIO 4
@@ -23,15 +92,81 @@
 // Requisitos de librerías (Arduino IDE):
 //   - HX711 (bogde): https://github.com/bogde/HX711
 //   - Preferences (core ESP32)
-//   - Core ESP32 de Espressif
+//   - Core ESP32 de Espressif (3.x, C++17)
 //
 // Compilación: ESP32 DevKit / WROOM / equivalente
 
 #include <Arduino.h>
 #include <HX711.h>
 #include <Preferences.h>
-#include <algorithm>  // std::sort
 #include <math.h>     // fabsf
+#include <stdarg.h>   // va_list
+#include <stdio.h>    // snprintf
+#include <stdlib.h>   // strtof
+#include <string.h>   // strcmp
+#include <sys/time.h> // gettimeofday (mantenido por el RTC en reinicios)
+#include <esp_system.h>  // esp_reset_reason
+#include <esp_ota_ops.h> // partición OTA inactiva / arranque
+
+#include "autotune.h"
+#include "bulk_codec.h"
+#include "channel_mux.h"
+#include "checkweigher.h"
+#include "event_log.h"
+#include "flow_credit.h"
+#include "frame_schema.h"
+#include "snapshot.h"
+#include "ota_stream.h"
+#include "overload.h"
+#include "partition_flash.h"
+#include "peak_hold.h"
+#include "pipeline.h"
+#include "probe.h"
+#include "profile.h"
+#include "quantizer.h"
+#include "rate.h"
+#include "refine.h"
+#include "rtos_static.h"
+#include "segmenter.h"
+#include "selftest.h"
+#include "spectrum.h"
+#include "trigger_capture.h"
+#include "warm_state.h"
+
+using bascula::ChannelMux;
+using bascula::CreditGate;
+using bascula::DeltaFrameWriter;
+using bascula::CheckWeigher;
+using bascula::DisplayQuantizer;
+using bascula::EspPartitionFlash;
+using bascula::LogCursor;
+using bascula::LogRecord;
+using bascula::OtaFrame;
+using bascula::OtaFrameParser;
+using bascula::OtaReceiver;
+using bascula::OtaResume;
+using bascula::RingLog;
+using bascula::FilterParams;
+using bascula::FilterTuner;
+using bascula::FilterTiming;
+using bascula::OverloadGuard;
+using bascula::PeakHold;
+using bascula::Pipeline;
+using bascula::PipelineOut;
+using bascula::CalProfile;
+using bascula::ProfileTable;
+using bascula::RateEstimator;
+using bascula::SegEvent;
+using bascula::SegParams;
+using bascula::Segmenter;
+using bascula::SelfTestResult;
+using bascula::SnapRequest;
+using bascula::SpectrumAnalyzer;
+using bascula::SpectrumReport;
+using bascula::StableRefiner;
+using bascula::TraceSample;
+using bascula::TriggerCapture;
+using bascula::WarmState;
 
 // ---------- CONFIG PINES ----------
 #ifndef HX711_DOUT_PIN
@@ -55,224 +190,1927 @@ static const uint32_t BAUD     = 115200;   // Serial1 (a la Pi)
 static const uint32_t BAUD_USB = 115200;   // Serial (debug USB)
 
 // ---------- FILTRO / ESTABILIDAD ----------
-static const size_t  MEDIAN_WINDOW   = 15;    // impar recomendado
-static const float   IIR_ALPHA       = 0.20f; // 0-1
+// En tiempo, no en muestras: rate.h los convierte según la tasa medida.
+// (375 ms / 112 ms equivalen a la antigua ventana de 15 y alpha 0.20 con el
+// pipeline a 40 Hz, que es lo que daba LOOP_HZ con un HX711 a 80 SPS.)
+static const uint32_t MEDIAN_MS      = 375;   // ventana de mediana
+static const uint32_t IIR_TAU_MS     = 112;   // constante de tiempo del IIR
 static const float   STABLE_DELTA_G  = 1.0f;  // umbral en gramos
 static const uint32_t STABLE_MS      = 700;   // ms
-static const uint16_t LOOP_HZ        = 50;    // Hz aprox
+static const uint16_t LOOP_HZ        = 50;    // Hz aprox (máximo)
+
+#ifndef HX711_NOMINAL_SPS
+#define HX711_NOMINAL_SPS 10                  // RATE a GND hasta medir
+#endif
+static const float    RATE_RETUNE_FRAC = 0.15f; // re-derivar si cambia > 15 %
+
+// ---------- SEGMENTACIÓN ----------
+static const float    SEG_MIN_STEP_G    = 2.0f;  // paso mínimo reportado
+static const float    SEG_SETTLE_BAND_G = 0.8f;  // banda de asentamiento
+static const uint32_t SEG_SETTLE_MS     = 250;   // más corto que STABLE_MS
+
+// ---------- CHECKWEIGHER ----------
+static const float    CHECK_HYST_G      = 0.3f;  // histéresis en los límites
+
+// ---------- VIBRACIONES ----------
+static const size_t   VIB_WINDOW        = 256;   // 3.2 s a 80 SPS
+static const float    VIB_ADAPT_K       = 3.0f;  // umbral = K * RMS de vibración
+static const float    VIB_ADAPT_MAX_G   = 5.0f;  // tope del umbral adaptado
+
+// ---------- ARRANQUE EN CALIENTE ----------
+static const int64_t  WARM_MAX_AGE_US   = 30LL * 1000000LL; // estado útil tras reset
+static const float    WARM_MAX_JUMP_G   = 5.0f;  // si la carga cambió, arranque frío
+
+// ---------- HX711 / AUTOTEST ----------
+static const uint32_t ADC_TIMEOUT_MS      = 500;     // > 4 periodos a 10 SPS
+static const uint32_t SELFTEST_BUDGET_MS  = 900;     // veredicto en < 1 s
+static const float    SELFTEST_NOISE_MAX  = 3000.0f; // cuentas (desv. típica)
+
+// ---------- DISPLAY ----------
+static const float    DIV_HYST_FRAC     = 0.25f; // histéresis por defecto (× división)
+static const uint32_t ROC_HEARTBEAT_MS  = 250;   // < 1 s: el host no da la señal por perdida
+
+// ---------- OTA ----------
+static const uint32_t OTA_FRAME_MS      = 200;     // tramas a 5 Hz durante la OTA
+
+// ---------- CANAL B ----------
+static const uint16_t CHB_EVERY_MIN     = 16;      // >= 16 conversiones de A por visita
+static const uint16_t CHB_EVERY_MAX     = 10000;
+
+// ---------- CAPACIDAD ----------
+static const float    DEFAULT_CAPACITY_G = 5000.0f; // celda de 5 kg
+static const float    DEFAULT_OVERLOAD_G = 6000.0f; // 120 %: riesgo de daño
+
+// ---------- CAPTURA CON DISPARO ----------
+static const size_t   TRIG_PSRAM_SAMPLES = 8192;  // 64 KB: ~100 s a 80 SPS
+static const size_t   TRIG_RAM_SAMPLES   = 320;   // sin PSRAM: 4 s a 80 SPS (2.5 KB)
+static const uint32_t TRIG_PRE_MS        = 2000;
+static const uint32_t TRIG_POST_MS       = 1000;
+static const uint8_t  TRIG_SOURCES       = bascula::TRIG_OVERLOAD | bascula::TRIG_ADC;
 
 // ---------- NVS ----------
 static const char* NVS_NAMESPACE   = "bascula";
-static const char* KEY_CAL_FACTOR  = "cal_f";
-static const char* KEY_TARE_OFFSET = "tare";
+static const char* KEY_CAL_FACTOR  = "cal_f";   // solo migración al perfil "default"
+static const char* KEY_TARE_OFFSET = "tare";    // ídem
+static const char* KEY_CAPACITY    = "cap_g";   // ídem
+static const char* KEY_OVERLOAD    = "ovl_g";   // ídem
+static const char* KEY_PROFILE     = "prof_act";
+static const char* KEY_PROFILE_FMT = "prof%u";  // un blob CalProfile por slot
+static const char* DEFAULT_PROFILE = "default";
+static const char* KEY_OVL_COUNT   = "ovl_n";
+static const char* KEY_CHB_EVERY   = "chb_n";
+static const char* KEY_DIV         = "div_g";
+static const char* KEY_DIV_HYST    = "div_h";
+static const char* KEY_OTA_RESUME  = "ota_rs";
 
 // ---------- COMANDOS ----------
 static const size_t CMD_MAX_LEN = 80;     // límite seguro para líneas de comando
+static_assert(bascula::commandMaxLen() < CMD_MAX_LEN, "comando del esquema más largo que CMD_MAX_LEN");
+
+// ---------- TAREAS / MEMORIA ----------
+#ifndef BASCULA_RAM_BUDGET
+#define BASCULA_RAM_BUDGET 36864          // bytes de estado estático propio
+#endif
+
+static const size_t   CMD_QUEUE_DEPTH   = 4;
+static const size_t   LOG_QUEUE_DEPTH   = 16;
+static const size_t   LOG_DUMP_BATCH    = 8;     // registros por lote de LOG:DUMP
+static const size_t   LOG_LINE_MAX      = 56;    // "LOG:<seq>,B:..,K:..,V:.." + CRLF
+static const size_t   LOG_TX_RESERVE    = 256;   // hueco que se deja a las tramas
+static const char*    LOG_PARTITION     = "blog";
+static const size_t   UART_RX_BYTES     = 2048;  // cabe más de una trama OTA
+static const size_t   TX_STREAM_BYTES   = 1024;  // ~60 tramas G: en cola
+static const uint32_t STATS_PERIOD_MS   = 1000;
+static const uint32_t STACK_WARN_BYTES  = 256;   // aviso si el margen baja de aquí
+
+static const UBaseType_t PRIO_ACQ = 5;
+static const UBaseType_t PRIO_TX  = 4;
+static const UBaseType_t PRIO_RX  = 3;
+static const UBaseType_t PRIO_OTA = 2;  // por debajo de rx: no frena la recepción
+static const UBaseType_t PRIO_LOG = 1;  // la flash nunca retrasa la adquisición
+
+struct CmdMsg {
+  char text[CMD_MAX_LEN + 1];
+  bool overflow;
+};
+
+// Petición a la tarea log: un evento que anotar o un volcado/consulta.
+struct LogMsg {
+  uint8_t  kind;   // bascula::LogKind o LOG_OP_*
+  int32_t  value;  // valor del evento o secuencia inicial del volcado
+  uint32_t ms;
+};
+static const uint8_t LOG_OP_DUMP = 0xF0;
+static const uint8_t LOG_OP_INFO = 0xF1;
+static const uint8_t LOG_OP_DUMP_BIN = 0xF2;
+static const uint8_t LOG_OP_TRIG_DUMP = 0xF3;  // value = primera muestra
+static const uint8_t LOG_OP_OVL_COUNT = 0xF4;  // value = contador a guardar en NVS
+
+// Petición a la tarea ota. Las tramas llegan ya comprobadas en un slot.
+struct OtaMsg {
+  uint8_t  op;
+  uint8_t  slot;
+  uint16_t chunk;
+  uint32_t size;
+  uint32_t crc;
+};
+enum : uint8_t { OTA_OP_FRAME = 0, OTA_OP_BAD, OTA_OP_BEGIN, OTA_OP_END, OTA_OP_ABORT,
+                 OTA_OP_STATUS };
+
+struct OtaSlot {
+  uint8_t bytes[bascula::OTA_FRAME_MAX];
+};
+
+// Progreso guardado en NVS, ligado a la partición en la que se escribía.
+struct OtaSaved {
+  OtaResume r;
+  uint32_t  addr;
+};
+
+static StaticTaskSlot<4096>                     acqTask;
+static StaticTaskSlot<2048>                     rxTask;
+static StaticTaskSlot<2048>                     txTask;
+static StaticQueueSlot<CmdMsg, CMD_QUEUE_DEPTH> cmdQueue;
+static StaticQueueSlot<SnapRequest, bascula::SNAP_QUEUE_DEPTH> snapQueue;
+static StaticStreamSlot<TX_STREAM_BYTES>        txStream;
+static StaticMutexSlot                          txMutex;
+static StaticTimerSlot                          statsTimer;
+static StaticTaskSlot<3072>                     logTask;
+static StaticQueueSlot<LogMsg, LOG_QUEUE_DEPTH> logQueue;
+static StaticTaskSlot<3072>                     otaTask;
+static StaticQueueSlot<OtaMsg, bascula::OTA_WINDOW + 4> otaQueue;
+static StaticQueueSlot<uint8_t, bascula::OTA_WINDOW>    otaFree;
 
 // ---------- OBJETOS ----------
 HX711      scale;
 Preferences prefs;
 
+static const FilterTiming FILTER_TIMING{MEDIAN_MS, IIR_TAU_MS, STABLE_DELTA_G,
+                                        STABLE_MS};
+static FilterTiming g_timing = FILTER_TIMING;  // del perfil activo (solo acq)
+static ProfileTable profiles;
+static Pipeline pipeline(bascula::filterParamsFor(
+    FILTER_TIMING, 1000.0f / (float)HX711_NOMINAL_SPS));
+static RateEstimator rate;
+static ChannelMux    mux;
+static DisplayQuantizer quant;
+static EspPartitionFlash logFlash;
+static RingLog<EspPartitionFlash> eventLog(logFlash);
+static DeltaFrameWriter<bascula::BULK_LOG_COLS> logWriter;  // solo tarea log
+static uint8_t           logWire[bascula::BULK_WIRE_MAX];
+static OtaSlot           otaSlots[bascula::OTA_WINDOW];
+static OtaFrameParser    otaParser;  // solo tarea rx
+static EspPartitionFlash otaFlash;
+static OtaReceiver<EspPartitionFlash> ota(otaFlash);
+static Segmenter segmenter(SegParams{
+    SEG_MIN_STEP_G, SEG_SETTLE_BAND_G, SEG_SETTLE_MS});
+static CheckWeigher checker(CHECK_HYST_G);
+static PeakHold     peaks;
+static StableRefiner refine;  // solo tarea acq
+static FilterTuner  tuner;   // solo tarea acq
+static CreditGate   fc;  // solo tarea acq
+static OverloadGuard guard;
+static SpectrumAnalyzer<VIB_WINDOW> vib;
+static SpectrumReport vibReport;
+// Captura con disparo: escribe acq; la tarea log lee la ventana congelada.
+static TriggerCapture trig;
+static TraceSample    trigRam[TRIG_RAM_SAMPLES];  // sin PSRAM
+static DeltaFrameWriter<bascula::BULK_TRACE_COLS> trigWriter;  // solo tarea log
+
+// Captura del autotest: crudos e instante de cada conversión.
+struct SelfTestCapture {
+  long     raw[bascula::SELFTEST_MAX_SAMPLES];
+  uint32_t tUs[bascula::SELFTEST_MAX_SAMPLES];
+  size_t   n;
+  uint32_t startMs;
+  bool     active;
+  bool     drdyToggled;  // DOUT volvió a alto tras cada lectura
+};
+static SelfTestCapture stCap;
+static SelfTestResult  stResult;
+
+// Sobrevive a reinicios por software/watchdog (no a cortes de alimentación).
+RTC_NOINIT_ATTR static WarmState g_warm;
+
+// Mapa de memoria por subsistema (bytes de almacenamiento estático propio).
+static constexpr MemRegion MEM_MAP[] = {
+  {"acq",   decltype(acqTask)::kBytes + sizeof(Pipeline) + sizeof(Segmenter) +
+            sizeof(CheckWeigher) + sizeof(PeakHold) + sizeof(OverloadGuard) +
+            sizeof(SelfTestCapture) + sizeof(SelfTestResult) +
+            sizeof(RateEstimator) + sizeof(ChannelMux) + sizeof(DisplayQuantizer) +
+            sizeof(ProfileTable) + sizeof(CreditGate) + sizeof(StableRefiner) +
+            sizeof(FilterTuner)},
+  {"rx",    decltype(rxTask)::kBytes + decltype(cmdQueue)::kBytes +
+            decltype(snapQueue)::kBytes},
+  {"tx",    decltype(txTask)::kBytes + decltype(txStream)::kBytes +
+            StaticMutexSlot::kBytes},
+  {"vib",   sizeof(SpectrumAnalyzer<VIB_WINDOW>) + sizeof(SpectrumReport)},
+  {"stats", StaticTimerSlot::kBytes},
+  {"log",   decltype(logTask)::kBytes + decltype(logQueue)::kBytes +
+            sizeof(EspPartitionFlash) + sizeof(RingLog<EspPartitionFlash>) +
+            sizeof(logWriter) + sizeof(logWire)},
+  {"ota",   decltype(otaTask)::kBytes + decltype(otaQueue)::kBytes +
+            decltype(otaFree)::kBytes + sizeof(otaSlots) + sizeof(OtaFrameParser) +
+            sizeof(EspPartitionFlash) + sizeof(OtaReceiver<EspPartitionFlash>)},
+  {"trig",  sizeof(TriggerCapture) + sizeof(trigRam) + sizeof(trigWriter)},
+};
+static constexpr size_t MEM_TOTAL = memMapTotal(MEM_MAP);
+static_assert(MEM_TOTAL <= BASCULA_RAM_BUDGET,
+              "Mapa de memoria estática excede BASCULA_RAM_BUDGET");
+
 // ---------- ESTADO ----------
 volatile float   g_calFactor  = 1.0f;  // unidades crudas -> gramos
 volatile int32_t g_tareOffset = 0;     // offset de tara (unidades crudas)
+int32_t           g_zeroOffset = bascula::OVERLOAD_NO_ZERO; // cero de calibración (solo acq)
+volatile uint32_t g_txDrops   = 0;     // líneas descartadas por buffer lleno
+bool              g_segEnabled = false; // eventos EVT:ADD/REM (solo tarea acq)
+bool              g_peakFrame  = false; // campos PK/PM en la trama (solo acq)
+bool              g_refine     = false; // refinado con la carga quieta (solo acq)
+bool              g_roc        = false; // trama solo al cambiar (solo acq)
+uint32_t          g_rawInvalid = 0;     // muestras saturadas descartadas
+volatile bool     g_ovlDirty   = false; // contador de sobrecargas por persistir
+bool              g_vibAdapt   = false; // umbral de estabilidad según vibración
+uint8_t           g_probe      = 0;     // máscara de sondas PRB: (solo acq)
+bool              g_vibValid   = false; // hay un informe VIB disponible
+bool              g_warmBoot   = false; // pipeline sembrado desde RTC
+bool              g_warmCheck  = false; // validar la siembra con la 1ª muestra
+int               g_resetReason = 0;    // esp_reset_reason() del arranque
+uint32_t          g_bootValidMs  = 0;   // arranque -> primera trama
+uint32_t          g_bootStableMs = 0;   // arranque -> primera trama S:1
+uint32_t          g_adcTimeouts  = 0;   // esperas de DRDY agotadas
+bool              g_helloSent    = false; // HELLO sale con el primer autotest
+bool              g_adcDown      = false; // racha de esperas agotadas en curso
+volatile uint32_t g_logDrops     = 0;   // eventos sin hueco en la cola del registro
+volatile bool     g_otaActive    = false; // rx acepta tramas OTA
+volatile uint32_t g_rxUs         = 0;   // llegada del último bloque a Serial1
+volatile uint32_t g_otaDrops     = 0;   // tramas OTA sin slot libre (fuera de ventana)
+uint32_t          g_periodUs     = 1000000UL / HX711_NOMINAL_SPS; // aplicado
+uint8_t           g_decim        = 1;   // conversiones por muestra del pipeline
+bool              g_periodKnown  = false; // g_periodUs medido (o heredado de RTC)
+long              g_chbRaw       = 0;   // última conversión válida del canal B
+uint32_t          g_chbMs        = 0;   // instante de g_chbRaw
+uint32_t          g_chbCount     = 0;   // conversiones válidas de B
+uint32_t          g_trigPreMs    = TRIG_PRE_MS;   // ventana pedida (solo acq)
+uint32_t          g_trigPostMs   = TRIG_POST_MS;
+bool              g_trigPsram    = false; // anillo de la captura en PSRAM
+volatile bool     g_trigDumping  = false; // la tarea log lee la ventana
+volatile uint32_t g_minHeadroom[5] = {0, 0, 0, 0, 0};  // acq, rx, tx, log, ota
+
+// ---------- UTILS ----------
+// Propaga calibración y tara a todas las etapas que trabajan en cuentas. La
+// protección de sobrecarga mide desde el cero de calibración, no desde la tara.
+static void applyCalibration() {
+  pipeline.setCalibration(g_calFactor, g_tareOffset);
+  guard.setCalibration(g_calFactor, g_zeroOffset);
+}
 
-// ---------- BUFFER MEDIANA ----------
-class RingBuffer {
-public:
-  explicit RingBuffer(size_t n) : N(n), idx(0), count(0) {
-    buf = new long[N];
-    for (size_t i = 0; i < N; ++i) buf[i] = 0;
+// Espera acotada a DRDY: un DOUT muerto no debe colgar la tarea acq.
+static bool readRaw(long& out, uint32_t timeoutMs = ADC_TIMEOUT_MS) {
+  uint32_t t0 = millis();
+  while (!scale.is_ready()) {
+    if ((millis() - t0) >= timeoutMs) return false;
+    vTaskDelay(1);
   }
-  ~RingBuffer() { delete[] buf; }
+  out = scale.read(); // 24-bit signed
+  return true;
+}
+
+// Encola una línea completa (con CRLF) hacia Serial1. Nunca se parte una
+// línea: si no cabe entera se descarta y se contabiliza.
+static void emitLine(const char* s) {
+  size_t n = strlen(s);
+  xSemaphoreTake(txMutex.handle, portMAX_DELAY);
+  if (xStreamBufferSpacesAvailable(txStream.handle) >= n + 2) {
+    xStreamBufferSend(txStream.handle, s, n, 0);
+    xStreamBufferSend(txStream.handle, "\r\n", 2, 0);
+  } else {
+    g_txDrops = g_txDrops + 1;
+  }
+  xSemaphoreGive(txMutex.handle);
+}
 
-  void add(long v) {
-    buf[idx] = v;
-    idx = (idx + 1) % N;
-    if (count < N) count++;
+// Trama binaria completa (bulk_codec.h) o nada, igual que emitLine().
+static void emitBytes(const uint8_t* p, size_t n) {
+  xSemaphoreTake(txMutex.handle, portMAX_DELAY);
+  if (xStreamBufferSpacesAvailable(txStream.handle) >= n) {
+    xStreamBufferSend(txStream.handle, p, n, 0);
+  } else {
+    g_txDrops = g_txDrops + 1;
   }
+  xSemaphoreGive(txMutex.handle);
+}
+
+// Anota un evento en el registro de flash sin esperar nunca: si la cola está
+// llena se cuenta y la tarea log deja constancia (LOG_DROPPED).
+static void logEvent(uint8_t kind, int32_t value) {
+  LogMsg m{kind, value, millis()};
+  if (xQueueSend(logQueue.handle, &m, 0) != pdTRUE) g_logDrops = g_logDrops + 1;
+}
+
+static void emitf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static void emitf(const char* fmt, ...) {
+  char out[96];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(out, sizeof(out), fmt, ap);
+  va_end(ap);
+  emitLine(out);
+}
+
+// ---------- CAPTURA CON DISPARO ----------
+// Ventana pedida en ms -> conversiones a la tasa aplicada. Solo mientras
+// graba: una ventana disparada o congelada no cambia.
+static void trigRetime() {
+  if (trig.state() != TriggerCapture::ARMED) return;
+  trig.configure(trig.sources(), (size_t)(g_trigPreMs * 1000UL / g_periodUs),
+                 (size_t)(g_trigPostMs * 1000UL / g_periodUs));
+}
+
+static void reportTrigHold() {
+  emitf("EVT:TRIG,WHY:%s,N:%u,AT:%u,MS:%lu", bascula::trigSourceName(trig.why()),
+        (unsigned)trig.count(), (unsigned)trig.triggerIndex(),
+        (unsigned long)trig.triggerMs());
+  logEvent(bascula::LOG_TRIG, trig.why());
+}
 
-  size_t size() const { return count; }
+// Fuentes como letras: M (movimiento), O (sobrecarga), A (ADC); "-" sin
+// ninguna (solo TRIG).
+static void trigSourcesText(uint8_t src, char (&out)[4]) {
+  size_t n = 0;
+  if (src & bascula::TRIG_MOTION) out[n++] = 'M';
+  if (src & bascula::TRIG_OVERLOAD) out[n++] = 'O';
+  if (src & bascula::TRIG_ADC) out[n++] = 'A';
+  if (n == 0) out[n++] = '-';
+  out[n] = '\0';
+}
 
-  long median() const {
-    if (count == 0) return 0;
-    long* tmp = new long[count];
-    for (size_t i = 0; i < count; ++i) tmp[i] = buf[i];
-    std::sort(tmp, tmp + count);
-    long m = tmp[count / 2]; // usar ventana impar
-    delete[] tmp;
-    return m;
+// Estado de la captura (TRIG:GET). PRE/POST en ms efectivos.
+static void reportTrig() {
+  static const char* const kState[] = {"OFF", "ARM", "POST", "HOLD"};
+  char src[4];
+  trigSourcesText(trig.sources(), src);
+  emitf("TRIG:%s,SRC:%s,PRE:%lu,POST:%lu,CAP:%u,MEM:%s,N:%u,AT:%u,WHY:%s,MS:%lu",
+        kState[trig.state()], src, (unsigned long)(trig.pre() * g_periodUs / 1000UL),
+        (unsigned long)(trig.post() * g_periodUs / 1000UL), (unsigned)trig.capacity(),
+        g_trigPsram ? "PSRAM" : "RAM", (unsigned)trig.count(), (unsigned)trig.triggerIndex(),
+        bascula::trigSourceName(trig.why()), (unsigned long)trig.triggerMs());
+}
+
+// El aviso sale cuando la ventana queda completa (sin post-disparo, ya).
+static bool fireTrig(uint8_t source, uint32_t ms) {
+  if (!trig.fire(source, ms)) return false;
+  if (trig.state() == TriggerCapture::HOLD) reportTrigHold();
+  return true;
+}
+
+static void noteAdcTimeout() {
+  g_adcTimeouts++;
+  if (!g_adcDown) {
+    g_adcDown = true;  // una entrada por racha, no una cada 500 ms
+    logEvent(bascula::LOG_ADC_FAULT, (int32_t)g_adcTimeouts);
+    fireTrig(bascula::TRIG_ADC, millis());
+  } else if (trig.freeze()) {
+    reportTrigHold();  // sin conversiones no llega el post-disparo
   }
+}
 
-private:
-  long*  buf;
-  size_t N;
-  size_t idx;
-  size_t count;
-};
+// Deriva ventana de mediana, alpha y diezmado del periodo de conversión.
+// Conserva el estado del filtro y el umbral de estabilidad vigente (que
+// VIB:ADAPT puede haber cambiado).
+static void applyTiming(uint32_t periodUs) {
+  g_periodUs = periodUs;
+  g_periodKnown = true;
+  g_decim = bascula::decimationFor(periodUs, 1000000UL / LOOP_HZ);
+  FilterParams p = bascula::filterParamsFor(
+      g_timing, (float)g_decim * (float)periodUs / 1000.0f);
+  p.stableDeltaG = pipeline.params().stableDeltaG;
+  pipeline.retime(p);
+  trigRetime();
+}
 
-// ---------- UTILS ----------
-static inline long readRaw() {
-  return scale.read(); // 24-bit signed
+static void reportRate() {
+  const FilterParams& p = pipeline.params();
+  emitf("RATE:SPS:%.2f,P:%lu,D:%u,N:%u,A:%.3f,HZ:%.1f,M:%d", (double)rate.sps(),
+        (unsigned long)g_periodUs, (unsigned)g_decim, (unsigned)p.medianWindow,
+        (double)p.iirAlpha, 1.0e6 / ((double)g_decim * (double)g_periodUs),
+        rate.valid() ? 1 : 0);
 }
 
-static inline float rawToGrams(long raw) {
-  long raw_net = raw - g_tareOffset;
-  return (float)raw_net * g_calFactor;
+// ---------- PERFILES ----------
+static void storeProfile(size_t slot) {
+  char key[8];
+  snprintf(key, sizeof(key), KEY_PROFILE_FMT, (unsigned)slot);
+  prefs.putBytes(key, &profiles.at(slot), sizeof(CalProfile));
 }
 
-// ---------- PARSEO DE COMANDOS ----------
-String cmdLine;
-bool   cmdOverflow = false;
+// Vuelca el estado vivo (cero, pendiente, filtro, capacidad) en el perfil
+// activo y lo persiste. Lo usan T, C:, CAP: y FILT:.
+static void storeActiveProfile() {
+  CalProfile& p = profiles.active();
+  p.calFactor = g_calFactor;
+  p.tareOffset = g_tareOffset;
+  p.zeroOffset = g_zeroOffset;
+  p.timing = g_timing;
+  p.capacityG = guard.capacityG();
+  p.overloadG = guard.overloadG();
+  profiles.reseal(profiles.activeSlot());
+  storeProfile(profiles.activeSlot());
+}
+
+// Aplica de una vez el perfil activo: todo ocurre en la tarea acq entre dos
+// muestras, así que ninguna trama mezcla valores de dos perfiles. El filtro
+// se re-siembra (la ventana de mediana con cuentas de otra plataforma no
+// sirve) y los detectores vuelven a partir de cero.
+static void applyProfile() {
+  const CalProfile& p = profiles.active();
+  g_calFactor = p.calFactor;
+  g_tareOffset = p.tareOffset;
+  g_zeroOffset = p.zeroOffset;
+  applyCalibration();
+  guard.configure(p.capacityG, p.overloadG);
+  g_timing = p.timing;
+  pipeline.setParams(bascula::filterParamsFor(
+      g_timing, (float)g_decim * (float)g_periodUs / 1000.0f));
+  segmenter.reset(0.0f);
+  quant.reset();
+  peaks.reset(millis());
+}
+
+// Carga los perfiles de NVS. Sin ninguno válido (primer arranque tras
+// actualizar) se crea "default" con las claves sueltas de antes.
+static void loadProfiles() {
+  for (size_t i = 0; i < bascula::PROFILE_MAX; ++i) {
+    char key[8];
+    snprintf(key, sizeof(key), KEY_PROFILE_FMT, (unsigned)i);
+    CalProfile p;
+    if (prefs.getBytesLength(key) == sizeof(p) &&
+        prefs.getBytes(key, &p, sizeof(p)) == sizeof(p)) {
+      profiles.load(i, p);
+    }
+  }
+  if (profiles.count() == 0) {
+    CalProfile p = bascula::profileUncalibrated(
+        FILTER_TIMING, prefs.getFloat(KEY_CAPACITY, DEFAULT_CAPACITY_G),
+        prefs.getFloat(KEY_OVERLOAD, DEFAULT_OVERLOAD_G));
+    p.tareOffset = prefs.getInt(KEY_TARE_OFFSET, 0);
+    if (prefs.isKey(KEY_CAL_FACTOR)) {
+      // Calibrada con una versión anterior: su tara hace de cero
+      p.calFactor = prefs.getFloat(KEY_CAL_FACTOR, 1.0f);
+      p.zeroOffset = p.tareOffset;
+    }
+    int slot = profiles.add(DEFAULT_PROFILE, p);
+    storeProfile((size_t)slot);
+    Serial.println(F("[NVS] Perfil 'default' creado desde la calibración previa"));
+  }
+  if (!profiles.setActive(prefs.getUChar(KEY_PROFILE, 0))) {
+    for (size_t i = 0; i < bascula::PROFILE_MAX; ++i) {
+      if (profiles.setActive(i)) break;
+    }
+  }
+}
+
+static void reportProfile() {
+  const CalProfile& p = profiles.active();
+  emitf("PROFILE:ACT:%s,F:%.8f,Z:%ld,MED:%lu,TAU:%lu,TH:%.2f,SMS:%lu,CAP:%.1f,OVL:%.1f",
+        p.name, (double)p.calFactor, (long)p.tareOffset, (unsigned long)p.timing.medianMs,
+        (unsigned long)p.timing.iirTauMs, (double)p.timing.stableDeltaG,
+        (unsigned long)p.timing.stableMs, (double)p.capacityG, (double)p.overloadG);
+}
+
+static void reportMemMap(Print& port) {
+  // Margen de pila libre por subsistema, en el mismo orden que MEM_MAP.
+  const uint32_t hw[] = {acqTask.headroom(), rxTask.headroom(), txTask.headroom(), 0, 0,
+                         logTask.headroom(), otaTask.headroom(), 0};
+  static_assert(sizeof(hw) / sizeof(hw[0]) == sizeof(MEM_MAP) / sizeof(MEM_MAP[0]),
+                "hw[] debe seguir el orden de MEM_MAP");
+  char out[96];
+  for (size_t i = 0; i < sizeof(MEM_MAP) / sizeof(MEM_MAP[0]); ++i) {
+    snprintf(out, sizeof(out), "MEM:%s,B:%u,F:%u", MEM_MAP[i].name,
+             (unsigned)MEM_MAP[i].bytes, (unsigned)hw[i]);
+    if (&port == &Serial1) emitLine(out); else port.println(out);
+  }
+  snprintf(out, sizeof(out), "MEM:TOTAL,B:%u,MAX:%u,DROP:%u", (unsigned)MEM_TOTAL,
+           (unsigned)BASCULA_RAM_BUDGET, (unsigned)g_txDrops);
+  if (&port == &Serial1) emitLine(out); else port.println(out);
+}
+
+static void reportVibration() {
+  const SpectrumReport& r = vibReport;
+  char out[224];
+  int n = snprintf(out, sizeof(out), "VIB:FS:%.1f,N:%u,RMS:%.3f", (double)r.fsHz,
+                   (unsigned)r.n, (double)r.rmsG);
+  for (size_t i = 0; i < bascula::SPECTRUM_PEAKS; ++i) {
+    n += snprintf(out + n, sizeof(out) - n, ",F%u:%.2f,A%u:%.3f", (unsigned)(i + 1),
+                  (double)r.peaks[i].hz, (unsigned)(i + 1), (double)r.peaks[i].ampG);
+  }
+  for (size_t b = 0; b < bascula::SPECTRUM_BANDS; ++b) {
+    n += snprintf(out + n, sizeof(out) - n, ",B%u:%.3f", (unsigned)b,
+                  (double)r.bandRmsG[b]);
+  }
+  snprintf(out + n, sizeof(out) - n, ",TH:%.2f", (double)pipeline.params().stableDeltaG);
+  emitLine(out);
+}
+
+// Cierra una ventana de vibración: FFT, adaptación opcional e informe.
+static void finishVibration() {
+  vib.analyze(vibReport);
+  g_vibValid = true;
+  if (g_vibAdapt) {
+    float th = VIB_ADAPT_K * vibReport.rmsG;
+    if (th < g_timing.stableDeltaG) th = g_timing.stableDeltaG;
+    if (th > VIB_ADAPT_MAX_G) th = VIB_ADAPT_MAX_G;
+    pipeline.setStableDelta(th);
+  }
+  reportVibration();
+}
+
+static int64_t rtcNowUs() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Intenta sembrar el pipeline con el estado guardado antes del reinicio.
+static void tryWarmStart() {
+  esp_reset_reason_t rr = esp_reset_reason();
+  g_resetReason = (int)rr;
+  if (rr == ESP_RST_POWERON || rr == ESP_RST_BROWNOUT) return;
+  if (!bascula::warmStateValid(g_warm, rtcNowUs(), WARM_MAX_AGE_US)) return;
+  if (g_warm.calFactor != g_calFactor || g_warm.tareOffset != g_tareOffset) return;
+  // La tasa de la placa no cambia en un reinicio: el filtro arranca ya
+  // dimensionado y la medida continua solo la confirma.
+  if (g_warm.periodUs != 0) applyTiming(g_warm.periodUs);
+  pipeline.warmStart(g_warm.medianRaw, g_warm.iir, g_warm.stable != 0, millis());
+  g_warmBoot = true;
+  g_warmCheck = true;
+}
+
+static void saveWarmState(const PipelineOut& o) {
+  g_warm.savedUs = rtcNowUs();
+  g_warm.calFactor = g_calFactor;
+  g_warm.tareOffset = g_tareOffset;
+  g_warm.medianRaw = (int32_t)o.median;
+  g_warm.iir = o.grams;
+  if (o.stable) g_warm.stableG = o.grams;
+  g_warm.stable = o.stable ? 1 : 0;
+  g_warm.periodUs = g_periodKnown ? g_periodUs : 0;
+  bascula::warmStateSeal(g_warm);
+}
+
+static void reportBoot(bool asEvent) {
+  emitf("%sW:%d,V:%lu,ST:%lu,RST:%d", asEvent ? "EVT:BOOT," : "BOOT:",
+        g_warmBoot ? 1 : 0, (unsigned long)g_bootValidMs,
+        (unsigned long)g_bootStableMs, g_resetReason);
+}
+
+// Umbral de movimiento del refinado en cuentas: el de estabilidad vigente
+// (quizá adaptado a la vibración).
+static float refineMotionCounts() {
+  const float cal = fabsf(pipeline.calFactor());
+  return cal > 0.0f ? pipeline.params().stableDeltaG / cal : 0.0f;
+}
+
+// Estado del refinado (REFINE:GET).
+static void reportRefine() {
+  emitf("REFINE:%d,N:%lu,RES:%.4f,SD:%.1f", g_refine ? 1 : 0,
+        (unsigned long)refine.count(),
+        (double)refine.resolution(pipeline.calFactor(), pipeline.params().iirAlpha),
+        (double)refine.sigmaCounts());
+}
+
+// Avisos del ajuste automático; con DONE aplica y persiste el filtro elegido
+// igual que FILT:.
+static void tuneEvent(FilterTuner::Event e) {
+  switch (e) {
+    case FilterTuner::LOAD:
+      emitf("AUTOTUNE:LOAD,SD:%.1f", (double)tuner.idleSigma());
+      break;
+    case FilterTuner::ANALYZE:
+      emitf("AUTOTUNE:RUN,STEP:%.1f", (double)tuner.stepGrams());
+      break;
+    case FilterTuner::DONE: {
+      const bascula::TuneResult& r = tuner.result();
+      g_timing = r.timing;
+      applyTiming(g_periodUs);
+      if (!g_vibAdapt) pipeline.setStableDelta(g_timing.stableDeltaG);
+      storeActiveProfile();
+      emitf("AUTOTUNE:MED:%lu,TAU:%lu,TH:%.2f,SMS:%lu,SETTLE:%lu,WAS:%ld,NOISE:%.3f,OK:%u/%u",
+            (unsigned long)r.timing.medianMs, (unsigned long)r.timing.iirTauMs,
+            (double)r.timing.stableDeltaG, (unsigned long)r.timing.stableMs,
+            (unsigned long)r.settleMs, (long)r.wasMs, (double)r.noiseG,
+            (unsigned)r.feasible, (unsigned)r.total);
+      break;
+    }
+    case FilterTuner::TIMEOUT:   emitLine("ERR:AUTOTUNE:timeout"); break;
+    case FilterTuner::NOSTEP:    emitLine("ERR:AUTOTUNE:nostep"); break;
+    case FilterTuner::UNSETTLED: emitLine("ERR:AUTOTUNE:unsettled"); break;
+    case FilterTuner::NOFIT:     emitLine("ERR:AUTOTUNE:nofit"); break;
+    default: break;
+  }
+}
+
+// Estado del control de flujo (FC:GET y caducidad de la concesión).
+static void reportFlow() {
+  emitf("FC:%s,CR:%u,SK:%lu", fc.enabled() ? "ON" : "OFF",
+        (unsigned)fc.credits(), (unsigned long)fc.skipped());
+}
+
+static void startSelfTest() {
+  stCap.n = 0;
+  stCap.startMs = millis();
+  stCap.drdyToggled = true;
+  stCap.active = true;
+}
+
+static void reportSelfTest() {
+  const SelfTestResult& r = stResult;
+  emitf("SELFTEST:%s,N:%u,SPS:%.1f,NOISE:%.1f,MEAN:%ld,MASK:0x%lX,MS:%lu,TO:%lu",
+        bascula::selfTestName(r.code), (unsigned)r.n, (double)r.sps,
+        (double)r.noise, (long)r.mean, (unsigned long)r.stuckMask,
+        (unsigned long)r.elapsedMs, (unsigned long)g_adcTimeouts);
+}
+
+// Cierra la captura. El primer veredicto va en el HELLO (el host decide con
+// él); las repeticiones por SELFTEST:RUN salen como línea SELFTEST:.
+static void finishSelfTest(uint32_t nowMs) {
+  stCap.active = false;
+  bascula::selfTestAnalyze(stCap.raw, stCap.tUs, stCap.n, stCap.drdyToggled,
+                           SELFTEST_NOISE_MAX, stResult);
+  stResult.elapsedMs = nowMs - stCap.startMs;
+  if (stResult.code != SelfTestResult::OK) {
+    logEvent(bascula::LOG_SELFTEST, (int32_t)stResult.code);
+  }
+  if (g_helloSent) {
+    reportSelfTest();
+    return;
+  }
+  g_helloSent = true;
+  emitf("HELLO:ESP32-HX711,ST:%s,SPS:%.1f,NOISE:%.1f",
+        bascula::selfTestName(stResult.code), (double)stResult.sps,
+        (double)stResult.noise);
+  Serial.print(F("Autotest HX711: "));
+  Serial.print(bascula::selfTestName(stResult.code));
+  Serial.print(F(" SPS=")); Serial.print(stResult.sps, 1);
+  Serial.print(F(" ruido=")); Serial.println(stResult.noise, 1);
+}
 
-void handleCommand(const String& line) {
-  // "T"         -> Tara (guardar offset actual)
+// Registra una conversión en la captura del autotest.
+static void selfTestPush(long raw, uint32_t nowMs) {
+  stCap.raw[stCap.n] = raw;
+  stCap.tUs[stCap.n] = micros();
+  stCap.n++;
+  // Tras los 25 pulsos de SCK el HX711 sube DOUT hasta la siguiente conversión
+  if (digitalRead(HX711_DOUT_PIN) != HIGH) stCap.drdyToggled = false;
+  if (stCap.n >= bascula::SELFTEST_MAX_SAMPLES ||
+      (nowMs - stCap.startMs) >= SELFTEST_BUDGET_MS) {
+    finishSelfTest(nowMs);
+  }
+}
+
+// ---------- PARSEO DE COMANDOS ----------
+// Se ejecuta en la tarea acq: es la única que toca HX711 y pipeline.
+void handleCommand(const char* line) {
+  // Comandos y respuestas: kCommands en frame_schema.h
+  // "T" | "TARE" -> Tara (guardar offset actual)
   // "C:<peso>"  -> Calibrar con peso patrón en gramos
-  if (line.length() == 0) return;
+  // "MEM"       -> Mapa de memoria y márgenes de pila
+  // "SEG:ON|OFF" -> Eventos de segmentación de ingredientes
+  // "CHECK:<min>,<max>" | "CHECK:OFF" -> Clasificación de porciones
+  // "PEAK:RESET|GET|ON|OFF" -> Pico/mínimo a tasa completa
+  // "CAP:<g>[,<ovl_g>]" | "CAP:GET" | "OVL:CLR" -> Capacidad y sobrecarga
+  // "VIB:RUN|GET|ADAPT:ON|OFF" -> Diagnóstico espectral de vibraciones
+  // "BOOT"      -> Arranque en caliente y tiempos hasta primera trama válida/estable
+  // "SELFTEST[:RUN]" -> Resultado del autotest del HX711 / repetirlo
+  // "RATE"      -> Tasa medida, diezmado y parámetros derivados del filtro
+  // "CHB:<n>|GET" -> Canal B cada n conversiones de A (0 = off) / último valor
+  // "DIV:<d>[,<h>]" | "DIV:GET" -> División de display (0 = off) e histéresis
+  // "ROC:ON|OFF" -> Trama solo al cambiar (report-on-change)
+  // "LOG:DUMP[B][:<desde>]" | "LOG:INFO" -> Registro de eventos en flash
+  //   (DUMPB: tramas binarias delta + varint, ver bulk_codec.h)
+  // "OTA:BEGIN:<bytes>,<crc32 hex>,<chunk>" | "OTA:END|ABORT|STATUS" -> OTA
+  // "PROFILE:<nombre>" | "PROFILE:LIST|GET" | "PROFILE:NEW|DEL:<nombre>" -> Perfiles
+  // "FILT:<med_ms>,<tau_ms>,<umbral_g>,<estable_ms>" | "FILT:GET" -> Filtro del perfil
+  // "FC:<n>" | "FC:OFF" | "FC:GET" -> Créditos de tramas G: (la concesión no responde)
+  // "SNAP:<id>" -> Solo llega aquí con el id inválido o la cola llena (rxTaskFn)
+  // "REFINE:ON|OFF|GET" -> Media de ventana creciente con la carga quieta
+  // "AUTOTUNE[:<ruido_g>[,<tol_g>]]" | "AUTOTUNE:ABORT" -> Ajuste automático del filtro
+  // "TRIG" | "TRIG:ARM[:<fuentes>[,<pre_ms>,<post_ms>]]" | "TRIG:OFF|GET" |
+  //   "TRIG:DUMP[:<desde>]" -> Captura con disparo (volcado en tramas BULK_TRACE)
+  // "PROBE:<máscara>" | "PROBE:OFF|GET" -> Línea PRB: tras cada trama (probe.h)
+  if (line[0] == '\0') return;
 
-  if (line == "T" || line == "t") {
-    long r = readRaw();
+  if (strcmp(line, "T") == 0 || strcmp(line, "t") == 0 || strcmp(line, "TARE") == 0) {
+    long r;
+    if (!readRaw(r)) {
+      noteAdcTimeout();
+      emitLine("ERR:ADC:timeout");
+      return;
+    }
     g_tareOffset = r;
-    prefs.putInt(KEY_TARE_OFFSET, g_tareOffset);
+    applyCalibration();
+    segmenter.reset(0.0f);
+    quant.reset();
+    storeActiveProfile();
     Serial.println(F("[NVS] Tara guardada"));
-    Serial1.println(F("ACK:T"));
+    logEvent(bascula::LOG_TARE, g_tareOffset);
+    emitLine("ACK:T");
     return;
   }
 
-  if (line.startsWith("C:") || line.startsWith("c:")) {
-    String w = line.substring(2);
-    w.trim();
-    float peso_ref = w.toFloat();
+  if (strncmp(line, "C:", 2) == 0 || strncmp(line, "c:", 2) == 0) {
+    float peso_ref = strtof(line + 2, nullptr);
     if (peso_ref <= 0.0f) {
-      Serial1.println(F("ERR:CAL:weight"));
+      emitLine("ERR:CAL:weight");
       return;
     }
     const int N = 20;
     long acc = 0;
     for (int i = 0; i < N; ++i) {
-      acc += readRaw();
+      long r;
+      if (!readRaw(r)) {
+        noteAdcTimeout();
+        emitLine("ERR:ADC:timeout");
+        return;
+      }
+      acc += r;
       delay(5);
     }
     long r_mean = acc / N;
     long r_net  = r_mean - g_tareOffset;
     if (r_net == 0) {
-      Serial1.println(F("ERR:CAL:zero"));
+      emitLine("ERR:CAL:zero");
       return;
     }
     g_calFactor = (float)peso_ref / (float)r_net;
-    prefs.putFloat(KEY_CAL_FACTOR, g_calFactor);
+    g_zeroOffset = g_tareOffset;  // la pesa se pone sobre el plato vacío tarado
+    applyCalibration();
+    guard.rearm();
+    storeActiveProfile();
     Serial.print(F("[NVS] Calibración guardada. Factor: "));
     Serial.println(g_calFactor, 8);
-    Serial1.print(F("ACK:C:"));
-    Serial1.println(g_calFactor, 8);
+    logEvent(bascula::LOG_CAL, (int32_t)lroundf(g_calFactor * 1.0e6f));
+    emitf("ACK:C:%.8f", (double)g_calFactor);
     return;
   }
 
-  Serial1.println(F("ERR:UNKNOWN_CMD"));
-}
+  if (strcmp(line, "MEM") == 0) {
+    reportMemMap(Serial1);
+    return;
+  }
 
-// ---------- SETUP ----------
-void setup() {
-  Serial.begin(BAUD_USB);
-  delay(150);
+  if (strcmp(line, "SEG:ON") == 0 || strcmp(line, "SEG:OFF") == 0) {
+    g_segEnabled = (line[5] == 'N');
+    segmenter.reset(pipeline.last().grams);
+    emitLine(g_segEnabled ? "ACK:SEG:ON" : "ACK:SEG:OFF");
+    return;
+  }
 
-  Serial1.begin(BAUD, SERIAL_8N1, UART1_RX_PIN, UART1_TX_PIN);
-  delay(100);
+  if (strcmp(line, "CHECK:OFF") == 0) {
+    checker.disable();
+    emitLine("ACK:CHECK:OFF");
+    return;
+  }
 
-  Serial.println();
-  Serial.println(F("== Bascula ESP32 + HX711 @ UART =="));
-  Serial.print(F("UART1 TX=")); Serial.print(UART1_TX_PIN);
-  Serial.print(F(" RX=")); Serial.println(UART1_RX_PIN);
+  if (strncmp(line, "CHECK:", 6) == 0) {
+    char* end = nullptr;
+    float lo = strtof(line + 6, &end);
+    if (end == line + 6 || *end != ',') {
+      emitLine("ERR:CHECK:format");
+      return;
+    }
+    const char* hiStart = end + 1;
+    float hi = strtof(hiStart, &end);
+    // nan pasaría lo > hi y dejaría la clasificación sin decidir nunca
+    if (end == hiStart || *end != '\0' || !isfinite(lo) || !isfinite(hi) || lo > hi) {
+      emitLine("ERR:CHECK:range");
+      return;
+    }
+    checker.configure(lo, hi);
+    emitf("ACK:CHECK:%.2f,%.2f", (double)lo, (double)hi);
+    return;
+  }
 
-  scale.begin(HX711_DOUT_PIN, HX711_SCK_PIN);
-  delay(50);
+  if (strcmp(line, "PEAK:RESET") == 0) {
+    peaks.reset(millis());
+    emitLine("ACK:PEAK:RESET");
+    return;
+  }
 
-  prefs.begin(NVS_NAMESPACE, false);
-  g_calFactor  = prefs.getFloat(KEY_CAL_FACTOR, 1.0f);
-  g_tareOffset = prefs.getInt(KEY_TARE_OFFSET, 0);
+  if (strcmp(line, "PEAK:GET") == 0) {
+    uint32_t now = millis();
+    emitf("PEAK:MAX:%.2f,MIN:%.2f,RMAX:%ld,RMIN:%ld,AMAX:%lu,AMIN:%lu,N:%lu,BAD:%lu",
+          (double)pipeline.rawToGrams(peaks.maxRaw()),
+          (double)pipeline.rawToGrams(peaks.minRaw()),
+          peaks.maxRaw(), peaks.minRaw(),
+          (unsigned long)(now - peaks.maxMs()), (unsigned long)(now - peaks.minMs()),
+          (unsigned long)peaks.count(), (unsigned long)g_rawInvalid);
+    return;
+  }
 
-  Serial.print(F("CalFactor: ")); Serial.println(g_calFactor, 8);
-  Serial.print(F("TareOffset: ")); Serial.println(g_tareOffset);
+  if (strcmp(line, "PEAK:ON") == 0 || strcmp(line, "PEAK:OFF") == 0) {
+    g_peakFrame = (line[6] == 'N');
+    emitLine(g_peakFrame ? "ACK:PEAK:ON" : "ACK:PEAK:OFF");
+    return;
+  }
 
-  Serial1.println(F("HELLO:ESP32-HX711"));
-}
+  if (strcmp(line, "CAP:GET") == 0) {
+    emitf("CAP:%.1f,OVL:%.1f,N:%lu,L:%d,ARM:%d", (double)guard.capacityG(),
+          (double)guard.overloadG(), (unsigned long)guard.count(),
+          guard.latched() ? 1 : 0, guard.armed() ? 1 : 0);
+    return;
+  }
 
-// ---------- LOOP ----------
-void loop() {
-  static RingBuffer rb(MEDIAN_WINDOW);
-  static bool first = true;
-  static float iir_value = 0.0f;
-  static uint32_t lastStableRefMs = 0;
-  static bool stable = false;
-
-  // 1) Leer crudo y alimentar mediana
-  long raw = readRaw();
-  rb.add(raw);
-
-  // 2) Mediana + IIR
-  float grams;
-  if (rb.size() >= 3) {
-    long med = rb.median();
-    float g  = rawToGrams(med);
-    if (first) {
-      iir_value = g;
-      first = false;
+  if (strncmp(line, "CAP:", 4) == 0) {
+    float cap, ovl;
+    const bascula::CapParse pr = bascula::capacityParse(line + 4, cap, ovl);
+    if (pr != bascula::CAP_OK) {
+      emitLine(pr == bascula::CAP_VALUE ? "ERR:CAP:value" : "ERR:CAP:overload");
+      return;
+    }
+    guard.configure(cap, ovl);
+    logEvent(bascula::LOG_CAP, (int32_t)lroundf(cap));
+    storeActiveProfile();
+    emitf("ACK:CAP:%.1f,%.1f", (double)cap, (double)ovl);
+    return;
+  }
+
+  if (strcmp(line, "OVL:CLR") == 0) {
+    if (guard.clearLatch()) {
+      logEvent(bascula::LOG_OVL_CLR, 0);
+      emitLine("ACK:OVL:CLR");
     } else {
-      iir_value = (1.0f - IIR_ALPHA) * iir_value + IIR_ALPHA * g;
+      emitLine("ERR:OVL:active");
     }
-    grams = iir_value;
-  } else {
-    grams = rawToGrams(raw);
+    return;
   }
 
-  // 3) Estabilidad temporal
-  static float last_grams = 0.0f;
-  float delta = fabsf(grams - last_grams);
-  uint32_t now = millis();
+  if (strcmp(line, "VIB:RUN") == 0) {
+    vib.start();
+    emitLine("ACK:VIB:RUN");
+    return;
+  }
 
-  if (delta <= STABLE_DELTA_G) {
-    if ((now - lastStableRefMs) >= STABLE_MS) {
-      stable = true;
+  if (strcmp(line, "VIB:GET") == 0) {
+    if (g_vibValid) reportVibration(); else emitLine("ERR:VIB:none");
+    return;
+  }
+
+  if (strcmp(line, "VIB:ADAPT:ON") == 0 || strcmp(line, "VIB:ADAPT:OFF") == 0) {
+    g_vibAdapt = (line[11] == 'N');
+    if (!g_vibAdapt) pipeline.setStableDelta(g_timing.stableDeltaG);
+    emitLine(g_vibAdapt ? "ACK:VIB:ADAPT:ON" : "ACK:VIB:ADAPT:OFF");
+    return;
+  }
+
+  if (strcmp(line, "BOOT") == 0) {
+    reportBoot(false);
+    return;
+  }
+
+  if (strcmp(line, "SELFTEST") == 0) {
+    if (stCap.active) emitLine("ERR:SELFTEST:busy"); else reportSelfTest();
+    return;
+  }
+
+  if (strcmp(line, "RATE") == 0) {
+    reportRate();
+    return;
+  }
+
+  if (strcmp(line, "DIV:GET") == 0) {
+    emitf("DIV:%.2f,H:%.2f,ROC:%d", (double)quant.division(),
+          (double)quant.hysteresis(), g_roc ? 1 : 0);
+    return;
+  }
+
+  if (strncmp(line, "DIV:", 4) == 0) {
+    char* end = nullptr;
+    float div = strtof(line + 4, &end);
+    // Divisiones de display admitidas: 0 (off), 0.1, 0.5, 1 y 2 g
+    static const float kDivs[] = {0.0f, 0.1f, 0.5f, 1.0f, 2.0f};
+    bool known = false;
+    for (float d : kDivs) known = known || fabsf(div - d) < 1e-4f;
+    if (end == line + 4 || !known || (*end != '\0' && *end != ',')) {
+      emitLine("ERR:DIV:value");
+      return;
     }
-  } else {
-    stable = false;
-    lastStableRefMs = now;
-  }
-  last_grams = grams;
-
-  // 4) Emitir trama única: "G:<valor>,S:<0|1>"
-  char out[64];
-  snprintf(out, sizeof(out), "G:%.2f,S:%d", grams, stable ? 1 : 0);
-  Serial1.println(out);
-
-  // 5) Leer comandos de la Pi con control de longitud
-  while (Serial1.available()) {
-    char c = (char)Serial1.read();
-    if (c == '\r' || c == '\n') {
-      // fin de línea
-      if (cmdOverflow) {
-        // Hemos descartado parte del comando por longitud
-        Serial1.println(F("ERR:CMDLEN"));
-      } else {
-        cmdLine.trim();
-        if (cmdLine.length() > 0) {
-          handleCommand(cmdLine);
+    float hyst = div * DIV_HYST_FRAC;
+    if (*end == ',') {
+      const char* hStart = end + 1;
+      hyst = strtof(hStart, &end);
+      if (end == hStart || *end != '\0' || !isfinite(hyst) || hyst < 0.0f || hyst >= 0.5f * div) {
+        emitLine("ERR:DIV:hyst");
+        return;
+      }
+    }
+    quant.configure(div, hyst);
+    prefs.putFloat(KEY_DIV, quant.division());
+    prefs.putFloat(KEY_DIV_HYST, quant.hysteresis());
+    emitf("ACK:DIV:%.2f,%.2f", (double)quant.division(), (double)quant.hysteresis());
+    return;
+  }
+
+  if (strcmp(line, "ROC:ON") == 0 || strcmp(line, "ROC:OFF") == 0) {
+    g_roc = (line[5] == 'N');
+    emitLine(g_roc ? "ACK:ROC:ON" : "ACK:ROC:OFF");
+    return;
+  }
+
+  if (strcmp(line, "LOG:INFO") == 0 || strncmp(line, "LOG:DUMP", 8) == 0) {
+    LogMsg m{LOG_OP_INFO, 0, millis()};
+    if (line[4] == 'D') {
+      const char* p = line + 8;
+      m.kind = LOG_OP_DUMP;
+      if (*p == 'B') {
+        m.kind = LOG_OP_DUMP_BIN;
+        p++;
+      }
+      if (*p == ':') {
+        char* end = nullptr;
+        unsigned long since = strtoul(p + 1, &end, 10);
+        if (end == p + 1 || *end != '\0') {
+          emitLine("ERR:LOG:since");
+          return;
         }
+        m.value = (int32_t)since;
+      } else if (*p != '\0') {
+        emitLine("ERR:UNKNOWN_CMD");
+        return;
+      }
+    }
+    // El volcado lo hace la tarea log (dueña de la flash), por lotes
+    if (xQueueSend(logQueue.handle, &m, 0) != pdTRUE) emitLine("ERR:BUSY");
+    return;
+  }
+
+  if (strncmp(line, "OTA:", 4) == 0) {
+    OtaMsg m{};
+    if (strncmp(line + 4, "BEGIN:", 6) == 0) {
+      const char* p = line + 10;
+      char* end = nullptr;
+      m.op = OTA_OP_BEGIN;
+      m.size = strtoul(p, &end, 10);
+      if (end == p || *end != ',') {
+        emitLine("ERR:OTA:format");
+        return;
+      }
+      p = end + 1;
+      m.crc = strtoul(p, &end, 16);
+      if (end == p || *end != ',') {
+        emitLine("ERR:OTA:format");
+        return;
+      }
+      p = end + 1;
+      m.chunk = (uint16_t)strtoul(p, &end, 10);
+      if (end == p || *end != '\0') {
+        emitLine("ERR:OTA:format");
+        return;
       }
-      cmdLine = "";
-      cmdOverflow = false;
+    } else if (strcmp(line + 4, "END") == 0) {
+      m.op = OTA_OP_END;
+    } else if (strcmp(line + 4, "ABORT") == 0) {
+      m.op = OTA_OP_ABORT;
+    } else if (strcmp(line + 4, "STATUS") == 0) {
+      m.op = OTA_OP_STATUS;
     } else {
-      if (!cmdOverflow) {
-        if (cmdLine.length() < CMD_MAX_LEN) {
-          cmdLine += c;
+      emitLine("ERR:UNKNOWN_CMD");
+      return;
+    }
+    if (xQueueSend(otaQueue.handle, &m, 0) != pdTRUE) emitLine("ERR:BUSY");
+    return;
+  }
+
+  if (strcmp(line, "PROFILE:LIST") == 0) {
+    for (size_t i = 0; i < bascula::PROFILE_MAX; ++i) {
+      if (!profiles.used(i)) continue;
+      const CalProfile& p = profiles.at(i);
+      emitf("PROFILE:%u,N:%s,F:%.8f,Z:%ld,A:%d", (unsigned)i, p.name, (double)p.calFactor,
+            (long)p.tareOffset, i == profiles.activeSlot() ? 1 : 0);
+    }
+    emitf("PROFILE:END,N:%u,MAX:%u", (unsigned)profiles.count(),
+          (unsigned)bascula::PROFILE_MAX);
+    return;
+  }
+
+  if (strcmp(line, "PROFILE:GET") == 0) {
+    reportProfile();
+    return;
+  }
+
+  if (strncmp(line, "PROFILE:NEW:", 12) == 0) {
+    // Copia del estado vivo con otro nombre; pasa a ser el activo (sin
+    // re-sembrar: los valores son los mismos). Luego T / C: lo ajustan.
+    const char* name = line + 12;
+    if (!bascula::profileNameValid(name)) {
+      emitLine("ERR:PROFILE:name");
+      return;
+    }
+    if (profiles.find(name) >= 0) {
+      emitLine("ERR:PROFILE:exists");
+      return;
+    }
+    int slot = profiles.add(name, profiles.active());
+    if (slot < 0) {
+      emitLine("ERR:PROFILE:full");
+      return;
+    }
+    profiles.setActive((size_t)slot);
+    storeActiveProfile();
+    prefs.putUChar(KEY_PROFILE, (uint8_t)slot);
+    logEvent(bascula::LOG_PROFILE, slot);
+    emitf("ACK:PROFILE:NEW:%s", name);
+    return;
+  }
+
+  if (strncmp(line, "PROFILE:DEL:", 12) == 0) {
+    int slot = profiles.find(line + 12);
+    if (slot < 0) {
+      emitLine("ERR:PROFILE:unknown");
+      return;
+    }
+    if (!profiles.remove((size_t)slot)) {
+      emitLine("ERR:PROFILE:active");
+      return;
+    }
+    char key[8];
+    snprintf(key, sizeof(key), KEY_PROFILE_FMT, (unsigned)slot);
+    prefs.remove(key);
+    emitf("ACK:PROFILE:DEL:%s", line + 12);
+    return;
+  }
+
+  if (strncmp(line, "PROFILE:", 8) == 0) {
+    int slot = profiles.find(line + 8);
+    if (slot < 0) {
+      emitLine("ERR:PROFILE:unknown");
+      return;
+    }
+    profiles.setActive((size_t)slot);
+    applyProfile();
+    prefs.putUChar(KEY_PROFILE, (uint8_t)slot);
+    logEvent(bascula::LOG_PROFILE, slot);
+    emitf("ACK:PROFILE:%s", line + 8);
+    return;
+  }
+
+  if (strcmp(line, "FILT:GET") == 0) {
+    emitf("FILT:MED:%lu,TAU:%lu,TH:%.2f,SMS:%lu", (unsigned long)g_timing.medianMs,
+          (unsigned long)g_timing.iirTauMs, (double)g_timing.stableDeltaG,
+          (unsigned long)g_timing.stableMs);
+    return;
+  }
+
+  if (strncmp(line, "FILT:", 5) == 0) {
+    FilterTiming t;
+    const bascula::FilterParse pr = bascula::filterTimingParse(line + 5, t);
+    if (pr != bascula::FILT_OK) {
+      emitLine(pr == bascula::FILT_FORMAT ? "ERR:FILT:format" : "ERR:FILT:value");
+      return;
+    }
+    // Sin re-sembrar: misma plataforma, solo cambia la respuesta del filtro
+    g_timing = t;
+    applyTiming(g_periodUs);
+    if (!g_vibAdapt) pipeline.setStableDelta(g_timing.stableDeltaG);
+    storeActiveProfile();
+    emitf("ACK:FILT:%lu,%lu,%.2f,%lu", (unsigned long)t.medianMs, (unsigned long)t.iirTauMs,
+          (double)t.stableDeltaG, (unsigned long)t.stableMs);
+    return;
+  }
+
+  if (strcmp(line, "CHB:GET") == 0) {
+    emitf("CHB:R:%ld,N:%lu,AGE:%lu,E:%u", g_chbRaw, (unsigned long)g_chbCount,
+          (unsigned long)(g_chbCount ? millis() - g_chbMs : 0),
+          (unsigned)mux.every());
+    return;
+  }
+
+  if (strncmp(line, "CHB:", 4) == 0) {
+    char* end = nullptr;
+    long every = strtol(line + 4, &end, 10);
+    if (end == line + 4 || *end != '\0' ||
+        (every != 0 && (every < CHB_EVERY_MIN || every > CHB_EVERY_MAX))) {
+      emitLine("ERR:CHB:value");
+      return;
+    }
+    mux.setEvery((uint16_t)every);
+    g_chbCount = 0;
+    prefs.putUShort(KEY_CHB_EVERY, (uint16_t)every);
+    emitf("ACK:CHB:%ld", every);
+    return;
+  }
+
+  if (strcmp(line, "SELFTEST:RUN") == 0) {
+    startSelfTest();
+    emitLine("ACK:SELFTEST:RUN");
+    return;
+  }
+
+  if (strncmp(line, "SNAP:", 5) == 0) {
+    emitLine(bascula::snapIdValid(line + 5) ? "ERR:SNAP:busy" : "ERR:SNAP:id");
+    return;
+  }
+
+  if (strcmp(line, "REFINE:GET") == 0) {
+    reportRefine();
+    return;
+  }
+
+  if (strcmp(line, "REFINE:ON") == 0 || strcmp(line, "REFINE:OFF") == 0) {
+    g_refine = (line[8] == 'N');
+    refine.reset();
+    emitLine(g_refine ? "ACK:REFINE:ON" : "ACK:REFINE:OFF");
+    return;
+  }
+
+  if (strcmp(line, "AUTOTUNE:ABORT") == 0) {
+    tuner.abort();
+    emitLine("ACK:AUTOTUNE:ABORT");
+    return;
+  }
+
+  if (strcmp(line, "AUTOTUNE") == 0 || strncmp(line, "AUTOTUNE:", 9) == 0) {
+    float noiseG = 0.0f, tolG = bascula::TUNE_TOL_G;
+    if (line[8] == ':') {
+      int n = sscanf(line + 9, "%f,%f", &noiseG, &tolG);
+      if (n < 1 || !(noiseG > 0.0f && noiseG <= 50.0f) || !(tolG > 0.0f && tolG <= 50.0f)) {
+        emitLine("ERR:AUTOTUNE:value");
+        return;
+      }
+    }
+    if (tuner.state() != FilterTuner::OFF) {
+      emitLine("ERR:AUTOTUNE:busy");
+      return;
+    }
+    tuner.start(g_timing, noiseG, tolG, (float)g_decim * (float)g_periodUs / 1000.0f,
+                pipeline.calFactor(), pipeline.tareOffset(), millis());
+    emitLine("ACK:AUTOTUNE:IDLE");
+    return;
+  }
+
+  if (strcmp(line, "TRIG") == 0) {
+    // Ya disparada o apagada no hace nada; TRIG:GET dice por qué
+    const bool fired = trig.state() == TriggerCapture::ARMED;
+    emitLine(fired ? "ACK:TRIG" : "ERR:TRIG:state");
+    if (fired) fireTrig(bascula::TRIG_CMD, millis());
+    return;
+  }
+
+  if (strcmp(line, "TRIG:GET") == 0) {
+    reportTrig();
+    return;
+  }
+
+  if (strcmp(line, "TRIG:OFF") == 0 || strncmp(line, "TRIG:ARM", 8) == 0) {
+    if (g_trigDumping) {
+      emitLine("ERR:TRIG:busy");
+      return;
+    }
+    if (line[5] == 'O') {
+      trig.off();
+      emitLine("ACK:TRIG:OFF");
+      return;
+    }
+    uint8_t src = trig.sources();
+    unsigned long pre = g_trigPreMs, post = g_trigPostMs;
+    if (line[8] == ':') {
+      const char* p = line + 9;
+      bool ok = *p != '\0' && *p != ',';
+      src = 0;
+      for (; *p != '\0' && *p != ','; ++p) {
+        if (*p == 'M') src |= bascula::TRIG_MOTION;
+        else if (*p == 'O') src |= bascula::TRIG_OVERLOAD;
+        else if (*p == 'A') src |= bascula::TRIG_ADC;
+        else if (*p != '-') ok = false;
+      }
+      char extra;
+      if (ok && *p == ',') ok = sscanf(p + 1, "%lu,%lu%c", &pre, &post, &extra) == 2;
+      if (!ok || pre > 600000UL || post > 600000UL) {
+        emitLine("ERR:TRIG:value");
+        return;
+      }
+    } else if (line[8] != '\0') {
+      emitLine("ERR:UNKNOWN_CMD");
+      return;
+    }
+    g_trigPreMs = (uint32_t)pre;
+    g_trigPostMs = (uint32_t)post;
+    trig.configure(src, 0, 0);
+    trig.arm();
+    trigRetime();
+    char txt[4];
+    trigSourcesText(trig.sources(), txt);
+    emitf("ACK:TRIG:ARM:%s,%lu,%lu", txt, (unsigned long)(trig.pre() * g_periodUs / 1000UL),
+          (unsigned long)(trig.post() * g_periodUs / 1000UL));
+    return;
+  }
+
+  if (strncmp(line, "TRIG:DUMP", 9) == 0) {
+    LogMsg m{LOG_OP_TRIG_DUMP, 0, millis()};
+    if (line[9] == ':') {
+      char* end = nullptr;
+      unsigned long from = strtoul(line + 10, &end, 10);
+      if (end == line + 10 || *end != '\0') {
+        emitLine("ERR:TRIG:value");
+        return;
+      }
+      m.value = (int32_t)from;
+    } else if (line[9] != '\0') {
+      emitLine("ERR:UNKNOWN_CMD");
+      return;
+    }
+    if (trig.state() != TriggerCapture::HOLD) {
+      emitLine("ERR:TRIG:state");
+      return;
+    }
+    // La tarea log la envía por lotes; acq no rearma hasta que termine
+    g_trigDumping = true;
+    if (xQueueSend(logQueue.handle, &m, 0) != pdTRUE) {
+      g_trigDumping = false;
+      emitLine("ERR:BUSY");
+    }
+    return;
+  }
+
+  if (strcmp(line, "PROBE:GET") == 0) {
+    emitf("PROBE:0x%02X", (unsigned)g_probe);
+    return;
+  }
+
+  if (strncmp(line, "PROBE:", 6) == 0) {
+    uint8_t mask;
+    if (!bascula::probeParseMask(line + 6, mask)) {
+      emitLine("ERR:PROBE:value");
+      return;
+    }
+    g_probe = mask;
+    emitf("ACK:PROBE:0x%02X", (unsigned)mask);
+    return;
+  }
+
+  if (strncmp(line, "FC:", 3) == 0) {
+    if (strcmp(line + 3, "GET") == 0) {
+      reportFlow();
+    } else if (strcmp(line + 3, "OFF") == 0) {
+      fc.disable();
+      emitLine("ACK:FC:OFF");
+    } else {
+      // Concesión: llega varias veces por segundo, así que no se responde
+      char* end = nullptr;
+      unsigned long n = strtoul(line + 3, &end, 10);
+      if (end == line + 3 || *end != '\0') {
+        emitLine("ERR:FC:value");
+        return;
+      }
+      fc.grant((uint16_t)(n > bascula::FC_CREDIT_MAX ? bascula::FC_CREDIT_MAX : n), millis());
+      const char* heldProbe = nullptr;
+      if (const char* held = fc.takeHeld(&heldProbe)) {
+        emitLine(held);
+        if (heldProbe) emitLine(heldProbe);
+      }
+    }
+    return;
+  }
+
+  emitLine("ERR:UNKNOWN_CMD");
+}
+
+// ---------- TAREAS ----------
+static void acqTaskFn(void*) {
+  uint8_t decimCount = 0;
+  // Última trama emitida (report-on-change)
+  float    lastG = 0.0f;
+  int      lastS = -1;
+  bool     lastOL = false;
+  uint32_t lastEmitMs = 0;
+  bool     wasStable = false;  // disparo por movimiento
+  long     lastValid = 0;      // sonda V
+  SnapRequest snaps[bascula::SNAP_QUEUE_DEPTH];
+  for (;;) {
+    // 1) Comandos pendientes (se aplican entre muestras y con el canal A
+    //    asentado: tara y calibración leen directamente del HX711)
+    CmdMsg msg;
+    while (mux.onA() && xQueueReceive(cmdQueue.handle, &msg, 0) == pdTRUE) {
+      if (msg.overflow) {
+        // Se descartó parte del comando por longitud
+        emitLine("ERR:CMDLEN");
+      } else {
+        handleCommand(msg.text);
+      }
+    }
+    if (fc.expired(millis())) reportFlow();  // host sin concesiones: envío libre
+
+    // 2) Leer cada conversión (tasa completa del HX711), validar y
+    //    alimentar pico/mínimo antes de cualquier filtrado. Sin visitas a B
+    //    mientras haya una captura que necesite A sin huecos.
+    mux.setHold(stCap.active || vib.active() || tuner.capturing() ||
+                uxQueueMessagesWaiting(snapQueue.handle) > 0);
+    const ChannelMux::Chan next = mux.planNext();
+    scale.set_gain(next == ChannelMux::B ? 32 : 128);  // solo fija los pulsos
+    long raw;
+    if (!readRaw(raw)) {
+      // Sin DRDY: no hay trama; el autotest en curso termina como NO_DRDY
+      // (o con lo capturado) y los comandos se siguen atendiendo.
+      noteAdcTimeout();
+      if (stCap.active) finishSelfTest(millis());
+      continue;
+    }
+    g_adcDown = false;
+    uint32_t now = millis();
+    const uint32_t convUs = micros();
+    const ChannelMux::Sample ms = mux.commit(next);
+    if (rate.push(convUs)) {
+      if (fabsf((float)rate.periodUs() - (float)g_periodUs) >
+          RATE_RETUNE_FRAC * (float)g_periodUs) {
+        applyTiming(rate.periodUs());
+      }
+      g_periodKnown = true;
+    }
+    if (ms.chan == ChannelMux::B) {
+      if (ms.valid) {
+        g_chbRaw = raw;
+        g_chbMs = now;
+        g_chbCount++;
+      }
+      continue;
+    }
+    if (!ms.valid) {
+      // Primera A tras volver de B. Una captura empezada con la visita en
+      // curso tendría un hueco: se reinicia.
+      if (stCap.active) stCap.n = 0;
+      if (vib.active() && vib.count() > 0) vib.start();
+      continue;
+    }
+    // Anillo de la captura con disparo: todas las conversiones de A, también
+    // las saturadas
+    if (trig.push(convUs, (int32_t)raw)) reportTrigHold();
+    if (stCap.active) selfTestPush(raw, now);
+    if (g_warmCheck) {
+      // Si la carga cambió durante el reinicio, la siembra no sirve
+      g_warmCheck = false;
+      if (fabsf(pipeline.rawToGrams(raw) - g_warm.iir) > WARM_MAX_JUMP_G) {
+        pipeline.reset();
+        g_warmBoot = false;
+      }
+    }
+    if (guard.push(raw)) {
+      // Protección: sale en la misma conversión, sin esperar al filtro
+      emitf("EVT:OVERLOAD,R:%ld,G:%.1f,N:%lu,MS:%lu", raw,
+            (double)pipeline.rawToGrams(raw), (unsigned long)guard.count(),
+            (unsigned long)now);
+      g_ovlDirty = true;
+      logEvent(bascula::LOG_OVERLOAD, (int32_t)raw);
+      fireTrig(bascula::TRIG_OVERLOAD, now);
+    }
+    if (bascula::rawValid(raw)) {
+      lastValid = raw;
+      peaks.push(raw, now);
+      if (g_refine) refine.push(raw, refineMotionCounts());
+      if (vib.push(pipeline.rawToGrams(raw), now)) finishVibration();
+    } else {
+      g_rawInvalid++;
+      fireTrig(bascula::TRIG_ADC, now);
+    }
+
+    // Ajuste automático: un par de la rejilla por conversión
+    if (tuner.state() == FilterTuner::RUN) tuneEvent(tuner.work());
+
+    // 3) Ritmo de lazo: filtro y trama a LOOP_HZ como máximo (diezmado
+    //    según la tasa medida). Una instantánea pendiente adelanta el paso
+    //    del filtro a esta conversión.
+    size_t nSnap = 0;
+    while (nSnap < bascula::SNAP_QUEUE_DEPTH &&
+           xQueuePeek(snapQueue.handle, &snaps[nSnap], 0) == pdTRUE &&
+           bascula::snapDue(snaps[nSnap], convUs)) {
+      xQueueReceive(snapQueue.handle, &snaps[nSnap++], 0);
+    }
+    if (nSnap > 0) decimCount = g_decim - 1;
+    if (++decimCount < g_decim) continue;
+    decimCount = 0;
+    const PipelineOut& o = pipeline.push(raw, now);
+    if (g_refine) refine.setStable(o.stable && !guard.flagged());
+    if (tuner.capturing()) tuneEvent(tuner.push(raw, now));
+    if (wasStable && !o.stable) fireTrig(bascula::TRIG_MOTION, now);
+    wasStable = o.stable;
+    for (size_t i = 0; i < nSnap; ++i) {
+      char snapOut[96];
+      bascula::snapFormat(snapOut, sizeof(snapOut), snaps[i], o.grams, raw, o.stable,
+                          guard.flagged(), convUs);
+      emitLine(snapOut);
+    }
+
+    // 4) Clasificación de porciones: el cambio sale antes que la trama
+    if (checker.push(o.grams, o.stable)) {
+      emitf("EVT:CHECK,C:%s,S:%d,G:%.2f,MS:%lu",
+            CheckWeigher::zoneName(checker.zone()), o.stable ? 1 : 0,
+            (double)o.grams, (unsigned long)now);
+    }
+
+    // 5) Emitir trama única: "G:<valor>,S:<0|1>" (+ campos opcionales, en
+    //    el orden y formato de WeightFrame, frame_schema.h)
+    //    Fuera de capacidad nunca se declara estable. G va cuantizado a la
+    //    división de display; con ROC solo sale si cambia algo visible.
+    //    Durante una OTA se pesa igual pero se emite a OTA_FRAME_MS para
+    //    dejar la UART a las confirmaciones. Con REFINE, G es la media
+    //    refinada y RES su resolución (con 3 decimales si baja de 5 mg).
+    const bool overloaded = guard.flagged();
+    const bool refined = g_refine && refine.refining();
+    const float res = g_refine ? refine.resolution(pipeline.calFactor(),
+                                                   pipeline.params().iirAlpha)
+                               : 0.0f;
+    const float shown = quant.push(
+        refined ? refine.grams(pipeline.calFactor(), pipeline.tareOffset()) : o.grams);
+    const int stableOut = (o.stable && !overloaded) ? 1 : 0;
+    const bool emitFrame = (!g_roc || shown != lastG || stableOut != lastS ||
+                            overloaded != lastOL ||
+                            (now - lastEmitMs) >= ROC_HEARTBEAT_MS) &&
+                           (!g_otaActive || (now - lastEmitMs) >= OTA_FRAME_MS);
+    using bascula::WeightFrame;
+    bascula::FrameRecord<WeightFrame> rec;
+    rec.fine = refined && res < 0.005f;
+    rec.set<WeightFrame::at("G")>(shown);
+    rec.set<WeightFrame::at("S")>(stableOut);
+    if (g_peakFrame && peaks.count() > 0) {
+      rec.set<WeightFrame::at("PK")>(pipeline.rawToGrams(peaks.maxRaw()));
+      rec.set<WeightFrame::at("PM")>(pipeline.rawToGrams(peaks.minRaw()));
+    }
+    if (mux.every() != 0 && g_chbCount > 0) rec.set<WeightFrame::at("B")>(g_chbRaw);
+    if (res > 0.0f) rec.set<WeightFrame::at("RES")>(res);
+    if (overloaded) rec.set<WeightFrame::at("OL")>(1);
+    char out[128];
+    char prb[bascula::FC_TRAILER_MAX];
+    static_assert(bascula::frameMaxLen<WeightFrame>() < sizeof(out) &&
+                      bascula::frameMaxLen<bascula::ProbeFrame>() < sizeof(prb),
+                  "la trama no cabe en out");
+    bascula::frameEncode(out, sizeof(out), rec);
+    if (emitFrame) {
+      // Sondas de la misma muestra, justo detrás de su trama
+      const char* probe = nullptr;
+      if (g_probe) {
+        const bascula::ProbeValues pv{raw, lastValid, o.median,
+                                      o.median - (long)pipeline.tareOffset(), o.grams,
+                                      o.delta, o.stableForMs};
+        bascula::probeFormat(prb, sizeof(prb), g_probe, pv);
+        probe = prb;
+      }
+      // Sin créditos quedan retenidas (solo las últimas) hasta la concesión
+      if (fc.offer(out, probe)) {
+        emitLine(out);
+        if (probe) emitLine(probe);
+      }
+      lastG = shown;
+      lastS = stableOut;
+      lastOL = overloaded;
+      lastEmitMs = now;
+    }
+    saveWarmState(o);
+    if (g_bootValidMs == 0) g_bootValidMs = now;
+    if (g_bootStableMs == 0 && o.stable && !overloaded) {
+      g_bootStableMs = now;
+      reportBoot(true);
+    }
+
+    // 6) Segmentación sobre la mediana (sin el retardo del IIR)
+    if (g_segEnabled) {
+      SegEvent ev;
+      if (segmenter.push(pipeline.rawToGrams(o.median), now, ev)) {
+        emitf("EVT:%s,D:%.2f,T:%.2f,MS:%lu,DUR:%lu",
+              ev.kind == SegEvent::ADD ? "ADD" : "REM", (double)ev.delta,
+              (double)ev.total, (unsigned long)ev.endMs,
+              (unsigned long)(ev.endMs - ev.startMs));
+      }
+    }
+  }
+}
+
+// Entrega a la tarea ota una trama OTA recién comprobada por el analizador.
+static void otaHandOff(OtaFrameParser::Result r) {
+  OtaMsg m{};
+  if (r == OtaFrameParser::BAD) {
+    m.op = OTA_OP_BAD;
+    xQueueSend(otaQueue.handle, &m, 0);
+    return;
+  }
+  uint8_t slot;
+  if (xQueueReceive(otaFree.handle, &slot, 0) != pdTRUE) {
+    // El host se salió de la ventana: se pierde y la reenviará
+    g_otaDrops = g_otaDrops + 1;
+    return;
+  }
+  memcpy(otaSlots[slot].bytes, otaParser.bytes(), otaParser.size());
+  m.op = OTA_OP_FRAME;
+  m.slot = slot;
+  if (xQueueSend(otaQueue.handle, &m, 0) != pdTRUE) {
+    xQueueSend(otaFree.handle, &slot, 0);
+    g_otaDrops = g_otaDrops + 1;
+  }
+}
+
+// Tarea de eventos UART del core, al vaciarse la FIFO o al callar la línea
+// (setRxTimeout): anota la llegada y despierta a rx.
+static void onUartRx() {
+  g_rxUs = micros();
+  if (rxTask.handle) xTaskNotifyGive(rxTask.handle);
+}
+
+static void rxTaskFn(void*) {
+  // Lee comandos de la Pi con control de longitud; la línea se ensambla en un
+  // buffer fijo y se entrega completa a la tarea acq. Con una sesión OTA
+  // abierta, un 0xA5 (nunca presente en un comando) abre una trama binaria
+  // que se analiza aquí mismo y pasa a la tarea ota; los restos binarios de
+  // una trama rota se descartan sin responder.
+  CmdMsg msg;
+  size_t len = 0;
+  bool junk = false;
+  msg.overflow = false;
+  for (;;) {
+    while (Serial1.available()) {
+      char c = (char)Serial1.read();
+      if (otaParser.active() || (g_otaActive && (uint8_t)c == bascula::OTA_SYNC0)) {
+        if (!otaParser.active()) {
+          len = 0;
+          msg.overflow = false;
+          junk = false;
+        }
+        OtaFrameParser::Result r = otaParser.feed((uint8_t)c);
+        if (r != OtaFrameParser::NONE) otaHandOff(r);
+        continue;
+      }
+      if (g_otaActive && c != '\r' && c != '\n' && (c < 0x20 || c > 0x7E)) junk = true;
+      if (c == '\r' || c == '\n') {
+        // fin de línea: recortar espacios
+        while (len > 0 && msg.text[len - 1] == ' ') len--;
+        msg.text[len] = '\0';
+        const char* start = msg.text;
+        while (*start == ' ') start++;
+        if (start != msg.text) memmove(msg.text, start, strlen(start) + 1);
+        // SNAP va directo a acq, que lo atiende en la siguiente conversión
+        // (sin esperar a la vuelta del lazo); si la cola está llena sigue el
+        // camino normal y handleCommand responde ERR:SNAP:busy. La petición
+        // lleva la llegada del bloque con el fin de línea, no el momento en
+        // que rx la procesa (si ya llegó otro bloque, su instante: nunca antes).
+        if (!junk && (msg.overflow || msg.text[0] != '\0')) {
+          SnapRequest snap;
+          const bool snapped = !msg.overflow &&
+                               bascula::snapParse(msg.text, g_rxUs, snap) &&
+                               xQueueSend(snapQueue.handle, &snap, 0) == pdTRUE;
+          if (!snapped && xQueueSend(cmdQueue.handle, &msg, 0) != pdTRUE) {
+            emitLine("ERR:BUSY");
+          }
+        }
+        len = 0;
+        msg.overflow = false;
+        junk = false;
+      } else if (!msg.overflow) {
+        if (len < CMD_MAX_LEN) {
+          msg.text[len++] = c;
         } else {
           // marcar overflow y seguir leyendo hasta fin de línea para vaciar buffer
-          cmdOverflow = true;
+          msg.overflow = true;
+        }
+      }
+    }
+    // Despierta con onUartRx; el plazo solo cubre un aviso perdido.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+  }
+}
+
+static void txTaskFn(void*) {
+  uint8_t chunk[64];
+  for (;;) {
+    size_t n = xStreamBufferReceive(txStream.handle, chunk, sizeof(chunk), portMAX_DELAY);
+    if (n > 0) Serial1.write(chunk, n);
+  }
+}
+
+// Espera (acotada) a que el lote quepa dejando sitio a las tramas.
+static void waitTxSpace(size_t bytes) {
+  for (int i = 0; i < 100; ++i) {
+    if (xStreamBufferSpacesAvailable(txStream.handle) >= bytes + LOG_TX_RESERVE) return;
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+template <class Writer>
+static void flushBulkFrame(Writer& w, uint32_t& frames, uint32_t& bytes) {
+  size_t n = w.finish(logWire);
+  waitTxSpace(n);
+  emitBytes(logWire, n);
+  frames++;
+  bytes += n;
+}
+
+// Texto (una línea LOG:<seq>,... por registro) o tramas binarias de tipo
+// BULK_LOG (~6 bytes por registro en vez de ~45). Ambos terminan en
+// LOG:END; el binario añade tramas y bytes enviados.
+static void dumpLog(uint32_t since, bool binary) {
+  LogRecord batch[LOG_DUMP_BATCH];
+  LogCursor cur = eventLog.begin();
+  uint32_t total = 0, frames = 0, bytes = 0;
+  size_t n;
+  if (binary) logWriter.begin(bascula::BULK_LOG, 0);
+  while ((n = eventLog.read(since, cur, batch, LOG_DUMP_BATCH)) > 0) {
+    if (!binary) waitTxSpace(n * LOG_LINE_MAX);
+    for (size_t i = 0; i < n; ++i) {
+      const LogRecord& r = batch[i];
+      if (!binary) {
+        emitf("LOG:%lu,B:%u,MS:%lu,K:%s,V:%ld", (unsigned long)r.seq, (unsigned)r.boot,
+              (unsigned long)r.ms, bascula::logKindName(r.kind), (long)r.value);
+        continue;
+      }
+      const int32_t row[bascula::BULK_LOG_COLS] = {(int32_t)r.seq, (int32_t)r.boot,
+                                                  (int32_t)r.ms, (int32_t)r.kind, r.value};
+      if (!logWriter.put(row)) {
+        flushBulkFrame(logWriter, frames, bytes);
+        logWriter.begin(bascula::BULK_LOG, (uint16_t)frames);
+        logWriter.put(row);
+      }
+    }
+    total += n;
+  }
+  if (!binary) {
+    emitf("LOG:END,N:%lu,NEXT:%lu", (unsigned long)total, (unsigned long)eventLog.nextSeq());
+    return;
+  }
+  if (!logWriter.empty()) flushBulkFrame(logWriter, frames, bytes);
+  emitf("LOG:END,N:%lu,NEXT:%lu,F:%lu,BYTES:%lu", (unsigned long)total,
+        (unsigned long)eventLog.nextSeq(), (unsigned long)frames, (unsigned long)bytes);
+}
+
+// Ventana congelada de la captura con disparo en tramas BULK_TRACE (µs,
+// crudo), desde la muestra `from`: ~4,6 bytes por conversión en vez de ~22.
+// acq no rearma mientras g_trigDumping siga activo.
+static void dumpTrig(uint32_t from) {
+  const size_t n = trig.count();
+  uint32_t rows = 0, frames = 0, bytes = 0;
+  trigWriter.begin(bascula::BULK_TRACE, 0);
+  for (size_t i = from; i < n; ++i) {
+    const TraceSample& t = trig.at(i);
+    const int32_t row[bascula::BULK_TRACE_COLS] = {(int32_t)t.tUs, t.raw};
+    if (!trigWriter.put(row)) {
+      flushBulkFrame(trigWriter, frames, bytes);
+      trigWriter.begin(bascula::BULK_TRACE, (uint16_t)frames);
+      trigWriter.put(row);
+    }
+    rows++;
+  }
+  if (!trigWriter.empty()) flushBulkFrame(trigWriter, frames, bytes);
+  emitf("TRIG:END,N:%lu,AT:%u,WHY:%s,MS:%lu,F:%lu,BYTES:%lu", (unsigned long)rows,
+        (unsigned)trig.triggerIndex(), bascula::trigSourceName(trig.why()),
+        (unsigned long)trig.triggerMs(), (unsigned long)frames, (unsigned long)bytes);
+  g_trigDumping = false;
+}
+
+static void logTaskFn(void*) {
+  // El montaje recorre la partición: aquí y no en setup(), para no retrasar
+  // la primera trama.
+  const bool ready = logFlash.open(LOG_PARTITION, bascula::LOG_PARTITION_SUBTYPE) &&
+                     eventLog.mount();
+  if (ready) eventLog.beginBoot();
+  uint32_t dropsLogged = 0;
+  LogMsg m;
+  for (;;) {
+    xQueueReceive(logQueue.handle, &m, portMAX_DELAY);
+    if (m.kind == LOG_OP_TRIG_DUMP) {
+      dumpTrig((uint32_t)m.value);  // en RAM: no depende de la partición
+      continue;
+    }
+    if (m.kind == LOG_OP_OVL_COUNT) {
+      prefs.putUInt(KEY_OVL_COUNT, (uint32_t)m.value);
+      continue;
+    }
+    if (m.kind == LOG_OP_DUMP || m.kind == LOG_OP_DUMP_BIN || m.kind == LOG_OP_INFO) {
+      if (!ready) {
+        emitLine("ERR:LOG:nopart");
+      } else if (m.kind != LOG_OP_INFO) {
+        dumpLog((uint32_t)m.value, m.kind == LOG_OP_DUMP_BIN);
+      } else {
+        emitf("LOG:INFO,NEXT:%lu,BOOT:%u,CAP:%u,SECT:%u,DROP:%lu",
+              (unsigned long)eventLog.nextSeq(), (unsigned)eventLog.boot(),
+              (unsigned)eventLog.capacity(), (unsigned)eventLog.sectors(),
+              (unsigned long)g_logDrops);
+      }
+      continue;
+    }
+    if (!ready) continue;
+    eventLog.append(m.kind, m.value, m.ms);
+    const uint32_t drops = g_logDrops;
+    if (drops != dropsLogged) {
+      eventLog.append(bascula::LOG_DROPPED, (int32_t)(drops - dropsLogged), millis());
+      dropsLogged = drops;
+    }
+  }
+}
+
+static bool loadOtaResume(OtaSaved& s) {
+  if (prefs.getBytesLength(KEY_OTA_RESUME) != sizeof(s)) return false;
+  return prefs.getBytes(KEY_OTA_RESUME, &s, sizeof(s)) == sizeof(s);
+}
+
+static void saveOtaResume() {
+  OtaSaved s{ota.resume(), otaFlash.partition()->address};
+  prefs.putBytes(KEY_OTA_RESUME, &s, sizeof(s));
+}
+
+static void otaBegin(const OtaMsg& m) {
+  const esp_partition_t* part = esp_ota_get_next_update_partition(nullptr);
+  if (part == nullptr) {
+    emitLine("ERR:OTA:nopart");
+    return;
+  }
+  otaFlash.attach(part);
+  OtaSaved saved;
+  const bool resumable = loadOtaResume(saved) && saved.addr == part->address;
+  int e = ota.begin(m.size, m.crc, m.chunk, resumable ? &saved.r : nullptr);
+  if (e != OtaReceiver<EspPartitionFlash>::OK) {
+    g_otaActive = false;
+    emitLine(e == OtaReceiver<EspPartitionFlash>::E_CHUNK ? "ERR:OTA:chunk" : "ERR:OTA:size");
+    return;
+  }
+  saveOtaResume();
+  g_otaActive = true;
+  emitf("OTA:READY:%u,W:%u,C:%u,N:%u", (unsigned)ota.next(), (unsigned)bascula::OTA_WINDOW,
+        (unsigned)m.chunk, (unsigned)ota.chunks());
+}
+
+// Verificación completa antes de activar: CRC de la imagen leída de flash y
+// validación del formato por el gestor de arranque (esp_ota_set_boot_partition).
+static void otaFinish() {
+  if (ota.status() != OtaReceiver<EspPartitionFlash>::COMPLETE) {
+    emitf("ERR:OTA:incomplete,NEXT:%u", (unsigned)ota.next());
+    return;
+  }
+  g_otaActive = false;
+  if (!ota.verify()) {
+    ota.abort();
+    prefs.remove(KEY_OTA_RESUME);
+    logEvent(bascula::LOG_OTA, -1);
+    emitLine("ERR:OTA:crc");
+    return;
+  }
+  if (esp_ota_set_boot_partition(otaFlash.partition()) != ESP_OK) {
+    ota.abort();
+    prefs.remove(KEY_OTA_RESUME);
+    logEvent(bascula::LOG_OTA, -2);
+    emitLine("ERR:OTA:image");
+    return;
+  }
+  prefs.remove(KEY_OTA_RESUME);
+  logEvent(bascula::LOG_OTA, (int32_t)ota.bytes());
+  emitf("OTA:OK:%lu", (unsigned long)ota.bytes());
+  Serial.println(F("[OTA] Imagen verificada y activada; reiniciando"));
+  vTaskDelay(pdMS_TO_TICKS(300));  // deja salir la respuesta y el registro
+  esp_restart();
+}
+
+static void otaTaskFn(void*) {
+  OtaMsg m;
+  for (;;) {
+    xQueueReceive(otaQueue.handle, &m, portMAX_DELAY);
+    switch (m.op) {
+      case OTA_OP_FRAME: {
+        OtaFrame f;
+        bascula::otaFrameView(otaSlots[m.slot].bytes, f);
+        OtaReceiver<EspPartitionFlash>::Verdict v = ota.accept(f);
+        xQueueSend(otaFree.handle, &m.slot, 0);
+        if (v == OtaReceiver<EspPartitionFlash>::FAIL) {
+          emitLine("ERR:OTA:flash");
+        } else {
+          emitf("OTA:%s:%u", v == OtaReceiver<EspPartitionFlash>::ACK ? "ACK" : "NAK",
+                (unsigned)ota.next());
+        }
+        if (ota.takePersistDue()) saveOtaResume();
+        break;
+      }
+      case OTA_OP_BAD:
+        if (ota.status() == OtaReceiver<EspPartitionFlash>::RECEIVING) {
+          emitf("OTA:NAK:%u", (unsigned)ota.next());
         }
+        break;
+      case OTA_OP_BEGIN:
+        otaBegin(m);
+        break;
+      case OTA_OP_END:
+        otaFinish();
+        break;
+      case OTA_OP_ABORT:
+        g_otaActive = false;
+        ota.abort();
+        prefs.remove(KEY_OTA_RESUME);
+        emitLine("ACK:OTA:ABORT");
+        break;
+      default: {
+        static const char* const kState[] = {"IDLE", "RX", "COMPLETE"};
+        emitf("OTA:STATE:%s,NEXT:%u,OF:%u,BYTES:%lu,DROP:%lu", kState[ota.status()],
+              (unsigned)ota.next(), (unsigned)ota.chunks(), (unsigned long)ota.bytes(),
+              (unsigned long)g_otaDrops);
+        break;
+      }
+    }
+  }
+}
+
+static void statsTimerCb(TimerHandle_t) {
+  // El contador de sobrecargas lo escribe en NVS la tarea log: la escritura
+  // puede tardar ms y aquí bloquearía la tarea de temporizadores. Con la
+  // cola llena se reintenta en el siguiente tick.
+  if (g_ovlDirty) {
+    g_ovlDirty = false;  // antes de leer: un enganche posterior vuelve a marcarlo
+    LogMsg m{LOG_OP_OVL_COUNT, (int32_t)guard.count(), millis()};
+    if (xQueueSend(logQueue.handle, &m, 0) != pdTRUE) g_ovlDirty = true;
+  }
+
+  const uint32_t hw[5] = {acqTask.headroom(), rxTask.headroom(), txTask.headroom(),
+                          logTask.headroom(), otaTask.headroom()};
+  static const char* const names[5] = {"acq", "rx", "tx", "log", "ota"};
+  for (int i = 0; i < 5; ++i) {
+    if (g_minHeadroom[i] == 0 || hw[i] < g_minHeadroom[i]) {
+      g_minHeadroom[i] = hw[i];
+      if (hw[i] < STACK_WARN_BYTES) {
+        Serial.print(F("[WARN] Pila baja en "));
+        Serial.print(names[i]);
+        Serial.print(F(": "));
+        Serial.println((unsigned)hw[i]);
       }
     }
   }
+}
+
+// ---------- SETUP ----------
+void setup() {
+  // Sin esperas fijas: cada ms aquí retrasa la primera trama válida.
+  Serial.begin(BAUD_USB);
+  Serial1.setRxBufferSize(UART_RX_BYTES);
+  Serial1.begin(BAUD, SERIAL_8N1, UART1_RX_PIN, UART1_TX_PIN);
+  Serial1.setRxTimeout(1);  // aviso a un símbolo de silencio tras el último byte
+  Serial1.onReceive(onUartRx);
+
+  Serial.println();
+  Serial.println(F("== Bascula ESP32 + HX711 @ UART =="));
+  Serial.print(F("UART1 TX=")); Serial.print(UART1_TX_PIN);
+  Serial.print(F(" RX=")); Serial.println(UART1_RX_PIN);
+
+  scale.begin(HX711_DOUT_PIN, HX711_SCK_PIN);
+
+  prefs.begin(NVS_NAMESPACE, false);
+  loadProfiles();
+  applyProfile();
+  guard.setCount(prefs.getUInt(KEY_OVL_COUNT, 0));
+  mux.setEvery(prefs.getUShort(KEY_CHB_EVERY, 0));
+  quant.configure(prefs.getFloat(KEY_DIV, 0.0f), prefs.getFloat(KEY_DIV_HYST, 0.0f));
+  tryWarmStart();
+
+  // Anillo de la captura con disparo: en PSRAM si la placa la tiene (única
+  // reserva, una vez y fuera del presupuesto de RAM interna); si no, el
+  // anillo estático pequeño.
+  TraceSample* ring = psramFound() ? static_cast<TraceSample*>(
+                                         ps_malloc(TRIG_PSRAM_SAMPLES * sizeof(TraceSample)))
+                                   : nullptr;
+  g_trigPsram = ring != nullptr;
+  trig.attach(g_trigPsram ? ring : trigRam, g_trigPsram ? TRIG_PSRAM_SAMPLES : TRIG_RAM_SAMPLES);
+  trig.configure(TRIG_SOURCES, 0, 0);
+  trig.arm();
+  trigRetime();
+
+  Serial.print(F("Perfil: ")); Serial.println(profiles.active().name);
+  Serial.print(F("CalFactor: ")); Serial.println(g_calFactor, 8);
+  Serial.print(F("TareOffset: ")); Serial.println(g_tareOffset);
+  Serial.print(F("Capacidad: ")); Serial.print(guard.capacityG(), 1);
+  Serial.print(F(" g, sobrecarga: ")); Serial.print(guard.overloadG(), 1);
+  Serial.print(F(" g, eventos: ")); Serial.print((unsigned)guard.count());
+  Serial.println(guard.armed() || guard.capacityG() <= 0.0f ? F("") : F(" (apagada: sin calibrar)"));
+  Serial.print(F("Arranque: ")); Serial.println(g_warmBoot ? F("caliente (RTC)") : F("frio"));
+  reportMemMap(Serial);
+
+  cmdQueue.create();
+  snapQueue.create();
+  logQueue.create();
+  otaQueue.create();
+  otaFree.create();
+  for (uint8_t i = 0; i < bascula::OTA_WINDOW; ++i) xQueueSend(otaFree.handle, &i, 0);
+  txStream.create();
+  txMutex.create();
+  statsTimer.create("stats", STATS_PERIOD_MS, true, statsTimerCb);
+
+  // El HELLO sale al terminar el autotest sobre las primeras conversiones
+  // (< SELFTEST_BUDGET_MS), sin retrasar la primera trama.
+  startSelfTest();
+
+  logEvent(bascula::LOG_BOOT, g_resetReason);
+  if (g_resetReason == ESP_RST_TASK_WDT || g_resetReason == ESP_RST_INT_WDT ||
+      g_resetReason == ESP_RST_WDT) {
+    logEvent(bascula::LOG_WDT, g_resetReason);
+  }
 
-  // 6) Ritmo de lazo
-  delay(1000 / LOOP_HZ);
+  txTask.start(txTaskFn, "tx", PRIO_TX, 0);
+  rxTask.start(rxTaskFn, "rx", PRIO_RX, 0);
+  acqTask.start(acqTaskFn, "acq", PRIO_ACQ, 1);
+  logTask.start(logTaskFn, "log", PRIO_LOG, 0);
+  otaTask.start(otaTaskFn, "ota", PRIO_OTA, 0);
+  xTimerStart(statsTimer.handle, 0);
+}
+
+// ---------- LOOP ----------
+void loop() {
+  // Todo el trabajo ocurre en tareas estáticas; el lazo de Arduino sobra.
+  vTaskDelete(nullptr);
 }
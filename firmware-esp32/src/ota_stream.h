@@ -0,0 +1,270 @@
+// firmware-esp32/src/ota_stream.h
+//
+// Actualización por Serial1 en streaming, sin tocar el cable USB: formato de
+// trama binaria, analizador byte a byte y receptor que escribe la imagen en
+// la partición OTA inactiva.
+//
+// Trama (little endian), intercalable con las líneas de comando ASCII porque
+// 0xA5 nunca empieza un comando:
+//
+//   A5 5A | seq u16 | raw u16 | len u16 | flags u8 | datos[len] | crc32 u32
+//
+// - Cada chunk de `chunk` bytes de imagen (el último puede ser menor) viaja
+//   comprimido por separado con lz.h (flags bit 0) o tal cual si no gana.
+// - El CRC-32 cubre desde seq hasta el último byte de datos.
+// - Ventana deslizante con retroceso (go-back-N): el host manda hasta
+//   OTA_WINDOW tramas sin confirmar; el receptor solo acepta la siguiente en
+//   orden y responde OTA:ACK:<siguiente> o OTA:NAK:<siguiente>.
+// - Reanudación: el receptor expone su progreso (OtaResume) para que main.cpp
+//   lo guarde en NVS cada OTA_PERSIST_EVERY chunks. Un OTA:BEGIN con la misma
+//   imagen (tamaño + CRC + chunk) continúa desde ahí, incluso tras reiniciar,
+//   volviendo al principio del sector en curso, que se borra y se reescribe.
+// - Al final se comprueba el CRC-32 de la imagen completa leída de flash; la
+//   activación (y la validación del formato de imagen) la hace main.cpp.
+//
+// La flash se abstrae igual que en event_log.h (size/read/write/erase) para
+// simular el enlace completo en el host (host/ota_upload.cpp --sim).
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "lz.h"
+
+namespace bascula {
+
+static const uint8_t  OTA_SYNC0         = 0xA5;
+static const uint8_t  OTA_SYNC1         = 0x5A;
+static const size_t   OTA_HDR_BYTES     = 9;
+static const size_t   OTA_CHUNK_MAX     = 1024;
+static const size_t   OTA_FRAME_MAX     = OTA_HDR_BYTES + OTA_CHUNK_MAX + 4;
+static const uint8_t  OTA_FLAG_LZ       = 0x01;
+static const uint8_t  OTA_WINDOW        = 4;     // tramas en vuelo
+static const uint16_t OTA_PERSIST_EVERY = 16;    // chunks entre guardados
+static const uint32_t OTA_SECTOR_BYTES  = 4096;
+
+static inline void otaPut16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+static inline void otaPut32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+static inline uint16_t otaGet16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+static inline uint32_t otaGet32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+// Vista de una trama ya validada (los datos apuntan al buffer de origen).
+struct OtaFrame {
+  uint16_t       seq;
+  uint16_t       rawLen;
+  uint16_t       dataLen;
+  uint8_t        flags;
+  const uint8_t* data;
+};
+
+// Construye la trama del chunk `seq` en out (>= OTA_FRAME_MAX bytes).
+// Devuelve los bytes a enviar.
+static inline size_t otaEncodeFrame(uint16_t seq, const uint8_t* raw, size_t rawLen,
+                                    bool compress, uint8_t* out) {
+  out[0] = OTA_SYNC0;
+  out[1] = OTA_SYNC1;
+  otaPut16(out + 2, seq);
+  otaPut16(out + 4, (uint16_t)rawLen);
+  uint8_t* data = out + OTA_HDR_BYTES;
+  // Solo se usa la versión comprimida si es estrictamente menor
+  size_t n = compress && rawLen > 1 ? lzCompress(raw, rawLen, data, rawLen - 1) : 0;
+  uint8_t flags = OTA_FLAG_LZ;
+  if (n == 0) {
+    memcpy(data, raw, rawLen);
+    n = rawLen;
+    flags = 0;
+  }
+  otaPut16(out + 6, (uint16_t)n);
+  out[8] = flags;
+  otaPut32(data + n, crc32(out + 2, OTA_HDR_BYTES - 2 + n));
+  return OTA_HDR_BYTES + n + 4;
+}
+
+// Interpreta una trama completa y ya comprobada (p. ej. copiada a un slot).
+static inline void otaFrameView(const uint8_t* buf, OtaFrame& f) {
+  f.seq = otaGet16(buf + 2);
+  f.rawLen = otaGet16(buf + 4);
+  f.dataLen = otaGet16(buf + 6);
+  f.flags = buf[8];
+  f.data = buf + OTA_HDR_BYTES;
+}
+
+// Analizador byte a byte. Ante una cabecera imposible o un CRC erróneo
+// devuelve BAD y vuelve a buscar sincronismo.
+class OtaFrameParser {
+public:
+  enum Result : uint8_t { NONE = 0, FRAME, BAD };
+
+  OtaFrameParser() { reset(); }
+
+  void reset() {
+    pos_ = 0;
+    total_ = 0;
+  }
+
+  bool active() const { return pos_ > 0; }
+
+  Result feed(uint8_t b) {
+    if (pos_ == 0 && b != OTA_SYNC0) return NONE;
+    if (pos_ == 1 && b != OTA_SYNC1) {
+      reset();
+      return BAD;
+    }
+    buf_[pos_++] = b;
+    if (pos_ == OTA_HDR_BYTES) {
+      uint16_t raw = otaGet16(buf_ + 4), len = otaGet16(buf_ + 6);
+      uint8_t flags = buf_[8];
+      if (raw == 0 || raw > OTA_CHUNK_MAX || len == 0 || len > OTA_CHUNK_MAX ||
+          (flags & ~OTA_FLAG_LZ) != 0 || (!(flags & OTA_FLAG_LZ) && len != raw)) {
+        reset();
+        return BAD;
+      }
+      total_ = OTA_HDR_BYTES + len + 4;
+    }
+    if (total_ == 0 || pos_ < total_) return NONE;
+
+    size_t n = total_ - 4;
+    bool ok = otaGet32(buf_ + n) == crc32(buf_ + 2, n - 2);
+    size_t done = total_;
+    reset();
+    size_ = done;
+    return ok ? FRAME : BAD;
+  }
+
+  // Bytes de la última trama completa (válidos hasta el siguiente feed()).
+  const uint8_t* bytes() const { return buf_; }
+  size_t         size() const { return size_; }
+
+private:
+  uint8_t buf_[OTA_FRAME_MAX];
+  size_t  pos_;
+  size_t  total_;
+  size_t  size_ = 0;
+};
+
+// Progreso reanudable de una sesión.
+struct OtaResume {
+  uint32_t size;
+  uint32_t crc;
+  uint16_t chunk;
+  uint16_t next;
+};
+
+template <class Flash>
+class OtaReceiver {
+public:
+  enum Status : uint8_t { IDLE = 0, RECEIVING, COMPLETE };
+  enum Verdict : uint8_t { ACK = 0, NAK, FAIL };
+  enum BeginError : int8_t { OK = 0, E_SIZE = -1, E_CHUNK = -2 };
+
+  explicit OtaReceiver(Flash& f)
+      : f_(f), status_(IDLE), size_(0), crc_(0), chunk_(0), next_(0),
+        persistDue_(false) {}
+
+  // Abre una sesión. Si `saved` describe la misma imagen, continúa desde su
+  // siguiente chunk; si no, empieza desde cero.
+  int begin(uint32_t size, uint32_t crc, uint16_t chunk, const OtaResume* saved) {
+    status_ = IDLE;
+    if (chunk == 0 || chunk > OTA_CHUNK_MAX || OTA_SECTOR_BYTES % chunk != 0) {
+      return E_CHUNK;
+    }
+    if (size == 0 || size > f_.size() || (size + chunk - 1) / chunk > 0xFFFFu) {
+      return E_SIZE;
+    }
+    size_ = size;
+    crc_ = crc;
+    chunk_ = chunk;
+    next_ = 0;
+    if (saved && saved->size == size && saved->crc == crc && saved->chunk == chunk &&
+        saved->next <= chunks()) {
+      // Se retoma al principio del sector: lo que hubiera a medias se borra
+      // y se reescribe entero.
+      next_ = (uint16_t)(saved->next - saved->next % (OTA_SECTOR_BYTES / chunk));
+    }
+    persistDue_ = false;
+    status_ = next_ >= chunks() ? COMPLETE : RECEIVING;
+    return OK;
+  }
+
+  Verdict accept(const OtaFrame& fr) {
+    if (status_ == COMPLETE && fr.seq < next_) return ACK;  // duplicado tardío
+    if (status_ != RECEIVING) return FAIL;
+    if (fr.seq < next_) return ACK;   // duplicado: reconfirmar
+    if (fr.seq > next_) return NAK;   // hueco: pedir desde next_
+
+    uint32_t off = (uint32_t)next_ * chunk_;
+    uint32_t want = size_ - off < chunk_ ? size_ - off : chunk_;
+    int n;
+    if (fr.flags & OTA_FLAG_LZ) {
+      n = lzDecompress(fr.data, fr.dataLen, work_, chunk_);
+    } else {
+      n = fr.dataLen <= chunk_ ? (int)fr.dataLen : -1;
+      if (n > 0) memcpy(work_, fr.data, (size_t)n);
+    }
+    if (n < 0 || (uint32_t)n != want || fr.rawLen != want) return NAK;
+
+    if (off % OTA_SECTOR_BYTES == 0 && !f_.erase(off)) return FAIL;
+    if (!f_.write(off, work_, (size_t)n)) return FAIL;
+    next_++;
+    if (next_ % OTA_PERSIST_EVERY == 0) persistDue_ = true;
+    if (next_ >= chunks()) status_ = COMPLETE;
+    return ACK;
+  }
+
+  // CRC-32 de la imagen completa leída de vuelta de la flash.
+  bool verify() {
+    if (status_ != COMPLETE) return false;
+    uint8_t blk[256];
+    uint32_t c = 0;
+    for (uint32_t off = 0; off < size_; off += sizeof(blk)) {
+      size_t n = size_ - off < sizeof(blk) ? size_ - off : sizeof(blk);
+      if (!f_.read(off, blk, n)) return false;
+      c = crc32(blk, n, c);
+    }
+    return c == crc_;
+  }
+
+  void abort() { status_ = IDLE; }
+
+  // true una vez cada OTA_PERSIST_EVERY chunks (se limpia al leerlo).
+  bool takePersistDue() {
+    bool d = persistDue_;
+    persistDue_ = false;
+    return d;
+  }
+
+  OtaResume resume() const { return OtaResume{size_, crc_, chunk_, next_}; }
+  Status   status() const { return status_; }
+  uint16_t next() const { return next_; }
+  uint16_t chunks() const { return (uint16_t)((size_ + chunk_ - 1) / chunk_); }
+  uint32_t bytes() const {
+    uint32_t b = (uint32_t)next_ * chunk_;
+    return b < size_ ? b : size_;
+  }
+
+private:
+  Flash&   f_;
+  Status   status_;
+  uint32_t size_;
+  uint32_t crc_;
+  uint16_t chunk_;
+  uint16_t next_;
+  bool     persistDue_;
+  uint8_t  work_[OTA_CHUNK_MAX];
+};
+
+}  // namespace bascula
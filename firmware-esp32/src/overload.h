@@ -0,0 +1,154 @@
+// firmware-esp32/src/overload.h
+//
+// Protección de capacidad y sobrecarga de la celda. Los umbrales en gramos
+// se convierten a cuentas crudas al configurar o recalibrar, de modo que la
+// comprobación por muestra es una resta y una comparación entera sobre el
+// crudo, antes de mediana e IIR: reacciona en una sola conversión.
+//
+// La carga se mide desde el cero de calibración (plato vacío), no desde la
+// tara: la celda soporta lo mismo con o sin recipiente tarado encima, así
+// que tarar no mueve los umbrales. Sin cero de calibración (unidad sin
+// calibrar, OVERLOAD_NO_ZERO) la protección está apagada: con pendiente 1 y
+// cero 0 el offset normal del HX711 ya superaría cualquier umbral.
+//
+// - Capacidad: por encima se marca la trama (OL) pero no se engancha.
+// - Sobrecarga: engancha (latch) hasta que se borre con la carga ya retirada,
+//   y cuenta cada enganche (el contador lo persiste main.cpp en NVS).
+// - Una conversión saturada en el sentido de carga positiva cuenta como
+//   sobrecarga.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include "peak_hold.h"  // HX711_RAW_MAX / HX711_RAW_MIN
+
+namespace bascula {
+
+// Cero de calibración sin fijar: fuera del rango de 24 bits del HX711.
+static const int32_t OVERLOAD_NO_ZERO = INT32_MIN;
+
+enum CapParse : uint8_t { CAP_OK = 0, CAP_VALUE, CAP_OVERLOAD };
+
+// Argumento de CAP: "<g>[,<ovl_g>]", sin nada detrás y con números finitos
+// (strtof acepta "nan": pasaría la comprobación de cap < 0 y dejaría la
+// protección apagada sin avisar). Sin umbral explícito la sobrecarga queda
+// al 120 % de la capacidad.
+static inline CapParse capacityParse(const char* s, float& capG, float& ovlG) {
+  char* end = nullptr;
+  const float cap = strtof(s, &end);
+  if (end == s || !isfinite(cap) || cap < 0.0f || (*end != '\0' && *end != ',')) {
+    return CAP_VALUE;
+  }
+  float ovl = cap * 1.2f;
+  if (*end == ',') {
+    const char* ovlStart = end + 1;
+    ovl = strtof(ovlStart, &end);
+    if (end == ovlStart || *end != '\0' || !isfinite(ovl) || ovl < cap) return CAP_OVERLOAD;
+  }
+  capG = cap;
+  ovlG = ovl;
+  return CAP_OK;
+}
+
+class OverloadGuard {
+public:
+  enum Level : uint8_t { NORMAL = 0, OVER_CAPACITY, OVERLOAD };
+
+  OverloadGuard()
+      : capG_(0.0f), ovlG_(0.0f), calFactor_(1.0f), zero_(0),
+        capCounts_(0), ovlCounts_(0), level_(NORMAL), latched_(false),
+        count_(0) {}
+
+  // capG = 0 desactiva la protección.
+  void configure(float capG, float ovlG) {
+    capG_ = capG;
+    ovlG_ = ovlG < capG ? capG : ovlG;
+    recompute();
+  }
+
+  // zeroOffset: crudo con el plato vacío (no la tara del usuario), u
+  // OVERLOAD_NO_ZERO sin calibrar.
+  void setCalibration(float calFactor, int32_t zeroOffset) {
+    calFactor_ = calFactor;
+    zero_ = zeroOffset;
+    recompute();
+  }
+
+  // Devuelve true si esta conversión provoca un nuevo enganche.
+  bool push(long raw) {
+    if (capCounts_ <= 0) {
+      level_ = NORMAL;
+      return false;
+    }
+    int64_t load = (int64_t)raw - zero_;
+    if (calFactor_ < 0.0f) load = -load;
+    bool saturated = calFactor_ >= 0.0f ? raw >= HX711_RAW_MAX
+                                        : raw <= HX711_RAW_MIN;
+
+    if (saturated || load >= ovlCounts_) {
+      level_ = OVERLOAD;
+    } else if (load >= capCounts_) {
+      level_ = OVER_CAPACITY;
+    } else {
+      level_ = NORMAL;
+    }
+
+    if (level_ == OVERLOAD && !latched_) {
+      latched_ = true;
+      count_++;
+      return true;
+    }
+    return false;
+  }
+
+  // Tras una calibración nueva (C:): el enganche se midió con otro cero y
+  // otra pendiente, así que se suelta y la siguiente conversión decide.
+  void rearm() {
+    latched_ = false;
+    level_ = NORMAL;
+  }
+
+  // Borra el enganche si la carga ya no supera el umbral de sobrecarga.
+  bool clearLatch() {
+    if (level_ == OVERLOAD) return false;
+    latched_ = false;
+    return true;
+  }
+
+  Level    level() const { return level_; }
+  bool     latched() const { return latched_; }
+  bool     armed() const { return capCounts_ > 0; }
+  bool     flagged() const { return latched_ || level_ != NORMAL; }
+  uint32_t count() const { return count_; }
+  void     setCount(uint32_t n) { count_ = n; }
+  float    capacityG() const { return capG_; }
+  float    overloadG() const { return ovlG_; }
+
+private:
+  void recompute() {
+    float k = fabsf(calFactor_);
+    if (capG_ <= 0.0f || k < 1e-12f || zero_ == OVERLOAD_NO_ZERO) {
+      capCounts_ = ovlCounts_ = 0;
+      return;
+    }
+    capCounts_ = (int64_t)(capG_ / k);
+    ovlCounts_ = (int64_t)(ovlG_ / k);
+  }
+
+  float    capG_;
+  float    ovlG_;
+  float    calFactor_;
+  int32_t  zero_;
+  int64_t  capCounts_;
+  int64_t  ovlCounts_;
+  Level    level_;
+  bool     latched_;
+  uint32_t count_;
+};
+
+}  // namespace bascula
@@ -0,0 +1,46 @@
+// firmware-esp32/src/partition_flash.h
+//
+// Acceso a una partición de flash con la interfaz que esperan RingLog
+// (event_log.h) y OtaReceiver (ota_stream.h): size/read/write/erase por
+// sectores de 4 KiB. Solo ESP32; en el host se sustituye por un buffer en RAM.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_partition.h>
+
+namespace bascula {
+
+class EspPartitionFlash {
+public:
+  static const uint32_t SECTOR_BYTES = 4096;
+
+  EspPartitionFlash() : part_(nullptr) {}
+
+  bool open(const char* label, uint8_t subtype) {
+    part_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                     (esp_partition_subtype_t)subtype, label);
+    return part_ != nullptr;
+  }
+
+  void attach(const esp_partition_t* part) { part_ = part; }
+  const esp_partition_t* partition() const { return part_; }
+
+  size_t size() const { return part_ ? part_->size : 0; }
+  bool read(uint32_t off, void* dst, size_t n) {
+    return part_ && esp_partition_read(part_, off, dst, n) == ESP_OK;
+  }
+  bool write(uint32_t off, const void* src, size_t n) {
+    return part_ && esp_partition_write(part_, off, src, n) == ESP_OK;
+  }
+  bool erase(uint32_t off) {
+    return part_ && esp_partition_erase_range(part_, off, SECTOR_BYTES) == ESP_OK;
+  }
+
+private:
+  const esp_partition_t* part_;
+};
+
+}  // namespace bascula
@@ -0,0 +1,62 @@
+// firmware-esp32/src/peak_hold.h
+//
+// Captura de pico y mínimo (peak-hold / min-hold) sobre las cuentas crudas
+// validadas, a la tasa completa del HX711 (antes de mediana e IIR), para
+// que los transitorios cortos (golpes, objetos que caen) no se pierdan.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace bascula {
+
+// Códigos de saturación del HX711 (24 bits con signo).
+static const long HX711_RAW_MAX = 0x7FFFFFL;
+static const long HX711_RAW_MIN = -0x800000L;
+
+// Una muestra es válida si el convertidor no está saturado en ningún extremo.
+static inline bool rawValid(long raw) {
+  return raw > HX711_RAW_MIN && raw < HX711_RAW_MAX;
+}
+
+class PeakHold {
+public:
+  PeakHold() { reset(0); }
+
+  void reset(uint32_t nowMs) {
+    count_ = 0;
+    max_ = 0;
+    min_ = 0;
+    maxMs_ = minMs_ = resetMs_ = nowMs;
+  }
+
+  void push(long raw, uint32_t nowMs) {
+    if (count_ == 0 || raw > max_) {
+      max_ = raw;
+      maxMs_ = nowMs;
+    }
+    if (count_ == 0 || raw < min_) {
+      min_ = raw;
+      minMs_ = nowMs;
+    }
+    count_++;
+  }
+
+  uint32_t count() const { return count_; }
+  long     maxRaw() const { return max_; }
+  long     minRaw() const { return min_; }
+  uint32_t maxMs() const { return maxMs_; }
+  uint32_t minMs() const { return minMs_; }
+  uint32_t resetMs() const { return resetMs_; }
+
+private:
+  uint32_t count_;
+  long     max_;
+  long     min_;
+  uint32_t maxMs_;
+  uint32_t minMs_;
+  uint32_t resetMs_;
+};
+
+}  // namespace bascula
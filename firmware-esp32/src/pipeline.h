@@ -0,0 +1,211 @@
+// firmware-esp32/src/pipeline.h
+//
+// Núcleo de filtrado portable: mediana (ventana N) + IIR (alpha) + estabilidad.
+// No depende de Arduino ni de FreeRTOS para poder compilarse también en el
+// host (herramientas de simulación y ajuste).
+//
+// - Sin memoria dinámica: la ventana de mediana usa almacenamiento fijo
+//   (MEDIAN_MAX) y el cálculo de la mediana trabaja sobre una copia en pila.
+// - La semántica replica el lazo original de main.cpp: hasta tener 3 muestras
+//   se publica el crudo convertido; después mediana -> IIR sembrado con el
+//   primer valor; estable si |Δ| <= umbral durante STABLE_MS.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>  // std::nth_element
+
+namespace bascula {
+
+static const size_t MEDIAN_MAX = 31;  // capacidad máxima de la ventana
+
+struct FilterParams {
+  uint8_t  medianWindow;   // impar recomendado, <= MEDIAN_MAX
+  float    iirAlpha;       // 0-1
+  float    stableDeltaG;   // umbral en gramos
+  uint32_t stableMs;       // ms
+};
+
+// ---------- VENTANA DE MEDIANA ----------
+class MedianRing {
+public:
+  MedianRing() : n_(1), idx_(0), count_(0) {
+    for (size_t i = 0; i < MEDIAN_MAX; ++i) buf_[i] = 0;
+  }
+
+  void setWindow(size_t n) {
+    if (n < 1) n = 1;
+    if (n > MEDIAN_MAX) n = MEDIAN_MAX;
+    n_ = n;
+    clear();
+  }
+
+  void clear() {
+    idx_ = 0;
+    count_ = 0;
+  }
+
+  void add(long v) {
+    buf_[idx_] = v;
+    idx_ = (idx_ + 1) % n_;
+    if (count_ < n_) count_++;
+  }
+
+  size_t size() const { return count_; }
+  size_t window() const { return n_; }
+
+  long median() const {
+    if (count_ == 0) return 0;
+    long tmp[MEDIAN_MAX];
+    for (size_t i = 0; i < count_; ++i) tmp[i] = buf_[i];
+    std::nth_element(tmp, tmp + count_ / 2, tmp + count_);
+    return tmp[count_ / 2];  // usar ventana impar
+  }
+
+private:
+  long   buf_[MEDIAN_MAX];
+  size_t n_;
+  size_t idx_;
+  size_t count_;
+};
+
+// ---------- SALIDA DE UNA ETAPA ----------
+struct PipelineOut {
+  float    grams;       // salida filtrada (IIR)
+  bool     stable;      // estabilidad temporal
+  long     median;      // mediana en cuentas crudas (o crudo si aún no hay 3)
+  float    delta;       // |Δ| respecto a la salida anterior
+  uint32_t stableForMs; // tiempo acumulado dentro del umbral
+};
+
+// ---------- PIPELINE ----------
+class Pipeline {
+public:
+  explicit Pipeline(const FilterParams& p)
+      : params_(p), calFactor_(1.0f), tareOffset_(0) {
+    rb_.setWindow(p.medianWindow);
+    reset();
+  }
+
+  // Cambia parámetros y re-siembra el filtro (la ventana se vacía).
+  void setParams(const FilterParams& p) {
+    params_ = p;
+    rb_.setWindow(p.medianWindow);
+    reset();
+  }
+  const FilterParams& params() const { return params_; }
+
+  // Cambia ventana/alpha (p. ej. al conocer la tasa real) conservando el
+  // estado: la ventana nueva se llena con la última mediana y el IIR y la
+  // estabilidad siguen donde estaban, sin escalón en la salida.
+  void retime(const FilterParams& p) {
+    params_ = p;
+    rb_.setWindow(p.medianWindow);
+    if (first_) return;
+    for (size_t i = 0; i < rb_.window(); ++i) rb_.add(out_.median);
+  }
+
+  // Ajusta solo el umbral de estabilidad, sin re-sembrar el filtro.
+  void setStableDelta(float g) { params_.stableDeltaG = g; }
+
+  void setCalibration(float calFactor, int32_t tareOffset) {
+    calFactor_ = calFactor;
+    tareOffset_ = tareOffset;
+  }
+  void setTare(int32_t tareOffset) { tareOffset_ = tareOffset; }
+  float   calFactor() const { return calFactor_; }
+  int32_t tareOffset() const { return tareOffset_; }
+
+  float rawToGrams(long raw) const {
+    long raw_net = raw - tareOffset_;
+    return (float)raw_net * calFactor_;
+  }
+
+  void reset() {
+    rb_.clear();
+    first_ = true;
+    iir_ = 0.0f;
+    last_ = 0.0f;
+    stableRefMs_ = 0;
+    out_ = PipelineOut();
+  }
+
+  // Arranque en caliente: llena la ventana de mediana con la última mediana
+  // conocida y siembra el IIR, de modo que la primera muestra ya sale
+  // filtrada. Si el estado era estable, la estabilidad no vuelve a esperar
+  // STABLE_MS completos.
+  void warmStart(long medianRaw, float iir, bool stable, uint32_t nowMs) {
+    reset();
+    for (size_t i = 0; i < rb_.window(); ++i) rb_.add(medianRaw);
+    iir_ = iir;
+    last_ = iir;
+    first_ = false;
+    stableRefMs_ = stable ? nowMs - params_.stableMs : nowMs;
+    out_.grams = iir;
+    out_.median = medianRaw;
+  }
+
+  // Fija el estado del IIR (p. ej. tras un cambio brusco conocido).
+  void seed(float grams, uint32_t nowMs) {
+    iir_ = grams;
+    last_ = grams;
+    first_ = false;
+    stableRefMs_ = nowMs;
+  }
+
+  const PipelineOut& push(long raw, uint32_t nowMs) {
+    rb_.add(raw);
+
+    // Mediana + IIR
+    float grams;
+    if (rb_.size() >= 3) {
+      long med = rb_.median();
+      float g  = rawToGrams(med);
+      if (first_) {
+        iir_ = g;
+        first_ = false;
+      } else {
+        iir_ = (1.0f - params_.iirAlpha) * iir_ + params_.iirAlpha * g;
+      }
+      grams = iir_;
+      out_.median = med;
+    } else {
+      grams = rawToGrams(raw);
+      out_.median = raw;
+    }
+
+    // Estabilidad temporal
+    float delta = fabsf(grams - last_);
+    if (delta <= params_.stableDeltaG) {
+      if ((nowMs - stableRefMs_) >= params_.stableMs) {
+        out_.stable = true;
+      }
+    } else {
+      out_.stable = false;
+      stableRefMs_ = nowMs;
+    }
+    last_ = grams;
+
+    out_.grams = grams;
+    out_.delta = delta;
+    out_.stableForMs = nowMs - stableRefMs_;
+    return out_;
+  }
+
+  const PipelineOut& last() const { return out_; }
+
+private:
+  FilterParams params_;
+  MedianRing   rb_;
+  float        calFactor_;
+  int32_t      tareOffset_;
+  bool         first_;
+  float        iir_;
+  float        last_;
+  uint32_t     stableRefMs_;
+  PipelineOut  out_;
+};
+
+}  // namespace bascula
@@ -0,0 +1,106 @@
+// firmware-esp32/src/probe.h
+//
+// Sondas del pipeline ("PROBE:<máscara>"): valores intermedios de la muestra
+// que produjo cada trama G:, en una línea propia que sale justo detrás:
+//
+//   PRB:R:<crudo>,V:<validado>,M:<mediana>,N:<neto>,I:<g>,D:<g>,T:<ms>
+//
+// Solo aparecen los campos de la máscara, siempre en este orden:
+//   R (0x01) cuenta cruda de la conversión que pasó al filtro
+//   V (0x02) último crudo validado (sin saturar)
+//   M (0x04) mediana en cuentas
+//   N (0x08) mediana menos la tara, en cuentas
+//   I (0x10) salida del IIR en gramos
+//   D (0x20) |Δ| de estabilidad en gramos
+//   T (0x40) tiempo acumulado dentro del umbral de estabilidad
+// Va aparte y no dentro de G: para no pasar del límite de línea del
+// decodificador del host (160 bytes) con todas las opciones activas. Con la
+// máscara a 0 no se formatea nada: una comparación por trama. Claves,
+// formatos y tamaño salen de ProbeFrame (frame_schema.h).
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "frame_schema.h"
+
+namespace bascula {
+
+enum ProbeTap : uint8_t {
+  PROBE_RAW    = 1u << ProbeFrame::at("R"),
+  PROBE_VALID  = 1u << ProbeFrame::at("V"),
+  PROBE_MEDIAN = 1u << ProbeFrame::at("M"),
+  PROBE_NET    = 1u << ProbeFrame::at("N"),
+  PROBE_IIR    = 1u << ProbeFrame::at("I"),
+  PROBE_DELTA  = 1u << ProbeFrame::at("D"),
+  PROBE_TIMER  = 1u << ProbeFrame::at("T"),
+};
+
+static const size_t  PROBE_TAPS = ProbeFrame::count;
+static const uint8_t PROBE_ALL  = (uint8_t)((1u << PROBE_TAPS) - 1);
+static_assert(PROBE_TAPS <= 8, "la máscara de PROBE es de 8 bits");
+
+// Las claves son de una letra: la máscara se puede dar con ellas
+constexpr bool probeKeysSingle() {
+  for (size_t i = 0; i < ProbeFrame::count; ++i) {
+    if (schemaStrLen(ProbeFrame::fields[i].tag) != 1) return false;
+  }
+  return true;
+}
+static_assert(probeKeysSingle(), "claves de ProbeFrame de una letra");
+
+struct ProbeValues {
+  long     raw;
+  long     valid;
+  long     median;
+  long     net;
+  float    iir;
+  float    delta;
+  uint32_t stableForMs;
+};
+
+// "PROBE:" ya quitado: número (decimal o 0x..), claves ("RMI") u "OFF".
+// false si sobra algo o hay bits fuera de PROBE_ALL.
+static inline bool probeParseMask(const char* s, uint8_t& mask) {
+  if (s[0] == '\0') return false;
+  if (s[0] == 'O' && s[1] == 'F' && s[2] == 'F' && s[3] == '\0') {
+    mask = 0;
+    return true;
+  }
+  if (s[0] >= '0' && s[0] <= '9') {
+    char* end = nullptr;
+    const unsigned long m = strtoul(s, &end, 0);
+    if (*end != '\0' || m > PROBE_ALL) return false;
+    mask = (uint8_t)m;
+    return true;
+  }
+  uint8_t m = 0;
+  for (; *s != '\0'; ++s) {
+    size_t i = 0;
+    while (i < PROBE_TAPS && ProbeFrame::fields[i].tag[0] != *s) ++i;
+    if (i == PROBE_TAPS) return false;
+    m |= (uint8_t)(1u << i);
+  }
+  mask = m;
+  return true;
+}
+
+// Línea PRB: con los campos de la máscara. Devuelve su longitud; con
+// size > frameMaxLen<ProbeFrame>() nunca se recorta.
+static inline size_t probeFormat(char* out, size_t size, uint8_t mask, const ProbeValues& v) {
+  FrameRecord<ProbeFrame> r;
+  r.set<ProbeFrame::at("R")>((double)v.raw);
+  r.set<ProbeFrame::at("V")>((double)v.valid);
+  r.set<ProbeFrame::at("M")>((double)v.median);
+  r.set<ProbeFrame::at("N")>((double)v.net);
+  r.set<ProbeFrame::at("I")>((double)v.iir);
+  r.set<ProbeFrame::at("D")>((double)v.delta);
+  r.set<ProbeFrame::at("T")>((double)v.stableForMs);
+  r.present = mask;
+  return frameEncode(out, size, r);
+}
+
+}  // namespace bascula
@@ -0,0 +1,192 @@
+// firmware-esp32/src/profile.h
+//
+// Perfiles de calibración con nombre (plato plano, soporte de bol, ...): cada
+// plataforma tiene su propio cero y su propia pendiente, y también su filtro
+// y sus umbrales. Hasta PROFILE_MAX perfiles, cada uno un blob de NVS con
+// CRC-32; main.cpp los carga al arrancar y los aplica de una vez al cambiar.
+//
+// Nombres de 1 a PROFILE_NAME_MAX caracteres [A-Za-z0-9_-], sin las palabras
+// reservadas de los subcomandos (LIST, GET, NEW, DEL).
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "overload.h"  // OVERLOAD_NO_ZERO
+#include "rate.h"
+
+namespace bascula {
+
+static const size_t PROFILE_MAX      = 8;
+static const size_t PROFILE_NAME_MAX = 15;
+
+struct CalProfile {
+  char         name[PROFILE_NAME_MAX + 1];
+  float        calFactor;   // unidades crudas -> gramos
+  int32_t      tareOffset;  // tara vigente (cuentas)
+  FilterTiming timing;      // mediana, IIR y estabilidad (en ms / g)
+  float        capacityG;
+  float        overloadG;
+  int32_t      zeroOffset;  // cero de calibración, plato vacío (cuentas) u OVERLOAD_NO_ZERO
+  uint32_t     crc;         // CRC-32 de todo lo anterior
+};
+
+// Límites de FILT: y de los perfiles leídos de NVS.
+static const uint32_t FILT_MEDIAN_MAX_MS = 3000;
+static const uint32_t FILT_TAU_MAX_MS    = 5000;
+static const uint32_t FILT_STABLE_MIN_MS = 100;
+static const uint32_t FILT_STABLE_MAX_MS = 10000;
+
+static inline bool filterTimingValid(const FilterTiming& t) {
+  return t.medianMs <= FILT_MEDIAN_MAX_MS && t.iirTauMs <= FILT_TAU_MAX_MS &&
+         t.stableDeltaG >= 0.05f && t.stableDeltaG <= 50.0f &&
+         t.stableMs >= FILT_STABLE_MIN_MS && t.stableMs <= FILT_STABLE_MAX_MS;
+}
+
+enum FilterParse : uint8_t { FILT_OK = 0, FILT_FORMAT, FILT_VALUE };
+
+// Argumento de FILT: "<med_ms>,<tau_ms>,<umbral_g>,<estable_ms>", sin nada
+// detrás. %lu se traga espacios y signo ("-1" sería un entero enorme que el
+// paso a uint32_t puede dejar dentro de rango), así que los campos enteros
+// deben empezar por dígito y se acotan antes de convertirlos.
+static inline FilterParse filterTimingParse(const char* s, FilterTiming& out) {
+  unsigned long med, tau, sms;
+  float th;
+  char extra;
+  if (sscanf(s, "%lu,%lu,%f,%lu%c", &med, &tau, &th, &sms, &extra) != 4) return FILT_FORMAT;
+  // sscanf ya ha casado las tres comas; el tercer campo es el umbral
+  const char* tau0 = strchr(s, ',') + 1;
+  const char* sms0 = strchr(strchr(tau0, ',') + 1, ',') + 1;
+  const char* const starts[] = {s, tau0, sms0};
+  for (const char* f : starts) {
+    if (*f < '0' || *f > '9') return FILT_FORMAT;
+  }
+  if (med > FILT_MEDIAN_MAX_MS || tau > FILT_TAU_MAX_MS || sms > FILT_STABLE_MAX_MS) {
+    return FILT_VALUE;
+  }
+  FilterTiming t{(uint32_t)med, (uint32_t)tau, th, (uint32_t)sms};
+  if (!filterTimingValid(t)) return FILT_VALUE;
+  out = t;
+  return FILT_OK;
+}
+
+static inline bool profileNameValid(const char* s) {
+  static const char* const kReserved[] = {"LIST", "GET", "NEW", "DEL"};
+  size_t n = strlen(s);
+  if (n == 0 || n > PROFILE_NAME_MAX) return false;
+  for (size_t i = 0; i < n; ++i) {
+    char c = s[i];
+    bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '_' || c == '-';
+    if (!ok) return false;
+  }
+  for (const char* r : kReserved) {
+    if (strcmp(s, r) == 0) return false;
+  }
+  return true;
+}
+
+static inline void profileSeal(CalProfile& p) {
+  p.crc = crc32(&p, offsetof(CalProfile, crc));
+}
+
+static inline bool profileValid(const CalProfile& p) {
+  if (p.crc != crc32(&p, offsetof(CalProfile, crc))) return false;
+  if (memchr(p.name, '\0', sizeof(p.name)) == nullptr || !profileNameValid(p.name)) {
+    return false;
+  }
+  return isfinite(p.calFactor) && p.calFactor != 0.0f && filterTimingValid(p.timing) &&
+         p.capacityG >= 0.0f && p.overloadG >= p.capacityG;
+}
+
+// Perfil de una unidad sin calibrar: pendiente 1, tara 0 y sin cero de
+// calibración, así que la protección de sobrecarga no actúa hasta C:.
+static inline CalProfile profileUncalibrated(const FilterTiming& timing, float capacityG,
+                                             float overloadG) {
+  CalProfile p;
+  memset(&p, 0, sizeof(p));
+  p.calFactor = 1.0f;
+  p.tareOffset = 0;
+  p.zeroOffset = OVERLOAD_NO_ZERO;
+  p.timing = timing;
+  p.capacityG = capacityG;
+  p.overloadG = overloadG;
+  return p;
+}
+
+// Tabla en RAM. La tarea acq es la única que la toca; main.cpp persiste
+// cada slot modificado.
+class ProfileTable {
+public:
+  ProfileTable() : used_(0), active_(0) {}
+
+  // Instala un perfil leído de NVS (se ignora si no es válido o el nombre
+  // ya está ocupado).
+  bool load(size_t slot, const CalProfile& p) {
+    if (slot >= PROFILE_MAX || !profileValid(p) || find(p.name) >= 0) return false;
+    slots_[slot] = p;
+    used_ |= (uint8_t)(1u << slot);
+    return true;
+  }
+
+  int find(const char* name) const {
+    for (size_t i = 0; i < PROFILE_MAX; ++i) {
+      if (used(i) && strcmp(slots_[i].name, name) == 0) return (int)i;
+    }
+    return -1;
+  }
+
+  // Copia `p` con el nombre dado en el primer slot libre. -1 si no cabe.
+  int add(const char* name, const CalProfile& p) {
+    for (size_t i = 0; i < PROFILE_MAX; ++i) {
+      if (used(i)) continue;
+      slots_[i] = p;
+      memset(slots_[i].name, 0, sizeof(slots_[i].name));
+      strncpy(slots_[i].name, name, PROFILE_NAME_MAX);
+      profileSeal(slots_[i]);
+      used_ |= (uint8_t)(1u << i);
+      return (int)i;
+    }
+    return -1;
+  }
+
+  // El perfil activo no se puede borrar.
+  bool remove(size_t slot) {
+    if (slot >= PROFILE_MAX || !used(slot) || slot == active_) return false;
+    used_ &= (uint8_t)~(1u << slot);
+    return true;
+  }
+
+  bool setActive(size_t slot) {
+    if (slot >= PROFILE_MAX || !used(slot)) return false;
+    active_ = (uint8_t)slot;
+    return true;
+  }
+
+  // Tras modificar un slot en sitio (tara, calibración, ...).
+  void reseal(size_t slot) { profileSeal(slots_[slot]); }
+
+  bool        used(size_t slot) const { return (used_ >> slot) & 1u; }
+  size_t      count() const {
+    size_t n = 0;
+    for (size_t i = 0; i < PROFILE_MAX; ++i) n += used(i) ? 1 : 0;
+    return n;
+  }
+  size_t            activeSlot() const { return active_; }
+  CalProfile&       active() { return slots_[active_]; }
+  const CalProfile& at(size_t slot) const { return slots_[slot]; }
+  CalProfile&       at(size_t slot) { return slots_[slot]; }
+
+private:
+  CalProfile slots_[PROFILE_MAX];
+  uint8_t    used_;
+  uint8_t    active_;
+};
+
+}  // namespace bascula
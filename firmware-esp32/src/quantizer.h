@@ -0,0 +1,55 @@
+// firmware-esp32/src/quantizer.h
+//
+// Cuantización a la división de display (0.1 / 0.5 / 1 / 2 g) con histéresis
+// en los límites, para que el último dígito no parpadee. El valor mostrado
+// solo cambia cuando la señal se aleja de él más de media división más la
+// banda de histéresis; entonces salta a la división más cercana.
+//
+// Solo afecta a la trama: el checkweigher, la segmentación y la estabilidad
+// siguen trabajando con la salida filtrada sin cuantizar.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <math.h>
+
+namespace bascula {
+
+class DisplayQuantizer {
+public:
+  DisplayQuantizer() : div_(0.0f), hyst_(0.0f), shown_(0.0f), primed_(false) {}
+
+  // div = 0 desactiva la cuantización. hyst en gramos (< div / 2).
+  void configure(float div, float hyst) {
+    div_ = div > 0.0f ? div : 0.0f;
+    if (hyst < 0.0f) hyst = 0.0f;
+    if (hyst > 0.45f * div_) hyst = 0.45f * div_;
+    hyst_ = hyst;
+    primed_ = false;
+  }
+
+  float division() const { return div_; }
+  float hysteresis() const { return hyst_; }
+  bool  active() const { return div_ > 0.0f; }
+
+  // Fuerza la siguiente muestra a fijar el valor sin histéresis (tara).
+  void reset() { primed_ = false; }
+
+  float push(float grams) {
+    if (div_ <= 0.0f) return grams;
+    if (!primed_ || fabsf(grams - shown_) >= 0.5f * div_ + hyst_) {
+      shown_ = roundf(grams / div_) * div_;
+      if (shown_ == 0.0f) shown_ = 0.0f;  // sin "-0.00"
+      primed_ = true;
+    }
+    return shown_;
+  }
+
+private:
+  float div_;
+  float hyst_;
+  float shown_;
+  bool  primed_;
+};
+
+}  // namespace bascula
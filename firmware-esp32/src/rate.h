@@ -0,0 +1,125 @@
+// firmware-esp32/src/rate.h
+//
+// Tasa real del HX711 y constantes de tiempo del filtro independientes de
+// ella. El pin RATE se cablea distinto según la placa (10 u 80 SPS), así que
+// el periodo entre conversiones se mide (al arrancar y de forma continua) y
+// las ventanas se expresan en milisegundos y se convierten aquí a muestras:
+// la latencia del filtro y el comportamiento de la estabilidad no dependen
+// de la variante de placa.
+//
+// - RateEstimator: media de los primeros intervalos y después EWMA (1/16).
+//   Los huecos (una conversión perdida mientras se atendía un comando, un
+//   timeout de DRDY) se descartan; si la tasa cambia de verdad, tras varios
+//   intervalos seguidos fuera de banda se vuelve a medir desde cero.
+// - filterParamsFor(): ventana de mediana impar y alpha del IIR equivalentes
+//   para el periodo con que se alimenta el pipeline.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "pipeline.h"
+
+namespace bascula {
+
+static const uint32_t RATE_MIN_PERIOD_US = 4000;    // > 250 SPS: no es un HX711
+static const uint32_t RATE_MAX_PERIOD_US = 250000;  // < 4 SPS: hueco, no periodo
+static const uint8_t  RATE_WARMUP        = 4;       // intervalos antes de fiarse
+static const uint8_t  RATE_RESYNC        = 8;       // fuera de banda seguidos
+
+class RateEstimator {
+public:
+  RateEstimator() { reset(); }
+
+  void reset() {
+    lastUs_ = 0;
+    periodUs_ = 0.0f;
+    n_ = 0;
+    outliers_ = 0;
+    primed_ = false;
+  }
+
+  // Marca una conversión (instante en µs). Devuelve true si el periodo
+  // estimado ya es utilizable.
+  bool push(uint32_t nowUs) {
+    if (!primed_) {
+      lastUs_ = nowUs;
+      primed_ = true;
+      return false;
+    }
+    uint32_t dt = nowUs - lastUs_;
+    lastUs_ = nowUs;
+    if (dt < RATE_MIN_PERIOD_US || dt > RATE_MAX_PERIOD_US) return valid();
+
+    // Con estimación asentada, fuera de [0.5, 1.5] periodos es un hueco.
+    if (n_ >= RATE_WARMUP &&
+        ((float)dt > 1.5f * periodUs_ || (float)dt < 0.5f * periodUs_)) {
+      if (++outliers_ >= RATE_RESYNC) {
+        n_ = 0;
+        outliers_ = 0;
+      }
+      return valid();
+    }
+    outliers_ = 0;
+
+    if (n_ < 16) {
+      n_++;
+      periodUs_ += ((float)dt - periodUs_) / (float)n_;
+    } else {
+      periodUs_ += ((float)dt - periodUs_) / 16.0f;
+    }
+    return valid();
+  }
+
+  bool     valid() const { return n_ >= RATE_WARMUP; }
+  uint32_t periodUs() const { return (uint32_t)(periodUs_ + 0.5f); }
+  float    sps() const { return periodUs_ > 0.0f ? 1.0e6f / periodUs_ : 0.0f; }
+
+private:
+  uint32_t lastUs_;
+  float    periodUs_;
+  uint8_t  n_;
+  uint8_t  outliers_;
+  bool     primed_;
+};
+
+// Constantes del filtro en tiempo, independientes de la tasa.
+struct FilterTiming {
+  uint32_t medianMs;      // duración de la ventana de mediana
+  uint32_t iirTauMs;      // constante de tiempo del IIR
+  float    stableDeltaG;  // umbral en gramos
+  uint32_t stableMs;      // ms
+};
+
+// Conversiones por muestra del pipeline para no superar loopPeriodUs
+// (mismo criterio que el antiguo "cada 1000/LOOP_HZ ms").
+static inline uint8_t decimationFor(uint32_t periodUs, uint32_t loopPeriodUs) {
+  if (periodUs == 0) return 1;
+  uint32_t d = (loopPeriodUs + periodUs - 1) / periodUs;
+  if (d < 1) d = 1;
+  if (d > 255) d = 255;
+  return (uint8_t)d;
+}
+
+// Parámetros equivalentes para un pipeline alimentado cada samplePeriodMs.
+static inline FilterParams filterParamsFor(const FilterTiming& t,
+                                           float samplePeriodMs) {
+  FilterParams p;
+  if (samplePeriodMs <= 0.0f) samplePeriodMs = 1.0f;
+  // Impar más cercano; por debajo de 3 la mediana no actúa.
+  long w = 2 * lroundf(((float)t.medianMs / samplePeriodMs - 1.0f) * 0.5f) + 1;
+  if (w < 3) w = 3;
+  if (w > (long)MEDIAN_MAX) w = (long)MEDIAN_MAX;
+  p.medianWindow = (uint8_t)w;
+  p.iirAlpha = t.iirTauMs > 0
+                   ? 1.0f - expf(-samplePeriodMs / (float)t.iirTauMs)
+                   : 1.0f;
+  p.stableDeltaG = t.stableDeltaG;
+  p.stableMs = t.stableMs;
+  return p;
+}
+
+}  // namespace bascula
@@ -0,0 +1,113 @@
+// firmware-esp32/src/refine.h
+//
+// Refinado progresivo con la carga quieta. La mediana y el IIR cortos del
+// pipeline están pensados para seguir cambios; con la carga ya estable
+// siguen dejando un ruido de ~0,1 g. Aquí, desde que el pipeline declara
+// S:1, se promedian TODOS los crudos validados (tasa completa del HX711) en
+// una ventana que crece: el error de la media baja con 1/sqrt(n).
+//
+// - Incremental: suma y suma de cuadrados de las desviaciones respecto al
+//   primer crudo (enteros de 64 bits, sin pérdida con float).
+// - Movimiento: un crudo que se aleja de la media más que el umbral de
+//   estabilidad vacía la ventana en esa misma conversión, sin esperar a que
+//   el IIR lo note. El umbral nunca baja de REFINE_K_SIGMA sigmas, para que
+//   el propio ruido no la vacíe.
+// - La ventana deja de crecer en REFINE_MAX_N (deriva y fluencia de la
+//   celda); a partir de ahí la media sigue siendo la de esas muestras.
+//
+// resolution() es la resolución efectiva en gramos: sigma/sqrt(n) mientras
+// se refina y, fuera del refinado, la del IIR para la última sigma medida.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bascula {
+
+static const uint32_t REFINE_MAX_N = 4096;  // ~51 s a 80 SPS
+static const uint32_t REFINE_MIN_N = 8;     // antes no se sustituye al IIR
+static const float    REFINE_K_SIGMA = 5.0f;  // suelo del umbral de movimiento
+
+class StableRefiner {
+public:
+  StableRefiner() : sigma_(0.0f) { reset(); }
+
+  // Vacía la ventana (movimiento, tara, cambio de perfil...). La sigma
+  // medida se conserva para la resolución fuera del refinado.
+  void reset() {
+    armed_ = false;
+    n_ = 0;
+    base_ = 0;
+    sum_ = 0;
+    sumSq_ = 0;
+  }
+
+  // Estado del pipeline en cada paso del filtro: refina solo con S:1.
+  void setStable(bool stable) {
+    if (!stable) {
+      reset();
+    } else {
+      armed_ = true;
+    }
+  }
+
+  // Crudo validado. motionCounts: umbral de estabilidad en cuentas.
+  // true si vació la ventana por movimiento.
+  bool push(long raw, float motionCounts) {
+    if (!armed_) return false;
+    const float limit = fmaxf(motionCounts, REFINE_K_SIGMA * sigma_);
+    if (n_ >= REFINE_MIN_N && fabsf((float)(raw - base_) - meanDev()) > limit) {
+      reset();
+      return true;
+    }
+    if (n_ >= REFINE_MAX_N) return false;
+    if (n_ == 0) base_ = raw;
+    const int64_t d = (int64_t)raw - base_;
+    sum_ += d;
+    sumSq_ += d * d;
+    n_++;
+    if (n_ >= REFINE_MIN_N) sigma_ = sqrtf(variance());
+    return false;
+  }
+
+  bool     refining() const { return n_ >= REFINE_MIN_N; }
+  uint32_t count() const { return n_; }
+  float    sigmaCounts() const { return sigma_; }
+
+  // Media en gramos. La resta de la tara va en enteros: un float no guarda
+  // décimas de cuenta a 8 millones de cuentas.
+  float grams(float calFactor, int32_t tareOffset) const {
+    return ((float)(base_ - tareOffset) + meanDev()) * calFactor;
+  }
+
+  // Resolución efectiva en gramos; 0 mientras no haya sigma medida.
+  // iirAlpha: la del pipeline, para el ruido que deja el IIR (ruido blanco:
+  // sigma * sqrt(alpha / (2 - alpha))).
+  float resolution(float calFactor, float iirAlpha) const {
+    const float s = sigma_ * fabsf(calFactor);
+    if (refining()) return s / sqrtf((float)n_);
+    if (iirAlpha <= 0.0f || iirAlpha >= 2.0f) return s;
+    return s * sqrtf(iirAlpha / (2.0f - iirAlpha));
+  }
+
+private:
+  float meanDev() const { return n_ ? (float)((double)sum_ / (double)n_) : 0.0f; }
+
+  // Varianza muestral de la ventana, en cuentas^2.
+  float variance() const {
+    const int64_t num = (int64_t)n_ * sumSq_ - sum_ * sum_;
+    return num > 0 ? (float)((double)num / ((double)n_ * (double)(n_ - 1))) : 0.0f;
+  }
+
+  bool     armed_;
+  uint32_t n_;
+  long     base_;
+  int64_t  sum_;
+  int64_t  sumSq_;
+  float    sigma_;
+};
+
+}  // namespace bascula
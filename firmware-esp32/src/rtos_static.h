@@ -0,0 +1,112 @@
+// firmware-esp32/src/rtos_static.h
+//
+// Envoltorios de asignación estática para FreeRTOS (ESP32).
+// Cada "slot" reserva en tiempo de compilación el TCB/control y el
+// almacenamiento de la tarea, cola, stream buffer, temporizador o mutex, y
+// expone kBytes para el mapa de memoria. Nunca se llama a malloc en runtime.
+//
+// Nota ESP-IDF: xTaskCreateStaticPinnedToCore recibe la pila en BYTES
+// (StackType_t es uint8_t), a diferencia del FreeRTOS vanilla (palabras).
+
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/stream_buffer.h>
+#include <freertos/timers.h>
+
+// ---------- TAREA ----------
+template <size_t StackBytes>
+struct StaticTaskSlot {
+  static constexpr size_t kStackBytes = StackBytes;
+  static constexpr size_t kBytes = sizeof(StaticTask_t) + StackBytes;
+
+  StaticTask_t tcb;
+  StackType_t  stack[StackBytes / sizeof(StackType_t)];
+  TaskHandle_t handle = nullptr;
+
+  TaskHandle_t start(TaskFunction_t fn, const char* name, UBaseType_t prio,
+                     BaseType_t core, void* arg = nullptr) {
+    handle = xTaskCreateStaticPinnedToCore(fn, name, StackBytes, arg, prio,
+                                           stack, &tcb, core);
+    return handle;
+  }
+
+  // Margen mínimo de pila observado (bytes libres); 0 si no arrancó.
+  uint32_t headroom() const {
+    return handle ? (uint32_t)uxTaskGetStackHighWaterMark(handle) : 0;
+  }
+};
+
+// ---------- COLA ----------
+template <typename T, size_t Depth>
+struct StaticQueueSlot {
+  static constexpr size_t kBytes = sizeof(StaticQueue_t) + Depth * sizeof(T);
+
+  StaticQueue_t ctrl;
+  uint8_t       storage[Depth * sizeof(T)];
+  QueueHandle_t handle = nullptr;
+
+  QueueHandle_t create() {
+    handle = xQueueCreateStatic(Depth, sizeof(T), storage, &ctrl);
+    return handle;
+  }
+};
+
+// ---------- STREAM BUFFER ----------
+template <size_t Bytes>
+struct StaticStreamSlot {
+  // FreeRTOS necesita un byte extra de almacenamiento sobre la capacidad útil.
+  static constexpr size_t kBytes = sizeof(StaticStreamBuffer_t) + Bytes + 1;
+
+  StaticStreamBuffer_t ctrl;
+  uint8_t              storage[Bytes + 1];
+  StreamBufferHandle_t handle = nullptr;
+
+  StreamBufferHandle_t create(size_t triggerLevel = 1) {
+    handle = xStreamBufferCreateStatic(Bytes, triggerLevel, storage, &ctrl);
+    return handle;
+  }
+};
+
+// ---------- TEMPORIZADOR ----------
+struct StaticTimerSlot {
+  static constexpr size_t kBytes = sizeof(StaticTimer_t);
+
+  StaticTimer_t ctrl;
+  TimerHandle_t handle = nullptr;
+
+  TimerHandle_t create(const char* name, uint32_t periodMs, bool autoReload,
+                       TimerCallbackFunction_t cb) {
+    handle = xTimerCreateStatic(name, pdMS_TO_TICKS(periodMs),
+                                autoReload ? pdTRUE : pdFALSE, nullptr, cb,
+                                &ctrl);
+    return handle;
+  }
+};
+
+// ---------- MUTEX ----------
+struct StaticMutexSlot {
+  static constexpr size_t kBytes = sizeof(StaticSemaphore_t);
+
+  StaticSemaphore_t ctrl;
+  SemaphoreHandle_t handle = nullptr;
+
+  SemaphoreHandle_t create() {
+    handle = xSemaphoreCreateMutexStatic(&ctrl);
+    return handle;
+  }
+};
+
+// ---------- MAPA DE MEMORIA ----------
+struct MemRegion {
+  const char* name;
+  size_t      bytes;
+};
+
+template <size_t N>
+constexpr size_t memMapTotal(const MemRegion (&map)[N], size_t i = 0) {
+  return i >= N ? 0 : map[i].bytes + memMapTotal(map, i + 1);
+}
@@ -0,0 +1,98 @@
+// firmware-esp32/src/segmenter.h
+//
+// Segmentación de ingredientes: detector de escalones sobre la señal de peso
+// a ritmo de muestra. Cada vez que la señal se mueve respecto a la línea base
+// y vuelve a asentarse se cierra un paso (ADD si sube, REM si baja) con su
+// delta, el total resultante y los instantes de inicio/fin del movimiento.
+//
+// El asentamiento usa su propia ventana corta (settleMs), independiente de
+// STABLE_MS, para no fundir adiciones rápidas consecutivas en un solo paso.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+namespace bascula {
+
+struct SegParams {
+  float    minStepG;     // delta mínimo para considerar un paso
+  float    settleBandG;  // banda de asentamiento alrededor del ancla
+  uint32_t settleMs;     // tiempo dentro de la banda para cerrar el paso
+};
+
+struct SegEvent {
+  enum Kind : uint8_t { NONE = 0, ADD, REMOVE };
+  Kind     kind;
+  float    delta;    // gramos añadidos (>0) o retirados (<0)
+  float    total;    // nivel asentado tras el paso
+  uint32_t startMs;  // inicio del movimiento
+  uint32_t endMs;    // asentamiento
+};
+
+class Segmenter {
+public:
+  explicit Segmenter(const SegParams& p) : params_(p) { reset(0.0f); }
+
+  void setParams(const SegParams& p) { params_ = p; }
+  const SegParams& params() const { return params_; }
+
+  // Reinicia la línea base (p. ej. tras tara).
+  void reset(float baseline) {
+    baseline_ = baseline;
+    anchor_ = baseline;
+    anchorMs_ = 0;
+    motionStartMs_ = 0;
+    moving_ = false;
+    primed_ = false;
+  }
+
+  float baseline() const { return baseline_; }
+  bool  moving() const { return moving_; }
+
+  // Devuelve true si con esta muestra se completa un paso (ev rellenado).
+  bool push(float grams, uint32_t nowMs, SegEvent& ev) {
+    if (!primed_) {
+      baseline_ = anchor_ = grams;
+      anchorMs_ = nowMs;
+      primed_ = true;
+      return false;
+    }
+
+    if (fabsf(grams - anchor_) > params_.settleBandG) {
+      anchor_ = grams;
+      anchorMs_ = nowMs;
+      if (!moving_ && fabsf(grams - baseline_) > params_.settleBandG) {
+        moving_ = true;
+        motionStartMs_ = nowMs;
+      }
+    }
+
+    if (!moving_ || (nowMs - anchorMs_) < params_.settleMs) return false;
+
+    // Asentado: cerrar el paso y mover la línea base (absorbe deriva lenta).
+    moving_ = false;
+    float d = grams - baseline_;
+    baseline_ = grams;
+    if (fabsf(d) < params_.minStepG) return false;
+
+    ev.kind = d > 0.0f ? SegEvent::ADD : SegEvent::REMOVE;
+    ev.delta = d;
+    ev.total = grams;
+    ev.startMs = motionStartMs_;
+    ev.endMs = nowMs;
+    return true;
+  }
+
+private:
+  SegParams params_;
+  float     baseline_;
+  float     anchor_;
+  uint32_t  anchorMs_;
+  uint32_t  motionStartMs_;
+  bool      moving_;
+  bool      primed_;
+};
+
+}  // namespace bascula
@@ -0,0 +1,120 @@
+// firmware-esp32/src/selftest.h
+//
+// Autotest del HX711: análisis de una captura corta (cuentas crudas y
+// instante en µs de cada flanco DRDY). main.cpp hace la captura acotada en
+// tiempo; aquí solo se decide el diagnóstico, en orden de gravedad:
+//
+//   NO_DRDY    DOUT nunca baja (sin alimentación o DOUT al aire/en alto)
+//   STUCK_LOW  DOUT no vuelve a subir tras leer y las lecturas son 0
+//   STUCK_HIGH todas las lecturas son 0xFFFFFF (DOUT fijo en alto al leer)
+//   SATURATED  alguna conversión en el código máximo/mínimo
+//   FLAT       todas las lecturas idénticas (SCK sin pulsos o bus muerto)
+//   STUCK_BITS algún bit bajo no cambia pese a haber ruido suficiente
+//   RATE       la tasa medida no se parece a 10 ni a 80 SPS
+//   NOISY      ruido por encima del máximo admitido
+//
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "peak_hold.h"  // HX711_RAW_MAX / HX711_RAW_MIN
+
+namespace bascula {
+
+static const size_t SELFTEST_MAX_SAMPLES = 16;
+
+struct SelfTestResult {
+  enum Code : uint8_t {
+    OK = 0, NO_DRDY, STUCK_LOW, STUCK_HIGH, SATURATED, FLAT, STUCK_BITS,
+    RATE, NOISY
+  };
+  Code     code;
+  uint8_t  n;           // conversiones capturadas
+  float    sps;         // tasa medida entre flancos DRDY
+  float    noise;       // desviación típica en cuentas
+  int32_t  mean;        // media en cuentas
+  uint32_t stuckMask;   // bits bajos constantes (solo con STUCK_BITS)
+  uint32_t elapsedMs;   // duración del autotest
+};
+
+static inline const char* selfTestName(SelfTestResult::Code c) {
+  switch (c) {
+    case SelfTestResult::OK:         return "OK";
+    case SelfTestResult::NO_DRDY:    return "NO_DRDY";
+    case SelfTestResult::STUCK_LOW:  return "STUCK_LOW";
+    case SelfTestResult::STUCK_HIGH: return "STUCK_HIGH";
+    case SelfTestResult::SATURATED:  return "SATURATED";
+    case SelfTestResult::FLAT:       return "FLAT";
+    case SelfTestResult::STUCK_BITS: return "STUCK_BITS";
+    case SelfTestResult::RATE:       return "RATE";
+    default:                         return "NOISY";
+  }
+}
+
+// raw/tUs: n conversiones; drdyToggled: DOUT volvió a alto tras cada lectura.
+static inline void selfTestAnalyze(const long* raw, const uint32_t* tUs,
+                                   size_t n, bool drdyToggled, float noiseMax,
+                                   SelfTestResult& r) {
+  r.n = (uint8_t)n;
+  r.sps = 0.0f;
+  r.noise = 0.0f;
+  r.mean = 0;
+  r.stuckMask = 0;
+  if (n == 0) {
+    r.code = SelfTestResult::NO_DRDY;
+    return;
+  }
+
+  bool allZero = true, allOnes = true, allSame = true, saturated = false;
+  uint32_t orAll = 0, andAll = 0xFFFFFFu;
+  double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t u = (uint32_t)raw[i] & 0xFFFFFFu;
+    allZero = allZero && raw[i] == 0;
+    allOnes = allOnes && u == 0xFFFFFFu;
+    allSame = allSame && raw[i] == raw[0];
+    saturated = saturated || raw[i] >= HX711_RAW_MAX || raw[i] <= HX711_RAW_MIN;
+    orAll |= u;
+    andAll &= u;
+    sum += (double)raw[i];
+  }
+  double mean = sum / (double)n;
+  double acc = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    double d = (double)raw[i] - mean;
+    acc += d * d;
+  }
+  r.mean = (int32_t)mean;
+  r.noise = (float)sqrt(acc / (double)n);
+  if (n >= 2 && tUs[n - 1] != tUs[0]) {
+    r.sps = (float)(n - 1) * 1.0e6f / (float)(tUs[n - 1] - tUs[0]);
+  }
+
+  if (allZero && !drdyToggled) { r.code = SelfTestResult::STUCK_LOW; return; }
+  if (allOnes)                 { r.code = SelfTestResult::STUCK_HIGH; return; }
+  if (saturated)               { r.code = SelfTestResult::SATURATED; return; }
+  if (n >= 3 && allSame)       { r.code = SelfTestResult::FLAT; return; }
+
+  // Con 12+ muestras y ruido de varias decenas de cuentas, que un bit bajo
+  // no cambie nunca es muy improbable (< 0,1 % por bit): bit pegado.
+  uint32_t constant = ~(orAll ^ andAll) & 0xFu;
+  if (n >= 12 && r.noise > 32.0f && constant != 0) {
+    r.stuckMask = constant;
+    r.code = SelfTestResult::STUCK_BITS;
+    return;
+  }
+
+  if (r.sps > 0.0f) {
+    bool near10 = r.sps > 7.5f && r.sps < 12.5f;
+    bool near80 = r.sps > 60.0f && r.sps < 100.0f;
+    if (!near10 && !near80) { r.code = SelfTestResult::RATE; return; }
+  }
+
+  r.code = r.noise > noiseMax ? SelfTestResult::NOISY : SelfTestResult::OK;
+}
+
+}  // namespace bascula
@@ -0,0 +1,70 @@
+// firmware-esp32/src/snapshot.h
+//
+// Instantánea sincronizada del peso ("SNAP:<id>") para las fotos de la
+// cámara. El último G: que vio el lector de Python puede tener cientos de ms;
+// la instantánea es la primera conversión del HX711 completada después de
+// recibir la petición, con su peso filtrado, la cuenta cruda, el estado de
+// estabilidad y el instante de la conversión:
+//
+//   SNAP:<id>,G:<g>,R:<crudo>,S:<0|1>,T:<µs>,L:<µs>[,OL:1]
+//
+// L es el tiempo entre la recepción de la línea y esa conversión: como
+// mucho un periodo de conversión (12,5 ms a 80 SPS). El id lo elige el host
+// y vuelve tal cual, así que las respuestas se emparejan con las peticiones
+// aunque haya varias en vuelo.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace bascula {
+
+static const size_t SNAP_ID_MAX      = 12;
+static const size_t SNAP_QUEUE_DEPTH = 4;  // peticiones en vuelo
+
+struct SnapRequest {
+  char     id[SNAP_ID_MAX + 1];
+  uint32_t rxUs;  // recepción de la línea
+};
+
+// 1 a SNAP_ID_MAX caracteres [A-Za-z0-9_-].
+static inline bool snapIdValid(const char* s) {
+  size_t n = 0;
+  for (; s[n] != '\0'; ++n) {
+    const char c = s[n];
+    if (n >= SNAP_ID_MAX) return false;
+    if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+          c == '_' || c == '-')) {
+      return false;
+    }
+  }
+  return n > 0;
+}
+
+// "SNAP:<id>" -> petición. false si no es SNAP o el id no vale.
+static inline bool snapParse(const char* line, uint32_t rxUs, SnapRequest& r) {
+  if (strncmp(line, "SNAP:", 5) != 0 || !snapIdValid(line + 5)) return false;
+  strncpy(r.id, line + 5, SNAP_ID_MAX);
+  r.id[SNAP_ID_MAX] = '\0';
+  r.rxUs = rxUs;
+  return true;
+}
+
+// La conversión completada en convUs sirve a la petición si es posterior.
+static inline bool snapDue(const SnapRequest& r, uint32_t convUs) {
+  return (int32_t)(convUs - r.rxUs) >= 0;
+}
+
+static inline int snapFormat(char* out, size_t size, const SnapRequest& r, float grams,
+                             long raw, bool stable, bool overloaded, uint32_t convUs) {
+  return snprintf(out, size, "SNAP:%s,G:%.2f,R:%ld,S:%d,T:%lu,L:%lu%s", r.id,
+                  (double)grams, raw, (stable && !overloaded) ? 1 : 0,
+                  (unsigned long)convUs, (unsigned long)(convUs - r.rxUs),
+                  overloaded ? ",OL:1" : "");
+}
+
+}  // namespace bascula
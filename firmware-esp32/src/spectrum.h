@@ -0,0 +1,211 @@
+// firmware-esp32/src/spectrum.h
+//
+// Análisis espectral de vibraciones para diagnóstico de instalación.
+// Recoge una ventana de N conversiones (en gramos), quita la media, aplica
+// Hann y calcula una FFT real de N puntos empaquetando la señal en N/2
+// complejos (FFT compleja de N/2 + separación par/impar). El núcleo complejo
+// usa esp-dsp (dsps_fft2r_fc32) cuando está disponible y una radix-2
+// iterativa portable en el resto de casos (compilación en el host).
+//
+// Resultado: frecuencia de muestreo real, RMS de la parte alterna, los picos
+// dominantes y la energía (RMS) por bandas. Todo el almacenamiento es
+// estático (N floats de muestras/espectro + N de trabajo + N de tabla).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(ESP_PLATFORM) && defined(__has_include)
+#if __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+#define BASCULA_USE_ESP_DSP 1
+#endif
+#endif
+
+namespace bascula {
+
+static const size_t SPECTRUM_PEAKS = 3;
+static const size_t SPECTRUM_BANDS = 4;
+// Bandas: deriva/balanceo lento, estante que cojea, motores, bombas/rotación.
+static const float SPECTRUM_BAND_EDGES_HZ[SPECTRUM_BANDS + 1] = {
+    0.0f, 1.0f, 5.0f, 15.0f, 1.0e6f};
+
+struct SpectrumPeak {
+  float hz;
+  float ampG;  // amplitud de pico en gramos
+};
+
+struct SpectrumReport {
+  float        fsHz;
+  uint16_t     n;
+  float        rmsG;
+  SpectrumPeak peaks[SPECTRUM_PEAKS];
+  float        bandRmsG[SPECTRUM_BANDS];
+};
+
+template <size_t N>
+class SpectrumAnalyzer {
+  static_assert(N >= 16 && (N & (N - 1)) == 0, "N debe ser potencia de 2");
+  static const size_t M = N / 2;  // puntos de la FFT compleja
+
+public:
+  SpectrumAnalyzer() : count_(0), active_(false), tableReady_(false) {}
+
+  void start() {
+    count_ = 0;
+    firstMs_ = lastMs_ = 0;
+    active_ = true;
+  }
+  void cancel() { active_ = false; }
+  bool active() const { return active_; }
+  size_t count() const { return count_; }
+
+  // Añade una muestra; devuelve true al completar la ventana.
+  bool push(float grams, uint32_t nowMs) {
+    if (!active_) return false;
+    if (count_ == 0) firstMs_ = nowMs;
+    lastMs_ = nowMs;
+    samples_[count_++] = grams;
+    if (count_ < N) return false;
+    active_ = false;
+    return true;
+  }
+
+  void analyze(SpectrumReport& r) {
+    initTable();
+    const float kPi = 3.14159265358979f;
+
+    r.n = (uint16_t)count_;
+    uint32_t span = lastMs_ - firstMs_;
+    r.fsHz = span > 0 ? (float)(count_ - 1) * 1000.0f / (float)span : 0.0f;
+
+    // Media y RMS de la parte alterna
+    float mean = 0.0f;
+    for (size_t i = 0; i < N; ++i) mean += samples_[i];
+    mean /= (float)N;
+    float acc = 0.0f;
+    for (size_t i = 0; i < N; ++i) {
+      float v = samples_[i] - mean;
+      acc += v * v;
+    }
+    r.rmsG = sqrtf(acc / (float)N);
+
+    // Hann + empaquetado real -> complejo: z[k] = x[2k] + j x[2k+1]
+    float sumW = 0.0f, sumW2 = 0.0f;
+    for (size_t i = 0; i < N; ++i) {
+      float w = 0.5f - 0.5f * cosf(2.0f * kPi * (float)i / (float)N);
+      sumW += w;
+      sumW2 += w * w;
+      work_[i] = (samples_[i] - mean) * w;
+    }
+    fftComplex(work_);
+
+    // Separación: X[k] = Xe[k] + W_N^k Xo[k], k = 0..M. El espectro de
+    // potencia |X[k]|^2 se guarda sobre samples_ (ya no se necesitan).
+    float* power = samples_;
+    for (size_t k = 0; k <= M; ++k) {
+      size_t k1 = k % M, k2 = (M - k) % M;
+      float zr = work_[2 * k1], zi = work_[2 * k1 + 1];
+      float cr = work_[2 * k2], ci = -work_[2 * k2 + 1];  // conj(Z[M-k])
+      float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+      float dr = 0.5f * (zr - cr), di = 0.5f * (zi - ci);
+      float orr = di, oi = -dr;  // (Z - conj) / 2j
+      float a = -2.0f * kPi * (float)k / (float)N;
+      float wr = cosf(a), wi = sinf(a);
+      float xr = er + (wr * orr - wi * oi);
+      float xi = ei + (wr * oi + wi * orr);
+      power[k] = xr * xr + xi * xi;
+    }
+
+    // Bandas (Parseval con corrección de la ventana)
+    const float binHz = r.fsHz / (float)N;
+    for (size_t b = 0; b < SPECTRUM_BANDS; ++b) r.bandRmsG[b] = 0.0f;
+    for (size_t k = 1; k <= M; ++k) {
+      float f = (float)k * binHz;
+      float p = (k == M ? 1.0f : 2.0f) * power[k] / ((float)N * sumW2);
+      for (size_t b = 0; b < SPECTRUM_BANDS; ++b) {
+        if (f >= SPECTRUM_BAND_EDGES_HZ[b] && f < SPECTRUM_BAND_EDGES_HZ[b + 1]) {
+          r.bandRmsG[b] += p;
+          break;
+        }
+      }
+    }
+    for (size_t b = 0; b < SPECTRUM_BANDS; ++b) r.bandRmsG[b] = sqrtf(r.bandRmsG[b]);
+
+    // Picos dominantes: máximos locales ordenados por amplitud
+    for (size_t i = 0; i < SPECTRUM_PEAKS; ++i) r.peaks[i] = SpectrumPeak{0.0f, 0.0f};
+    for (size_t k = 1; k < M; ++k) {
+      if (!(power[k] > power[k - 1] && power[k] >= power[k + 1])) continue;
+      float amp = 2.0f * sqrtf(power[k]) / sumW;
+      for (size_t i = 0; i < SPECTRUM_PEAKS; ++i) {
+        if (amp > r.peaks[i].ampG) {
+          for (size_t j = SPECTRUM_PEAKS - 1; j > i; --j) r.peaks[j] = r.peaks[j - 1];
+          r.peaks[i] = SpectrumPeak{(float)k * binHz, amp};
+          break;
+        }
+      }
+    }
+  }
+
+private:
+  void initTable() {
+    if (tableReady_) return;
+#ifdef BASCULA_USE_ESP_DSP
+    dsps_fft2r_init_fc32(table_, (int)N);
+#else
+    // Twiddles de la FFT de M puntos: exp(-j 2 pi k / M), k < M/2
+    const float kPi = 3.14159265358979f;
+    for (size_t k = 0; k < M / 2; ++k) {
+      table_[2 * k]     = cosf(2.0f * kPi * (float)k / (float)M);
+      table_[2 * k + 1] = -sinf(2.0f * kPi * (float)k / (float)M);
+    }
+#endif
+    tableReady_ = true;
+  }
+
+  // FFT compleja in situ de M puntos intercalados (re, im).
+  void fftComplex(float* d) {
+#ifdef BASCULA_USE_ESP_DSP
+    dsps_fft2r_fc32(d, (int)M);
+    dsps_bit_rev_fc32(d, (int)M);
+#else
+    for (size_t i = 1, j = 0; i < M; ++i) {
+      size_t bit = M >> 1;
+      for (; j & bit; bit >>= 1) j ^= bit;
+      j ^= bit;
+      if (i < j) {
+        float t = d[2 * i]; d[2 * i] = d[2 * j]; d[2 * j] = t;
+        t = d[2 * i + 1]; d[2 * i + 1] = d[2 * j + 1]; d[2 * j + 1] = t;
+      }
+    }
+    for (size_t len = 2; len <= M; len <<= 1) {
+      size_t step = M / len;
+      for (size_t i = 0; i < M; i += len) {
+        for (size_t k = 0; k < len / 2; ++k) {
+          float wr = table_[2 * k * step], wi = table_[2 * k * step + 1];
+          size_t a = i + k, b = i + k + len / 2;
+          float xr = d[2 * b] * wr - d[2 * b + 1] * wi;
+          float xi = d[2 * b] * wi + d[2 * b + 1] * wr;
+          d[2 * b] = d[2 * a] - xr;
+          d[2 * b + 1] = d[2 * a + 1] - xi;
+          d[2 * a] += xr;
+          d[2 * a + 1] += xi;
+        }
+      }
+    }
+#endif
+  }
+
+  alignas(16) float samples_[N];
+  alignas(16) float work_[N];
+  alignas(16) float table_[N];
+  size_t   count_;
+  uint32_t firstMs_;
+  uint32_t lastMs_;
+  bool     active_;
+  bool     tableReady_;
+};
+
+}  // namespace bascula
@@ -0,0 +1,165 @@
+// firmware-esp32/src/trigger_capture.h
+//
+// Captura con disparo, como un osciloscopio: un anillo guarda siempre los
+// últimos crudos del HX711 (instante en µs y cuenta, a la tasa completa) y,
+// al dispararse, congela una ventana con `pre` conversiones anteriores al
+// disparo, la del disparo y `post` posteriores. La ventana queda quieta hasta
+// volver a armar, para leerla cuando convenga (tramas BULK_TRACE).
+//
+// - Fuentes: movimiento, sobrecarga y error del ADC según la máscara; el
+//   disparo por comando vale siempre que esté armado.
+// - El almacenamiento lo da el llamador (PSRAM o RAM estática): aquí solo
+//   hay índices.
+// - Congelada, push() no toca el anillo: otra tarea puede leer la ventana sin
+//   bloqueo mientras nadie vuelva a armar.
+// - pre + post + 1 nunca supera la capacidad, así que la ventana no se pisa a
+//   sí misma mientras se completa el post-disparo.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bascula {
+
+struct TraceSample {
+  uint32_t tUs;
+  int32_t  raw;
+};
+
+enum TrigSource : uint8_t {
+  TRIG_MOTION   = 1,  // S:1 -> S:0
+  TRIG_OVERLOAD = 2,  // sobrecarga recién enganchada
+  TRIG_ADC      = 4,  // crudo saturado o sin DRDY
+  TRIG_CMD      = 8,  // comando TRIG
+};
+
+static inline const char* trigSourceName(uint8_t s) {
+  switch (s) {
+    case TRIG_MOTION:   return "MOT";
+    case TRIG_OVERLOAD: return "OVL";
+    case TRIG_ADC:      return "ADC";
+    case TRIG_CMD:      return "CMD";
+    default:            return "-";
+  }
+}
+
+class TriggerCapture {
+public:
+  enum State : uint8_t { OFF = 0, ARMED, POST, HOLD };
+
+  TriggerCapture()
+      : buf_(nullptr), cap_(0), sources_(0), pre_(0), post_(0), state_(OFF) {
+    clear();
+  }
+
+  void attach(TraceSample* buf, size_t capacity) {
+    buf_ = buf;
+    cap_ = buf ? capacity : 0;
+    state_ = OFF;
+    clear();
+  }
+
+  // Fuentes y ventana en conversiones, recortadas a la capacidad. No vacía
+  // el anillo: sirve también para reajustar a una tasa nueva estando armada.
+  void configure(uint8_t sources, size_t pre, size_t post) {
+    sources_ = sources & (TRIG_MOTION | TRIG_OVERLOAD | TRIG_ADC);
+    if (cap_ == 0) {
+      pre_ = post_ = 0;
+      return;
+    }
+    pre_ = pre;
+    post_ = post;
+    if (pre + post + 1 > cap_) {
+      // No cabe: se reparte la capacidad en la misma proporción
+      post_ = (size_t)((uint64_t)post * (cap_ - 1) / (pre + post));
+      pre_ = cap_ - 1 - post_;
+    }
+  }
+
+  // Vacía el anillo y empieza a grabar (descarta la ventana congelada).
+  void arm() {
+    clear();
+    state_ = cap_ ? ARMED : OFF;
+  }
+
+  void off() {
+    clear();
+    state_ = OFF;
+  }
+
+  // Una conversión de A. true si con ella se completa la ventana.
+  bool push(uint32_t tUs, int32_t raw) {
+    if (state_ == OFF || state_ == HOLD) return false;
+    buf_[head_] = TraceSample{tUs, raw};
+    head_ = head_ + 1 == cap_ ? 0 : head_ + 1;
+    if (n_ < cap_) n_++;
+    if (state_ != POST) return false;
+    len_++;
+    if (--left_ > 0) return false;
+    state_ = HOLD;
+    return true;
+  }
+
+  // Disparo con la última conversión guardada como muestra del disparo.
+  // true si dispara (armada y fuente habilitada).
+  bool fire(uint8_t source, uint32_t ms) {
+    if (state_ != ARMED || !(source & (sources_ | TRIG_CMD))) return false;
+    const size_t last = n_ > 0 ? 1 : 0;
+    const size_t before = n_ - last < pre_ ? n_ - last : pre_;
+    len_ = before + last;
+    start_ = (head_ + cap_ - len_) % cap_;
+    at_ = before;
+    why_ = source;
+    ms_ = ms;
+    left_ = post_;
+    state_ = post_ > 0 ? POST : HOLD;
+    return true;
+  }
+
+  // Congela lo que haya del post-disparo (el ADC dejó de convertir). true
+  // si la ventana pasa a estar completa ahora.
+  bool freeze() {
+    if (state_ != POST) return false;
+    state_ = HOLD;
+    return true;
+  }
+
+  State    state() const { return state_; }
+  uint8_t  sources() const { return sources_; }
+  size_t   capacity() const { return cap_; }
+  size_t   pre() const { return pre_; }
+  size_t   post() const { return post_; }
+
+  // Ventana disparada: muestras, posición del disparo, fuente e instante.
+  size_t   count() const { return state_ == POST || state_ == HOLD ? len_ : 0; }
+  size_t   triggerIndex() const { return at_; }
+  uint8_t  why() const { return why_; }
+  uint32_t triggerMs() const { return ms_; }
+  const TraceSample& at(size_t i) const { return buf_[(start_ + i) % cap_]; }
+
+private:
+  void clear() {
+    head_ = n_ = start_ = len_ = at_ = left_ = 0;
+    why_ = 0;
+    ms_ = 0;
+  }
+
+  TraceSample* buf_;
+  size_t       cap_;
+  uint8_t      sources_;
+  size_t       pre_;
+  size_t       post_;
+  State        state_;
+  size_t       head_;   // siguiente posición a escribir
+  size_t       n_;      // conversiones guardadas (hasta cap_)
+  size_t       start_;  // primera muestra de la ventana
+  size_t       len_;
+  size_t       at_;
+  size_t       left_;   // post-disparo que falta
+  uint8_t      why_;
+  uint32_t     ms_;
+};
+
+}  // namespace bascula
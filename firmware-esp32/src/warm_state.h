@@ -0,0 +1,48 @@
+// firmware-esp32/src/warm_state.h
+//
+// Estado de arranque en caliente. main.cpp lo guarda en memoria RTC lenta
+// (RTC_NOINIT_ATTR), que sobrevive a reinicios por software y watchdog pero
+// no a un corte de alimentación. Se valida con magic + CRC y con la marca de
+// tiempo del reloj del sistema, que el temporizador RTC mantiene en esos
+// reinicios; un estado demasiado antiguo se descarta.
+// Portable (sin Arduino), igual que pipeline.h.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc32.h"
+
+namespace bascula {
+
+static const uint32_t WARM_MAGIC = 0x4B4D5257u;  // "WRMK"
+
+struct WarmState {
+  uint32_t magic;
+  int64_t  savedUs;      // reloj del sistema al guardar
+  float    calFactor;    // calibración vigente (debe coincidir con NVS)
+  int32_t  tareOffset;   // cero/tara vigente
+  int32_t  medianRaw;    // última mediana en cuentas
+  float    iir;          // estado del IIR
+  float    stableG;      // último peso declarado estable
+  uint8_t  stable;       // estado estable al guardar
+  uint8_t  pad[3];
+  uint32_t periodUs;     // periodo medido del HX711 (0 = desconocido)
+  uint32_t crc;          // CRC-32 de todo lo anterior
+};
+
+static inline void warmStateSeal(WarmState& w) {
+  w.magic = WARM_MAGIC;
+  w.crc = crc32(&w, offsetof(WarmState, crc));
+}
+
+static inline bool warmStateValid(const WarmState& w, int64_t nowUs,
+                                  int64_t maxAgeUs) {
+  if (w.magic != WARM_MAGIC) return false;
+  if (w.crc != crc32(&w, offsetof(WarmState, crc))) return false;
+  int64_t age = nowUs - w.savedUs;
+  return age >= 0 && age <= maxAgeUs;
+}
+
+}  // namespace bascula
@@ -2,23 +2,42 @@
 """
 Lector serie robusto para Báscula-Cam (compatibilidad hacia atrás)
 ------------------------------------------------------------------
-- Acepta líneas:  G:<float>,S:<0|1>
+- Acepta líneas:  G:<float>,S:<0|1>[,<campos extra>]
 - Tolera terminadores \r, \n o \r\n y líneas concatenadas.
+- El análisis lo hace el decodificador de tramas común
+  (bascula/core/frame_decoder.py sobre libbascula_frames.so).
 - Firma retrocompatible: __init__(port, baudrate=115200, baud=None, logger=None)
   (el wrapper actual llama con baud= y logger=).
 """
 
 from __future__ import annotations
-import re
 import threading
 import time
+from pathlib import Path
 from typing import Callable, Optional
 
 import serial
 
-_SPLIT_CRLF = re.compile(r"[\r\n]+")
-_SPLIT_G = re.compile(r"(?=G:)")  # partir cuando aparecen múltiples "G:"
-_PARSE = re.compile(r"\s*G:\s*([+-]?\d+(?:\.\d+)?)\s*,\s*S:\s*([01])\s*$", re.ASCII)
+
+def _load_frame_decoder():
+    # Con python_backend en sys.path, "bascula" es python_backend/bascula y no
+    # el paquete de la raíz: se carga el módulo por ruta (no depende de nada).
+    try:
+        from bascula.core import frame_decoder
+        return frame_decoder
+    except ImportError:
+        import importlib.util
+        import sys
+
+        path = Path(__file__).resolve().parents[1] / "bascula" / "core" / "frame_decoder.py"
+        spec = importlib.util.spec_from_file_location("bascula_frame_decoder", path)
+        module = importlib.util.module_from_spec(spec)
+        sys.modules[spec.name] = module
+        spec.loader.exec_module(module)
+        return module
+
+
+_frames = _load_frame_decoder()
 
 
 class SerialScale:
@@ -39,7 +58,7 @@ class SerialScale:
         self._thread: Optional[threading.Thread] = None
         self._stop = threading.Event()
         self._on_read: Optional[Callable[[float, int], None]] = None
-        self._buf = b""
+        self._decoder = _frames.FrameDecoder()
         # logger se acepta para compat, no se usa aquí.
 
     def start(self, on_read: Callable[[float, int], None]) -> None:
@@ -73,34 +92,15 @@ class SerialScale:
                     time.sleep(0.02)
                     continue
 
-                self._buf += chunk
-                parts = _SPLIT_CRLF.split(self._buf.decode("ascii", errors="ignore"))
-                self._buf = parts[-1].encode("ascii", errors="ignore")  # posible resto incompleto
-                lines = parts[:-1]
-
-                for raw in lines:
-                    line = raw.strip()
-                    if not line:
+                for frame in self._decoder.feed(chunk):
+                    if frame.kind != _frames.KIND_WEIGHT:
                         continue
-                    for sub in _SPLIT_G.split(line):
-                        sub = sub.strip()
-                        if not sub:
-                            continue
-                        m = _PARSE.match(sub)
-                        if not m:
-                            continue
-                        g_str, s_str = m.groups()
-                        try:
-                            grams = float(g_str)
-                            stable = int(s_str)
-                        except Exception:
-                            continue
-                        now = time.time()
-                        if now - last_emit >= 0.015:  # ~66 Hz máx.
-                            last_emit = now
-                            cb = self._on_read
-                            if cb:
-                                cb(grams, stable)
+                    now = time.time()
+                    if now - last_emit >= 0.015:  # ~66 Hz máx.
+                        last_emit = now
+                        cb = self._on_read
+                        if cb:
+                            cb(frame.grams, int(frame.stable))
 
             except serial.SerialException:
                 time.sleep(0.05)
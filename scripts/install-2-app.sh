@@ -161,6 +161,16 @@ EOF
   fi
 }
 
+build_frame_decoder() {
+  # Decodificador de tramas del puerto serie (bascula/core/frame_decoder.py):
+  # sin libbascula_frames.so la báscula no lee, así que un fallo aborta.
+  local runtime_root="$1" venv_dir="$2"
+  log "compilando libbascula_frames.so"
+  sudo -u "${TARGET_USER}" make -s -C "${runtime_root}/firmware-esp32/host" libbascula_frames.so
+  (cd "${runtime_root}" && sudo -u "${TARGET_USER}" "${venv_dir}/bin/python" -c \
+    'from bascula.core.frame_decoder import FrameDecoder; FrameDecoder(); print("[CHK] libbascula_frames OK")')
+}
+
 configure_audio() {
   cat > /etc/asound.conf <<'EOF'
 pcm.!default {
@@ -441,6 +451,7 @@ main() {
   ensure_simplejpeg "${APP_VENV}"
   add_dist_packages_pth "${APP_VENV}"
   install_requirements "${APP_VENV}" "${BASCULA_CURRENT}/requirements.txt" "${RUNTIME_ROOT}"
+  build_frame_decoder "${RUNTIME_ROOT}" "${APP_VENV}"
 
   configure_audio
   download_piper_voice
@@ -1133,6 +1133,16 @@ if ! pip_retry "${VENV_PIP}" install --no-deps -e .; then
   exit 1
 fi
 
+# Decodificador de tramas del puerto serie: sin él la báscula no lee
+if ! make -s -C "${BASCULA_CURRENT_LINK}/firmware-esp32/host" libbascula_frames.so; then
+  err "Build of libbascula_frames.so failed (make -C firmware-esp32/host libbascula_frames.so)"
+  exit 1
+fi
+if ! "${VENV_PY}" -c 'from bascula.core.frame_decoder import FrameDecoder; FrameDecoder()'; then
+  err "libbascula_frames.so does not load"
+  exit 1
+fi
+
 if ! "${VENV_PIP}" check; then
   err "pip check detected dependency conflicts in the virtual environment"
   "${VENV_PIP}" freeze || true
@@ -210,6 +210,21 @@ update_requirements() {
   return 0
 }
 
+build_frame_decoder() {
+  # La release nueva trae sus fuentes: libbascula_frames.so se recompila
+  # para que cuadre con bascula/core/frame_decoder.py
+  local release_dir="$1"
+  log "Compilando libbascula_frames.so"
+  if ! make -s -C "${release_dir}/firmware-esp32/host" libbascula_frames.so; then
+    fail "No se pudo compilar libbascula_frames.so" || return 1
+  fi
+  if ! (cd "${release_dir}" && "${release_dir}/.venv/bin/python" -c \
+      'from bascula.core.frame_decoder import FrameDecoder; FrameDecoder()'); then
+    fail "libbascula_frames.so no carga" || return 1
+  fi
+  return 0
+}
+
 reset_failure_state() {
   rm -f "${FORCE_FLAG}" "${FAIL_COUNT_FILE}" 2>/dev/null || true
 }
@@ -268,6 +283,7 @@ main() {
   chown -R "${BASCULA_USER}:${BASCULA_GROUP}" "${NEW_RELEASE_DIR}"
 
   update_requirements "${NEW_RELEASE_DIR}" || return 1
+  build_frame_decoder "${NEW_RELEASE_DIR}" || return 1
 
   stop_services
   ln -sfn "${NEW_RELEASE_DIR}" "${CURRENT_LINK}"
@@ -1,4 +1,6 @@
 import json
+import shutil
+import subprocess
 import sys
 import types
 from pathlib import Path
@@ -60,5 +62,14 @@ except Exception:  # pragma: no cover - tests inject stub
     yaml_stub.safe_load = safe_load
     sys.modules["yaml"] = yaml_stub
 
+# The serial readers decode through libbascula_frames.so, which the installers
+# build; do the same here so the suite runs against the current sources.
+if shutil.which("make") and shutil.which("g++"):
+    subprocess.run(
+        ["make", "-s", "-C", str(ROOT / "firmware-esp32" / "host"), "libbascula_frames.so"],
+        check=True,
+        timeout=300,
+    )
+
 collect_ignore = ["scripts/test_serial.py"]
 collect_ignore_glob = ["scripts/test_*.py"]
@@ -0,0 +1,218 @@
+from __future__ import annotations
+
+import shutil
+import subprocess
+from pathlib import Path
+
+import pytest
+
+HOST_DIR = Path(__file__).resolve().parents[1] / "firmware-esp32" / "host"
+
+pytestmark = pytest.mark.skipif(
+    shutil.which("make") is None or shutil.which("g++") is None,
+    reason="sin compilador C++ para las herramientas del host",
+)
+
+
+def _make(*targets: str) -> subprocess.CompletedProcess[str]:
+    return subprocess.run(
+        ["make", "-s", "-C", str(HOST_DIR), *targets],
+        capture_output=True,
+        text=True,
+        timeout=600,
+    )
+
+
+def test_host_tools_build_and_pass_simulated_checks() -> None:
+    result = _make("all", "check")
+    assert result.returncode == 0, result.stdout + result.stderr
+
+
+def test_ota_upload_resumes_after_reboot() -> None:
+    assert _make("ota_upload").returncode == 0
+    result = subprocess.run(
+        [str(HOST_DIR / "ota_upload"), "--sim", "--synthetic", "200000", "--cut", "80"],
+        capture_output=True,
+        text=True,
+        timeout=120,
+    )
+    assert result.returncode == 0, result.stdout + result.stderr
+    assert "reinicios del ESP32" in result.stdout
+    summary = result.stdout.strip().splitlines()[-1]
+    frames = int(summary.split(" tramas")[0].rsplit(", ", 1)[1])
+    sessions = int(summary.split(" sesiones")[0].rsplit(", ", 1)[1])
+    assert sessions > 1
+    # Reanuda desde lo guardado: no se reenvía la imagen entera en cada sesión
+    chunks = (200000 + 1023) // 1024
+    assert frames < chunks * 2
+
+
+def _read_lines(fd: int, want: int, timeout: float) -> list[str]:
+    import os
+    import select
+    import time
+
+    buf = b""
+    deadline = time.monotonic() + timeout
+    while buf.count(b"\n") < want and time.monotonic() < deadline:
+        ready, _, _ = select.select([fd], [], [], 0.2)
+        if ready:
+            buf += os.read(fd, 4096)
+    return buf.decode(errors="replace").splitlines()
+
+
+def test_hx711_gpio_mock_serves_firmware_frames_on_pty(tmp_path) -> None:
+    import os
+    import time
+
+    from bascula.core.scale_serial import parse_weight_line
+    from bascula.services.scale import TARE_COMMAND
+
+    assert _make("hx711_gpio").returncode == 0
+    link = tmp_path / "scale"
+    proc = subprocess.Popen(
+        [str(HOST_DIR / "hx711_gpio"), "--mock", "--mock-grams", "250", "--pty", str(link),
+         "--state", str(tmp_path / "hx711.state"), "--prio", "1"],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    try:
+        deadline = time.monotonic() + 5
+        while not link.exists() and time.monotonic() < deadline:
+            time.sleep(0.05)
+        fd = os.open(link, os.O_RDWR | os.O_NOCTTY)
+        try:
+            # 40 tramas por segundo: en 2 s el filtro ya ha asentado
+            lines = _read_lines(fd, 80, 5)
+            frames = [line for line in lines if line.startswith("G:")]
+            assert len(frames) > 40
+            grams, stable = parse_weight_line(frames[-1])
+            assert grams == pytest.approx(250, abs=1.0)
+            assert frames[-1].endswith(",S:1")
+
+            # Mismo comando que envía SerialScaleBackend.tare()
+            os.write(fd, f"{TARE_COMMAND}\n".encode())
+            lines = _read_lines(fd, 80, 5)
+            assert "ACK:T" in lines
+            after = [line for line in lines[lines.index("ACK:T"):] if line.startswith("G:")]
+            grams, _ = parse_weight_line(after[-1])
+            assert grams == pytest.approx(0, abs=1.0)
+        finally:
+            os.close(fd)
+    finally:
+        proc.terminate()
+        _, err = proc.communicate(timeout=10)
+    assert proc.returncode == 0, err
+    assert "tare=" in (tmp_path / "hx711.state").read_text()
+
+
+def test_hx711_gpio_mock_answers_snapshots_within_one_conversion(tmp_path) -> None:
+    import os
+    import time
+
+    from bascula.services.scale import parse_snapshot_line
+
+    assert _make("hx711_gpio").returncode == 0
+    link = tmp_path / "scale"
+    proc = subprocess.Popen(
+        [str(HOST_DIR / "hx711_gpio"), "--mock", "--mock-grams", "250", "--pty", str(link),
+         "--prio", "1"],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    try:
+        deadline = time.monotonic() + 5
+        while not link.exists() and time.monotonic() < deadline:
+            time.sleep(0.05)
+        fd = os.open(link, os.O_RDWR | os.O_NOCTTY)
+        try:
+            _read_lines(fd, 80, 5)  # filtro asentado y tasa medida
+            os.write(fd, b"RATE\n")
+            rate = next(line for line in _read_lines(fd, 10, 2) if line.startswith("RATE:"))
+            period_us = int(rate.split(",P:")[1].split(",")[0])
+            latencies = []
+            for i in range(20):
+                time.sleep(0.003 * (i % 7))  # peticiones en cualquier fase
+                os.write(fd, f"SNAP:t{i}\n".encode())
+                lines = []
+                while not any(line.startswith(f"SNAP:t{i},") for line in lines):
+                    lines += _read_lines(fd, 1, 1)
+                snap = parse_snapshot_line(next(line for line in lines if line.startswith(f"SNAP:t{i},")))
+                assert snap is not None and snap["stable"]
+                assert snap["grams"] == pytest.approx(250, abs=1.0)
+                latencies.append(snap["latency_us"])
+            # Una lectura descartada por tiempos (TF:) pasa a la conversión siguiente
+            within = [lat for lat in latencies if lat <= period_us + 1000]
+            assert len(within) >= 15
+            assert max(latencies) <= 2 * period_us + 1000
+        finally:
+            os.close(fd)
+    finally:
+        proc.terminate()
+        proc.communicate(timeout=10)
+
+
+def _write_trace(path: Path, seed: int) -> None:
+    import math
+    import random
+
+    rng = random.Random(seed)
+    rows = []
+    level, prev, t_step = 0.0, 0.0, -10.0
+    steps = iter([3.0, 7.5, 12.0, 16.0])
+    next_step = next(steps)
+    for i in range(int(20.0 / 0.0125)):
+        t = i * 0.0125
+        if t >= next_step:
+            prev, level, t_step = level, rng.uniform(50.0, 800.0), t
+            next_step = next(steps, 1e9)
+        s = t - t_step
+        grams = level + (prev - level) * math.exp(-s / 0.06) + 3.0 * math.exp(-s / 0.2) * math.sin(
+            2 * math.pi * 7.0 * s
+        )
+        rows.append(f"TR:{2000000 + int(t * 1e6)},{84210 + round(grams * 420 + rng.gauss(0, 60))}")
+    path.write_text("LOG:END,N:0\n" + "\n".join(rows) + "\n")
+
+
+def test_filter_sweep_reports_pareto_front_from_traces(tmp_path) -> None:
+    assert _make("filter_sweep").returncode == 0
+    for seed in range(3):
+        _write_trace(tmp_path / f"cocina{seed}.txt", seed)
+    args = [
+        str(HOST_DIR / "filter_sweep"),
+        "--cal",
+        str(1 / 420),
+        "--med",
+        "100:500:100",
+        "--tau",
+        "0:200:50",
+        "--th",
+        "0.2:1.0:0.2",
+        "--sms",
+        "200:800:200",
+        str(tmp_path),
+    ]
+    outputs = []
+    for threads in ("1", "3"):
+        result = subprocess.run(
+            args + ["--threads", threads], capture_output=True, text=True, timeout=120
+        )
+        assert result.returncode == 0, result.stderr
+        outputs.append(result.stdout)
+    # El reparto entre hilos no cambia el resultado
+    assert outputs[0] == outputs[1]
+    assert "3 trazas" in result.stderr and "12 escalones" in result.stderr
+    lines = outputs[0].strip().splitlines()
+    assert lines[0].startswith("med_ms,tau_ms,th_g,stable_ms,settle_ms,noise_g,false_ms")
+    front = [line.split(",") for line in lines[1:]]
+    assert front
+    settle = [float(row[4]) for row in front]
+    noise = [float(row[5]) for row in front]
+    assert settle == sorted(settle)
+    # En el frente, asentar antes se paga con más ruido o más estabilidad falsa
+    for a, b in zip(front, front[1:]):
+        assert float(b[5]) < float(a[5]) or float(b[6]) < float(a[6])
+    assert min(noise) < max(noise)
+    assert all(row[8].startswith("FILT:") for row in front)
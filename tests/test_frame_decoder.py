@@ -0,0 +1,153 @@
+from __future__ import annotations
+
+import json
+import re
+from pathlib import Path
+
+import pytest
+
+from bascula.core import frame_decoder
+from bascula.core.frame_decoder import KIND_BULK, KIND_INFO, KIND_PROBE, KIND_TEXT, KIND_WEIGHT, FrameDecoder
+
+DATA_DIR = Path(__file__).resolve().parent / "data"
+
+# Captura del puerto serie: arranque del ESP32, tramas del pipeline, respuestas
+# a comandos, eventos, un volcado LOG:DUMPB y daños típicos del enlace (fin de
+# línea perdido, ruido, trama cortada, línea demasiado larga, trama binaria
+# con CRC erróneo).
+CAPTURE = (DATA_DIR / "serial_capture.bin").read_bytes()
+EXPECTED = json.loads((DATA_DIR / "serial_capture.json").read_text())
+
+
+def _decode(decoder: FrameDecoder, chunk: int) -> list:
+    frames = []
+    for i in range(0, len(CAPTURE), chunk):
+        frames.extend(decoder.feed(CAPTURE[i:i + chunk]))
+    # Mismo formato que el JSON (tuplas como listas)
+    return json.loads(json.dumps([list(f) for f in frames]))
+
+
+@pytest.mark.parametrize("chunk", [len(CAPTURE), 128, 7, 1])
+def test_decoder_matches_capture(chunk: int) -> None:
+    decoder = FrameDecoder(bulk=True)
+    assert _decode(decoder, chunk) == EXPECTED["frames"]
+    assert decoder.stats == EXPECTED["stats"]
+
+
+def test_capture_weights_match_previous_regex_parser() -> None:
+    # Lo que sacaba python_backend/serial_scale.py con expresiones regulares
+    parse = re.compile(r"\s*G:\s*([+-]?\d+(?:\.\d+)?)\s*,\s*S:\s*([01])\s*(?:,[^\r\n]*)?$", re.ASCII)
+    legacy = []
+    for line in re.split(r"[\r\n]+", CAPTURE.decode("ascii", errors="ignore"))[:-1]:
+        for sub in re.split(r"(?=G:)", line.strip()):
+            m = parse.match(sub.strip())
+            if m:
+                legacy.append((float(m.group(1)), m.group(2) == "1"))
+    frames = FrameDecoder().feed(CAPTURE)
+    assert [(f.grams, f.stable) for f in frames if f.kind == KIND_WEIGHT] == legacy
+    assert len(legacy) == EXPECTED["stats"]["weights"]
+
+
+def test_binary_dump_rows_only_with_bulk_option() -> None:
+    plain = FrameDecoder().feed(CAPTURE)
+    assert not [f for f in plain if f.kind == KIND_BULK]
+    rows = [f for f in FrameDecoder(bulk=True).feed(CAPTURE) if f.kind == KIND_BULK]
+    log = [f.row for f in rows if f.bulk_type == "L"]
+    assert [r[0] for r in log] == list(range(30, 41))
+    assert all(len(f.row) == 2 for f in rows if f.bulk_type == "T")
+
+
+def test_refined_resolution_and_schema_replies() -> None:
+    frames = FrameDecoder().feed(b"G:250.004,S:1,RES:0.0048\r\nG:1.00,S:0\r\nTRIG:OFF\r\nAUTOTUNE:RUN\r\n")
+    assert frames[0].resolution == pytest.approx(0.0048)
+    assert frames[1].resolution is None
+    assert [f.kind for f in frames[2:]] == [KIND_INFO, KIND_INFO]
+
+
+def _hide_library(monkeypatch: pytest.MonkeyPatch) -> None:
+    frame_decoder.native_library()
+    # Se restauran al acabar: la biblioteca ya cargada sigue valiendo
+    for name in ("_LIB", "_LIB_ERROR"):
+        monkeypatch.setattr(frame_decoder, name, getattr(frame_decoder, name))
+    monkeypatch.setattr(frame_decoder, "_load_library", lambda: (None, "libbascula_frames.so not found"))
+    monkeypatch.setattr(frame_decoder, "_LIB_LOADED", False)
+
+
+def test_missing_library_fails_loudly(monkeypatch: pytest.MonkeyPatch) -> None:
+    _hide_library(monkeypatch)
+    with pytest.raises(frame_decoder.FrameDecoderUnavailable, match="make -C firmware-esp32/host"):
+        FrameDecoder()
+
+
+def test_readers_report_missing_library_on_start(monkeypatch: pytest.MonkeyPatch) -> None:
+    from bascula.core.scale_serial import SerialScale
+    from bascula.services.serial_reader import SerialReader
+
+    _hide_library(monkeypatch)
+    # Sin biblioteca la báscula pasa a simulación en vez de quedarse sin hilo lector
+    sim = SerialScale(simulate_if_unavailable=True)
+    sim.start()
+    try:
+        assert sim.is_simulated
+    finally:
+        sim.stop()
+    with pytest.raises(frame_decoder.FrameDecoderUnavailable):
+        SerialScale(simulate_if_unavailable=False).start()
+    reader = SerialReader()
+    with pytest.raises(frame_decoder.FrameDecoderUnavailable):
+        reader.start()
+    assert reader._thread is None
+
+
+PROBE_STREAM = (
+    b"G:120.00,S:1\r\nPRB:R:84502,V:84502,M:84498,N:50400,I:119.9952,D:0.0011,T:1450\r\n"
+    b"G:120.01,S:1\r\nPRB:R:84470,N:50372,XX:3,I:abc\r\nprb:T:0\r\nPRB:\r\n"
+)
+
+
+def _probes(decoder: FrameDecoder) -> list:
+    frames = []
+    for i in range(0, len(PROBE_STREAM), 5):
+        frames.extend(decoder.feed(PROBE_STREAM[i:i + 5]))
+    return frames
+
+
+def test_probe_lines_decode_for_plotting() -> None:
+    frames = _probes(FrameDecoder())
+    assert [f.kind for f in frames] == [KIND_WEIGHT, KIND_PROBE, KIND_WEIGHT, KIND_PROBE, KIND_PROBE, KIND_PROBE]
+    assert frames[1].taps == {
+        "R": 84502.0, "V": 84502.0, "M": 84498.0, "N": 50400.0, "I": 119.9952, "D": 0.0011, "T": 1450.0,
+    }
+    # Campos desconocidos o mal formados se saltan; el resto de la línea vale
+    assert frames[3].probe_mask == 0x09 and frames[3].taps == {"R": 84470.0, "N": 50372.0}
+    assert frames[4].taps == {"T": 0.0}
+    assert frames[5].probe_mask == 0 and frames[5].probe == (0.0,) * 7
+
+
+def test_probe_csv_for_plotting(tmp_path: Path, capsys: pytest.CaptureFixture) -> None:
+    path = tmp_path / "probes.bin"
+    path.write_bytes(b"PRB:T:5\r\n" + PROBE_STREAM)
+    assert frame_decoder.main(["--probes", str(path)]) == 0
+    lines = capsys.readouterr().out.splitlines()
+    assert lines[0] == "n,G,S,R,V,M,N,I,D,T"
+    assert lines[1] == "0,,,,,,,,,5.0"
+    assert lines[2] == "1,120.0,1,84502.0,84502.0,84498.0,50400.0,119.9952,0.0011,1450.0"
+    assert lines[3] == "2,120.01,1,84470.0,,,50372.0,,,"
+    assert len(lines) == 6
+
+
+def test_core_serial_scale_uses_frames_and_firmware_stability() -> None:
+    from bascula.core.scale_serial import SerialScale
+
+    scale = SerialScale(simulate_if_unavailable=True)
+    decoder = FrameDecoder()
+    for chunk in (b"G:12.5", b"0,S:1\r\nEVT:ADD,D:3.0,T:12.5,MS:1,DUR:2\r\n", b"G:bad,S:1\r\n"):
+        for frame in decoder.feed(chunk):
+            scale._handle_frame(frame)
+    assert scale.read_gross() == pytest.approx(12.5)
+    assert scale.stable is True
+    assert scale.last_raw_line == "G:12.50,S:1"
+    for frame in decoder.feed(b"ST,GS,+0001.25 kg\r\n"):
+        assert frame.kind == KIND_TEXT
+        scale._handle_frame(frame)
+    assert scale.read_gross() == pytest.approx(1250.0)
@@ -0,0 +1,77 @@
+from __future__ import annotations
+
+import re
+from pathlib import Path
+
+import pytest
+
+from bascula.core import frame_decoder
+from bascula.core.frame_decoder import KIND_INFO, KIND_WEIGHT, FrameDecoder
+from bascula.services.scale import TARE_COMMAND
+
+SCHEMA = (Path(__file__).resolve().parents[1] / "firmware-esp32" / "src" / "frame_schema.h").read_text()
+
+_FIELD_RE = re.compile(r'\{"(\w+)",\s*FieldType::(\w+),\s*(\d+),\s*(\d+),\s*(\d+),\s*(true|false),')
+_COMMAND_RE = re.compile(r'\{"([^"]+)",\s*"[^"]*",\s*(nullptr|"[^"]*"),')
+
+
+def _block(start: str) -> str:
+    # Desde `start` hasta el cierre de su tabla
+    i = SCHEMA.index(start)
+    return SCHEMA[i:SCHEMA.index("};", i)]
+
+
+def _fields(frame: str) -> list:
+    return [
+        (tag, kind.lower(), int(dec), req == "true")
+        for tag, kind, dec, _fine, _digits, req in _FIELD_RE.findall(_block(f"struct {frame}"))
+    ]
+
+
+def _commands() -> list:
+    return [(tag, None if reply == "nullptr" else reply.strip('"'))
+            for tag, reply in _COMMAND_RE.findall(_block("kCommands[] = {"))]
+
+
+def test_probe_keys_come_from_header() -> None:
+    fields = _fields("ProbeFrame")
+    assert "".join(tag for tag, *_ in fields) == frame_decoder.probe_keys()
+    assert len(fields) == frame_decoder.PROBES
+    assert 'prefix = "PRB:"' in _block("struct ProbeFrame")
+
+
+def test_replies_in_header_are_protocol_lines() -> None:
+    unsolicited = re.search(r"kUnsolicited\[\] = \{([^}]*)\}", SCHEMA)
+    assert unsolicited is not None
+    prefixes = re.findall(r'"([^"]+)"', unsolicited.group(1))
+    prefixes += [reply for _tag, reply in _commands() if reply]
+    frames = FrameDecoder().feed("".join(f"{p}X\r\n" for p in prefixes).encode())
+    assert [f.kind for f in frames] == [KIND_INFO] * len(prefixes)
+
+
+def test_line_limit_matches_header() -> None:
+    assert f"FRAME_LINE_MAX = {frame_decoder.LINE_MAX};" in SCHEMA
+
+
+@pytest.mark.parametrize(
+    "command",
+    [TARE_COMMAND, "FC:8", "SNAP:a1", "SEG:ON", "CHECK:1.00,2.00", "ROC:OFF", "PROFILE:pan", "DIV:1", "PROBE:OFF"],
+)
+def test_host_commands_exist_in_firmware(command: str) -> None:
+    tags = [tag for tag, _ in _commands()]
+    assert any(command == tag or (tag.endswith(":") and command.startswith(tag)) for tag in tags)
+
+
+def test_every_weight_field_round_trips() -> None:
+    # Una línea con todos los campos de la tabla, como la escribe el firmware
+    samples = {"float": "-12.5", "int": "-8388608", "bool": "1", "flag": "1"}
+    fields = _fields("WeightFrame")
+    assert [req for *_, req in fields] == sorted((req for *_, req in fields), reverse=True)
+    line = ",".join(f"{tag}:{samples[kind]}" for tag, kind, _, _ in fields)
+    frames = FrameDecoder().feed(line.encode() + b",NEW:7\r\nS:1,G:1.00\r\n")
+    assert frames[0].kind == KIND_WEIGHT
+    assert frames[0].stable and frames[0].overload
+    assert frames[0].peak == frames[0].minimum == frames[0].resolution == -12.5
+    assert frames[0].chb == -8388608
+    # Falta un obligatorio en su sitio: no es trama de peso
+    assert frames[1].kind != KIND_WEIGHT
@@ -34,3 +34,11 @@ def test_install_script_protects_optional_directories() -> None:
     assert "REPO_ROOT=\"${REPO_ROOT:-$(pwd)}\"" in script_text
     assert "RUNTIME_ROOT=\"/opt/bascula/current\"" in script_text
     assert "echo \"[inst] rsync protected: data local models\"" in script_text
+
+
+def test_installers_build_frame_decoder() -> None:
+    scripts = Path(__file__).resolve().parents[1] / "scripts"
+    for name in ("install-2-app.sh", "install-all.sh", "ota.sh"):
+        text = (scripts / name).read_text(encoding="utf-8")
+        assert "libbascula_frames.so" in text, f"{name} no compila el decodificador de tramas"
+        assert "FrameDecoder()" in text, f"{name} no comprueba que la librería carga"
@@ -0,0 +1,62 @@
+from __future__ import annotations
+
+import json
+
+from bascula.services import photo_manager
+
+
+class FakeCamera:
+    def __init__(self, events: list[str]) -> None:
+        self.events = events
+
+    def capture_file(self, path: str, format: str, quality: int) -> None:
+        self.events.append("capture")
+        with open(path, "wb") as fh:
+            fh.write(b"\xff\xd8jpeg")
+
+
+class FakeScale:
+    def __init__(self, events: list[str], reply: dict | None) -> None:
+        self.events = events
+        self.reply = reply
+
+    def request_snapshot(self) -> str:
+        self.events.append("request")
+        return "2a"
+
+    def wait_snapshot(self, snap_id: str, timeout: float = 0.25):
+        self.events.append(f"wait:{snap_id}")
+        return self.reply
+
+
+def _manager(tmp_path, monkeypatch) -> photo_manager.PhotoManager:
+    base = tmp_path / "photos"
+    monkeypatch.setattr(photo_manager, "BASE", base)
+    monkeypatch.setattr(photo_manager, "STAGING", base / "staging")
+    monkeypatch.setattr(photo_manager, "META", base / "meta")
+    return photo_manager.PhotoManager(config=photo_manager.PhotoConfig())
+
+
+def test_capture_attaches_snapshot_requested_before_exposure(tmp_path, monkeypatch) -> None:
+    events: list[str] = []
+    manager = _manager(tmp_path, monkeypatch)
+    manager.attach_camera(FakeCamera(events))
+    snap = {"id": "2a", "grams": 152.3, "raw": 148000, "stable": True, "t_us": 9, "latency_us": 4100}
+    manager.attach_scale(FakeScale(events, snap))
+    path = manager.capture("plato")
+    assert events == ["request", "capture", "wait:2a"]
+    meta = json.loads((photo_manager.META / (path.stem + ".json")).read_text())
+    assert meta["label"] == "plato" and meta["weight"] == snap
+
+
+def test_capture_without_scale_or_reply_keeps_plain_meta(tmp_path, monkeypatch) -> None:
+    events: list[str] = []
+    manager = _manager(tmp_path, monkeypatch)
+    manager.attach_camera(FakeCamera(events))
+    path = manager.capture()
+    meta = json.loads((photo_manager.META / (path.stem + ".json")).read_text())
+    assert "weight" not in meta
+    manager.attach_scale(FakeScale(events, None))
+    path = manager.capture("otra")
+    meta = json.loads((photo_manager.META / (path.stem + ".json")).read_text())
+    assert "weight" not in meta
@@ -1,6 +1,8 @@
 from __future__ import annotations
 
 import logging
+import threading
+from collections import deque
 from types import SimpleNamespace
 
 import pytest
@@ -67,3 +69,222 @@ def test_serial_backend_logs_loss_after_gap(tmp_path, caplog: pytest.LogCaptureF
         assert any("sin datos válidos" in message for message in messages)
     finally:
         backend.stop()
+
+
+def test_serial_backend_collects_segmentation_events(tmp_path) -> None:
+    device = tmp_path / "ttyFAKE"
+    device.touch()
+    FakeSerial.read_queue = [b"EVT:ADD,D:52.30,T:152.30,MS:12000,DUR:310\r\n"]
+    backend = scale.SerialScaleBackend(str(device), 115200, logger=scale.LOGGER)
+    try:
+        assert backend.read() is None
+        events = backend.drain_events()
+        assert events == [
+            {"kind": "ADD", "D": pytest.approx(52.3), "T": pytest.approx(152.3), "MS": 12000.0, "DUR": 310.0}
+        ]
+        assert backend.drain_events() == []
+    finally:
+        backend.stop()
+
+
+def test_serial_backend_skips_binary_dump_frames(tmp_path) -> None:
+    device = tmp_path / "ttyFAKE"
+    device.touch()
+    # Una trama de LOG:DUMPB cuyos bytes parecen una línea de peso
+    FakeSerial.read_queue = [b"\xa5LG:99.0,S:1\x01\x02\n", b"G:2.50,S:0\n"]
+    backend = scale.SerialScaleBackend(str(device), 115200, logger=scale.LOGGER)
+    try:
+        assert backend.read() is None
+        assert backend.read() == pytest.approx(2.5)
+    finally:
+        backend.stop()
+
+
+def test_serial_backend_keeps_refined_resolution(tmp_path) -> None:
+    device = tmp_path / "ttyFAKE"
+    device.touch()
+    FakeSerial.read_queue = [b"G:250.004,S:1,RES:0.0048\r\n"]
+    backend = scale.SerialScaleBackend(str(device), 115200, logger=scale.LOGGER)
+    try:
+        assert backend.read() == pytest.approx(250.004)
+        assert backend.resolution_hint == pytest.approx(0.0048)
+        FakeSerial.read_queue = [b"G:400.00,S:0,OL:1\n"]
+        assert backend.read() == pytest.approx(400.0)
+        assert backend.resolution_hint is None
+    finally:
+        backend.stop()
+
+
+def test_weight_parsers_ignore_event_lines() -> None:
+    from bascula.core.scale_serial import parse_weight_line
+
+    assert parse_weight_line("EVT:ADD,D:12.0,T:40.0,MS:1,DUR:2") == (None, None)
+    # El decodificador compartido entre llamadas no arrastra la línea anterior
+    assert parse_weight_line("G:1.00,S:1") == (pytest.approx(1.0), True)
+    assert parse_weight_line("G:2.50,S:0") == (pytest.approx(2.5), False)
+    assert scale.parse_event_line("G:1.00,S:1") is None
+
+
+def test_parse_check_event_keeps_zone_name() -> None:
+    event = scale.parse_event_line("EVT:CHECK,C:OVER,S:1,G:251.20,MS:4400")
+    assert event == {"kind": "CHECK", "C": "OVER", "S": 1.0, "G": pytest.approx(251.2), "MS": 4400.0}
+
+
+def test_display_division_sends_div_and_roc() -> None:
+    sent: list[str] = []
+    service = scale.ScaleService.__new__(scale.ScaleService)
+    service._backend = SimpleNamespace(send_command=sent.append)
+    service.logger = logging.getLogger("test")
+
+    assert service.set_display_division(0.5)
+    assert service.set_display_division(1, hysteresis_g=0.2, report_on_change=False)
+    assert sent == ["DIV:0.5", "ROC:ON", "DIV:1,0.2", "ROC:OFF"]
+
+
+def test_select_profile_sends_profile_and_clears_window() -> None:
+    sent: list[str] = []
+    service = scale.ScaleService.__new__(scale.ScaleService)
+    service._backend = SimpleNamespace(send_command=sent.append)
+    service.logger = logging.getLogger("test")
+    service._lock = threading.Lock()
+    service._window = deque([1.0, 2.0])
+    service._skip_duplicate_sample = False
+
+    assert service.select_profile("bol_holder")
+    assert sent == ["PROFILE:bol_holder"]
+    assert not service._window
+    assert service._skip_duplicate_sample
+
+    for bad in ("", "LIST", "plato plano", "x" * 16):
+        with pytest.raises(ValueError):
+            service.select_profile(bad)
+    assert sent == ["PROFILE:bol_holder"]
+
+
+class FlowSerial(FakeSerial):
+    """Puerto con control de flujo: al recibir FC:<n> emite la trama retenida."""
+
+    written: list[bytes] = []
+    held: bytes = b""
+
+    @property
+    def in_waiting(self) -> int:
+        return sum(len(chunk) for chunk in FakeSerial.read_queue)
+
+    def write(self, payload: bytes) -> int:
+        FlowSerial.written.append(payload)
+        if payload.startswith(b"FC:") and FlowSerial.held:
+            FakeSerial.read_queue.append(FlowSerial.held)
+            FlowSerial.held = b""
+        return len(payload)
+
+
+def test_serial_backend_credit_window_skips_stale_frames(tmp_path, monkeypatch) -> None:
+    monkeypatch.setattr(scale, "serial", SimpleNamespace(Serial=FlowSerial))
+    device = tmp_path / "ttyFAKE"
+    device.touch()
+    FakeSerial.read_queue = [b"G:1.00,S:1\r\n"]
+    FlowSerial.written = []
+    FlowSerial.held = b""
+    backend = scale.SerialScaleBackend(str(device), 115200, flow_credits=8, logger=scale.LOGGER)
+    try:
+        assert FlowSerial.written == [b"FC:8\n"]
+        assert backend.read() == pytest.approx(1.0)
+        # Renovación a mitad de ventana
+        FakeSerial.read_queue = [b"G:2.00,S:1\r\n"] * 3
+        assert backend.read() == pytest.approx(2.0)
+        assert FlowSerial.written[-1] == b"FC:8\n" and len(FlowSerial.written) == 2
+        # Lector parado: la ventana entera es vieja y vale la trama retenida
+        FakeSerial.read_queue = [b"G:%d.00,S:1\r\n" % i for i in range(8)]
+        FlowSerial.held = b"G:500.00,S:0\r\n"
+        assert backend.read() == pytest.approx(500.0)
+        assert backend.signal_hint is False
+        assert len(FlowSerial.written) == 3 and not FakeSerial.read_queue
+    finally:
+        backend.stop()
+
+
+def test_serial_backend_stops_granting_on_old_firmware(tmp_path, monkeypatch) -> None:
+    monkeypatch.setattr(scale, "serial", SimpleNamespace(Serial=FlowSerial))
+    device = tmp_path / "ttyFAKE"
+    device.touch()
+    FakeSerial.read_queue = [b"ERR:UNKNOWN_CMD\r\n"] + [b"G:3.00,S:1\r\n"] * 12
+    FlowSerial.written = []
+    FlowSerial.held = b""
+    backend = scale.SerialScaleBackend(str(device), 115200, flow_credits=8, logger=scale.LOGGER)
+    try:
+        assert backend.read() == pytest.approx(3.0)
+        assert FlowSerial.written == [b"FC:8\n"]
+    finally:
+        backend.stop()
+
+
+class SnapSerial(FakeSerial):
+    """Responde a SNAP:<id> como el firmware, con la siguiente conversión."""
+
+    def write(self, payload: bytes) -> int:
+        text = payload.decode().strip()
+        if text.startswith("SNAP:"):
+            FakeSerial.read_queue.append(
+                f"SNAP:{text[5:]},G:250.40,R:189210,S:1,T:123456789,L:8300\r\n".encode()
+            )
+        return len(payload)
+
+
+def test_parse_snapshot_line() -> None:
+    snap = scale.parse_snapshot_line("SNAP:a1,G:-0.25,R:84000,S:0,T:4294967,L:12500,OL:1")
+    assert snap == {
+        "id": "a1",
+        "grams": pytest.approx(-0.25),
+        "raw": 84000,
+        "stable": False,
+        "t_us": 4294967,
+        "latency_us": 12500,
+        "overload": True,
+    }
+    assert scale.parse_snapshot_line("SNAP:a1,G:1.0") is None
+    assert scale.parse_snapshot_line("G:1.00,S:1") is None
+
+
+def test_serial_backend_matches_snapshot_replies(tmp_path, monkeypatch) -> None:
+    monkeypatch.setattr(scale, "serial", SimpleNamespace(Serial=SnapSerial))
+    device = tmp_path / "ttyFAKE"
+    device.touch()
+    FakeSerial.read_queue = []
+    backend = scale.SerialScaleBackend(str(device), 115200, logger=scale.LOGGER)
+    try:
+        first = backend.request_snapshot()
+        second = backend.request_snapshot()
+        assert first != second
+        # El hilo lector recoge las respuestas entre tramas normales
+        FakeSerial.read_queue.insert(1, b"G:250.00,S:1\r\n")
+        for _ in range(3):
+            backend.read()
+        snap = backend.wait_snapshot(second, timeout=0.1)
+        assert snap is not None and snap["id"] == second
+        assert snap["grams"] == pytest.approx(250.4) and snap["raw"] == 189210
+        assert snap["stable"] is True and snap["latency_us"] == 8300
+        assert snap["rtt_s"] is not None and snap["rtt_s"] >= 0.0
+        assert backend.wait_snapshot(first, timeout=0.1)["id"] == first
+        assert backend.wait_snapshot("ffff", timeout=0.01) is None
+    finally:
+        backend.stop()
+
+
+def test_service_snapshot_applies_ui_calibration() -> None:
+    service = scale.ScaleService.__new__(scale.ScaleService)
+    service._lock = threading.Lock()
+    service._offset = 50.0
+    service._calibration_factor = 2.0
+    service.logger = logging.getLogger("test")
+    replies = {"7": {"id": "7", "grams": 250.0, "raw": 1, "stable": True, "t_us": 1, "latency_us": 2}}
+    service._backend = SimpleNamespace(
+        request_snapshot=lambda: "7",
+        wait_snapshot=lambda snap_id, timeout: replies.pop(snap_id, None),
+    )
+    snap = service.snapshot()
+    assert snap["firmware_g"] == pytest.approx(250.0)
+    assert snap["grams"] == pytest.approx((250.0 - 50.0) / service._effective_factor())
+    assert service.snapshot() is None
+    service._backend = SimpleNamespace()
+    assert service.request_snapshot() is None